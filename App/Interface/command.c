@@ -0,0 +1,407 @@
+/*
+ * command.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "command.h"
+
+static uint8_t request[CMD_PAYLOAD_MAX_LEN + FRAME_CRC_LEN];
+static uint8_t response[CMD_PAYLOAD_MAX_LEN];
+static uint16_t response_len = 0;
+static uint8_t response_frame[FRAME_ENCODED_MAX_LEN(CMD_PAYLOAD_MAX_LEN)];
+static uint32_t frames_handled = 0;
+static uint32_t frames_rejected = 0;
+
+inline static uint16_t command_get_u16(const uint8_t *data)
+{
+	return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+inline static uint32_t command_get_u32(const uint8_t *data)
+{
+	return (uint32_t)data[0] | ((uint32_t)data[1] << 8)
+			| ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+inline static void command_put_u8(uint8_t value)
+{
+	response[response_len++] = value;
+}
+
+inline static void command_put_u16(uint16_t value)
+{
+	command_put_u8((uint8_t)value);
+	command_put_u8((uint8_t)(value >> 8));
+}
+
+inline static void command_put_u32(uint32_t value)
+{
+	command_put_u16((uint16_t)value);
+	command_put_u16((uint16_t)(value >> 16));
+}
+
+inline static void command_put_u64(uint64_t value)
+{
+	command_put_u32((uint32_t)value);
+	command_put_u32((uint32_t)(value >> 32));
+}
+
+static void command_send(uint8_t code, uint16_t id, CmdStatus_t status)
+{
+	response[0] = code;
+	response[1] = (uint8_t)id;
+	response[2] = (uint8_t)(id >> 8);
+	response[3] = status;
+
+	// results are only valid along with an OK
+	if (status != CMDSTATUS_OK) response_len = 4;
+
+	uint16_t len = frame_encode(response, response_len, response_frame, sizeof(response_frame));
+	serial_send(response_frame, len);
+}
+
+static CmdStatus_t command_get_param(CmdParam_t param, SPIDevice_t *spid, uint32_t *value)
+{
+	switch (param)
+	{
+	case CMDPARAM_PRESCALER:
+		*value = spi_io_get_prescaler(spid);
+		break;
+	case CMDPARAM_CRC:
+		*value = spid->crc_enabled;
+		break;
+	case CMDPARAM_NSS:
+		*value = spid->nss;
+		break;
+	case CMDPARAM_MODE:
+		*value = spid->mode;
+		break;
+	case CMDPARAM_FRAMING:
+		*value = spid->framing;
+		break;
+	case CMDPARAM_CS_SETUP_US:
+		*value = spid->cs_setup_us;
+		break;
+	case CMDPARAM_CS_HOLD_US:
+		*value = spid->cs_hold_us;
+		break;
+	case CMDPARAM_TURNAROUND_US:
+		*value = spid->turnaround_us;
+		break;
+	case CMDPARAM_TX_POLICY:
+		*value = serial_get_tx_policy();
+		break;
+	default:
+		return CMDSTATUS_BAD_ARG;
+	}
+
+	return CMDSTATUS_OK;
+}
+
+static CmdStatus_t command_set_param(CmdParam_t param, SPIDevice_t *spid, uint32_t value)
+{
+	bool success = true;
+
+	switch (param)
+	{
+	case CMDPARAM_PRESCALER:
+		if (value > UINT16_MAX || !spi_io_set_prescaler(spid, value)) return CMDSTATUS_BAD_ARG;
+		break;
+	case CMDPARAM_CRC:
+		if (value > 1) return CMDSTATUS_BAD_ARG;
+		for (uint8_t idx = 0; idx < 3; idx++)
+		{
+			success &= spi_io_set_crc(spi_io_get_device(idx), value);
+		}
+		break;
+	case CMDPARAM_NSS:
+		if (value > SPINSS_HARD_PULSE) return CMDSTATUS_BAD_ARG;
+		// Targets never pulse, they take NSS as an input either way
+		success = spi_io_set_nss(spi_io_get_device(0), value);
+		for (uint8_t idx = 1; idx < 3; idx++)
+		{
+			success &= spi_io_set_nss(spi_io_get_device(idx),
+					value == SPINSS_SOFT ? SPINSS_SOFT : SPINSS_HARD);
+		}
+		break;
+	case CMDPARAM_MODE:
+		if (value > SPIMODE_DMA) return CMDSTATUS_BAD_ARG;
+		for (uint8_t idx = 0; idx < 3; idx++)
+		{
+			success &= spi_io_set_mode(spi_io_get_device(idx), value);
+		}
+		break;
+	case CMDPARAM_FRAMING:
+		if (value > SPIFRAME_SINGLE) return CMDSTATUS_BAD_ARG;
+		for (uint8_t idx = 0; idx < 3; idx++)
+		{
+			success &= spi_io_set_framing(spi_io_get_device(idx), value);
+		}
+		break;
+	case CMDPARAM_CS_SETUP_US:
+		if (value > UINT16_MAX) return CMDSTATUS_BAD_ARG;
+		spi_io_set_cs_timing(spid, value, spid->cs_hold_us);
+		break;
+	case CMDPARAM_CS_HOLD_US:
+		if (value > UINT16_MAX) return CMDSTATUS_BAD_ARG;
+		spi_io_set_cs_timing(spid, spid->cs_setup_us, value);
+		break;
+	case CMDPARAM_TURNAROUND_US:
+		if (value > UINT16_MAX) return CMDSTATUS_BAD_ARG;
+		spi_io_set_turnaround(spid, value);
+		break;
+	case CMDPARAM_TX_POLICY:
+		if (value > UARTTX_DROP_OLDEST) return CMDSTATUS_BAD_ARG;
+		serial_set_tx_policy(value);
+		break;
+	default:
+		return CMDSTATUS_BAD_ARG;
+	}
+
+	// a device refuses while it is busy
+	return success ? CMDSTATUS_OK : CMDSTATUS_BUSY;
+}
+
+static CmdStatus_t command_param(CmdCode_t code, const uint8_t *args, uint16_t len)
+{
+	if (len != (code == CMD_SET_PARAM ? 6u : 2u)) return CMDSTATUS_BAD_LENGTH;
+
+	SPIDevice_t *spid = spi_io_get_device(args[1]);
+	uint32_t value = 0;
+
+	if (spid == NULL) return CMDSTATUS_BAD_ARG;
+
+	if (code == CMD_SET_PARAM)
+	{
+		CmdStatus_t status = command_set_param(args[0], spid, command_get_u32(args + 2));
+		if (status != CMDSTATUS_OK) return status;
+	}
+
+	CmdStatus_t status = command_get_param(args[0], spid, &value);
+	command_put_u32(value);
+
+	return status;
+}
+
+static CmdStatus_t command_get_counters(const uint8_t *args, uint16_t len)
+{
+	if (len != 1) return CMDSTATUS_BAD_LENGTH;
+
+	SPIDevice_t *spid = spi_io_get_device(args[0]);
+
+	if (spid == NULL) return CMDSTATUS_BAD_ARG;
+
+	// the order is part of the protocol, append new counters at the end
+	command_put_u32(spid->rx_packets);
+	command_put_u32(spid->header_errors);
+	command_put_u32(spid->read_errors);
+	command_put_u32(spid->response_drops);
+	command_put_u32(spid->crc_errors);
+	command_put_u32(spid->crc_retransmits);
+	command_put_u32(spid->crc_failures);
+	command_put_u32(spid->acked_bytes);
+	command_put_u32(spid->recovery_count);
+	command_put_u32(cycles_to_us(spid->recovery_max_cycles));
+	command_put_u32(spid->tx_queue.dequeue_count);
+	command_put_u32(spid->tx_queue.enqueue_failures);
+	command_put_u32(spid->tx_queue.high_water);
+
+	for (uint8_t phase = 1; phase < SPI_PHASE_COUNT; phase++)
+	{
+		command_put_u32(spid->phase_timeouts[phase]);
+	}
+
+	return CMDSTATUS_OK;
+}
+
+static CmdStatus_t command_reset_counters(const uint8_t *args, uint16_t len)
+{
+	if (len != 1) return CMDSTATUS_BAD_LENGTH;
+	if (args[0] != CMD_ALL_DEVICES && spi_io_get_device(args[0]) == NULL) return CMDSTATUS_BAD_ARG;
+
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		if (args[0] != CMD_ALL_DEVICES && args[0] != idx) continue;
+
+		SPIDevice_t *spid = spi_io_get_device(idx);
+
+		spi_io_reset_crc_stats(spid);
+		spi_io_reset_recovery_stats(spid);
+		spi_io_reset_queue_stats(spid);
+	}
+
+	return CMDSTATUS_OK;
+}
+
+/**
+ * Sends back-to-back packets from SPI1 to a Target through the queue, like
+ * the menu's benchmark, collecting the phase trace for GET_HISTOGRAM.
+ */
+static CmdStatus_t command_run_benchmark(const uint8_t *args, uint16_t len)
+{
+	uint8_t test_buff[SPI_DATA_MAX_LEN] = {0};
+
+	if (len != 6) return CMDSTATUS_BAD_LENGTH;
+
+	SPIDevice_t *cnt_dev = spi_io_get_device(0);
+	SPIDevice_t *tgt_dev = spi_io_get_device(args[0]);
+	uint32_t packet_count = command_get_u32(args + 1);
+	uint8_t packet_len = args[5];
+
+	if (args[0] == 0 || tgt_dev == NULL || packet_count < 1
+		|| packet_len < 1 || packet_len > SPI_DATA_MAX_LEN)
+	{
+		return CMDSTATUS_BAD_ARG;
+	}
+
+	if (!spi_io_is_idle(cnt_dev) || !spi_io_is_idle(tgt_dev)) return CMDSTATUS_BUSY;
+
+	for (uint8_t idx = 0; idx < SPI_DATA_MAX_LEN; idx++)
+	{
+		test_buff[idx] = (uint8_t)(idx * 29u + 7u);
+	}
+
+	uint32_t rx_packets = tgt_dev->rx_packets;
+	uint32_t crc_errors = cnt_dev->crc_errors + tgt_dev->crc_errors;
+	uint32_t crc_failures = cnt_dev->crc_failures;
+	uint32_t recoveries = cnt_dev->recovery_count + tgt_dev->recovery_count;
+
+	cnt_dev->state = SPISTATE_PENDING;
+	tgt_dev->state = SPISTATE_PENDING;
+	spi_event_flush();
+	bzero((uint8_t *)tgt_dev->regs[0], sizeof(tgt_dev->regs[0]));
+
+	// accumulated in 64 bits, long runs outlast a wrap of the cycle counter
+	uint64_t elapsed_cycles = 0;
+	uint32_t last_cycles = cycles_now();
+
+	for (uint32_t pkt = 0; pkt < packet_count; pkt++)
+	{
+		test_buff[0] = (uint8_t)pkt;
+
+		while (spi_io_queue_depth(cnt_dev) >= SPI_TX_QUEUE_LEN)
+		{
+			spi_io_poll();
+			spi_trace_collect();
+			__WFI();
+		}
+
+		spi_io_transmit(cnt_dev, test_buff, packet_len, 0, tgt_dev);
+
+		uint32_t now = cycles_now();
+		elapsed_cycles += now - last_cycles;
+		last_cycles = now;
+	}
+
+	while (!spi_io_is_idle(cnt_dev) || !spi_io_is_idle(tgt_dev) || tgt_dev->state & SPISTATE_SELECTED)
+	{
+		spi_io_poll();
+		spi_trace_collect();
+
+		uint32_t now = cycles_now();
+		elapsed_cycles += now - last_cycles;
+		last_cycles = now;
+	}
+
+	elapsed_cycles += cycles_now() - last_cycles;
+	spi_trace_collect();
+
+	test_buff[0] = (uint8_t)(packet_count - 1);
+
+	command_put_u32((uint32_t)(elapsed_cycles / (SystemCoreClock / 1000000u)));
+	command_put_u32(tgt_dev->rx_packets - rx_packets);
+	command_put_u32(cnt_dev->crc_errors + tgt_dev->crc_errors - crc_errors);
+	command_put_u32(cnt_dev->crc_failures - crc_failures);
+	command_put_u32(cnt_dev->recovery_count + tgt_dev->recovery_count - recoveries);
+	command_put_u8(((cnt_dev->state | tgt_dev->state) & SPISTATE_ERROR) ? 1u : 0u);
+	command_put_u8(memcmp(test_buff, (uint8_t *)tgt_dev->regs[0], packet_len) == 0);
+
+	return CMDSTATUS_OK;
+}
+
+static CmdStatus_t command_get_histogram(const uint8_t *args, uint16_t len)
+{
+	if (len != 2) return CMDSTATUS_BAD_LENGTH;
+	if (args[0] >= SPI_TRACE_DEVICES || args[1] >= SPI_TRACE_POINT_COUNT) return CMDSTATUS_BAD_ARG;
+
+	spi_trace_collect();
+
+	const SPITraceStats_t *stats = spi_trace_get_stats(args[0], args[1]);
+
+	command_put_u32(SystemCoreClock);
+	command_put_u32(stats->count);
+	command_put_u32(stats->count == 0 ? 0 : stats->min);
+	command_put_u32(stats->max);
+	command_put_u64(stats->total);
+
+	for (uint8_t bin = 0; bin < SPI_TRACE_HIST_BINS; bin++)
+	{
+		command_put_u32(stats->hist[bin]);
+	}
+
+	return CMDSTATUS_OK;
+}
+
+/**
+ * Handles a frame taken from the console input, see serial_set_frame_handler().
+ */
+void command_handle_frame(const uint8_t *frame, uint16_t len)
+{
+	uint16_t request_len = frame_decode(frame, len, request, sizeof(request));
+
+	// the code and request ID of a damaged frame cannot be trusted
+	if (request_len < 3)
+	{
+		frames_rejected++;
+		command_send(CMD_FRAME_ERROR, 0xFFFFu, CMDSTATUS_BAD_FRAME);
+		return;
+	}
+
+	CmdCode_t code = request[0];
+	uint16_t id = command_get_u16(request + 1);
+	const uint8_t *args = request + 3;
+	uint16_t args_len = request_len - 3;
+	CmdStatus_t status;
+
+	frames_handled++;
+	response_len = 4;
+
+	switch (code)
+	{
+	case CMD_PING:
+		status = args_len == 0 ? CMDSTATUS_OK : CMDSTATUS_BAD_LENGTH;
+		command_put_u8(CMD_PROTOCOL_VERSION);
+		command_put_u16(CMD_PAYLOAD_MAX_LEN);
+		command_put_u32(HAL_GetTick());
+		command_put_u32(frames_handled);
+		command_put_u32(frames_rejected);
+		break;
+	case CMD_GET_PARAM:
+	case CMD_SET_PARAM:
+		status = command_param(code, args, args_len);
+		break;
+	case CMD_GET_COUNTERS:
+		status = command_get_counters(args, args_len);
+		break;
+	case CMD_RESET_COUNTERS:
+		status = command_reset_counters(args, args_len);
+		break;
+	case CMD_RUN_BENCHMARK:
+		status = command_run_benchmark(args, args_len);
+		break;
+	case CMD_GET_HISTOGRAM:
+		status = command_get_histogram(args, args_len);
+		break;
+	case CMD_RESET_HISTOGRAMS:
+		status = args_len == 0 ? CMDSTATUS_OK : CMDSTATUS_BAD_LENGTH;
+		if (status == CMDSTATUS_OK) spi_trace_reset();
+		break;
+	default:
+		status = CMDSTATUS_UNKNOWN;
+		break;
+	}
+
+	command_send(code | CMD_RESPONSE_FLAG, id, status);
+}
@@ -0,0 +1,96 @@
+/*
+ * command.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+#include "frame.h"
+#include "uart_io.h"
+#include "spi_io.h"
+
+/**
+ * Binary commands for automated test control, framed as in frame.h on the
+ * console UART and handled whenever the console waits for input.
+ * A request is the command code, a 16 bit request ID and the arguments.
+ * The response carries the code with CMD_RESPONSE_FLAG set, the same ID,
+ * a status byte and, with CMDSTATUS_OK only, the results.
+ * Multi-byte fields are little-endian. Frames that fail to decode are
+ * answered by CMD_FRAME_ERROR with ID 0xFFFF.
+ */
+#define CMD_PROTOCOL_VERSION (1u)
+// the longest request or response, without the CRC
+#define CMD_PAYLOAD_MAX_LEN (128u)
+#define CMD_RESPONSE_FLAG (0x80u)
+#define CMD_FRAME_ERROR (0xFFu)
+// a device index asking for all devices, see CMD_RESET_COUNTERS
+#define CMD_ALL_DEVICES (0xFFu)
+
+/**
+ * Arguments -> results, devices are given by their index: 0 SPI1, 1 SPI3, 2 SPI5.
+ * PING: none -> version u8, max payload u16, uptime ms u32,
+ *   frames handled u32, frames rejected u32.
+ * GET_PARAM: param u8, device u8 -> value u32.
+ * SET_PARAM: param u8, device u8, value u32 -> value u32 read back.
+ * GET_COUNTERS: device u8 -> CMD_COUNTER_COUNT x u32, see command.c.
+ * RESET_COUNTERS: device u8 or CMD_ALL_DEVICES -> none.
+ * RUN_BENCHMARK: target u8, packet count u32, payload length u8 ->
+ *   elapsed us u32, packets received u32, CRC errors u32, dropped u32,
+ *   recoveries u32, error flags u8, last packet verified u8.
+ * GET_HISTOGRAM: target u8, trace point u8 -> core clock u32, count u32,
+ *   min u32, max u32, total u64, SPI_TRACE_HIST_BINS x u32, all in cycles.
+ * RESET_HISTOGRAMS: none -> none.
+ */
+typedef enum CmdCode
+{
+	CMD_PING = 0x01,
+	CMD_GET_PARAM = 0x02,
+	CMD_SET_PARAM = 0x03,
+	CMD_GET_COUNTERS = 0x04,
+	CMD_RESET_COUNTERS = 0x05,
+	CMD_RUN_BENCHMARK = 0x06,
+	CMD_GET_HISTOGRAM = 0x07,
+	CMD_RESET_HISTOGRAMS = 0x08,
+} CmdCode_t;
+
+typedef enum CmdStatus
+{
+	CMDSTATUS_OK = 0x00,
+	CMDSTATUS_UNKNOWN = 0x01,
+	CMDSTATUS_BAD_LENGTH = 0x02,
+	CMDSTATUS_BAD_ARG = 0x03,
+	CMDSTATUS_BUSY = 0x04,
+	CMDSTATUS_BAD_FRAME = 0x05,
+} CmdStatus_t;
+
+/**
+ * CRC, NSS, MODE and FRAMING are set on all devices at once, both ends
+ * of a link having to agree, the Targets taking NSS as an input.
+ * PRESCALER only matters on the Controller, the CS timings on the Targets.
+ */
+typedef enum CmdParam
+{
+	CMDPARAM_PRESCALER = 0x00,
+	CMDPARAM_CRC = 0x01,
+	CMDPARAM_NSS = 0x02,
+	CMDPARAM_MODE = 0x03,
+	CMDPARAM_FRAMING = 0x04,
+	CMDPARAM_CS_SETUP_US = 0x05,
+	CMDPARAM_CS_HOLD_US = 0x06,
+	CMDPARAM_TURNAROUND_US = 0x07,
+	CMDPARAM_TX_POLICY = 0x08,
+} CmdParam_t;
+
+#define CMD_COUNTER_COUNT (19u)
+
+void command_handle_frame(const uint8_t *frame, uint16_t len);
+
+#endif /* COMMAND_H_ */
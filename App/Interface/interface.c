@@ -11,114 +11,12 @@ inline static void clear_spi_states(volatile SPIDeviceState_t *cnt_state_ptr, vo
 {
 	*cnt_state_ptr = SPISTATE_PENDING;
 	*tgt_state_ptr = SPISTATE_PENDING;
-}
-
-inline static bool diff_spi_state_change(SPIDeviceState_t *old_state, SPIDeviceState_t *new_state, char *device_name)
-{
-	SPIDeviceState_t delta = *new_state ^ *old_state;
-	bool error = false;
-
-	// if delta is zero then no changes have been detected and no action is necessary
-	// TODO: maybe also check if change is negative or positive, since both yield the same XOR result
-	if (delta != 0x00)
-	{
-		// CS line change
-		if (delta & SPISTATE_SELECTED)
-		{
-			serial_print(device_name, 0);
-			serial_print(" reports CS line: ", 0);
-
-			if (*new_state & SPISTATE_SELECTED)
-			{
-				serial_print_line("Falling Edge.", 0);
-			}
-			else
-			{
-				serial_print_line("Rising Edge.", 0);
-			}
-		}
-
-		// operation error
-		if (delta & SPISTATE_ERROR)
-		{
-			error = true;
-			serial_print(device_name, 0);
-			serial_print(" reports error during operation: ", 0);
-
-			if (*new_state & SPISTATE_TX_PENDING)
-			{
-				serial_print_line("Transmit.", 0);
-			}
-			else if (*new_state & SPISTATE_RX_PENDING)
-			{
-				serial_print_line("Receive.", 0);
-			}
-			else if (*new_state & SPISTATE_TX_RX_PENDING)
-			{
-				serial_print_line("Transmit and Receive.", 0);
-			}
-			else
-			{
-				serial_print_line("Unknown.", 0);
-			}
-		}
-
-		// operation aborted
-		if (delta & SPISTATE_ABORT)
-		{
-			serial_print(device_name, 0);
-			serial_print(" aborted operation: ", 0);
-
-			if (*new_state & SPISTATE_TX_PENDING)
-			{
-				serial_print_line("Transmit.", 0);
-			}
-			else if (*new_state & SPISTATE_RX_PENDING)
-			{
-				serial_print_line("Receive.", 0);
-			}
-			else if (*new_state & SPISTATE_TX_RX_PENDING)
-			{
-				serial_print_line("Transmit and Receive.", 0);
-			}
-			else
-			{
-				serial_print_line("Unknown.", 0);
-			}
-		}
-
-		// operation completed
-		if (delta & SPISTATE_CPLT)
-		{
-			serial_print(device_name, 0);
-			serial_print(" completed operation: ", 0);
-
-			if (*new_state & SPISTATE_TX_PENDING)
-			{
-				serial_print_line("Transmit.", 0);
-			}
-			else if (*new_state & SPISTATE_RX_PENDING)
-			{
-				serial_print_line("Receive.", 0);
-			}
-			else if (*new_state & SPISTATE_TX_RX_PENDING)
-			{
-				serial_print_line("Transmit and Receive.", 0);
-			}
-			else
-			{
-				serial_print_line("Unknown.", 0);
-			}
-		}
 
-		// update old state to the new
-		*old_state = *new_state;
-	}
-
-	return error;
+	// events of earlier operations are of no interest anymore
+	spi_event_flush();
 }
 
-inline static void print_spi_error(uint8_t err_code, char *device_name)
+inline static void print_spi_error(uint8_t err_code, const char *device_name)
 {
 	serial_print("Device ", 0);
 	serial_print(device_name, 0);
@@ -153,24 +51,217 @@ inline static void print_spi_error(uint8_t err_code, char *device_name)
 	}
 }
 
+static const char *phase_names[SPI_PHASE_COUNT] = {
+	"idle", "CS setup", "header", "payload", "turnaround", "response", "CS hold"
+};
+
+inline static void print_spi_event(SPIEvent_t *event, uint32_t base_cycles)
+{
+	char line_buff[96] = {0};
+	SPIDevice_t *spid = spi_io_get_device(event->device);
+	const char *name = spid == NULL ? "SPI?" : spid->name;
+	const char *phase = event->detail == 0 ? "header" : "payload";
+	unsigned long elapsed_us = cycles_to_us(event->cycles - base_cycles);
+
+	switch(event->type)
+	{
+	case SPIEVT_SELECTED:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s reports CS line: Falling Edge.", elapsed_us, name);
+		break;
+	case SPIEVT_DESELECTED:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s reports CS line: Rising Edge.", elapsed_us, name);
+		break;
+	case SPIEVT_TX_CPLT:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s completed operation: Transmit (%s).", elapsed_us, name, phase);
+		break;
+	case SPIEVT_RX_CPLT:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s completed operation: Receive (%s).", elapsed_us, name, phase);
+		break;
+	case SPIEVT_ERROR:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s reports error during operation.", elapsed_us, name);
+		break;
+	case SPIEVT_ABORT:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s aborted operation.", elapsed_us, name);
+		break;
+	case SPIEVT_TIMEOUT:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s timed out in phase: %s.", elapsed_us, name,
+				event->detail < SPI_PHASE_COUNT ? phase_names[event->detail] : "unknown");
+		break;
+	case SPIEVT_RECOVERED:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s recovered in %u us.", elapsed_us, name, event->detail);
+		break;
+	case SPIEVT_REJECTED:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s rejected header with opcode 0x%02X.", elapsed_us, name, event->detail);
+		break;
+	default:
+		snprintf(line_buff, sizeof(line_buff), "[%6lu us] %s reports unknown event.", elapsed_us, name);
+		break;
+	}
+
+	serial_print_line(line_buff, 0);
+
+	if (event->type == SPIEVT_ERROR) print_spi_error(event->detail, name);
+}
+
+inline static uint16_t dlog_device_name(uint8_t device)
+{
+	switch(device)
+	{
+	case 0:
+		return DLOG_STR("SPI1");
+	case 1:
+		return DLOG_STR("SPI3");
+	case 2:
+		return DLOG_STR("SPI5");
+	default:
+		return DLOG_STR("SPI?");
+	}
+}
+
+inline static uint16_t dlog_error_name(uint16_t err_code)
+{
+	switch(err_code)
+	{
+	case HAL_SPI_ERROR_NONE:
+		return DLOG_STR("NONE");
+	case HAL_SPI_ERROR_ABORT:
+		return DLOG_STR("ABORT");
+	case HAL_SPI_ERROR_CRC:
+		return DLOG_STR("CRC");
+	case HAL_SPI_ERROR_DMA:
+		return DLOG_STR("DMA");
+	case HAL_SPI_ERROR_FLAG:
+		return DLOG_STR("FLAG");
+	case HAL_SPI_ERROR_FRE:
+		return DLOG_STR("FRE");
+	case HAL_SPI_ERROR_MODF:
+		return DLOG_STR("MODF");
+	case HAL_SPI_ERROR_OVR:
+		return DLOG_STR("OVR");
+	default:
+		return DLOG_STR("unknown");
+	}
+}
+
+inline static uint16_t dlog_phase_name(uint16_t phase)
+{
+	switch(phase)
+	{
+	case SPIPHASE_IDLE:
+		return DLOG_STR("idle");
+	case SPIPHASE_CS_SETUP:
+		return DLOG_STR("CS setup");
+	case SPIPHASE_HEADER:
+		return DLOG_STR("header");
+	case SPIPHASE_PAYLOAD:
+		return DLOG_STR("payload");
+	case SPIPHASE_TURNAROUND:
+		return DLOG_STR("turnaround");
+	case SPIPHASE_RESPONSE:
+		return DLOG_STR("response");
+	case SPIPHASE_CS_HOLD:
+		return DLOG_STR("CS hold");
+	default:
+		return DLOG_STR("unknown");
+	}
+}
+
+/**
+ * The deferred counterpart of print_spi_event(): the same texts as log
+ * records, stamped with the time of the interrupt, for dlog_drain() to send.
+ */
+inline static void log_spi_event(SPIEvent_t *event)
+{
+	uint16_t name = dlog_device_name(event->device);
+	uint16_t phase = event->detail == 0 ? DLOG_STR("header") : DLOG_STR("payload");
+
+	switch(event->type)
+	{
+	case SPIEVT_SELECTED:
+		DLOG_AT(event->cycles, "%s reports CS line: Falling Edge.", name);
+		break;
+	case SPIEVT_DESELECTED:
+		DLOG_AT(event->cycles, "%s reports CS line: Rising Edge.", name);
+		break;
+	case SPIEVT_TX_CPLT:
+		DLOG_AT(event->cycles, "%s completed operation: Transmit (%s).", name, phase);
+		break;
+	case SPIEVT_RX_CPLT:
+		DLOG_AT(event->cycles, "%s completed operation: Receive (%s).", name, phase);
+		break;
+	case SPIEVT_ERROR:
+		DLOG_AT(event->cycles, "%s reports error during operation.", name);
+		DLOG_AT(event->cycles, "Device %s reported error: %s", name, dlog_error_name(event->detail));
+		break;
+	case SPIEVT_ABORT:
+		DLOG_AT(event->cycles, "%s aborted operation.", name);
+		break;
+	case SPIEVT_TIMEOUT:
+		DLOG_AT(event->cycles, "%s timed out in phase: %s.", name, dlog_phase_name(event->detail));
+		break;
+	case SPIEVT_RECOVERED:
+		DLOG_AT(event->cycles, "%s recovered in %u us.", name, event->detail);
+		break;
+	case SPIEVT_REJECTED:
+		DLOG_AT(event->cycles, "%s rejected header with opcode 0x%02X.", name, event->detail);
+		break;
+	default:
+		DLOG_AT(event->cycles, "%s reports unknown event %u.", name, event->type);
+		break;
+	}
+}
+
+/**
+ * Drains the event ring until both devices are idle, sleeping in between.
+ * Timestamps are relative to the first event of the operation,
+ * the ring is flushed by clear_spi_states() before the operation starts.
+ * With deferred logging the events go out as log records instead.
+ */
 inline static void monitor_spi_operation(SPIDevice_t *cnt_device_ptr, SPIDevice_t *tgt_device_ptr)
 {
-	bool error = false;
-	SPIDeviceState_t cnt_prev_state = 0x00;
-	SPIDeviceState_t tgt_prev_state = 0x00;
-	SPIDeviceState_t cnt_curr_state = 0x00;
-	SPIDeviceState_t tgt_curr_state = 0x00;
+	char line_buff[64] = {0};
+	SPIEvent_t event = {0};
+	uint32_t base_cycles = 0;
+	bool has_base = false;
+	bool busy = true;
+
+	while (busy || !spi_event_is_empty())
+	{
+		spi_io_poll();
+
+		while (spi_event_pop(&event))
+		{
+			if (!has_base)
+			{
+				base_cycles = event.cycles;
+				has_base = true;
+			}
+
+			if (dlog_is_enabled()) log_spi_event(&event);
+			else print_spi_event(&event, base_cycles);
+		}
 
-	do
+		// batching the records keeps the frame overhead down
+		if (dlog_pending() >= DLOG_RING_LEN / 2) dlog_drain();
+
+		busy = !spi_io_is_idle(cnt_device_ptr) || !spi_io_is_idle(tgt_device_ptr)
+				|| tgt_device_ptr->state & SPISTATE_SELECTED;
+
+		// with interrupts masked no event can slip in between the check and the WFI,
+		// a pending interrupt still wakes the core and runs once they are unmasked
+		__disable_irq();
+		if (busy && spi_event_is_empty()) __WFI();
+		__enable_irq();
+	}
+
+	dlog_drain();
+
+	if (spi_event_overflows() > 0)
 	{
-		cnt_curr_state = cnt_device_ptr->state;
-		tgt_curr_state = tgt_device_ptr->state;
-		error = diff_spi_state_change(&cnt_prev_state, &cnt_curr_state, cnt_device_ptr->name);
-		if (error) print_spi_error(cnt_device_ptr->handle->ErrorCode, cnt_device_ptr->name);
-		error = diff_spi_state_change(&tgt_prev_state, &tgt_curr_state, tgt_device_ptr->name);
-		if (error) print_spi_error(tgt_device_ptr->handle->ErrorCode, tgt_device_ptr->name);
-	} while ((cnt_device_ptr->op + tgt_device_ptr->op) > SPIOP_NONE
-			|| tgt_curr_state & SPISTATE_SELECTED);
+		snprintf(line_buff, sizeof(line_buff), "%lu events lost to ring overflow.",
+				(unsigned long)spi_event_overflows());
+		serial_print_line(line_buff, 0);
+	}
 }
 
 inline static void loopback_test_routine(SPI_HandleTypeDef *hspi_cnt, SPI_HandleTypeDef *hspi_tgt)
@@ -211,48 +302,1806 @@ inline static void loopback_test_routine(SPI_HandleTypeDef *hspi_cnt, SPI_Handle
 
 	serial_print("Received message: ", 0);
 	serial_print_line((char *)tgt_dev->regs[0], 0);
+
+	/**
+	 * Reading the message back from the target's register,
+	 * into the controller's local copy of the same register.
+	 */
+	serial_print_line("Reading message back.", 0);
+	clear_spi_states(&cnt_dev->state, &tgt_dev->state);
+	bzero((uint8_t *)cnt_dev->regs[0], sizeof(cnt_dev->regs[0]));
+	spi_io_read(cnt_dev, 0, strlen(test_buff)+1, tgt_dev);
+
+	monitor_spi_operation(cnt_dev, tgt_dev);
+
+	serial_print("Read back message: ", 0);
+	serial_print_line((char *)cnt_dev->regs[0], 0);
 	serial_print("Loopback test concluded.", 0);
 	serial_scan(test_buff, 0, ASCII_PRINTABLE);
 	serial_print_line("---", 3);
 }
 
-void interface_loop(void)
+inline static uint32_t wait_spi_idle(SPIDevice_t *cnt_device_ptr, SPIDevice_t *tgt_device_ptr)
 {
-	char buff[8] = {0};
+	uint32_t idle_count = 0;
 
-	HAL_Delay(1);
+	// counting the spins gives a rough measure of the CPU time left over by the transfer
+	while (!spi_io_is_idle(cnt_device_ptr) || !spi_io_is_idle(tgt_device_ptr)
+			|| tgt_device_ptr->state & SPISTATE_SELECTED)
+	{
+		spi_io_poll();
+		idle_count++;
+	}
 
-	if (!spi_io_is_initialized())
+	return idle_count;
+}
+
+/**
+ * Like wait_spi_idle(), but gives up at the given HAL tick,
+ * as a bus run beyond its limits may never complete.
+ */
+inline static bool wait_spi_idle_until(SPIDevice_t *cnt_device_ptr, SPIDevice_t *tgt_device_ptr, uint32_t deadline)
+{
+	while (!spi_io_is_idle(cnt_device_ptr) || !spi_io_is_idle(tgt_device_ptr)
+			|| tgt_device_ptr->state & SPISTATE_SELECTED)
 	{
-		serial_print_line("Fresh boot! Welcome.", 0);
-		serial_print_line("Initializing SPI I/O utils.", 0);
-		spi_io_initialize();
+		spi_io_poll();
+		if ((int32_t)(HAL_GetTick() - deadline) >= 0) return false;
+	}
 
-		if (spi_io_is_initialized())
+	return true;
+}
+
+/**
+ * After a stall, keeps polling until the phase deadlines have aborted and
+ * recovered whatever the devices were left in, so that the next run starts
+ * from idle devices.
+ */
+inline static void recover_spi_stall(SPIDevice_t *cnt_device_ptr, SPIDevice_t *tgt_device_ptr)
+{
+	wait_spi_idle(cnt_device_ptr, tgt_device_ptr);
+	clear_spi_states(&cnt_device_ptr->state, &tgt_device_ptr->state);
+}
+
+inline static void transfer_comparison_routine(SPI_HandleTypeDef *hspi_cnt, SPI_HandleTypeDef *hspi_tgt)
+{
+	static const uint16_t packet_count = 16;
+	static const char *mode_names[2] = { "IT", "DMA" };
+	static const char *framing_names[2] = { "split", "single" };
+
+	char line_buff[96] = {0};
+	uint8_t test_buff[SPI_DATA_MAX_LEN] = {0};
+
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = hspi_to_struct(hspi_tgt);
+
+	serial_print("Transfer comparison: ", 0);
+	serial_print(cnt_dev->name, 0);
+	serial_print("->", 2);
+	serial_print(tgt_dev->name, 0);
+	serial_print_line(".", 1);
+
+	for (uint8_t framing = SPIFRAME_SPLIT; framing <= SPIFRAME_SINGLE; framing++)
+	{
+		spi_io_set_framing(cnt_dev, framing);
+		spi_io_set_framing(tgt_dev, framing);
+
+		for (uint8_t mode = SPIMODE_IT; mode <= SPIMODE_DMA; mode++)
 		{
-			serial_print_line("SPI I/O utils initialized.", 0);
+			uint32_t idle_count = 0;
+			uint16_t mismatch_count = 0;
+
+			if (!spi_io_set_mode(cnt_dev, mode) || !spi_io_set_mode(tgt_dev, mode))
+			{
+				serial_print(mode_names[mode], 0);
+				serial_print_line(" mode unavailable, skipping.", 0);
+				continue;
+			}
+
+			uint32_t start_tick = HAL_GetTick();
+
+			for (uint16_t packet = 0; packet < packet_count; packet++)
+			{
+				for (uint8_t idx = 0; idx < sizeof(test_buff); idx++)
+				{
+					test_buff[idx] = (uint8_t)(packet + idx);
+				}
+
+				clear_spi_states(&cnt_dev->state, &tgt_dev->state);
+				spi_io_transmit(cnt_dev, test_buff, sizeof(test_buff), 0, tgt_dev);
+				idle_count += wait_spi_idle(cnt_dev, tgt_dev);
+
+				if (memcmp((uint8_t *)tgt_dev->regs[0], test_buff, sizeof(test_buff)) != 0)
+				{
+					mismatch_count++;
+				}
+			}
+
+			uint32_t elapsed_ms = HAL_GetTick() - start_tick;
+
+			snprintf(line_buff, sizeof(line_buff),
+					"%s/%s: %u packets of %u bytes in %lu ms, %u mismatched, %lu idle spins.",
+					mode_names[mode], framing_names[framing],
+					packet_count, (unsigned)sizeof(test_buff),
+					(unsigned long)elapsed_ms, mismatch_count, (unsigned long)idle_count);
+			serial_print_line(line_buff, 0);
 		}
+	}
+
+	// leave both devices in the default configuration
+	spi_io_set_mode(cnt_dev, SPIMODE_IT);
+	spi_io_set_mode(tgt_dev, SPIMODE_IT);
+	spi_io_set_framing(cnt_dev, SPIFRAME_SPLIT);
+	spi_io_set_framing(tgt_dev, SPIFRAME_SPLIT);
+
+	serial_print_line("Transfer comparison concluded.", 0);
+	serial_print_line("---", 3);
+}
 
+inline static uint32_t scan_number(const char *prompt, uint8_t max_digits)
+{
+	char buff[11] = {0};
+
+	if (max_digits > sizeof(buff)-1) max_digits = sizeof(buff)-1;
+
+	serial_print(prompt, 0);
+	serial_scan(buff, max_digits, ASCII_NUMERIC);
+
+	return strtoul(buff, NULL, 10);
+}
+
+inline static SPIDevice_t *select_target_device(void)
+{
+	char buff[2] = {0};
+
+	serial_print("Target device (3: SPI3, 5: SPI5): [ ]\b\b", 0);
+	serial_scan(buff, 1, ASCII_NUMERIC);
+
+	switch(buff[0])
+	{
+	case '3':
+		return hspi_to_struct(&hspi3);
+	case '5':
+		return hspi_to_struct(&hspi5);
+	default:
+		serial_print_line("Invalid device.", 0);
+		return NULL;
+	}
+}
+
+inline static void cs_timing_routine(void)
+{
+	char line_buff[80] = {0};
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	snprintf(line_buff, sizeof(line_buff), "%s CS timing: setup %u us, hold %u us, turnaround %u us.",
+			tgt_dev->name, tgt_dev->cs_setup_us, tgt_dev->cs_hold_us, tgt_dev->turnaround_us);
+	serial_print_line(line_buff, 0);
+
+	uint32_t setup_us = scan_number("New setup time (us): ", 5);
+	uint32_t hold_us = scan_number("New hold time (us): ", 5);
+	uint32_t turnaround_us = scan_number("New read turnaround time (us): ", 5);
+
+	if (setup_us > UINT16_MAX || hold_us > UINT16_MAX || turnaround_us > UINT16_MAX)
+	{
+		serial_print_line("Value out of range.", 0);
 		return;
 	}
 
-	serial_print_line("-\r\nPlease select a test routine from the list:", 0);
-	serial_print_line("1: SPI Half-Duplex Loopback Test (SPI1->SPI3)", 0);
-	serial_print_line("2: SPI Half-Duplex Loopback Test (SPI1->SPI5)", 0);
+	spi_io_set_cs_timing(tgt_dev, setup_us, hold_us);
+	spi_io_set_turnaround(tgt_dev, turnaround_us);
 
-	bzero(buff, sizeof(buff));
-	serial_print("Your selection: [ ]\b\b", 0);
-	serial_scan(buff, 1, ASCII_NUMERIC);
+	snprintf(line_buff, sizeof(line_buff), "%s CS timing: setup %u us, hold %u us, turnaround %u us.",
+			tgt_dev->name, tgt_dev->cs_setup_us, tgt_dev->cs_hold_us, tgt_dev->turnaround_us);
+	serial_print_line(line_buff, 0);
+	serial_print_line("---", 3);
+}
 
-	serial_print_line("-\r\n--", 5);
+inline static void queue_stats_routine(void)
+{
+	static SPI_HandleTypeDef *handles[3] = { &hspi1, &hspi3, &hspi5 };
+	char line_buff[112] = {0};
 
-	switch(buff[0])
+	serial_print_line("SPI transmit queue statistics:", 0);
+
+	for (uint8_t idx = 0; idx < 3; idx++)
 	{
-	case '1':
-		loopback_test_routine(&hspi1, &hspi3);
-		break;
-	case '2':
-		loopback_test_routine(&hspi1, &hspi5);
+		SPIDevice_t *spid = hspi_to_struct(handles[idx]);
+		SPITxQueue_t *queue = &spid->tx_queue;
+		uint32_t mean_cycles = queue->dequeue_count == 0 ? 0
+				: (uint32_t)(queue->delay_total_cycles / queue->dequeue_count);
+
+		snprintf(line_buff, sizeof(line_buff),
+				"%s: depth %u/%u, high water %u, sent %lu, rejected %lu, delay us min/mean/max %lu/%lu/%lu.",
+				spid->name, spi_io_queue_depth(spid), SPI_TX_QUEUE_LEN, queue->high_water,
+				(unsigned long)queue->dequeue_count, (unsigned long)queue->enqueue_failures,
+				(unsigned long)(queue->dequeue_count == 0 ? 0 : cycles_to_us(queue->delay_min_cycles)),
+				(unsigned long)cycles_to_us(mean_cycles),
+				(unsigned long)cycles_to_us(queue->delay_max_cycles));
+		serial_print_line(line_buff, 0);
+
+		spi_io_reset_queue_stats(spid);
+	}
+
+	serial_print_line("Statistics reset.", 0);
+	serial_print_line("---", 3);
+}
+
+inline static void crc_mode_routine(void)
+{
+	static SPI_HandleTypeDef *handles[3] = { &hspi1, &hspi3, &hspi5 };
+	char line_buff[112] = {0};
+	bool enable = !hspi_to_struct(&hspi1)->crc_enabled;
+
+	serial_print_line("SPI CRC statistics:", 0);
+
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		SPIDevice_t *spid = hspi_to_struct(handles[idx]);
+
+		snprintf(line_buff, sizeof(line_buff),
+				"%s: CRC %s, clean bytes %lu, CRC errors %lu, retransmits %lu, dropped packets %lu.",
+				spid->name, spid->crc_enabled ? "on" : "off",
+				(unsigned long)spid->acked_bytes, (unsigned long)spid->crc_errors,
+				(unsigned long)spid->crc_retransmits, (unsigned long)spid->crc_failures);
+		serial_print_line(line_buff, 0);
+
+		spi_io_reset_crc_stats(spid);
+	}
+
+	// both ends of every link have to switch together
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		SPIDevice_t *spid = hspi_to_struct(handles[idx]);
+
+		if (!spi_io_set_crc(spid, enable))
+		{
+			serial_print("Failed switching CRC mode on ", 0);
+			serial_print_line(spid->name, 0);
+		}
+	}
+
+	serial_print_line(enable ? "CRC mode enabled." : "CRC mode disabled.", 0);
+	serial_print_line("---", 3);
+}
+
+inline static void prescaler_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	char line_buff[80] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+
+	snprintf(line_buff, sizeof(line_buff), "%s prescaler: %u (%lu bit/s).",
+			cnt_dev->name, spi_io_get_prescaler(cnt_dev),
+			(unsigned long)spi_io_get_bitrate(cnt_dev));
+	serial_print_line(line_buff, 0);
+
+	uint32_t divider = scan_number("New prescaler (2, 4, ..., 256): ", 3);
+
+	if (divider > UINT16_MAX || !spi_io_set_prescaler(cnt_dev, divider))
+	{
+		serial_print_line("Invalid prescaler.", 0);
+		return;
+	}
+
+	snprintf(line_buff, sizeof(line_buff), "%s prescaler: %u (%lu bit/s).",
+			cnt_dev->name, spi_io_get_prescaler(cnt_dev),
+			(unsigned long)spi_io_get_bitrate(cnt_dev));
+	serial_print_line(line_buff, 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * Runs the verification workload at every prescaler, from the slowest
+ * to the fastest: each packet is written to the Target, compared against
+ * the Target's register, then read back and compared again on the Controller.
+ * Returns the number of failed packets, or UINT32_MAX if the bus stalled.
+ */
+inline static uint32_t speed_sweep_workload(SPIDevice_t *cnt_dev, SPIDevice_t *tgt_dev, uint32_t packet_count)
+{
+	static const uint32_t packet_timeout_ms = 100;
+
+	uint8_t test_buff[SPI_DATA_MAX_LEN] = {0};
+	uint32_t error_count = 0;
+
+	for (uint32_t pkt = 0; pkt < packet_count; pkt++)
+	{
+		for (uint8_t idx = 0; idx < SPI_DATA_MAX_LEN; idx++)
+		{
+			test_buff[idx] = (uint8_t)(pkt * 37u + idx * 11u) ^ (idx & 1 ? 0xAA : 0x55);
+		}
+
+		clear_spi_states(&cnt_dev->state, &tgt_dev->state);
+		bzero((uint8_t *)tgt_dev->regs[1], sizeof(tgt_dev->regs[1]));
+		bzero((uint8_t *)cnt_dev->regs[1], sizeof(cnt_dev->regs[1]));
+
+		spi_io_transmit(cnt_dev, test_buff, SPI_DATA_MAX_LEN, 1, tgt_dev);
+		if (!wait_spi_idle_until(cnt_dev, tgt_dev, HAL_GetTick() + packet_timeout_ms)) return UINT32_MAX;
+
+		spi_io_read(cnt_dev, 1, SPI_DATA_MAX_LEN, tgt_dev);
+		if (!wait_spi_idle_until(cnt_dev, tgt_dev, HAL_GetTick() + packet_timeout_ms)) return UINT32_MAX;
+
+		if (memcmp(test_buff, (uint8_t *)tgt_dev->regs[1], SPI_DATA_MAX_LEN) != 0
+			|| memcmp(test_buff, (uint8_t *)cnt_dev->regs[1], SPI_DATA_MAX_LEN) != 0
+			|| ((cnt_dev->state | tgt_dev->state) & (SPISTATE_ERROR | SPISTATE_ABORT)))
+		{
+			error_count++;
+		}
+	}
+
+	return error_count;
+}
+
+inline static void speed_sweep_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static SPI_HandleTypeDef *handles[2] = { &hspi3, &hspi5 };
+
+	char line_buff[96] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	uint16_t initial_divider = spi_io_get_prescaler(cnt_dev);
+	uint32_t packet_count = scan_number("Packets per setting: ", 5);
+
+	if (packet_count < 1)
+	{
+		serial_print_line("Value out of range.", 0);
+		return;
+	}
+
+	for (uint8_t tgt = 0; tgt < 2; tgt++)
+	{
+		SPIDevice_t *tgt_dev = hspi_to_struct(handles[tgt]);
+		uint16_t best_divider = 0;
+		bool stalled = false;
+
+		serial_print("Speed sweep: ", 0);
+		serial_print(cnt_dev->name, 0);
+		serial_print("->", 2);
+		serial_print(tgt_dev->name, 0);
+		serial_print_line(".", 1);
+
+		for (uint16_t divider = 256; divider >= 2 && !stalled; divider >>= 1)
+		{
+			spi_io_set_prescaler(cnt_dev, divider);
+
+			uint32_t error_count = speed_sweep_workload(cnt_dev, tgt_dev, packet_count);
+			stalled = error_count == UINT32_MAX;
+
+			if (stalled)
+			{
+				snprintf(line_buff, sizeof(line_buff), "Prescaler %3u (%8lu bit/s): bus stalled, %s sweep stopped.",
+						divider, (unsigned long)spi_io_get_bitrate(cnt_dev), tgt_dev->name);
+			}
+			else
+			{
+				snprintf(line_buff, sizeof(line_buff), "Prescaler %3u (%8lu bit/s): %lu/%lu packets failed.",
+						divider, (unsigned long)spi_io_get_bitrate(cnt_dev),
+						(unsigned long)error_count, (unsigned long)packet_count);
+
+				if (error_count == 0) best_divider = divider;
+			}
+			serial_print_line(line_buff, 0);
+		}
+
+		if (best_divider == 0)
+		{
+			snprintf(line_buff, sizeof(line_buff), "%s: no error-free setting found.", tgt_dev->name);
+		}
+		else
+		{
+			spi_io_set_prescaler(cnt_dev, best_divider);
+			snprintf(line_buff, sizeof(line_buff), "%s: fastest error-free prescaler %u (%lu bit/s).",
+					tgt_dev->name, best_divider, (unsigned long)spi_io_get_bitrate(cnt_dev));
+		}
+		serial_print_line(line_buff, 0);
+
+		// the other Target still gets its sweep
+		if (stalled) recover_spi_stall(cnt_dev, tgt_dev);
+	}
+
+	spi_io_set_prescaler(cnt_dev, initial_divider);
+	serial_print_line("Speed sweep concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+inline static void nss_mode_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static SPI_HandleTypeDef *handles[2] = { &hspi3, &hspi5 };
+	static const char *nss_names[3] = { "software CS", "hardware NSS", "hardware NSS pulse" };
+
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+
+	serial_print("Current mode: ", 0);
+	serial_print_line(nss_names[cnt_dev->nss], 0);
+	serial_print_line("0: Software CS, Targets armed from EXTI", 0);
+	serial_print_line("1: Hardware NSS, Targets pre-armed", 0);
+	serial_print_line("2: Hardware NSS pulse, Targets pre-armed", 0);
+
+	uint32_t nss = scan_number("New mode: ", 1);
+
+	if (nss > SPINSS_HARD_PULSE)
+	{
+		serial_print_line("Invalid mode.", 0);
+		return;
+	}
+
+	// Targets never pulse, they take NSS as an input either way
+	bool success = spi_io_set_nss(cnt_dev, nss);
+	for (uint8_t idx = 0; idx < 2; idx++)
+	{
+		success &= spi_io_set_nss(hspi_to_struct(handles[idx]),
+				nss == SPINSS_SOFT ? SPINSS_SOFT : SPINSS_HARD);
+	}
+
+	serial_print_line(success ? "Mode set." : "Failed setting mode, a device is busy.", 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * For each CS mode, lowers the Target's CS setup time until the verification
+ * workload fails, reporting the smallest setup time with no failed packets,
+ * along with the worst delay measured between selecting the Target and the
+ * Target arming its reception from the EXTI.
+ */
+inline static void cs_margin_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static const uint16_t max_setup_us = 20;
+	static const struct
+	{
+		SPINSSMode_t cnt_nss;
+		SPINSSMode_t tgt_nss;
+		const char *name;
+	} configs[3] = {
+		{ SPINSS_SOFT, SPINSS_SOFT, "software CS" },
+		{ SPINSS_SOFT, SPINSS_HARD, "hardware NSS input" },
+		{ SPINSS_HARD_PULSE, SPINSS_HARD, "NSS pulse output" },
+	};
+
+	char line_buff[112] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	uint32_t packet_count = scan_number("Packets per setting: ", 5);
+
+	if (packet_count < 1)
+	{
+		serial_print_line("Value out of range.", 0);
+		return;
+	}
+
+	SPINSSMode_t initial_cnt_nss = cnt_dev->nss;
+	SPINSSMode_t initial_tgt_nss = tgt_dev->nss;
+	uint16_t initial_setup_us = tgt_dev->cs_setup_us;
+
+	for (uint8_t cfg = 0; cfg < 3; cfg++)
+	{
+		int32_t best_setup_us = -1;
+		bool stalled = false;
+
+		if (!spi_io_set_nss(cnt_dev, configs[cfg].cnt_nss)
+			|| !spi_io_set_nss(tgt_dev, configs[cfg].tgt_nss))
+		{
+			serial_print("Failed setting mode: ", 0);
+			serial_print_line(configs[cfg].name, 0);
+			continue;
+		}
+
+		tgt_dev->arm_latency_max_cycles = 0;
+
+		for (int32_t setup_us = max_setup_us; setup_us >= 0 && !stalled; setup_us--)
+		{
+			spi_io_set_cs_timing(tgt_dev, setup_us, tgt_dev->cs_hold_us);
+
+			uint32_t error_count = speed_sweep_workload(cnt_dev, tgt_dev, packet_count);
+			stalled = error_count == UINT32_MAX;
+
+			if (error_count != 0) break;
+			best_setup_us = setup_us;
+		}
+
+		if (best_setup_us < 0)
+		{
+			snprintf(line_buff, sizeof(line_buff), "%s: fails at %u us setup%s.",
+					configs[cfg].name, max_setup_us, stalled ? ", bus stalled" : "");
+		}
+		else
+		{
+			snprintf(line_buff, sizeof(line_buff),
+					"%s: minimum error-free setup %ld us, worst EXTI arming latency %lu ns%s.",
+					configs[cfg].name, (long)best_setup_us,
+					(unsigned long)((uint64_t)tgt_dev->arm_latency_max_cycles * 1000u / (SystemCoreClock / 1000000u)),
+					stalled ? ", bus stalled" : "");
+		}
+		serial_print_line(line_buff, 0);
+
+		// the next mode is only set up on idle devices, and still gets measured
+		if (stalled) recover_spi_stall(cnt_dev, tgt_dev);
+	}
+
+	spi_io_set_cs_timing(tgt_dev, initial_setup_us, tgt_dev->cs_hold_us);
+	spi_io_set_nss(cnt_dev, initial_cnt_nss);
+	spi_io_set_nss(tgt_dev, initial_tgt_nss);
+	serial_print_line("CS margin measurement concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+inline static void recovery_stats_routine(void)
+{
+	static SPI_HandleTypeDef *handles[3] = { &hspi1, &hspi3, &hspi5 };
+	char line_buff[112] = {0};
+
+	serial_print_line("SPI timeout and recovery statistics:", 0);
+
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		SPIDevice_t *spid = hspi_to_struct(handles[idx]);
+
+		snprintf(line_buff, sizeof(line_buff), "%s: %lu recoveries, last %lu us, max %lu us, %lu headers rejected.",
+				spid->name, (unsigned long)spid->recovery_count,
+				(unsigned long)cycles_to_us(spid->recovery_last_cycles),
+				(unsigned long)cycles_to_us(spid->recovery_max_cycles),
+				(unsigned long)spid->header_errors);
+		serial_print_line(line_buff, 0);
+
+		for (uint8_t phase = 1; phase < SPI_PHASE_COUNT; phase++)
+		{
+			if (spid->phase_timeouts[phase] == 0) continue;
+
+			snprintf(line_buff, sizeof(line_buff), "  timed out in %s: %lu",
+					phase_names[phase], (unsigned long)spid->phase_timeouts[phase]);
+			serial_print_line(line_buff, 0);
+		}
+
+		spi_io_reset_recovery_stats(spid);
+	}
+
+	serial_print_line("Statistics reset.", 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * Writes and reads back packets for as long as asked, verifying each one.
+ * A fault can be injected periodically by cancelling the Controller's
+ * CS setup wait, leaving the Target selected with nothing ever clocked,
+ * which both devices have to recover from on their own.
+ */
+inline static void soak_test_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static const uint32_t packet_timeout_ms = 100;
+
+	char line_buff[112] = {0};
+	uint8_t test_buff[SPI_DATA_MAX_LEN] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	uint32_t packet_count = scan_number("Packet count: ", 7);
+	uint32_t inject_every = scan_number("Inject a fault every N packets (0: never): ", 5);
+	uint32_t failed_count = 0;
+	uint32_t stall_count = 0;
+	uint32_t cnt_recoveries = cnt_dev->recovery_count;
+	uint32_t tgt_recoveries = tgt_dev->recovery_count;
+	uint32_t start_tick = HAL_GetTick();
+
+	for (uint32_t pkt = 0; pkt < packet_count; pkt++)
+	{
+		for (uint8_t idx = 0; idx < SPI_DATA_MAX_LEN; idx++)
+		{
+			test_buff[idx] = (uint8_t)(pkt + idx * 13u);
+		}
+
+		clear_spi_states(&cnt_dev->state, &tgt_dev->state);
+		bzero((uint8_t *)cnt_dev->regs[1], sizeof(cnt_dev->regs[1]));
+
+		spi_io_transmit(cnt_dev, test_buff, SPI_DATA_MAX_LEN, 1, tgt_dev);
+		if (inject_every > 0 && (pkt + 1) % inject_every == 0) us_timer_cancel(cnt_dev);
+		spi_io_read(cnt_dev, 1, SPI_DATA_MAX_LEN, tgt_dev);
+
+		if (!wait_spi_idle_until(cnt_dev, tgt_dev, HAL_GetTick() + packet_timeout_ms))
+		{
+			stall_count++;
+		}
+
+		if (memcmp(test_buff, (uint8_t *)cnt_dev->regs[1], SPI_DATA_MAX_LEN) != 0
+			|| ((cnt_dev->state | tgt_dev->state) & (SPISTATE_ERROR | SPISTATE_ABORT)))
+		{
+			failed_count++;
+		}
+	}
+
+	snprintf(line_buff, sizeof(line_buff),
+			"%lu packets in %lu ms: %lu failed, %lu stalled, recoveries %s %lu, %s %lu.",
+			(unsigned long)packet_count, (unsigned long)(HAL_GetTick() - start_tick),
+			(unsigned long)failed_count, (unsigned long)stall_count,
+			cnt_dev->name, (unsigned long)(cnt_dev->recovery_count - cnt_recoveries),
+			tgt_dev->name, (unsigned long)(tgt_dev->recovery_count - tgt_recoveries));
+	serial_print_line(line_buff, 0);
+	serial_print_line("Soak test concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * Runs the verification workload, then prints the per-phase statistics
+ * the trace layer collected for the Target. Each phase is the time
+ * leading up to its trace point, from the previous point reached.
+ */
+inline static void phase_trace_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static const char *point_names[SPI_TRACE_POINT_COUNT] = {
+		"CS assert", "Target selected", "header TX", "header RX", "payload TX",
+		"payload RX", "processing start", "processing end", "response RX", "CS release"
+	};
+
+	char line_buff[112] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+	uint32_t cycles_per_us = SystemCoreClock / 1000000u;
+
+	if (tgt_dev == NULL) return;
+
+	uint32_t packet_count = scan_number("Packet count: ", 5);
+
+	if (packet_count < 1)
+	{
+		serial_print_line("Value out of range.", 0);
+		return;
+	}
+
+	spi_trace_reset();
+
+	for (uint32_t pkt = 0; pkt < packet_count; pkt++)
+	{
+		speed_sweep_workload(cnt_dev, tgt_dev, 1);
+		// collect as we go, records are only kept for SPI_TRACE_SLOTS transactions
+		spi_trace_collect();
+	}
+
+	snprintf(line_buff, sizeof(line_buff), "Phase durations in ns, %s->%s, %lu write+read packets:",
+			cnt_dev->name, tgt_dev->name, (unsigned long)packet_count);
+	serial_print_line(line_buff, 0);
+
+	for (uint8_t point = 0; point < SPI_TRACE_POINT_COUNT; point++)
+	{
+		const SPITraceStats_t *stats = spi_trace_get_stats(spi_io_get_index(tgt_dev), point);
+
+		if (stats == NULL || stats->count == 0) continue;
+
+		snprintf(line_buff, sizeof(line_buff), "until %-16s n %6lu, min %8lu, mean %8lu, max %8lu",
+				point_names[point], (unsigned long)stats->count,
+				(unsigned long)(stats->min * 1000u / cycles_per_us),
+				(unsigned long)(stats->total * 1000u / cycles_per_us / stats->count),
+				(unsigned long)(stats->max * 1000u / cycles_per_us));
+		serial_print_line(line_buff, 0);
+
+		// histogram bins double in width, labelled by their upper bound
+		serial_print("  histogram:", 0);
+		for (uint8_t bin = 0; bin < SPI_TRACE_HIST_BINS; bin++)
+		{
+			if (stats->hist[bin] == 0) continue;
+
+			snprintf(line_buff, sizeof(line_buff), " <%luns:%lu",
+					(unsigned long)(((uint64_t)1u << (SPI_TRACE_HIST_SHIFT + bin)) * 1000u / cycles_per_us),
+					(unsigned long)stats->hist[bin]);
+			serial_print(line_buff, 0);
+		}
+		serial_print_line(NULL, 0);
+	}
+
+	if (spi_trace_lost() > 0)
+	{
+		snprintf(line_buff, sizeof(line_buff), "%lu transactions lost before collection.",
+				(unsigned long)spi_trace_lost());
+		serial_print_line(line_buff, 0);
+	}
+
+	serial_print_line("Phase trace concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * Sends back-to-back packets through the queue, with no console output until
+ * the last one is done. Bus efficiency relates the payload bits to the SCK bits
+ * the elapsed time could have carried, so it accounts for the header, CRC,
+ * CS and turnaround gaps, and the interrupt handling in between.
+ */
+inline static void benchmark_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	char line_buff[160] = {0};
+	uint8_t test_buff[SPI_DATA_MAX_LEN] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	uint32_t packet_count = scan_number("Packet count: ", 7);
+	uint32_t packet_len = scan_number("Payload size in bytes (1-64): ", 2);
+
+	if (packet_count < 1 || packet_len < 1 || packet_len > SPI_DATA_MAX_LEN)
+	{
+		serial_print_line("Value out of range.", 0);
+		return;
+	}
+
+	for (uint8_t idx = 0; idx < SPI_DATA_MAX_LEN; idx++)
+	{
+		test_buff[idx] = (uint8_t)(idx * 29u + 7u);
+	}
+
+	uint32_t rx_packets = tgt_dev->rx_packets;
+	uint32_t crc_errors = cnt_dev->crc_errors + tgt_dev->crc_errors;
+	uint32_t crc_failures = cnt_dev->crc_failures;
+	uint32_t recoveries = cnt_dev->recovery_count + tgt_dev->recovery_count;
+	uint32_t error_states = 0;
+
+	clear_spi_states(&cnt_dev->state, &tgt_dev->state);
+	bzero((uint8_t *)tgt_dev->regs[0], sizeof(tgt_dev->regs[0]));
+
+	// accumulated in 64 bits, long runs outlast a wrap of the cycle counter
+	uint64_t elapsed_cycles = 0;
+	uint32_t last_cycles = cycles_now();
+
+	for (uint32_t pkt = 0; pkt < packet_count; pkt++)
+	{
+		test_buff[0] = (uint8_t)pkt;
+
+		while (spi_io_queue_depth(cnt_dev) >= SPI_TX_QUEUE_LEN)
+		{
+			spi_io_poll();
+			__WFI();
+		}
+
+		spi_io_transmit(cnt_dev, test_buff, packet_len, 0, tgt_dev);
+
+		uint32_t now = cycles_now();
+		elapsed_cycles += now - last_cycles;
+		last_cycles = now;
+	}
+
+	while (!spi_io_is_idle(cnt_dev) || !spi_io_is_idle(tgt_dev) || tgt_dev->state & SPISTATE_SELECTED)
+	{
+		spi_io_poll();
+
+		uint32_t now = cycles_now();
+		elapsed_cycles += now - last_cycles;
+		last_cycles = now;
+	}
+
+	elapsed_cycles += cycles_now() - last_cycles;
+
+	if ((cnt_dev->state | tgt_dev->state) & SPISTATE_ERROR) error_states++;
+	rx_packets = tgt_dev->rx_packets - rx_packets;
+	crc_errors = cnt_dev->crc_errors + tgt_dev->crc_errors - crc_errors;
+	crc_failures = cnt_dev->crc_failures - crc_failures;
+	recoveries = cnt_dev->recovery_count + tgt_dev->recovery_count - recoveries;
+	test_buff[0] = (uint8_t)(packet_count - 1);
+	bool last_match = memcmp(test_buff, (uint8_t *)tgt_dev->regs[0], packet_len) == 0;
+
+	uint64_t elapsed_us = elapsed_cycles / (SystemCoreClock / 1000000u);
+	uint64_t payload_bits = (uint64_t)packet_count * packet_len * 8u;
+	uint64_t sck_bits = (uint64_t)spi_io_get_bitrate(cnt_dev) * elapsed_us / 1000000u;
+
+	snprintf(line_buff, sizeof(line_buff), "%s->%s, prescaler %u (%lu bit/s), %s framing, %s mode%s:",
+			cnt_dev->name, tgt_dev->name, spi_io_get_prescaler(cnt_dev),
+			(unsigned long)spi_io_get_bitrate(cnt_dev),
+			cnt_dev->framing == SPIFRAME_SINGLE ? "single" : "split",
+			cnt_dev->mode == SPIMODE_DMA ? "DMA" : "IT",
+			cnt_dev->crc_enabled ? ", CRC" : "");
+	serial_print_line(line_buff, 0);
+
+	snprintf(line_buff, sizeof(line_buff), "%lu x %lu bytes in %lu us: %lu bytes/s, %lu packets/s, bus efficiency %lu.%lu%%.",
+			(unsigned long)packet_count, (unsigned long)packet_len, (unsigned long)elapsed_us,
+			(unsigned long)(elapsed_us == 0 ? 0 : payload_bits / 8u * 1000000u / elapsed_us),
+			(unsigned long)(elapsed_us == 0 ? 0 : (uint64_t)packet_count * 1000000u / elapsed_us),
+			(unsigned long)(sck_bits == 0 ? 0 : payload_bits * 100u / sck_bits),
+			(unsigned long)(sck_bits == 0 ? 0 : payload_bits * 1000u / sck_bits % 10u));
+	serial_print_line(line_buff, 0);
+
+	snprintf(line_buff, sizeof(line_buff), "Errors: %lu packets missing, CRC errors %lu, dropped %lu, recoveries %lu, error flags %lu, last packet %s.",
+			(unsigned long)(packet_count > rx_packets ? packet_count - rx_packets : 0),
+			(unsigned long)crc_errors, (unsigned long)crc_failures,
+			(unsigned long)recoveries, (unsigned long)error_states,
+			last_match ? "verified" : "MISMATCHED");
+	serial_print_line(line_buff, 0);
+	serial_print_line("Benchmark concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * Formats num/den as a three digit mantissa and a decimal exponent,
+ * sparing the floating point printf support.
+ */
+inline static void format_ratio(char *buffer, size_t size, uint64_t num, uint64_t den)
+{
+	int16_t exponent = 0;
+
+	if (num == 0 || den == 0)
+	{
+		snprintf(buffer, size, "0");
+		return;
+	}
+
+	while (num < den)
+	{
+		num *= 10u;
+		exponent--;
+	}
+
+	while (num >= den * 10u)
+	{
+		den *= 10u;
+		exponent++;
+	}
+
+	uint32_t digits = (uint32_t)(num * 100u / den);
+
+	snprintf(buffer, size, "%lu.%02lue%d", (unsigned long)(digits / 100u),
+			(unsigned long)(digits % 100u), exponent);
+}
+
+inline static uint32_t isqrt64(uint64_t value)
+{
+	uint64_t root = 0;
+	uint64_t bit = (uint64_t)1u << 62;
+
+	while (bit > value) bit >>= 2;
+
+	while (bit != 0)
+	{
+		if (value >= root + bit)
+		{
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return (uint32_t)root;
+}
+
+/**
+ * Streams PRBS payloads to a Target, which regenerates the sequence
+ * and counts the mismatched bits as the packets come in.
+ * The upper bound is at 95% confidence: the rule of three with no errors,
+ * else the normal approximation k + 1.96 sqrt(k) + 1.92 errors.
+ */
+inline static void ber_test_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static const char *prbs_names[3] = { "PRBS7", "PRBS15", "PRBS31" };
+
+	char line_buff[128] = {0};
+	char ber_buff[16] = {0};
+	char bound_buff[16] = {0};
+	PRBSGenerator_t prbs;
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	serial_print_line("0: PRBS7, 1: PRBS15, 2: PRBS31", 0);
+	uint32_t type = scan_number("Sequence: ", 1);
+	uint32_t packet_count = scan_number("Packet count: ", 7);
+
+	if (type > PRBS31 || packet_count < 1)
+	{
+		serial_print_line("Value out of range.", 0);
+		return;
+	}
+
+	prbs_initialize(&prbs, type);
+	spi_io_ber_listen(tgt_dev, type, true);
+	clear_spi_states(&cnt_dev->state, &tgt_dev->state);
+
+	uint32_t start_tick = HAL_GetTick();
+
+	for (uint32_t pkt = 0; pkt < packet_count; pkt++)
+	{
+		while (!spi_io_ber_send(cnt_dev, &prbs, SPI_DATA_MAX_LEN, (uint16_t)pkt, tgt_dev))
+		{
+			spi_io_poll();
+			__WFI();
+		}
+	}
+
+	wait_spi_idle(cnt_dev, tgt_dev);
+
+	uint32_t elapsed_ms = HAL_GetTick() - start_tick;
+	SPIBer_t *ber = &tgt_dev->ber;
+
+	spi_io_ber_listen(tgt_dev, type, false);
+
+	uint64_t errors = ber->bit_errors;
+	uint64_t upper_errors_x100 = errors == 0 ? 300u
+			: errors * 100u + 196u * isqrt64(errors * 10000u) / 100u + 192u;
+
+	format_ratio(ber_buff, sizeof(ber_buff), errors, ber->bit_count);
+	format_ratio(bound_buff, sizeof(bound_buff), upper_errors_x100, ber->bit_count * 100u);
+
+	snprintf(line_buff, sizeof(line_buff), "%s, %s->%s at %lu bit/s, %lu ms:",
+			prbs_names[type], cnt_dev->name, tgt_dev->name,
+			(unsigned long)spi_io_get_bitrate(cnt_dev), (unsigned long)elapsed_ms);
+	serial_print_line(line_buff, 0);
+
+	snprintf(line_buff, sizeof(line_buff),
+			"%lu packets checked, %lu missed, %lu duplicated, %lu resyncs, %lu kbit, %lu bit errors.",
+			(unsigned long)ber->packet_count, (unsigned long)ber->missed_packets,
+			(unsigned long)ber->duplicate_packets, (unsigned long)ber->resyncs,
+			(unsigned long)(ber->bit_count / 1000u), (unsigned long)errors);
+	serial_print_line(line_buff, 0);
+
+	snprintf(line_buff, sizeof(line_buff), "BER %s, 95%% upper bound %s, check cost %lu cycles/byte.",
+			ber_buff, bound_buff,
+			(unsigned long)(ber->bit_count == 0 ? 0 : ber->check_cycles * 8u / ber->bit_count));
+	serial_print_line(line_buff, 0);
+	serial_print_line("BER test concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+inline static uint32_t stress_random(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+/**
+ * Sends packets with randomized headers back to back: lengths and registers
+ * past their bounds, unknown opcodes and corrupted pads, mixed with valid
+ * writes and reads. Every check_every packets a verified write and read-back
+ * shows whether the Target still answers correctly after what it dropped.
+ */
+inline static void stress_test_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static const uint32_t check_every = 32;
+	static const uint32_t packet_timeout_ms = 100;
+	static const uint8_t opcodes[6] = {
+		SPIOP_TX, SPIOP_RX, SPI_OPCODE_STREAM,
+		SPI_OPCODE_STREAM | SPI_OPCODE_FLAG_FINAL, SPI_OPCODE_PRBS, 0x00
+	};
+
+	char line_buff[128] = {0};
+	uint8_t payload[SPI_DATA_MAX_LEN] = {0};
+	SPIHeader_t header;
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	uint32_t packet_count = scan_number("Packet count: ", 7);
+	uint32_t seed = cycles_now() | 1u;
+
+	snprintf(line_buff, sizeof(line_buff), "Seed 0x%08lX, %s->%s at %lu bit/s.", (unsigned long)seed,
+			cnt_dev->name, tgt_dev->name, (unsigned long)spi_io_get_bitrate(cnt_dev));
+	serial_print_line(line_buff, 0);
+
+	// random stream chunks must not land in a buffer left by a stream test
+	spi_io_stream_listen(tgt_dev, NULL, 0);
+	spi_io_ber_listen(tgt_dev, PRBS7, false);
+	clear_spi_states(&cnt_dev->state, &tgt_dev->state);
+
+	uint32_t rx_packets = tgt_dev->rx_packets;
+	uint32_t header_errors = tgt_dev->header_errors;
+	uint32_t read_errors = cnt_dev->read_errors;
+	uint32_t crc_failures = cnt_dev->crc_failures;
+	uint32_t cnt_recoveries = cnt_dev->recovery_count;
+	uint32_t tgt_recoveries = tgt_dev->recovery_count;
+	uint32_t check_count = 0;
+	uint32_t check_failures = 0;
+	uint32_t stall_count = 0;
+	uint64_t wire_bytes = 0;
+	uint32_t start_tick = HAL_GetTick();
+
+	for (uint32_t pkt = 0; pkt < packet_count; pkt++)
+	{
+		uint32_t r = stress_random(&seed);
+		uint32_t s = stress_random(&seed);
+
+		// each pad is corrupted one time in sixteen, one opcode in four is random
+		header.pad_head[0] = (r & 0x0F) == 0 ? (uint8_t)(s >> 24) : 255u;
+		header.pad_head[1] = (r & 0xF0) == 0 ? (uint8_t)(s >> 16) : 255u;
+		header.pad_tail[0] = (r & 0xF00) == 0 ? (uint8_t)(s >> 8) : 255u;
+		header.opcode = ((r >> 12) & 0x07) < 6 ? opcodes[(r >> 12) & 0x07] : (uint8_t)s;
+		// lengths are within bounds half of the time
+		header.tx_len = (r >> 15) & 1 ? (uint8_t)((r >> 16) % (SPI_DATA_MAX_LEN + 1)) : (uint8_t)(r >> 16);
+		header.rx_len = (r >> 24) & 1 ? (uint8_t)(s % (SPI_DATA_MAX_LEN + 1)) : (uint8_t)s;
+		header.tx_reg = (uint8_t)((r >> 25) & 0x03);
+		header.rx_reg = (uint8_t)((r >> 27) & 0x03);
+
+		payload[pkt % SPI_DATA_MAX_LEN] = (uint8_t)r;
+
+		while (!spi_io_transmit_raw(cnt_dev, &header, payload, tgt_dev))
+		{
+			spi_io_poll();
+			__WFI();
+		}
+
+		wire_bytes += sizeof(SPIHeader_t) + (header.tx_len > SPI_DATA_MAX_LEN ? SPI_DATA_MAX_LEN : header.tx_len);
+
+		if ((pkt + 1) % check_every == 0 || pkt + 1 == packet_count)
+		{
+			if (!wait_spi_idle_until(cnt_dev, tgt_dev, HAL_GetTick() + packet_timeout_ms))
+			{
+				stall_count++;
+			}
+
+			check_count++;
+			if (speed_sweep_workload(cnt_dev, tgt_dev, 1) != 0) check_failures++;
+		}
+	}
+
+	uint32_t elapsed_ms = HAL_GetTick() - start_tick;
+	if (elapsed_ms == 0) elapsed_ms = 1;
+
+	snprintf(line_buff, sizeof(line_buff), "%lu packets in %lu ms, %lu packets/s, %lu byte/s of headers and payload.",
+			(unsigned long)packet_count, (unsigned long)elapsed_ms,
+			(unsigned long)((uint64_t)packet_count * 1000u / elapsed_ms),
+			(unsigned long)(wire_bytes * 1000u / elapsed_ms));
+	serial_print_line(line_buff, 0);
+
+	snprintf(line_buff, sizeof(line_buff), "%s: %lu packets accepted, %lu headers rejected, %lu recoveries.",
+			tgt_dev->name, (unsigned long)(tgt_dev->rx_packets - rx_packets),
+			(unsigned long)(tgt_dev->header_errors - header_errors),
+			(unsigned long)(tgt_dev->recovery_count - tgt_recoveries));
+	serial_print_line(line_buff, 0);
+
+	snprintf(line_buff, sizeof(line_buff), "%s: %lu read errors, %lu CRC failures, %lu recoveries.",
+			cnt_dev->name, (unsigned long)(cnt_dev->read_errors - read_errors),
+			(unsigned long)(cnt_dev->crc_failures - crc_failures),
+			(unsigned long)(cnt_dev->recovery_count - cnt_recoveries));
+	serial_print_line(line_buff, 0);
+
+	snprintf(line_buff, sizeof(line_buff), "Link checks: %lu of %lu failed, %lu stalls.",
+			(unsigned long)check_failures, (unsigned long)check_count, (unsigned long)stall_count);
+	serial_print_line(line_buff, 0);
+	serial_print_line("Stress test concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+inline static void stream_test_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static uint8_t source_buff[4096];
+	static uint8_t sink_buff[4096];
+
+	char line_buff[112] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	uint32_t len = scan_number("Stream length in bytes (max 4096): ", 4);
+
+	if (len < 1 || len > sizeof(source_buff))
+	{
+		serial_print_line("Value out of range.", 0);
+		return;
+	}
+
+	for (uint32_t idx = 0; idx < len; idx++)
+	{
+		source_buff[idx] = (uint8_t)((idx * 7u) + (idx >> 8));
+	}
+
+	bzero(sink_buff, sizeof(sink_buff));
+	clear_spi_states(&cnt_dev->state, &tgt_dev->state);
+	spi_io_stream_listen(tgt_dev, sink_buff, sizeof(sink_buff));
+
+	uint32_t start_cycles = cycles_now();
+	uint32_t chunk_count = spi_io_stream_send(cnt_dev, source_buff, len, tgt_dev);
+	wait_spi_idle(cnt_dev, tgt_dev);
+	uint32_t elapsed_us = cycles_to_us(cycles_now() - start_cycles);
+
+	SPIStream_t *stream = &tgt_dev->stream;
+	bool match = stream->complete && stream->length == len
+			&& memcmp(source_buff, sink_buff, len) == 0;
+
+	snprintf(line_buff, sizeof(line_buff),
+			"%lu bytes in %lu chunks, %lu us, %lu bytes/s, seq errors %lu, overflows %lu, data %s.",
+			(unsigned long)stream->length, (unsigned long)chunk_count,
+			(unsigned long)elapsed_us,
+			(unsigned long)(elapsed_us == 0 ? 0 : (uint64_t)len * 1000000u / elapsed_us),
+			(unsigned long)stream->seq_errors, (unsigned long)stream->overflow_errors,
+			match ? "verified" : "MISMATCHED");
+	serial_print_line(line_buff, 0);
+
+	spi_io_stream_listen(tgt_dev, NULL, 0);
+	serial_print_line("Stream test concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+inline static void uart_tx_routine(void)
+{
+	static const char *policy_names[3] = { "block", "drop newest", "drop oldest" };
+	char line_buff[112] = {0};
+	UARTTxStats_t stats;
+	UARTRxStats_t rx_stats;
+
+	// taken before printing, which queues output of its own
+	serial_get_tx_stats(&stats);
+	serial_get_rx_stats(&rx_stats);
+	uint16_t pending = serial_tx_pending();
+
+	serial_print_line("UART ring statistics:", 0);
+	snprintf(line_buff, sizeof(line_buff),
+			"TX: policy %s, pending %u/%u, high water %u.",
+			policy_names[serial_get_tx_policy()], pending, UART_TX_RING_LEN, stats.high_water);
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff),
+			"TX: queued %lu, dropped %lu, evicted %lu bytes, blocked writes %lu.",
+			(unsigned long)stats.queued_bytes, (unsigned long)stats.dropped_bytes,
+			(unsigned long)stats.evicted_bytes, (unsigned long)stats.blocked_writes);
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff),
+			"RX: received %lu, overflowed %lu bytes, line errors %lu, high water %u/%u.",
+			(unsigned long)rx_stats.received_bytes, (unsigned long)rx_stats.overflow_bytes,
+			(unsigned long)rx_stats.line_errors, rx_stats.high_water, UART_RX_RING_LEN);
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff), "RX: binary frames %lu, oversized %lu.",
+			(unsigned long)rx_stats.frames, (unsigned long)rx_stats.oversized_frames);
+	serial_print_line(line_buff, 0);
+
+	serial_print_line("0: Block until the ring has room", 0);
+	serial_print_line("1: Drop the newest output", 0);
+	serial_print_line("2: Drop the oldest queued output", 0);
+
+	uint32_t policy = scan_number("New policy: ", 1);
+
+	if (policy > UARTTX_DROP_OLDEST)
+	{
+		serial_print_line("Invalid policy.", 0);
+		return;
+	}
+
+	serial_set_tx_policy(policy);
+	serial_reset_tx_stats();
+	serial_reset_rx_stats();
+
+	serial_print_line("Policy set, statistics reset.", 0);
+	serial_print_line("---", 3);
+}
+
+#define CONSOLE_CONFIRM_MS (10000u)
+#define CONSOLE_TEST_LINES (64u)
+
+/**
+ * Switches the console to a faster baud rate, falling back to the default
+ * unless the terminal confirms with "ok" at the new rate before the timeout,
+ * then measures the output throughput the new rate achieves.
+ */
+inline static void console_baud_routine(void)
+{
+	static const uint32_t rates[5] = { UART_DEFAULT_BAUD, 921600u, 2000000u, 3000000u, 4500000u };
+	char line_buff[112] = {0};
+	char confirm_buff[4] = {0};
+
+	// 16x oversampling tops out at the kernel clock over 16
+	uint32_t over16_max = HAL_RCC_GetPCLK1Freq() / 16u;
+
+	snprintf(line_buff, sizeof(line_buff), "Current rate: %lu baud.", (unsigned long)serial_get_baud());
+	serial_print_line(line_buff, 0);
+
+	for (uint8_t idx = 0; idx < 5; idx++)
+	{
+		snprintf(line_buff, sizeof(line_buff), "%u: %lu baud%s", idx, (unsigned long)rates[idx],
+				rates[idx] > over16_max ? ", 8x oversampling" : "");
+		serial_print_line(line_buff, 0);
+	}
+
+	uint32_t choice = scan_number("New rate: ", 1);
+
+	if (choice >= 5)
+	{
+		serial_print_line("Invalid rate.", 0);
+		return;
+	}
+
+	snprintf(line_buff, sizeof(line_buff),
+			"Switching to %lu baud, set the terminal to it and type ok within %lu s.",
+			(unsigned long)rates[choice], (unsigned long)(CONSOLE_CONFIRM_MS / 1000u));
+	serial_print_line(line_buff, 0);
+
+	bool confirmed = false;
+
+	if (serial_set_baud(rates[choice], rates[choice] > over16_max))
+	{
+		SerialLine_t line;
+		uint32_t start = HAL_GetTick();
+
+		serial_print("Confirm: ", 0);
+		serial_line_begin(&line, confirm_buff, sizeof(confirm_buff) - 1, ASCII_PRINTABLE);
+
+		// lines garbled by a mismatched rate are ignored until the timeout
+		while (HAL_GetTick() - start < CONSOLE_CONFIRM_MS)
+		{
+			if (!serial_line_poll(&line))
+			{
+				__WFI();
+				continue;
+			}
+
+			if (strcmp(confirm_buff, "ok") == 0)
+			{
+				confirmed = true;
+				break;
+			}
+
+			serial_print("Confirm: ", 0);
+			serial_line_begin(&line, confirm_buff, sizeof(confirm_buff) - 1, ASCII_PRINTABLE);
+		}
+	}
+
+	if (!confirmed)
+	{
+		serial_set_baud(UART_DEFAULT_BAUD, false);
+		snprintf(line_buff, sizeof(line_buff), "No confirmation, back at %lu baud.",
+				(unsigned long)UART_DEFAULT_BAUD);
+		serial_print_line(line_buff, 0);
+		serial_print_line("---", 3);
+		return;
+	}
+
+	uint32_t baud = serial_get_baud();
+
+	snprintf(line_buff, sizeof(line_buff), "Confirmed, divider yields %lu baud. Throughput test:",
+			(unsigned long)baud);
+	serial_print_line(line_buff, 0);
+	serial_flush();
+
+	// 62 characters and CR LF per line
+	static const char pattern[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+	uint32_t start = cycles_now();
+
+	for (uint32_t idx = 0; idx < CONSOLE_TEST_LINES; idx++)
+	{
+		serial_print_line(pattern, sizeof(pattern) - 1);
+	}
+
+	serial_flush();
+
+	uint32_t elapsed_us = cycles_to_us(cycles_now() - start);
+	uint32_t bytes = CONSOLE_TEST_LINES * (sizeof(pattern) + 1);
+	// start and stop bits frame every byte
+	uint64_t line_bytes = (uint64_t)baud * elapsed_us / 10u / 1000000u;
+
+	snprintf(line_buff, sizeof(line_buff), "%lu bytes in %lu us: %lu bytes/s, %lu.%lu%% of the line rate.",
+			(unsigned long)bytes, (unsigned long)elapsed_us,
+			(unsigned long)(elapsed_us == 0 ? 0 : (uint64_t)bytes * 1000000u / elapsed_us),
+			(unsigned long)(line_bytes == 0 ? 0 : bytes * 100u / line_bytes),
+			(unsigned long)(line_bytes == 0 ? 0 : bytes * 1000u / line_bytes % 10u));
+	serial_print_line(line_buff, 0);
+	serial_print_line("Baud rate switch concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * Toggles deferred logging of the SPI events. While it is on, the loopback
+ * tests send their events as binary log frames, which Host/Tools/dlog_decode.py
+ * turns back into text using the firmware's ELF.
+ */
+inline static void deferred_log_routine(void)
+{
+	char line_buff[80] = {0};
+
+	dlog_drain();
+	dlog_set_enabled(!dlog_is_enabled());
+
+	snprintf(line_buff, sizeof(line_buff), "Deferred logging: %s, %lu records logged, %lu dropped.",
+			dlog_is_enabled() ? "on" : "off",
+			(unsigned long)dlog_records(), (unsigned long)dlog_dropped());
+	serial_print_line(line_buff, 0);
+
+	if (dlog_is_enabled())
+	{
+		serial_print_line("SPI events are now sent as binary frames, decode the console with:", 0);
+		serial_print_line("  Host/Tools/dlog_decode.py --elf <firmware.elf> --port <port>", 0);
+	}
+
+	serial_print_line("---", 3);
+}
+
+/**
+ * Shows the state of the USB CDC port and selects the console transport.
+ */
+inline static void console_transport_routine(void)
+{
+	static const char *state_names[5] = { "detached", "default", "addressed", "configured", "suspended" };
+	static const char *transport_names[2] = { "USART3", "USB CDC" };
+	static const char *stop_bit_names[3] = { "1", "1.5", "2" };
+	char line_buff[112] = {0};
+	USBCDCStats_t stats;
+	USBCDCLineCoding_t coding;
+
+	usb_cdc_get_stats(&stats);
+	usb_cdc_get_line_coding(&coding);
+
+	snprintf(line_buff, sizeof(line_buff), "USB CDC: %s, terminal %s, line coding %lu baud %u%c%s.",
+			state_names[usb_cdc_get_state()], usb_cdc_is_connected() ? "open" : "closed",
+			(unsigned long)coding.baud, coding.data_bits, coding.parity < 5 ? "NOEMS"[coding.parity] : '?',
+			coding.stop_bits < 3 ? stop_bit_names[coding.stop_bits] : "?");
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff),
+			"USB TX: %lu bytes in %lu transfers, %lu zero-length packets, %lu bytes lost.",
+			(unsigned long)stats.tx_bytes, (unsigned long)stats.tx_transfers,
+			(unsigned long)stats.zero_length_packets, (unsigned long)stats.tx_lost_bytes);
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff), "USB RX: %lu bytes in %lu packets, %lu pauses for a full ring.",
+			(unsigned long)stats.rx_bytes, (unsigned long)stats.rx_packets, (unsigned long)stats.rx_pauses);
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff), "USB: %lu bus resets, %lu stalled requests.",
+			(unsigned long)stats.bus_resets, (unsigned long)stats.stalled_requests);
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff), "Console output: %s, selected %s.",
+			transport_names[serial_active_transport()], transport_names[serial_get_transport()]);
+	serial_print_line(line_buff, 0);
+
+	serial_print_line("0: USART3 only", 0);
+	serial_print_line("1: USB CDC, USART3 while no terminal has the port open", 0);
+
+	uint32_t transport = scan_number("Console transport: ", 1);
+
+	if (transport > SERIALTRANSPORT_USB)
+	{
+		serial_print_line("Invalid transport.", 0);
+		return;
+	}
+
+	// the answer goes out where the question did
+	serial_flush();
+	serial_set_transport(transport);
+	usb_cdc_reset_stats();
+
+	snprintf(line_buff, sizeof(line_buff), "Console output now goes to %s.",
+			transport_names[serial_active_transport()]);
+	serial_print_line(line_buff, 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * A CPU-bound pass over RAM like the ones of the tests: generating and
+ * checking a PRBS over the buffer, a few times. Returns the bit errors,
+ * always 0, so that the work cannot be optimized out.
+ */
+inline static uint32_t cache_workload(uint8_t *buffer, uint32_t len)
+{
+	PRBSGenerator_t prbs;
+	uint32_t errors = 0;
+
+	for (uint8_t round = 0; round < 4; round++)
+	{
+		prbs_initialize(&prbs, PRBS31);
+		prbs_fill(&prbs, buffer, len);
+		prbs_initialize(&prbs, PRBS31);
+		errors += prbs_check(&prbs, buffer, len);
+	}
+
+	return errors;
+}
+
+/**
+ * Runs a CPU workload and DMA write/read-back round trips with the caches
+ * off, then on. With the D-cache on, a DMA buffer in cached memory would
+ * show up as mismatched read-backs.
+ */
+inline static void cache_benchmark_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static uint8_t work_buff[4096];
+	static const char *pass_names[2] = { "off", "on" };
+	char line_buff[128] = {0};
+	uint32_t work_cycles[2] = {0};
+	uint32_t link_cycles[2] = {0};
+	uint32_t errors[2] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	uint32_t packet_count = scan_number("Packet count: ", 5);
+
+	if (packet_count < 1)
+	{
+		serial_print_line("Value out of range.", 0);
+		return;
+	}
+
+	snprintf(line_buff, sizeof(line_buff), "Caches %s, ART %s, DMA buffers in %lu KiB uncached at 0x%08lX.",
+			mpu_cache_is_enabled() ? "on" : "off", mpu_cache_art_is_enabled() ? "on" : "off",
+			(unsigned long)(DMA_RAM_SIZE / 1024u), (unsigned long)DMA_RAM_BASE);
+	serial_print_line(line_buff, 0);
+
+	SPITransferMode_t cnt_mode = cnt_dev->mode;
+	SPITransferMode_t tgt_mode = tgt_dev->mode;
+
+	if (!spi_io_set_mode(cnt_dev, SPIMODE_DMA) || !spi_io_set_mode(tgt_dev, SPIMODE_DMA))
+	{
+		spi_io_set_mode(cnt_dev, cnt_mode);
+		serial_print_line("Could not switch to DMA mode, a device is busy.", 0);
+		return;
+	}
+
+	// the console is drained first, its interrupts would count against the passes
+	serial_flush();
+
+	for (uint8_t pass = 0; pass < 2; pass++)
+	{
+		mpu_cache_set_enabled(pass == 1);
+
+		uint32_t start = cycles_now();
+		errors[pass] = cache_workload(work_buff, sizeof(work_buff));
+		work_cycles[pass] = cycles_now() - start;
+
+		start = cycles_now();
+		uint32_t link_errors = speed_sweep_workload(cnt_dev, tgt_dev, packet_count);
+		link_cycles[pass] = cycles_now() - start;
+
+		if (link_errors == UINT32_MAX)
+		{
+			snprintf(line_buff, sizeof(line_buff), "Caches %s: a DMA round trip timed out.", pass_names[pass]);
+		}
+		else
+		{
+			errors[pass] += link_errors;
+			snprintf(line_buff, sizeof(line_buff),
+					"Caches %s: workload %lu cycles, %lu DMA round trips in %lu us, %lu mismatched.",
+					pass_names[pass], (unsigned long)work_cycles[pass], (unsigned long)packet_count,
+					(unsigned long)cycles_to_us(link_cycles[pass]), (unsigned long)link_errors);
+		}
+		serial_print_line(line_buff, 0);
+		serial_flush();
+	}
+
+	mpu_cache_set_enabled(true);
+	spi_io_set_mode(cnt_dev, cnt_mode);
+	spi_io_set_mode(tgt_dev, tgt_mode);
+
+	snprintf(line_buff, sizeof(line_buff), "Speedup: workload %lu.%02lux, DMA round trips %lu.%02lux, %s.",
+			(unsigned long)(work_cycles[1] == 0 ? 0 : work_cycles[0] / work_cycles[1]),
+			(unsigned long)(work_cycles[1] == 0 ? 0 : (uint64_t)work_cycles[0] * 100u / work_cycles[1] % 100u),
+			(unsigned long)(link_cycles[1] == 0 ? 0 : link_cycles[0] / link_cycles[1]),
+			(unsigned long)(link_cycles[1] == 0 ? 0 : (uint64_t)link_cycles[0] * 100u / link_cycles[1] % 100u),
+			errors[0] + errors[1] == 0 ? "all data verified" : "DATA MISMATCHED");
+	serial_print_line(line_buff, 0);
+	serial_print_line("Cache benchmark concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+inline static void print_placement(const char *name, uintptr_t addr)
+{
+	char line_buff[96] = {0};
+
+	if (addr == 0)
+	{
+		snprintf(line_buff, sizeof(line_buff), "%-34s not in the vector table", name);
+	}
+	else
+	{
+		snprintf(line_buff, sizeof(line_buff), "%-34s 0x%08lX %s", name,
+				(unsigned long)addr, tcm_region_name(addr));
+	}
+	serial_print_line(line_buff, 0);
+}
+
+/**
+ * Shows where the linker placed the interrupt paths of the SPI transactions
+ * and the device state, then measures the delay from the Controller
+ * selecting the Target until the Target has its reception armed, with the
+ * caches off and on. Whatever of that path still runs from flash or SRAM
+ * makes the two differ, the TCMs are not cached.
+ */
+inline static void tcm_report_routine(SPI_HandleTypeDef *hspi_cnt)
+{
+	static const struct
+	{
+		const char *name;
+		IRQn_Type irqn;
+	} vectors[5] = {
+		{ "EXTI2_IRQHandler (SPI3 CS)", EXTI2_IRQn },
+		{ "EXTI3_IRQHandler (SPI5 CS)", EXTI3_IRQn },
+		{ "SPI1_IRQHandler", SPI1_IRQn },
+		{ "SPI3_IRQHandler", SPI3_IRQn },
+		{ "SPI5_IRQHandler", SPI5_IRQn },
+	};
+	static const char *pass_names[2] = { "off", "on" };
+
+	char line_buff[112] = {0};
+	SPIDevice_t *cnt_dev = hspi_to_struct(hspi_cnt);
+	SPIDevice_t *tgt_dev = select_target_device();
+
+	if (tgt_dev == NULL) return;
+
+	uint32_t packet_count = scan_number("Packet count: ", 5);
+
+	if (packet_count < 1)
+	{
+		serial_print_line("Value out of range.", 0);
+		return;
+	}
+
+	const struct
+	{
+		const char *name;
+		uintptr_t addr;
+	} symbols[7] = {
+		{ "HAL_GPIO_EXTI_Callback", (uintptr_t)HAL_GPIO_EXTI_Callback },
+		{ "HAL_SPI_TxCpltCallback", (uintptr_t)HAL_SPI_TxCpltCallback },
+		{ "HAL_SPI_RxCpltCallback", (uintptr_t)HAL_SPI_RxCpltCallback },
+		{ "spi_io_receive", (uintptr_t)spi_io_receive },
+		{ "us_timer_isr", (uintptr_t)us_timer_isr },
+		{ "SPI devices", (uintptr_t)spi_io_get_device(0) },
+		{ "SPI DMA buffers", (uintptr_t)spi_io_get_device(0)->tx_buff },
+	};
+
+	snprintf(line_buff, sizeof(line_buff), "ITCM: %lu of %lu bytes of interrupt code.",
+			(unsigned long)tcm_itcm_used(), (unsigned long)ITCM_SIZE);
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff), "DTCM: %lu of %lu bytes of device state.",
+			(unsigned long)tcm_dtcm_used(), (unsigned long)DTCM_SIZE);
+	serial_print_line(line_buff, 0);
+
+	// the Thumb bit of the vectors is not part of the address
+	for (uint8_t idx = 0; idx < 5; idx++)
+	{
+		print_placement(vectors[idx].name, NVIC_GetVector(vectors[idx].irqn) & ~1u);
+	}
+
+	for (uint8_t idx = 0; idx < 7; idx++)
+	{
+		print_placement(symbols[idx].name, symbols[idx].addr & ~(uintptr_t)1u);
+	}
+
+	// with hardware NSS the reception is armed ahead of the selection
+	if (tgt_dev->nss != SPINSS_SOFT)
+	{
+		serial_print_line("The CS-to-receive latency is only measured with software CS.", 0);
+		serial_print_line("---", 3);
+		return;
+	}
+
+	serial_flush();
+
+	for (uint8_t pass = 0; pass < 2; pass++)
+	{
+		mpu_cache_set_enabled(pass == 1);
+
+		tgt_dev->arm_latency_max_cycles = 0;
+		tgt_dev->arm_latency_total_cycles = 0;
+		tgt_dev->arm_latency_count = 0;
+
+		uint32_t error_count = speed_sweep_workload(cnt_dev, tgt_dev, packet_count);
+		uint32_t selections = tgt_dev->arm_latency_count;
+
+		if (error_count == UINT32_MAX || selections == 0)
+		{
+			snprintf(line_buff, sizeof(line_buff), "Caches %s: the workload stalled, no latency measured.",
+					pass_names[pass]);
+		}
+		else
+		{
+			snprintf(line_buff, sizeof(line_buff),
+					"Caches %s: CS-to-receive mean %lu ns, worst %lu ns over %lu selections, %lu failed packets.",
+					pass_names[pass],
+					(unsigned long)((uint64_t)tgt_dev->arm_latency_total_cycles * 1000u / selections
+							/ (SystemCoreClock / 1000000u)),
+					(unsigned long)((uint64_t)tgt_dev->arm_latency_max_cycles * 1000u / (SystemCoreClock / 1000000u)),
+					(unsigned long)selections, (unsigned long)error_count);
+		}
+		serial_print_line(line_buff, 0);
+		serial_flush();
+	}
+
+	mpu_cache_set_enabled(true);
+
+	serial_print_line("TCM report concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+/**
+ * Switches the clock profile, then shows the bus clocks it set up and what
+ * follows from them: the flash wait states, the console's baud rate, and
+ * the range of SPI bit rates each device's prescaler can reach.
+ */
+inline static void clock_profile_routine(void)
+{
+	char line_buff[112] = {0};
+
+	for (uint8_t idx = 0; idx < CLOCKPROFILE_COUNT; idx++)
+	{
+		const ClockProfileConfig_t *config = clock_profile_get_config(idx);
+
+		snprintf(line_buff, sizeof(line_buff), "%u: %s, %lu MHz%s", idx, config->name,
+				(unsigned long)(config->sysclk_hz / 1000000u), idx == clock_profile_get() ? " (current)" : "");
+		serial_print_line(line_buff, 0);
+	}
+
+	uint32_t profile = scan_number("Profile: ", 1);
+
+	switch (clock_profile_set(profile))
+	{
+	case CLOCKPROFILESTATUS_OK:
+		break;
+	case CLOCKPROFILESTATUS_INVALID:
+		serial_print_line("Invalid profile.", 0);
+		serial_print_line("---", 3);
+		return;
+	case CLOCKPROFILESTATUS_USB_ATTACHED:
+		serial_print_line("Switch refused, USB is attached.", 0);
+		serial_print_line("---", 3);
+		return;
+	case CLOCKPROFILESTATUS_SPI_BUSY:
+		serial_print_line("Switch refused, an SPI device is busy.", 0);
+		serial_print_line("---", 3);
+		return;
+	default:
+		// the clocks were changed back, what follows reports the previous profile
+		serial_print_line("The profile could not be set up, switched back.", 0);
+		break;
+	}
+
+	const ClockProfileConfig_t *config = clock_profile_get_config(clock_profile_get());
+	uint8_t scale = config->voltage_scale == PWR_REGULATOR_VOLTAGE_SCALE1 ? 1
+			: config->voltage_scale == PWR_REGULATOR_VOLTAGE_SCALE2 ? 2 : 3;
+
+	snprintf(line_buff, sizeof(line_buff), "Profile %s: SYSCLK %lu Hz, PCLK1 %lu Hz, PCLK2 %lu Hz.", config->name,
+			(unsigned long)HAL_RCC_GetSysClockFreq(), (unsigned long)HAL_RCC_GetPCLK1Freq(),
+			(unsigned long)HAL_RCC_GetPCLK2Freq());
+	serial_print_line(line_buff, 0);
+	snprintf(line_buff, sizeof(line_buff), "Regulator scale %u%s, %lu flash wait states, console at %lu baud.",
+			scale, config->over_drive ? " with over-drive" : "", (unsigned long)__HAL_FLASH_GET_LATENCY(),
+			(unsigned long)serial_get_baud());
+	serial_print_line(line_buff, 0);
+
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		SPIDevice_t *spid = spi_io_get_device(idx);
+		uint32_t kernel_hz = spi_io_get_kernel_clock(spid);
+
+		snprintf(line_buff, sizeof(line_buff), "%s: %lu to %lu bit/s, prescaler %u (%lu bit/s).", spid->name,
+				(unsigned long)(kernel_hz / 256u), (unsigned long)(kernel_hz / 2u),
+				spi_io_get_prescaler(spid), (unsigned long)spi_io_get_bitrate(spid));
+		serial_print_line(line_buff, 0);
+	}
+
+	serial_print_line("Clock profile switch concluded.", 0);
+	serial_print_line("---", 3);
+}
+
+void interface_loop(void)
+{
+	char buff[8] = {0};
+	uint32_t selection = 0;
+
+	HAL_Delay(1);
+
+	if (!spi_io_is_initialized())
+	{
+		serial_print_line("Fresh boot! Welcome.", 0);
+		serial_print_line("Initializing SPI I/O utils.", 0);
+		spi_io_initialize();
+		usb_cdc_initialize();
+
+		if (spi_io_is_initialized())
+		{
+			serial_print_line("SPI I/O utils initialized.", 0);
+			serial_set_frame_handler(command_handle_frame);
+		}
+
+		return;
+	}
+
+	serial_print_line("-\r\nPlease select a test routine from the list:", 0);
+	serial_print_line("1: SPI Half-Duplex Loopback Test (SPI1->SPI3)", 0);
+	serial_print_line("2: SPI Half-Duplex Loopback Test (SPI1->SPI5)", 0);
+	serial_print_line("3: SPI Transfer Comparison, IT/DMA x split/single framing (SPI1->SPI3)", 0);
+	serial_print_line("4: Set Target CS Setup/Hold/Turnaround Time", 0);
+	serial_print_line("5: SPI Transmit Queue Statistics", 0);
+	serial_print_line("6: SPI Stream Transfer Test (SPI1->Target)", 0);
+	serial_print_line("7: Toggle SPI CRC Mode and Print CRC Statistics", 0);
+	serial_print_line("8: Set Controller SPI Clock Prescaler (SPI1)", 0);
+	serial_print_line("9: SPI Speed Sweep, fastest error-free prescaler (SPI1->SPI3/SPI5)", 0);
+	serial_print_line("10: Set SPI Chip Select Mode, software CS or hardware NSS", 0);
+	serial_print_line("11: CS Setup Margin per Chip Select Mode (SPI1->Target)", 0);
+	serial_print_line("12: SPI Timeout and Recovery Statistics", 0);
+	serial_print_line("13: SPI Soak Test with Fault Injection (SPI1->Target)", 0);
+	serial_print_line("14: SPI Per-Phase Timing Trace (SPI1->Target)", 0);
+	serial_print_line("15: SPI Throughput Benchmark (SPI1->Target)", 0);
+	serial_print_line("16: SPI PRBS Bit Error Rate Test (SPI1->Target)", 0);
+	serial_print_line("17: SPI Header Stress Test, randomized packets (SPI1->Target)", 0);
+	serial_print_line("18: UART TX/RX Ring Statistics and TX Policy", 0);
+	serial_print_line("19: Switch Console Baud Rate and Measure Throughput", 0);
+	serial_print_line("20: Toggle Deferred Binary Logging of SPI Events", 0);
+	serial_print_line("21: USB CDC Console Status and Transport Selection", 0);
+	serial_print_line("22: Cache Benchmark and DMA Coherency Check (SPI1->Target)", 0);
+	serial_print_line("23: TCM Placement Report and CS-to-Receive Latency (SPI1->Target)", 0);
+	serial_print_line("24: Clock Profile, performance/balanced/low-power", 0);
+
+	bzero(buff, sizeof(buff));
+	serial_print("Your selection: [  ]\b\b\b", 0);
+	serial_scan(buff, 2, ASCII_NUMERIC);
+	selection = strtoul(buff, NULL, 10);
+
+	serial_print_line("-\r\n--", 5);
+
+	switch(selection)
+	{
+	case 1:
+		loopback_test_routine(&hspi1, &hspi3);
+		break;
+	case 2:
+		loopback_test_routine(&hspi1, &hspi5);
+		break;
+	case 3:
+		transfer_comparison_routine(&hspi1, &hspi3);
+		break;
+	case 4:
+		cs_timing_routine();
+		break;
+	case 5:
+		queue_stats_routine();
+		break;
+	case 6:
+		stream_test_routine(&hspi1);
+		break;
+	case 7:
+		crc_mode_routine();
+		break;
+	case 8:
+		prescaler_routine(&hspi1);
+		break;
+	case 9:
+		speed_sweep_routine(&hspi1);
+		break;
+	case 10:
+		nss_mode_routine(&hspi1);
+		break;
+	case 11:
+		cs_margin_routine(&hspi1);
+		break;
+	case 12:
+		recovery_stats_routine();
+		break;
+	case 13:
+		soak_test_routine(&hspi1);
+		break;
+	case 14:
+		phase_trace_routine(&hspi1);
+		break;
+	case 15:
+		benchmark_routine(&hspi1);
+		break;
+	case 16:
+		ber_test_routine(&hspi1);
+		break;
+	case 17:
+		stress_test_routine(&hspi1);
+		break;
+	case 18:
+		uart_tx_routine();
+		break;
+	case 19:
+		console_baud_routine();
+		break;
+	case 20:
+		deferred_log_routine();
+		break;
+	case 21:
+		console_transport_routine();
+		break;
+	case 22:
+		cache_benchmark_routine(&hspi1);
+		break;
+	case 23:
+		tcm_report_routine(&hspi1);
+		break;
+	case 24:
+		clock_profile_routine();
 		break;
 	default:
 	serial_print_line("Invalid selection.", 0);
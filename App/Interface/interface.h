@@ -9,13 +9,20 @@
 #define INTERFACE_H_
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
 #include "main.h"
 
 #include "uart_io.h"
+#include "usb_cdc.h"
 #include "spi_io.h"
+#include "command.h"
+#include "dlog.h"
+#include "mpu_cache.h"
+#include "tcm.h"
+#include "clock_profile.h"
 
 extern SPI_HandleTypeDef hspi1;
 extern SPI_HandleTypeDef hspi3;
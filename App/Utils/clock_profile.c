@@ -0,0 +1,180 @@
+/*
+ * clock_profile.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "clock_profile.h"
+#include "spi_io.h"
+#include "uart_io.h"
+#include "usb_cdc.h"
+#include "us_timer.h"
+
+// 2 MHz at the PLL input, where its jitter is lowest
+#define CLOCK_PROFILE_PLL_M (4u)
+
+static const ClockProfileConfig_t profiles[CLOCKPROFILE_COUNT] = {
+	[CLOCKPROFILE_PERFORMANCE] = {
+		.name = "performance",
+		.sysclk_hz = 216000000u,
+		.voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE1,
+		.over_drive = true,
+		.pll_n = 216,
+		.pll_q = 9,
+		.apb1_divider = RCC_HCLK_DIV4,
+		.apb2_divider = RCC_HCLK_DIV2,
+		.flash_latency = FLASH_LATENCY_7,
+	},
+	[CLOCKPROFILE_BALANCED] = {
+		.name = "balanced",
+		.sysclk_hz = 168000000u,
+		.voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE2,
+		.over_drive = false,
+		.pll_n = 168,
+		.pll_q = 7,
+		.apb1_divider = RCC_HCLK_DIV4,
+		.apb2_divider = RCC_HCLK_DIV2,
+		.flash_latency = FLASH_LATENCY_5,
+	},
+	[CLOCKPROFILE_LOW_POWER] = {
+		.name = "low-power",
+		.sysclk_hz = 72000000u,
+		.voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE3,
+		.over_drive = false,
+		.pll_n = 72,
+		.pll_q = 3,
+		.apb1_divider = RCC_HCLK_DIV2,
+		.apb2_divider = RCC_HCLK_DIV1,
+		.flash_latency = FLASH_LATENCY_2,
+	},
+};
+
+// what SystemClock_Config() sets up
+static ClockProfile_t current = CLOCKPROFILE_LOW_POWER;
+static bool over_drive = false;
+// the Controllers' rates as last set outside of a switch, and by the last switch
+static uint32_t requested_bitrates[3] = {0};
+static uint32_t applied_bitrates[3] = {0};
+
+/**
+ * Follows the sequence of the reference manual: the PLL is reprogrammed,
+ * and the regulator scale changed, with the system on HSE, the over-drive
+ * is entered once the PLL runs again, and only then the system goes back
+ * to the PLL with the wait states of the new clock.
+ */
+static bool clock_profile_apply(const ClockProfileConfig_t *config)
+{
+	RCC_OscInitTypeDef osc = {0};
+	RCC_ClkInitTypeDef clk = {0};
+
+	// keeping the wait states of the old clock, which are enough for HSE
+	clk.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+	clk.SYSCLKSource = RCC_SYSCLKSOURCE_HSE;
+	clk.AHBCLKDivider = RCC_SYSCLK_DIV1;
+	clk.APB1CLKDivider = RCC_HCLK_DIV1;
+	clk.APB2CLKDivider = RCC_HCLK_DIV1;
+
+	if (HAL_RCC_ClockConfig(&clk, __HAL_FLASH_GET_LATENCY()) != HAL_OK) return false;
+
+	if (over_drive && !config->over_drive)
+	{
+		if (HAL_PWREx_DisableOverDrive() != HAL_OK) return false;
+		over_drive = false;
+	}
+
+	osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+	osc.PLL.PLLState = RCC_PLL_OFF;
+
+	if (HAL_RCC_OscConfig(&osc) != HAL_OK) return false;
+
+	// the scale only changes with the PLL off, and applies once it is back on
+	__HAL_RCC_PWR_CLK_ENABLE();
+	__HAL_PWR_VOLTAGESCALING_CONFIG(config->voltage_scale);
+
+	osc.PLL.PLLState = RCC_PLL_ON;
+	osc.PLL.PLLSource = RCC_PLLSOURCE_HSE;
+	osc.PLL.PLLM = CLOCK_PROFILE_PLL_M;
+	osc.PLL.PLLN = config->pll_n;
+	osc.PLL.PLLP = RCC_PLLP_DIV2;
+	osc.PLL.PLLQ = config->pll_q;
+
+	if (HAL_RCC_OscConfig(&osc) != HAL_OK) return false;
+
+	if (config->over_drive && !over_drive)
+	{
+		if (HAL_PWREx_EnableOverDrive() != HAL_OK) return false;
+		over_drive = true;
+	}
+
+	clk.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+	clk.APB1CLKDivider = config->apb1_divider;
+	clk.APB2CLKDivider = config->apb2_divider;
+
+	return HAL_RCC_ClockConfig(&clk, config->flash_latency) == HAL_OK;
+}
+
+const ClockProfileConfig_t *clock_profile_get_config(ClockProfile_t profile)
+{
+	if (profile >= CLOCKPROFILE_COUNT) return NULL;
+
+	return profiles + profile;
+}
+
+ClockProfile_t clock_profile_get(void)
+{
+	return current;
+}
+
+/**
+ * Only call it from thread context. Fails without touching the clocks if
+ * USB is attached or an SPI device is busy, and returns to the previous
+ * profile if the new one cannot be set up.
+ */
+ClockProfileStatus_t clock_profile_set(ClockProfile_t profile)
+{
+	ClockProfileStatus_t status = CLOCKPROFILESTATUS_OK;
+
+	if (profile >= CLOCKPROFILE_COUNT) return CLOCKPROFILESTATUS_INVALID;
+
+	if (usb_cdc_get_state() != USBCDC_DETACHED) return CLOCKPROFILESTATUS_USB_ATTACHED;
+
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		SPIDevice_t *spid = spi_io_get_device(idx);
+
+		if (!spi_io_is_idle(spid) || spi_io_queue_depth(spid) > 0) return CLOCKPROFILESTATUS_SPI_BUSY;
+
+		// a rate only rounded down by an earlier switch is not rounded down further
+		uint32_t bitrate = spi_io_get_bitrate(spid);
+		if (bitrate != applied_bitrates[idx]) requested_bitrates[idx] = bitrate;
+	}
+
+	// the console output still queued would go out at a wrong rate
+	serial_flush();
+
+	if (clock_profile_apply(profiles + profile))
+	{
+		current = profile;
+	}
+	else
+	{
+		// the system is left on HSE, there is no running on from there
+		if (!clock_profile_apply(profiles + current)) Error_Handler();
+		status = CLOCKPROFILESTATUS_REVERTED;
+	}
+
+	us_timer_update_clock();
+	serial_update_clock();
+
+	// Targets follow the Controller's clock
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		SPIDevice_t *spid = spi_io_get_device(idx);
+
+		if (spid->handle->Init.Mode == SPI_MODE_MASTER) spi_io_set_max_bitrate(spid, requested_bitrates[idx]);
+		applied_bitrates[idx] = spi_io_get_bitrate(spid);
+	}
+
+	return status;
+}
@@ -0,0 +1,72 @@
+/*
+ * clock_profile.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_CLOCK_PROFILE_H_
+#define UTILS_CLOCK_PROFILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+typedef enum ClockProfile
+{
+	CLOCKPROFILE_PERFORMANCE = 0x00,
+	CLOCKPROFILE_BALANCED = 0x01,
+	CLOCKPROFILE_LOW_POWER = 0x02,
+	CLOCKPROFILE_COUNT = 0x03,
+} ClockProfile_t;
+
+/**
+ * USB_ATTACHED and SPI_BUSY refuse a switch without touching the clocks,
+ * REVERTED reports a profile that could not be set up, the previous one
+ * running again.
+ */
+typedef enum ClockProfileStatus
+{
+	CLOCKPROFILESTATUS_OK = 0x00,
+	CLOCKPROFILESTATUS_INVALID = 0x01,
+	CLOCKPROFILESTATUS_USB_ATTACHED = 0x02,
+	CLOCKPROFILESTATUS_SPI_BUSY = 0x03,
+	CLOCKPROFILESTATUS_REVERTED = 0x04,
+} ClockProfileStatus_t;
+
+/**
+ * A clock tree from the 8 MHz HSE through the PLL, whose Q output stays at
+ * the 48 MHz of USB in all of them. The flash wait states are the minimum
+ * for 2.7 to 3.6 V, APB1 stays within 54 MHz and APB2 within 108 MHz.
+ */
+typedef struct ClockProfileConfig
+{
+	const char *name;
+	uint32_t sysclk_hz;
+	uint32_t voltage_scale;
+	bool over_drive;
+	uint32_t pll_n;
+	uint32_t pll_q;
+	uint32_t apb1_divider;
+	uint32_t apb2_divider;
+	uint32_t flash_latency;
+} ClockProfileConfig_t;
+
+/**
+ * Runtime switching between the clock profiles. SystemClock_Config() boots
+ * into the low-power one, the CubeMX configuration.
+ *
+ * A switch runs the system from HSE while the PLL is reprogrammed, which
+ * also stops the USB clock, so it is refused while USB is attached. It is
+ * refused as well while an SPI device has a transaction in progress.
+ * Afterwards the microsecond timer, the USART3 divider and the Controllers'
+ * SPI prescalers are derived again from the new bus clocks, a Controller
+ * keeping the fastest rate that does not exceed the one it was set to, so
+ * that switching back and forth does not slow it down step by step.
+ */
+const ClockProfileConfig_t *clock_profile_get_config(ClockProfile_t profile);
+ClockProfile_t clock_profile_get(void);
+ClockProfileStatus_t clock_profile_set(ClockProfile_t profile);
+
+#endif /* UTILS_CLOCK_PROFILE_H_ */
@@ -0,0 +1,40 @@
+/*
+ * cycles.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_CYCLES_H_
+#define UTILS_CYCLES_H_
+
+#include <stdint.h>
+
+#include "main.h"
+
+/**
+ * Thin wrappers over the DWT cycle counter.
+ * Differences between two readings are valid across a single wrap
+ * (about 59 seconds at 72 MHz) when computed in uint32_t.
+ */
+
+static inline void cycles_initialize(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	// the Cortex-M7 DWT is locked out of reset
+	DWT->LAR = 0xC5ACCE55u;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t cycles_now(void)
+{
+	return DWT->CYCCNT;
+}
+
+static inline uint32_t cycles_to_us(uint32_t cycles)
+{
+	return cycles / (SystemCoreClock / 1000000u);
+}
+
+#endif /* UTILS_CYCLES_H_ */
@@ -0,0 +1,142 @@
+/*
+ * dlog.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include <string.h>
+
+#include "dlog.h"
+#include "frame.h"
+#include "uart_io.h"
+
+// the ID and up to five bytes per varint
+#define DLOG_PACKED_MAX_LEN (2u + 5u * (1u + DLOG_MAX_ARGS))
+
+static uint32_t ring[DLOG_RING_LEN];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t dropped = 0;
+static volatile uint32_t records = 0;
+static volatile bool enabled = false;
+
+static uint8_t payload[DLOG_FRAME_MAX_LEN];
+static uint8_t frame[FRAME_ENCODED_MAX_LEN(DLOG_FRAME_MAX_LEN)];
+
+void dlog_write(uint32_t cycles, const char *fmt, uint8_t nargs, const uint32_t *args)
+{
+	if (!enabled) return;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (DLOG_RING_LEN - (head - tail) < 2u + nargs)
+	{
+		dropped++;
+		__set_PRIMASK(primask);
+		return;
+	}
+
+	uint32_t idx = head;
+	ring[idx++ & (DLOG_RING_LEN - 1)] = dlog_id(fmt) | (uint32_t)nargs << 16;
+	ring[idx++ & (DLOG_RING_LEN - 1)] = cycles;
+	for (uint8_t i = 0; i < nargs; i++) ring[idx++ & (DLOG_RING_LEN - 1)] = args[i];
+
+	// publish the record only once it is complete
+	__DMB();
+	head = idx;
+	records++;
+
+	__set_PRIMASK(primask);
+}
+
+inline static uint16_t dlog_put_varint(uint8_t *out, uint32_t value)
+{
+	uint16_t len = 0;
+
+	while (value >= 0x80u)
+	{
+		out[len++] = (uint8_t)(value | 0x80u);
+		value >>= 7;
+	}
+
+	out[len++] = (uint8_t)value;
+
+	return len;
+}
+
+/**
+ * Sends the pending records, as many per frame as fit. Each one is packed
+ * as its 16-bit ID, its timestamp as the cycles since the previous record
+ * and its arguments, all but the ID as LEB128 varints. The decoder counts
+ * the arguments from the format string.
+ * Only call it from the main loop, it blocks while the TX ring is full.
+ */
+void dlog_drain(void)
+{
+	while (tail != head)
+	{
+		uint32_t prev_cycles = ring[(tail + 1) & (DLOG_RING_LEN - 1)];
+		uint16_t len = 0;
+
+		// the code, the clock in MHz and the timestamp the first record counts from
+		payload[len++] = DLOG_FRAME_CODE;
+		payload[len++] = (uint8_t)(SystemCoreClock / 1000000u);
+		memcpy(payload + len, &prev_cycles, sizeof(prev_cycles));
+		len += sizeof(prev_cycles);
+
+		while (tail != head && len + DLOG_PACKED_MAX_LEN <= DLOG_FRAME_MAX_LEN)
+		{
+			uint32_t idx = tail;
+			uint32_t word = ring[idx++ & (DLOG_RING_LEN - 1)];
+			uint32_t cycles = ring[idx++ & (DLOG_RING_LEN - 1)];
+			uint8_t nargs = (uint8_t)(word >> 16);
+
+			payload[len++] = (uint8_t)word;
+			payload[len++] = (uint8_t)(word >> 8);
+			len += dlog_put_varint(payload + len, cycles - prev_cycles);
+			prev_cycles = cycles;
+
+			for (uint8_t i = 0; i < nargs; i++)
+			{
+				len += dlog_put_varint(payload + len, ring[idx++ & (DLOG_RING_LEN - 1)]);
+			}
+
+			// the slots are free for the producers from here on
+			__DMB();
+			tail = idx;
+		}
+
+		serial_send(frame, frame_encode(payload, len, frame, sizeof(frame)));
+	}
+}
+
+/**
+ * Records pending when logging is disabled are still sent by the next drain.
+ */
+void dlog_set_enabled(bool enable)
+{
+	enabled = enable;
+}
+
+// in ring words, two per record plus its arguments
+uint32_t dlog_pending(void)
+{
+	return head - tail;
+}
+
+bool dlog_is_enabled(void)
+{
+	return enabled;
+}
+
+uint32_t dlog_dropped(void)
+{
+	return dropped;
+}
+
+uint32_t dlog_records(void)
+{
+	return records;
+}
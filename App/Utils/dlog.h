@@ -0,0 +1,70 @@
+/*
+ * dlog.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_DLOG_H_
+#define UTILS_DLOG_H_
+
+// in 32-bit words, must be a power of two
+#define DLOG_RING_LEN (512u)
+#define DLOG_MAX_ARGS (4u)
+// leading code of the log frames, the command codes and responses never take it
+#define DLOG_FRAME_CODE (0x40u)
+#define DLOG_FRAME_MAX_LEN (128u)
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+#include "cycles.h"
+
+/**
+ * Deferred logging: a log call stores the ID of its format string, a cycle
+ * timestamp and its arguments as a record in a RAM ring, and formats nothing.
+ * The format strings live in the dlog_fmt section, which is kept in the ELF
+ * but never loaded, their ID is the offset into it. dlog_drain() sends the
+ * records as frames (see frame.h), Host/Tools/dlog_decode.py rebuilds the
+ * text from the ELF.
+ *
+ * Arguments are integers of up to 32 bits. A %s argument is the ID of
+ * a string from DLOG_STR(), which lives in the same section.
+ *
+ * Logging masks interrupts only to copy the record, it is safe from any
+ * interrupt, records are dropped while logging is disabled or the ring is full.
+ */
+#define DLOG_SECTION __attribute__((section("dlog_fmt"), used))
+
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+
+#define DLOG_AT(cycles, fmt, ...) do { \
+		static const char dlog_fmt[] DLOG_SECTION = fmt; \
+		_Static_assert(DLOG_NARGS(__VA_ARGS__) <= DLOG_MAX_ARGS, "too many log arguments"); \
+		const uint32_t dlog_args[] = { 0, ##__VA_ARGS__ }; \
+		dlog_write((cycles), dlog_fmt, DLOG_NARGS(__VA_ARGS__), dlog_args + 1); \
+	} while (0)
+
+#define DLOG(fmt, ...) DLOG_AT(cycles_now(), fmt, ##__VA_ARGS__)
+
+#define DLOG_STR(text) ({ static const char dlog_str[] DLOG_SECTION = text; dlog_id(dlog_str); })
+
+extern const char __start_dlog_fmt[];
+
+static inline uint16_t dlog_id(const char *str)
+{
+	return (uint16_t)(str - __start_dlog_fmt);
+}
+
+void dlog_write(uint32_t cycles, const char *fmt, uint8_t nargs, const uint32_t *args);
+void dlog_drain(void);
+uint32_t dlog_pending(void);
+void dlog_set_enabled(bool enabled);
+bool dlog_is_enabled(void);
+uint32_t dlog_dropped(void);
+uint32_t dlog_records(void);
+
+#endif /* UTILS_DLOG_H_ */
@@ -0,0 +1,106 @@
+/*
+ * frame.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "frame.h"
+
+uint16_t frame_crc16(const uint8_t *data, uint16_t len)
+{
+	uint16_t crc = 0xFFFFu;
+
+	for (uint16_t idx = 0; idx < len; idx++)
+	{
+		crc ^= (uint16_t)data[idx] << 8;
+
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = crc & 0x8000u ? (uint16_t)((crc << 1) ^ 0x1021u) : (uint16_t)(crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+/**
+ * Appends the CRC to the payload, COBS encodes both and delimits the result.
+ * Returns the number of bytes written to out, 0 if it is too small.
+ */
+uint16_t frame_encode(const uint8_t *payload, uint16_t len, uint8_t *out, uint16_t out_size)
+{
+	if (out_size < FRAME_ENCODED_MAX_LEN((uint32_t)len)) return 0;
+
+	uint16_t crc = frame_crc16(payload, len);
+	uint8_t crc_bytes[FRAME_CRC_LEN] = { (uint8_t)crc, (uint8_t)(crc >> 8) };
+	uint16_t code_idx = 1;
+	uint16_t out_idx = 2;
+	uint8_t code = 1;
+
+	out[0] = FRAME_DELIMITER;
+
+	// each code byte tells how far the next zero is, the zeros are left out
+	for (uint16_t idx = 0; idx < len + FRAME_CRC_LEN; idx++)
+	{
+		uint8_t byte = idx < len ? payload[idx] : crc_bytes[idx - len];
+
+		if (byte != 0)
+		{
+			out[out_idx++] = byte;
+			code++;
+		}
+
+		if (byte == 0 || code == 0xFFu)
+		{
+			out[code_idx] = code;
+			code_idx = out_idx++;
+			code = 1;
+		}
+	}
+
+	out[code_idx] = code;
+	out[out_idx++] = FRAME_DELIMITER;
+
+	return out_idx;
+}
+
+/**
+ * Decodes a frame received between delimiters and checks its CRC.
+ * Returns the payload length, without the CRC, or 0 if the frame is malformed,
+ * fails the check or does not fit out.
+ */
+uint16_t frame_decode(const uint8_t *in, uint16_t len, uint8_t *out, uint16_t out_size)
+{
+	uint16_t in_idx = 0;
+	uint16_t out_idx = 0;
+
+	while (in_idx < len)
+	{
+		uint8_t code = in[in_idx++];
+
+		if (code == 0) return 0;
+
+		for (uint8_t run = 1; run < code; run++)
+		{
+			if (in_idx >= len || in[in_idx] == 0 || out_idx >= out_size) return 0;
+
+			out[out_idx++] = in[in_idx++];
+		}
+
+		// a full run is not followed by a zero, nor is the last one
+		if (code < 0xFFu && in_idx < len)
+		{
+			if (out_idx >= out_size) return 0;
+
+			out[out_idx++] = 0;
+		}
+	}
+
+	if (out_idx <= FRAME_CRC_LEN) return 0;
+
+	uint16_t payload_len = out_idx - FRAME_CRC_LEN;
+	uint16_t crc = (uint16_t)(out[payload_len] | (out[payload_len + 1] << 8));
+
+	return frame_crc16(out, payload_len) == crc ? payload_len : 0;
+}
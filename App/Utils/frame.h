@@ -0,0 +1,29 @@
+/*
+ * frame.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_FRAME_H_
+#define UTILS_FRAME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Binary frames on the serial link: the payload is trailed by its CRC-16
+ * (CCITT, polynomial 0x1021, initial value 0xFFFF, little-endian), COBS
+ * encoded so that it holds no zero byte, and enclosed in zero delimiters.
+ * Text never contains a zero byte, so frames can share a link with it.
+ */
+#define FRAME_DELIMITER (0x00u)
+#define FRAME_CRC_LEN (2u)
+// COBS adds a code byte per 254 data bytes, plus the delimiters
+#define FRAME_ENCODED_MAX_LEN(len) ((len) + FRAME_CRC_LEN + ((len) + FRAME_CRC_LEN) / 254u + 1u + 2u)
+
+uint16_t frame_crc16(const uint8_t *data, uint16_t len);
+uint16_t frame_encode(const uint8_t *payload, uint16_t len, uint8_t *out, uint16_t out_size);
+uint16_t frame_decode(const uint8_t *in, uint16_t len, uint8_t *out, uint16_t out_size);
+
+#endif /* UTILS_FRAME_H_ */
@@ -0,0 +1,72 @@
+/*
+ * mpu_cache.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "mpu_cache.h"
+
+/**
+ * Maps DMA_RAM as normal memory that is neither cached nor buffered
+ * (TEX 1, C 0, B 0), then turns on the I- and D-cache. Everything else
+ * keeps the default memory map, where SRAM is write-back cached.
+ * The ART accelerator and the flash prefetch are left to HAL_Init(),
+ * from ART_ACCELERATOR_ENABLE and PREFETCH_ENABLE in stm32f7xx_hal_conf.h.
+ */
+void mpu_cache_initialize(void)
+{
+	MPU_Region_InitTypeDef region = {0};
+
+	HAL_MPU_Disable();
+
+	region.Enable = MPU_REGION_ENABLE;
+	region.Number = MPU_REGION_NUMBER0;
+	region.BaseAddress = DMA_RAM_BASE;
+	region.Size = DMA_RAM_MPU_SIZE;
+	region.SubRegionDisable = 0x00;
+	region.TypeExtField = MPU_TEX_LEVEL1;
+	region.AccessPermission = MPU_REGION_FULL_ACCESS;
+	region.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+	region.IsShareable = MPU_ACCESS_SHAREABLE;
+	region.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+	region.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+	HAL_MPU_ConfigRegion(&region);
+
+	HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+
+	mpu_cache_set_enabled(true);
+}
+
+/**
+ * For measurements, the firmware itself runs with the caches on.
+ * Enabling a cache invalidates it, which would drop the dirty lines of
+ * a D-cache already on, so each one is only switched if it has to be.
+ * Disabling the D-cache cleans it first.
+ */
+void mpu_cache_set_enabled(bool enable)
+{
+	bool icache = (SCB->CCR & SCB_CCR_IC_Msk) != 0;
+	bool dcache = (SCB->CCR & SCB_CCR_DC_Msk) != 0;
+
+	if (enable)
+	{
+		if (!icache) SCB_EnableICache();
+		if (!dcache) SCB_EnableDCache();
+	}
+	else
+	{
+		if (dcache) SCB_DisableDCache();
+		if (icache) SCB_DisableICache();
+	}
+}
+
+bool mpu_cache_is_enabled(void)
+{
+	return (SCB->CCR & (SCB_CCR_IC_Msk | SCB_CCR_DC_Msk)) == (SCB_CCR_IC_Msk | SCB_CCR_DC_Msk);
+}
+
+bool mpu_cache_art_is_enabled(void)
+{
+	return (FLASH->ACR & FLASH_ACR_ARTEN) != 0;
+}
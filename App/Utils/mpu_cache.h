@@ -0,0 +1,41 @@
+/*
+ * mpu_cache.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_MPU_CACHE_H_
+#define UTILS_MPU_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+// SRAM2, the DMA_RAM region of the linker scripts
+#define DMA_RAM_BASE (0x2004C000u)
+#define DMA_RAM_SIZE (16u * 1024u)
+#define DMA_RAM_MPU_SIZE MPU_REGION_SIZE_16KB
+
+/**
+ * Places a variable in DMA_RAM, which the MPU maps as normal uncached
+ * memory, so that buffers the DMA streams read or write need no cache
+ * maintenance. The section is not loaded, and the startup code does not
+ * clear it either: its owner initializes it.
+ */
+#define DMA_BUFFER __attribute__((section(".dma_buffer")))
+
+/**
+ * The Cortex-M7 L1 caches, with the MPU region that keeps DMA_BUFFER
+ * memory out of the data cache, and the state of the flash ART accelerator
+ * HAL_Init() turns on.
+ * mpu_cache_initialize() runs first thing in main(), before any DMA
+ * transfer and with the caches still off.
+ */
+void mpu_cache_initialize(void);
+void mpu_cache_set_enabled(bool enable);
+bool mpu_cache_is_enabled(void);
+bool mpu_cache_art_is_enabled(void);
+
+#endif /* UTILS_MPU_CACHE_H_ */
@@ -0,0 +1,274 @@
+/*
+ * prbs.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "prbs.h"
+
+#define PRBS7_PERIOD (127u)
+// words generated per pass, as many as a whole SPI payload has
+#define PRBS_CHUNK_WORDS (16u)
+
+// the first bytes repeat after the period, so that a word can be read at any position
+static uint8_t prbs7_table[PRBS7_PERIOD + 3u] DTCM_BSS;
+static bool prbs7_ready = false;
+
+/**
+ * The history holds the latest bits with the newest one in bit 0, so the
+ * bits tap_a and tap_b steps back of the next count bits sit right above
+ * bits tap_a - count and tap_b - count. As many bits as the nearer tap is
+ * back come out of a single step, the first one in the highest bit.
+ */
+ITCM_FUNC static inline uint32_t prbs_advance(uint32_t *history, uint8_t tap_a, uint8_t tap_b, uint8_t count)
+{
+	uint32_t next = ((*history >> (tap_a - count)) ^ (*history >> (tap_b - count))) & ((1u << count) - 1u);
+
+	*history = (*history << count) | next;
+
+	return next;
+}
+
+/**
+ * The next four bytes as a word in memory order, the first in the low bits.
+ */
+ITCM_FUNC static inline uint32_t prbs15_next_word(uint32_t *history)
+{
+	uint32_t bits = prbs_advance(history, 15, 14, 14) << 18;
+	bits |= prbs_advance(history, 15, 14, 14) << 4;
+	bits |= prbs_advance(history, 15, 14, 4);
+
+	return __REV(bits);
+}
+
+ITCM_FUNC static inline uint32_t prbs31_next_word(uint32_t *history)
+{
+	uint32_t bits = prbs_advance(history, 31, 28, 28) << 4;
+	bits |= prbs_advance(history, 31, 28, 4);
+
+	return __REV(bits);
+}
+
+ITCM_FUNC static inline uint32_t prbs7_next_word(uint8_t *table_pos)
+{
+	uint32_t word;
+
+	memcpy(&word, prbs7_table + *table_pos, sizeof(word));
+	*table_pos = (*table_pos + 4u) % PRBS7_PERIOD;
+
+	return word;
+}
+
+ITCM_FUNC static inline uint8_t prbs_next_byte(PRBSGenerator_t *prbs)
+{
+	uint8_t next;
+
+	switch (prbs->type)
+	{
+	case PRBS15:
+		return (uint8_t)prbs_advance(&prbs->history, 15, 14, 8);
+	case PRBS31:
+		return (uint8_t)prbs_advance(&prbs->history, 31, 28, 8);
+	default:
+		next = prbs7_table[prbs->table_pos];
+		prbs->table_pos = prbs->table_pos + 1 == PRBS7_PERIOD ? 0 : prbs->table_pos + 1;
+		return next;
+	}
+}
+
+/**
+ * The next words of the sequence, with the type dispatched once for all of them.
+ */
+ITCM_FUNC static void prbs_next_words(PRBSGenerator_t *prbs, uint32_t *words, uint32_t count)
+{
+	uint32_t history = prbs->history;
+	uint8_t table_pos = prbs->table_pos;
+
+	switch (prbs->type)
+	{
+	case PRBS15:
+		for (uint32_t idx = 0; idx < count; idx++)
+		{
+			words[idx] = prbs15_next_word(&history);
+		}
+		break;
+	case PRBS31:
+		for (uint32_t idx = 0; idx < count; idx++)
+		{
+			words[idx] = prbs31_next_word(&history);
+		}
+		break;
+	default:
+		for (uint32_t idx = 0; idx < count; idx++)
+		{
+			words[idx] = prbs7_next_word(&table_pos);
+		}
+		break;
+	}
+
+	prbs->history = history;
+	prbs->table_pos = table_pos;
+}
+
+static void prbs7_build_table(void)
+{
+	uint32_t history = 0x7Fu;
+
+	for (uint32_t idx = 0; idx < PRBS7_PERIOD; idx++)
+	{
+		uint8_t next = 0;
+
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			uint32_t value = ((history >> 6) ^ (history >> 5)) & 1u;
+			history = (history << 1) | value;
+			next = (next << 1) | value;
+		}
+
+		prbs7_table[idx] = next;
+	}
+
+	memcpy(prbs7_table + PRBS7_PERIOD, prbs7_table, 3u);
+	prbs7_ready = true;
+}
+
+/**
+ * Both ends of a link start from the same all-ones seed.
+ */
+void prbs_initialize(PRBSGenerator_t *prbs, PRBSType_t type)
+{
+	if (!prbs7_ready) prbs7_build_table();
+
+	prbs->type = type;
+	prbs->history = UINT32_MAX;
+	prbs->table_pos = 0;
+}
+
+void prbs_fill(PRBSGenerator_t *prbs, uint8_t *buffer, uint32_t len)
+{
+	uint32_t words[PRBS_CHUNK_WORDS];
+	uint32_t idx = 0;
+
+	while (len - idx >= 4)
+	{
+		uint32_t count = (len - idx) / 4;
+		if (count > PRBS_CHUNK_WORDS) count = PRBS_CHUNK_WORDS;
+
+		prbs_next_words(prbs, words, count);
+		memcpy(buffer + idx, words, count * 4);
+		idx += count * 4;
+	}
+
+	for (; idx < len; idx++)
+	{
+		buffer[idx] = prbs_next_byte(prbs);
+	}
+}
+
+/**
+ * Advances the sequence past data that never arrived, a whole step at a time.
+ */
+ITCM_FUNC void prbs_skip(PRBSGenerator_t *prbs, uint32_t len)
+{
+	uint32_t bits = len * 8u;
+
+	switch (prbs->type)
+	{
+	case PRBS15:
+		for (; bits >= 14; bits -= 14)
+		{
+			prbs_advance(&prbs->history, 15, 14, 14);
+		}
+		if (bits > 0) prbs_advance(&prbs->history, 15, 14, (uint8_t)bits);
+		break;
+	case PRBS31:
+		for (; bits >= 28; bits -= 28)
+		{
+			prbs_advance(&prbs->history, 31, 28, 28);
+		}
+		if (bits > 0) prbs_advance(&prbs->history, 31, 28, (uint8_t)bits);
+		break;
+	default:
+		prbs->table_pos = (prbs->table_pos + len) % PRBS7_PERIOD;
+		break;
+	}
+}
+
+/**
+ * Takes the generator state from received data, for starting over once the
+ * receiver has lost its place in the sequence: the next byte expected is the
+ * one following the data. Needs four bytes, which must be free of errors.
+ */
+ITCM_FUNC bool prbs_resync(PRBSGenerator_t *prbs, const volatile uint8_t *data, uint32_t len)
+{
+	if (len < 4) return false;
+
+	if (prbs->type == PRBS7)
+	{
+		// any 7 bits in a row occur once per period, so the first byte places the data
+		for (uint8_t pos = 0; pos < PRBS7_PERIOD; pos++)
+		{
+			if (prbs7_table[pos] == data[0])
+			{
+				prbs->table_pos = (pos + len) % PRBS7_PERIOD;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	prbs->history = ((uint32_t)data[len - 4] << 24) | ((uint32_t)data[len - 3] << 16)
+			| ((uint32_t)data[len - 2] << 8) | data[len - 1];
+
+	return true;
+}
+
+/**
+ * Bit count of each byte in a word, SWAR style,
+ * the four counts are then summed by a single USAD8.
+ */
+ITCM_FUNC static inline uint32_t prbs_popcount(uint32_t word)
+{
+	word = word - ((word >> 1) & 0x55555555u);
+	word = (word & 0x33333333u) + ((word >> 2) & 0x33333333u);
+	word = (word + (word >> 4)) & 0x0F0F0F0Fu;
+
+	return __USAD8(word, 0);
+}
+
+/**
+ * Compares received data against the locally regenerated sequence a word
+ * at a time, returning the number of mismatched bits.
+ */
+ITCM_FUNC uint32_t prbs_check(PRBSGenerator_t *prbs, const volatile uint8_t *data, uint32_t len)
+{
+	uint32_t expected[PRBS_CHUNK_WORDS];
+	uint32_t errors = 0;
+	uint32_t idx = 0;
+
+	while (len - idx >= 4)
+	{
+		uint32_t count = (len - idx) / 4;
+		if (count > PRBS_CHUNK_WORDS) count = PRBS_CHUNK_WORDS;
+
+		prbs_next_words(prbs, expected, count);
+
+		for (uint32_t word = 0; word < count; word++, idx += 4)
+		{
+			uint32_t received;
+			// the payload is not word aligned, the M7 handles the unaligned load
+			memcpy(&received, (const uint8_t *)data + idx, sizeof(received));
+
+			errors += prbs_popcount(received ^ expected[word]);
+		}
+	}
+
+	for (; idx < len; idx++)
+	{
+		errors += prbs_popcount((uint32_t)(data[idx] ^ prbs_next_byte(prbs)));
+	}
+
+	return errors;
+}
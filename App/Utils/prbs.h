@@ -0,0 +1,45 @@
+/*
+ * prbs.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_PRBS_H_
+#define UTILS_PRBS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "main.h"
+#include "tcm.h"
+
+/**
+ * ITU-T O.150 style pseudo-random bit sequences, sent MSB first.
+ * PRBS15 (x^15 + x^14 + 1) and PRBS31 (x^31 + x^28 + 1) have both taps
+ * at least 14 and 28 bits back, so that many bits are generated per step
+ * from the bit history. PRBS7 (x^7 + x^6 + 1) does not, but its byte
+ * sequence repeats every 127 bytes and is served from a table instead.
+ */
+typedef enum PRBSType
+{
+	PRBS7 = 0x00,
+	PRBS15 = 0x01,
+	PRBS31 = 0x02,
+} PRBSType_t;
+
+typedef struct PRBSGenerator
+{
+	PRBSType_t type;
+	uint32_t history;
+	uint8_t table_pos;
+} PRBSGenerator_t;
+
+void prbs_initialize(PRBSGenerator_t *prbs, PRBSType_t type);
+void prbs_fill(PRBSGenerator_t *prbs, uint8_t *buffer, uint32_t len);
+void prbs_skip(PRBSGenerator_t *prbs, uint32_t len);
+bool prbs_resync(PRBSGenerator_t *prbs, const volatile uint8_t *data, uint32_t len);
+uint32_t prbs_check(PRBSGenerator_t *prbs, const volatile uint8_t *data, uint32_t len);
+
+#endif /* UTILS_PRBS_H_ */
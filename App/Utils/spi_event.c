@@ -0,0 +1,72 @@
+/*
+ * spi_event.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "spi_event.h"
+
+static SPIEvent_t ring[SPI_EVENT_RING_LEN];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t overflows = 0;
+
+ITCM_FUNC void spi_event_push(uint8_t device, SPIEventType_t type, uint16_t detail)
+{
+	uint32_t cycles = cycles_now();
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (head - tail >= SPI_EVENT_RING_LEN)
+	{
+		overflows++;
+		__set_PRIMASK(primask);
+		return;
+	}
+
+	SPIEvent_t *event = ring + (head & (SPI_EVENT_RING_LEN - 1));
+	event->cycles = cycles;
+	event->type = type;
+	event->device = device;
+	event->detail = detail;
+
+	// publish the record only once it is complete
+	__DMB();
+	head++;
+
+	__set_PRIMASK(primask);
+}
+
+bool spi_event_pop(SPIEvent_t *event)
+{
+	if (tail == head) return false;
+
+	*event = ring[tail & (SPI_EVENT_RING_LEN - 1)];
+
+	// the slot is free for the producers from here on
+	__DMB();
+	tail++;
+
+	return true;
+}
+
+bool spi_event_is_empty(void)
+{
+	return tail == head;
+}
+
+/**
+ * Drops pending events and clears the overflow count,
+ * e.g. before monitoring a new operation.
+ */
+void spi_event_flush(void)
+{
+	tail = head;
+	overflows = 0;
+}
+
+uint32_t spi_event_overflows(void)
+{
+	return overflows;
+}
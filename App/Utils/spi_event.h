@@ -0,0 +1,63 @@
+/*
+ * spi_event.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_SPI_EVENT_H_
+#define UTILS_SPI_EVENT_H_
+
+// must be a power of two
+#define SPI_EVENT_RING_LEN (64u)
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+#include "cycles.h"
+#include "tcm.h"
+
+typedef enum SPIEventType
+{
+	SPIEVT_SELECTED = 0x00,
+	SPIEVT_DESELECTED = 0x01,
+	SPIEVT_TX_CPLT = 0x02,
+	SPIEVT_RX_CPLT = 0x03,
+	SPIEVT_ERROR = 0x04,
+	SPIEVT_ABORT = 0x05,
+	SPIEVT_TIMEOUT = 0x06,
+	SPIEVT_RECOVERED = 0x07,
+	SPIEVT_REJECTED = 0x08,
+} SPIEventType_t;
+
+/**
+ * A timestamped record of an SPI interrupt. The detail holds the transfer
+ * phase for completions (0: header, 1: payload or whole packet),
+ * the HAL error code for errors, the SPIPhase_t that expired for timeouts,
+ * the time spent in microseconds for recoveries and the opcode
+ * of a packet a Target rejected.
+ */
+typedef struct SPIEvent
+{
+	uint32_t cycles;
+	uint8_t type;
+	uint8_t device;
+	uint16_t detail;
+} SPIEvent_t;
+
+/**
+ * Events are pushed from the EXTI and SPI interrupts, and drained by the
+ * main loop. The ring has a single consumer, but its producers run at
+ * different interrupt priorities and may preempt each other, so claiming
+ * a slot masks interrupts for the few instructions it takes.
+ * A full ring drops the new event and counts it as an overflow.
+ */
+void spi_event_push(uint8_t device, SPIEventType_t type, uint16_t detail);
+bool spi_event_pop(SPIEvent_t *event);
+bool spi_event_is_empty(void);
+void spi_event_flush(void);
+uint32_t spi_event_overflows(void);
+
+#endif /* UTILS_SPI_EVENT_H_ */
@@ -8,150 +8,1399 @@
 #include "spi_io.h"
 
 static bool is_initialized = false;
-static SPIDevice_t devices[3] = {0};
+// in DTCM like the interrupt code in ITCM, for the CS-to-receive latency
+static SPIDevice_t devices[3] DTCM_BSS = {0};
+// the section is not loaded, spi_io_initialize() clears it
+static SPIDeviceBuffers_t device_buffers[3] DMA_BUFFER;
 
-static void spi_io_process_rx(SPIDevice_t *spid)
+/**
+ * The deadline of a transfer phase, from the time it takes to clock len bytes.
+ * A Target cannot know the Controller's clock, so the slowest one is assumed.
+ */
+ITCM_FUNC static uint32_t spi_io_transfer_timeout_us(uint16_t len)
+{
+	uint32_t min_bitrate = HAL_RCC_GetPCLK2Freq() / 256u;
+
+	return SPI_TIMEOUT_MARGIN_US + (uint32_t)len * 8u * 1000000u / min_bitrate;
+}
+
+/**
+ * Header lengths are only trusted up to the size of the packet buffers.
+ */
+ITCM_FUNC static uint8_t spi_io_clamp_len(uint8_t len)
+{
+	return len > SPI_DATA_MAX_LEN ? SPI_DATA_MAX_LEN : len;
+}
+
+ITCM_FUNC static void spi_io_enter_phase(SPIDevice_t *spid, SPIPhase_t phase, uint32_t timeout_us)
+{
+	spid->phase_start_cycles = cycles_now();
+	spid->phase_timeout_cycles = timeout_us * (SystemCoreClock / 1000000u);
+	spid->phase = phase;
+}
+
+/**
+ * The transfer functions used depend on the device's transfer mode.
+ * In DMA mode the CPU only takes an interrupt when the whole block is done,
+ * instead of one per FIFO access.
+ */
+ITCM_FUNC static HAL_StatusTypeDef spi_io_start_tx(SPIDevice_t *spid, SPIPhase_t phase, uint8_t *data, uint16_t len)
+{
+	spi_io_enter_phase(spid, phase, spi_io_transfer_timeout_us(len));
+
+	if (spid->mode == SPIMODE_DMA)
+	{
+		return HAL_SPI_Transmit_DMA(spid->handle, data, len);
+	}
+
+	return HAL_SPI_Transmit_IT(spid->handle, data, len);
+}
+
+ITCM_FUNC static HAL_StatusTypeDef spi_io_start_rx(SPIDevice_t *spid, SPIPhase_t phase, uint8_t *data, uint16_t len)
+{
+	spi_io_enter_phase(spid, phase, spi_io_transfer_timeout_us(len));
+
+	if (spid->mode == SPIMODE_DMA)
+	{
+		return HAL_SPI_Receive_DMA(spid->handle, data, len);
+	}
+
+	return HAL_SPI_Receive_IT(spid->handle, data, len);
+}
+
+/**
+ * Whether the reception armed has not taken a frame yet.
+ */
+ITCM_FUNC static bool spi_io_rx_untouched(SPIDevice_t *spid)
+{
+	SPI_HandleTypeDef *hspi = spid->handle;
+
+	if (spid->mode == SPIMODE_DMA)
+	{
+		return __HAL_DMA_GET_COUNTER(hspi->hdmarx) == hspi->RxXferSize;
+	}
+
+	return hspi->RxXferCount == hspi->RxXferSize;
+}
+
+ITCM_FUNC static void spi_io_start_packet(SPIDevice_t *spid)
+{
+	if (spid->framing == SPIFRAME_SINGLE)
+	{
+		spi_io_start_tx(spid, SPIPHASE_HEADER, (uint8_t *)spid->tx_buff, sizeof(SPIPacket_t));
+	}
+	else
+	{
+		spi_io_start_tx(spid, SPIPHASE_HEADER, (uint8_t *)&spid->tx_buff->header,
+				sizeof(SPIHeader_t));
+	}
+}
+
+ITCM_FUNC static bool spi_io_start_next(SPIDevice_t *spid, bool chained);
+
+ITCM_FUNC static void spi_io_push_event(SPIDevice_t *spid, SPIEventType_t type, uint16_t detail)
+{
+	spi_event_push(spi_io_get_index(spid), type, detail);
+}
+
+/**
+ * Waits on the shared microsecond timer as a phase of the transaction.
+ * The timer is only ever busy if it was left armed, the wait is then skipped.
+ */
+ITCM_FUNC static void spi_io_wait(SPIDevice_t *spid, SPIPhase_t phase, uint16_t delay_us, USTimerCallback_t callback)
+{
+	spi_io_enter_phase(spid, phase, delay_us + SPI_TIMEOUT_MARGIN_US);
+
+	if (!us_timer_start(delay_us, callback, spid))
+	{
+		callback(spid);
+	}
+}
+
+/**
+ * With hardware NSS a Target keeps its reception armed whenever it is idle,
+ * so it is ready for the first clock regardless of the Controller's CS setup time.
+ */
+ITCM_FUNC static void spi_io_rearm_hard_nss(SPIDevice_t *spid)
+{
+	if (spid->nss != SPINSS_SOFT
+		&& spid->handle->Init.Mode == SPI_MODE_SLAVE
+		&& spid->op == SPIOP_NONE
+		&& !spid->resync_pending)
+	{
+		spi_io_receive(spid);
+	}
+}
+
+/**
+ * Discards the frames left in a Target's RX FIFO outside of a reception,
+ * e.g. the rest of a dropped packet, along with the overrun they caused.
+ */
+ITCM_FUNC static void spi_io_resync(SPIDevice_t *spid)
+{
+	SPI_TypeDef *instance = spid->handle->Instance;
+
+	while (instance->SR & SPI_SR_FRLVL)
+	{
+		(void)*(volatile uint8_t *)&instance->DR;
+	}
+
+	__HAL_SPI_CLEAR_OVRFLAG(spid->handle);
+	spid->resync_pending = false;
+}
+
+ITCM_FUNC static void spi_io_complete_tx(SPIDevice_t *spid)
+{
+	spid->state |= SPISTATE_TX_CPLT;
+
+	// keep the bus busy with the next queued packet, if any
+	if (!spi_io_start_next(spid, false))
+	{
+		spid->op &= ~SPIOP_TX;
+	}
+}
+
+/**
+ * CS setup time elapsed: the Target is armed, start clocking.
+ */
+ITCM_FUNC static void spi_io_cs_setup_elapsed(void *context)
+{
+	spi_io_start_packet((SPIDevice_t *)context);
+}
+
+/**
+ * Turnaround time elapsed: the Target has its response ready, clock it in.
+ */
+ITCM_FUNC static void spi_io_turnaround_elapsed(void *context)
+{
+	SPIDevice_t *spid = (SPIDevice_t *)context;
+
+	spi_io_start_rx(spid, SPIPHASE_RESPONSE, (uint8_t *)spid->rx_buff,
+			sizeof(SPIHeader_t) + spi_io_clamp_len(spid->tx_buff->header.rx_len));
+}
+
+/**
+ * CS deselect time of a retransmission elapsed: select the Target again,
+ * its falling edge EXTI re-arms the reception for the repeated packet.
+ */
+ITCM_FUNC static void spi_io_reselect_elapsed(void *context)
+{
+	SPIDevice_t *spid = (SPIDevice_t *)context;
+
+	if (spid->tx_buff->header.opcode == SPIOP_RX)
+	{
+		spid->state |= SPISTATE_RX_PENDING;
+		spid->op |= SPIOP_RX;
+	}
+
+	spid->tx_pos = spid->framing == SPIFRAME_SINGLE ? 1 : 0;
+
+	spid->target_device->select_cycles = cycles_now();
+	spi_trace_stamp(spid->txn_id, SPITRACE_CS_ASSERT);
+	HAL_GPIO_WritePin(spid->target_device->cs_port_out,
+		spid->target_device->cs_pin_out, GPIO_PIN_RESET);
+
+	spi_io_wait(spid, SPIPHASE_CS_SETUP, spid->target_device->cs_setup_us, spi_io_cs_setup_elapsed);
+}
+
+/**
+ * CS hold time elapsed: deselect the Target and conclude the transmission.
+ */
+ITCM_FUNC static void spi_io_cs_hold_elapsed(void *context)
+{
+	SPIDevice_t *spid = (SPIDevice_t *)context;
+
+	// a hardware NSS output is only released by disabling the peripheral
+	if (spid->nss != SPINSS_SOFT) __HAL_SPI_DISABLE(spid->handle);
+
+	HAL_GPIO_WritePin(spid->target_device->cs_port_out,
+		spid->target_device->cs_pin_out, GPIO_PIN_SET);
+
+	if (spid->retry_pending)
+	{
+		// the transaction goes on, it is only closed by its final release
+		// CS must stay high long enough for the Target to see a new falling edge
+		uint16_t deselect_us = spid->target_device->cs_hold_us > 0
+				? spid->target_device->cs_hold_us : 1u;
+
+		spid->retry_pending = false;
+
+		spi_io_wait(spid, SPIPHASE_CS_HOLD, deselect_us, spi_io_reselect_elapsed);
+
+		return;
+	}
+
+	spi_trace_stamp(spid->txn_id, SPITRACE_CS_RELEASE);
+
+	spid->target_device = NULL;
+
+	spi_io_complete_tx(spid);
+}
+
+/**
+ * Inter-chunk gap elapsed: the Target has re-armed its reception,
+ * continue the stream without releasing CS.
+ */
+ITCM_FUNC static void spi_io_chain_elapsed(void *context)
+{
+	SPIDevice_t *spid = (SPIDevice_t *)context;
+
+	spid->state |= SPISTATE_TX_CPLT;
+
+	if (!spi_io_start_next(spid, true))
+	{
+		// cannot happen as the queue only ever grows from the producer side,
+		// but never leave the Target selected
+		spi_io_cs_hold_elapsed(spid);
+	}
+}
+
+/**
+ * A non-final stream chunk followed by another chunk to the same Target
+ * keeps CS asserted, paying only the Target's turnaround between chunks
+ * instead of a full CS hold and setup.
+ */
+ITCM_FUNC static bool spi_io_can_chain(SPIDevice_t *spid)
+{
+	SPITxQueue_t *queue = &spid->tx_queue;
+	uint8_t opcode = spid->tx_buff->header.opcode;
+
+	if (!(opcode & SPI_OPCODE_STREAM) || (opcode & SPI_OPCODE_FLAG_FINAL)) return false;
+
+	if (queue->tail == queue->head) return false;
+
+	SPIQueueEntry_t *next = queue->entries + (queue->tail & (SPI_TX_QUEUE_LEN - 1));
+
+	return next->target_device == spid->target_device
+		&& (next->packet.header.opcode & SPI_OPCODE_STREAM);
+}
+
+ITCM_FUNC static void spi_io_start_cs_hold(SPIDevice_t *spid)
+{
+	spi_io_wait(spid, SPIPHASE_CS_HOLD, spid->target_device->cs_hold_us, spi_io_cs_hold_elapsed);
+}
+
+/**
+ * Releases the Target and schedules the packet in tx_buff to be sent again,
+ * or gives up on it once its retries are exhausted.
+ */
+ITCM_FUNC static void spi_io_retry(SPIDevice_t *spid)
+{
+	spid->op &= ~SPIOP_RX;
+
+	if (spid->retries < SPI_CRC_MAX_RETRIES)
+	{
+		spid->retries++;
+		spid->crc_retransmits++;
+		spid->retry_pending = true;
+	}
+	else
+	{
+		spid->crc_failures++;
+		spid->state |= SPISTATE_ERROR;
+	}
+
+	spi_io_start_cs_hold(spid);
+}
+
+/**
+ * Turnaround time after a CRC-protected write elapsed: clock in the Target's ACK.
+ */
+ITCM_FUNC static void spi_io_ack_turnaround_elapsed(void *context)
+{
+	SPIDevice_t *spid = (SPIDevice_t *)context;
+
+	*spid->ack_byte = 0u;
+	spid->op |= SPIOP_RX;
+	spi_io_start_rx(spid, SPIPHASE_RESPONSE, (uint8_t *)spid->ack_byte, 1);
+}
+
+ITCM_FUNC static void spi_io_process_ack(SPIDevice_t *spid)
+{
+	spid->op &= ~SPIOP_RX;
+
+	// anything but an ACK, including a stale byte from a Target that never
+	// recognized the packet, means the packet has to go out again
+	if (*spid->ack_byte != SPI_ACK)
+	{
+		spi_io_retry(spid);
+		return;
+	}
+
+	spid->acked_bytes += spid->tx_buff->header.tx_len;
+
+	if (spi_io_can_chain(spid))
+	{
+		spi_io_wait(spid, SPIPHASE_TURNAROUND, spid->target_device->turnaround_us, spi_io_chain_elapsed);
+	}
+	else
+	{
+		spi_io_start_cs_hold(spid);
+	}
+}
+
+/**
+ * Pops the next packet off the device queue and starts transmitting it.
+ * Called either from thread context with the TX line idle and interrupts
+ * masked, or from the completion of the previous packet in ISR context.
+ */
+ITCM_FUNC static bool spi_io_start_next(SPIDevice_t *spid, bool chained)
+{
+	SPITxQueue_t *queue = &spid->tx_queue;
+
+	if (queue->tail == queue->head) return false;
+
+	SPIQueueEntry_t *entry = queue->entries + (queue->tail & (SPI_TX_QUEUE_LEN - 1));
+	SPIDevice_t *target_device = entry->target_device;
+	uint32_t delay_cycles = cycles_now() - entry->enqueue_cycles;
+
+	memcpy((uint8_t *)spid->tx_buff, &entry->packet, sizeof(SPIPacket_t));
+
+	// the slot is free for the producer from here on
+	__DMB();
+	queue->tail++;
+
+	queue->dequeue_count++;
+	queue->delay_total_cycles += delay_cycles;
+	if (delay_cycles < queue->delay_min_cycles) queue->delay_min_cycles = delay_cycles;
+	if (delay_cycles > queue->delay_max_cycles) queue->delay_max_cycles = delay_cycles;
+
+	spid->state |= SPISTATE_TX_PENDING;
+	spid->op |= SPIOP_TX;
+	spid->retries = 0;
+
+	// a read request keeps the RX line busy until the response is in
+	if (spid->tx_buff->header.opcode == SPIOP_RX)
+	{
+		spid->state |= SPISTATE_RX_PENDING;
+		spid->op |= SPIOP_RX;
+	}
+
+	// in single framing the payload goes out with the header,
+	// so the completion of the first transfer concludes the packet
+	spid->tx_pos = spid->framing == SPIFRAME_SINGLE ? 1 : 0;
+
+	// the target device is only set when a Controller is transmitting,
+	// since it is only used for controlling the CS line
+	if (target_device != NULL)
+	{
+		spid->txn_id = spi_trace_open(spi_io_get_index(spid), spi_io_get_index(target_device));
+		target_device->txn_id = spid->txn_id;
+	}
+
+	if (chained)
+	{
+		// the Target is still selected from the previous chunk
+		spi_io_start_packet(spid);
+	}
+	else if (target_device != NULL)
+	{
+		/**
+		 * Enabling the target devices's CS line.
+		 * In this implementation this triggers an EXTI callback,
+		 * which in turn calls spi_io_receive() on the target SPI device.
+		 * The transfer itself starts once the Target's setup time has elapsed.
+		 */
+		spid->target_device = target_device;
+		target_device->select_cycles = cycles_now();
+		spi_trace_stamp(spid->txn_id, SPITRACE_CS_ASSERT);
+		HAL_GPIO_WritePin(target_device->cs_port_out, target_device->cs_pin_out, GPIO_PIN_RESET);
+
+		spi_io_wait(spid, SPIPHASE_CS_SETUP, target_device->cs_setup_us, spi_io_cs_setup_elapsed);
+	}
+	else
+	{
+		spi_io_start_packet(spid);
+	}
+
+	return true;
+}
+
+/**
+ * Answers a read request with a contiguous header+data response,
+ * armed right away so that it is ready within the Controller's turnaround.
+ */
+ITCM_FUNC static void spi_io_respond(SPIDevice_t *spid, uint8_t reg, uint8_t len)
+{
+	if (spid->op & SPIOP_TX)
+	{
+		spid->response_drops++;
+		return;
+	}
+
+	if (len > SPI_DATA_MAX_LEN) len = SPI_DATA_MAX_LEN;
+
+	memset((uint8_t *)spid->tx_buff->header.pad_head, 255u, 2);
+	memset((uint8_t *)spid->tx_buff->header.pad_tail, 255u, 1);
+	spid->tx_buff->header.opcode = SPIOP_RX;
+	spid->tx_buff->header.tx_len = 0u;
+	spid->tx_buff->header.tx_reg = 0u;
+	spid->tx_buff->header.rx_len = len;
+	spid->tx_buff->header.rx_reg = reg;
+	memcpy((uint8_t *)spid->tx_buff->data, (uint8_t *)spid->regs[reg], len);
+
+	spid->state |= SPISTATE_TX_PENDING;
+	spid->op |= SPIOP_TX;
+	spid->tx_pos = 1;
+
+	spi_io_start_tx(spid, SPIPHASE_RESPONSE, (uint8_t *)spid->tx_buff, sizeof(SPIHeader_t) + len);
+}
+
+/**
+ * Target side of a CRC-protected write, sent right away like a read response.
+ */
+ITCM_FUNC static void spi_io_acknowledge(SPIDevice_t *spid, uint8_t ack)
+{
+	if (spid->op & SPIOP_TX)
+	{
+		spid->response_drops++;
+		return;
+	}
+
+	*spid->ack_byte = ack;
+
+	spid->state |= SPISTATE_TX_PENDING;
+	spid->op |= SPIOP_TX;
+	spid->tx_pos = 1;
+
+	spi_io_start_tx(spid, SPIPHASE_RESPONSE, (uint8_t *)spid->ack_byte, 1);
+}
+
+/**
+ * A Target only acts on a header that is consistent as a whole: intact pads,
+ * a known opcode, and lengths and registers within bounds. Anything else,
+ * from a Controller out of step or from bit errors on the bus, is dropped
+ * before the header sizes a reception or a copy.
+ */
+ITCM_FUNC static bool spi_io_header_is_valid(volatile SPIHeader_t *header)
+{
+	if (header->pad_head[0] != 255u || header->pad_head[1] != 255u
+		|| header->pad_tail[0] != 255u)
+	{
+		return false;
+	}
+
+	if (header->tx_len > SPI_DATA_MAX_LEN) return false;
+
+	switch (header->opcode)
+	{
+	case SPIOP_TX:
+		return header->tx_len > 0 && header->tx_reg < SPI_REG_COUNT;
+	case SPIOP_RX:
+		return header->rx_len > 0 && header->rx_len <= SPI_DATA_MAX_LEN
+			&& header->rx_reg < SPI_REG_COUNT
+			&& (header->tx_len == 0 || header->tx_reg < SPI_REG_COUNT);
+	case SPI_OPCODE_STREAM:
+	case SPI_OPCODE_STREAM | SPI_OPCODE_FLAG_FINAL:
+	case SPI_OPCODE_PRBS:
+		// rx_reg/rx_len hold a sequence number, any value goes
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Drops a packet whose header failed validation. Whatever the Controller
+ * still clocks under the same CS is drained once the Target is deselected,
+ * so the next packet starts aligned. A CRC-protected packet is NACKed.
+ */
+ITCM_FUNC static void spi_io_reject_header(SPIDevice_t *spid)
+{
+	spid->header_errors++;
+	spid->state |= SPISTATE_ERROR;
+	spid->op &= ~SPIOP_RX;
+	spid->resync_pending = true;
+	spi_io_push_event(spid, SPIEVT_REJECTED, spid->rx_buff->header.opcode);
+
+	if (spid->crc_enabled)
+	{
+		spid->rearm_after_tx = false;
+		spi_io_acknowledge(spid, SPI_NACK);
+	}
+}
+
+ITCM_FUNC static void spi_io_process_rx(SPIDevice_t *spid)
+{
+	spi_trace_stamp(spid->txn_id, SPITRACE_PROCESS_START);
+
+	spid->rx_packets++;
+
+	if (spid->rx_buff->header.tx_len > 0
+		&& spid->rx_buff->header.tx_reg < SPI_REG_COUNT)
+	{
+		memcpy((uint8_t *)spid->regs[spid->rx_buff->header.tx_reg],
+				(uint8_t *)spid->rx_buff->data, spid->rx_buff->header.tx_len);
+	}
+
+	spid->state |= SPISTATE_RX_CPLT;
+	spid->op &= ~SPIOP_RX;
+
+	if (spid->rx_buff->header.opcode == SPIOP_RX
+		&& spid->rx_buff->header.rx_len > 0
+		&& spid->rx_buff->header.rx_reg < SPI_REG_COUNT)
+	{
+		spi_io_respond(spid, spid->rx_buff->header.rx_reg,
+				spid->rx_buff->header.rx_len);
+	}
+	else if (spid->crc_enabled && spid->rx_buff->header.opcode != SPIOP_RX)
+	{
+		spid->acked_bytes += spid->rx_buff->header.tx_len;
+		spi_io_acknowledge(spid, SPI_ACK);
+	}
+
+	spi_io_rearm_hard_nss(spid);
+
+	spi_trace_stamp(spid->txn_id, SPITRACE_PROCESS_END);
+}
+
+/**
+ * Places a stream chunk into the listener's buffer by its sequence number,
+ * so a missed chunk leaves a gap instead of shifting the rest of the data.
+ */
+ITCM_FUNC static void spi_io_process_stream_chunk(SPIDevice_t *spid)
+{
+	SPIStream_t *stream = &spid->stream;
+	uint16_t seq = SPI_HEADER_GET_SEQ(spid->rx_buff->header);
+	uint8_t len = spid->rx_buff->header.tx_len;
+	uint32_t offset = (uint32_t)seq * SPI_DATA_MAX_LEN;
+
+	bool is_final = spid->rx_buff->header.opcode & SPI_OPCODE_FLAG_FINAL;
+
+	spi_trace_stamp(spid->txn_id, SPITRACE_PROCESS_START);
+
+	spid->state |= SPISTATE_RX_CPLT;
+	spid->op &= ~SPIOP_RX;
+
+	if (stream->buffer != NULL && !stream->complete)
+	{
+		stream->chunk_count++;
+
+		if (seq != stream->next_seq) stream->seq_errors++;
+		stream->next_seq = seq + 1;
+
+		if (len > SPI_DATA_MAX_LEN || offset + len > stream->capacity)
+		{
+			stream->overflow_errors++;
+		}
+		else
+		{
+			memcpy(stream->buffer + offset, (uint8_t *)spid->rx_buff->data, len);
+			if (offset + len > stream->length) stream->length = offset + len;
+		}
+
+		if (is_final) stream->complete = true;
+	}
+
+	// more chunks follow under the same CS assertion, re-arm right away
+	bool more = !is_final
+			&& HAL_GPIO_ReadPin(spid->cs_port_in, spid->cs_pin_in) == GPIO_PIN_RESET;
+
+	if (spid->crc_enabled)
+	{
+		// the ACK has to be clocked out before the next chunk can come in
+		spid->rearm_after_tx = more;
+		spid->acked_bytes += len;
+		spi_io_acknowledge(spid, SPI_ACK);
+	}
+	else if (more)
+	{
+		spi_io_receive(spid);
+	}
+
+	spi_io_rearm_hard_nss(spid);
+
+	spi_trace_stamp(spid->txn_id, SPITRACE_PROCESS_END);
+}
+
+/**
+ * Checks a BER test payload in place against the regenerated sequence,
+ * without copying it anywhere.
+ */
+ITCM_FUNC static void spi_io_process_prbs(SPIDevice_t *spid)
+{
+	SPIBer_t *ber = &spid->ber;
+	uint16_t seq = SPI_HEADER_GET_SEQ(spid->rx_buff->header);
+	uint8_t len = spid->rx_buff->header.tx_len;
+	uint16_t gap = seq - ber->next_seq;
+	uint16_t behind = ber->next_seq - seq;
+
+	spi_trace_stamp(spid->txn_id, SPITRACE_PROCESS_START);
+
+	spid->rx_packets++;
+	spid->state |= SPISTATE_RX_CPLT;
+	spid->op &= ~SPIOP_RX;
+
+	if (ber->active && len <= SPI_DATA_MAX_LEN)
+	{
+		uint32_t start_cycles = cycles_now();
+
+		// a packet from just behind was already counted, e.g. when its ACK was lost
+		if (behind > 0 && behind <= SPI_BER_MAX_GAP)
+		{
+			ber->duplicate_packets++;
+		}
+		else if (gap > SPI_BER_MAX_GAP)
+		{
+			// no skipping for as long as a corrupted number asks, the data tells where the sequence is
+			if (prbs_resync(&ber->prbs, spid->rx_buff->data, len)) ber->next_seq = seq + 1;
+			ber->resyncs++;
+		}
+		else
+		{
+			if (gap > 0)
+			{
+				// all packets of a test share the same length
+				ber->missed_packets += gap;
+				prbs_skip(&ber->prbs, (uint32_t)gap * len);
+			}
+
+			ber->bit_errors += prbs_check(&ber->prbs, spid->rx_buff->data, len);
+			ber->bit_count += (uint32_t)len * 8u;
+			ber->packet_count++;
+			ber->next_seq = seq + 1;
+		}
+
+		ber->check_cycles += cycles_now() - start_cycles;
+	}
+
+	if (spid->crc_enabled)
+	{
+		spid->acked_bytes += len;
+		spi_io_acknowledge(spid, SPI_ACK);
+	}
+
+	spi_io_rearm_hard_nss(spid);
+
+	spi_trace_stamp(spid->txn_id, SPITRACE_PROCESS_END);
+}
+
+/**
+ * Controller side of a read: validates the Target's response
+ * and mirrors the data into the local copy of the register.
+ */
+ITCM_FUNC static void spi_io_process_response(SPIDevice_t *spid)
+{
+	volatile SPIHeader_t *request = &spid->tx_buff->header;
+	volatile SPIHeader_t *response = &spid->rx_buff->header;
+
+	if (response->pad_head[0] == 255u && response->pad_head[1] == 255u
+		&& response->opcode == SPIOP_RX
+		&& response->rx_reg == request->rx_reg
+		&& response->rx_len == request->rx_len
+		&& request->rx_reg < SPI_REG_COUNT
+		&& request->rx_len <= SPI_DATA_MAX_LEN)
+	{
+		memcpy((uint8_t *)spid->regs[request->rx_reg],
+				(uint8_t *)spid->rx_buff->data, request->rx_len);
+		spid->state |= SPISTATE_RX_CPLT;
+	}
+	else
+	{
+		spid->read_errors++;
+		spid->state |= SPISTATE_ERROR;
+	}
+
+	spid->op &= ~SPIOP_RX;
+}
+
+bool spi_io_is_initialized(void)
+{
+	return is_initialized;
+}
+
+void spi_io_initialize(void)
+{
+	if (is_initialized) return;
+
+	bzero(devices+0, sizeof(SPIDevice_t));
+	strcpy(devices[0].name, "SPI1");
+	devices[0].handle = &hspi1;
+	devices[0].nss_pin = SPI1_NSS_Pin;
+	devices[0].nss_port = SPI1_NSS_GPIO_Port;
+	devices[0].nss_af = SPI1_NSS_AF;
+
+	bzero(devices+1, sizeof(SPIDevice_t));
+	strcpy(devices[1].name, "SPI3");
+	devices[1].handle = &hspi3;
+	devices[1].cs_pin_in = SPI3_CS_IN_Pin;
+	devices[1].cs_pin_out = SPI3_CS_OUT_Pin;
+	devices[1].cs_port_in = SPI3_CS_IN_GPIO_Port;
+	devices[1].cs_port_out = SPI3_CS_OUT_GPIO_Port;
+	devices[1].nss_pin = SPI3_NSS_Pin;
+	devices[1].nss_port = SPI3_NSS_GPIO_Port;
+	devices[1].nss_af = SPI3_NSS_AF;
+	devices[1].cs_setup_us = SPI_CS_SETUP_US_DEFAULT;
+	devices[1].cs_hold_us = SPI_CS_HOLD_US_DEFAULT;
+	devices[1].turnaround_us = SPI_TURNAROUND_US_DEFAULT;
+
+	bzero(devices+2, sizeof(SPIDevice_t));
+	strcpy(devices[2].name, "SPI5");
+	devices[2].handle = &hspi5;
+	devices[2].cs_pin_in = SPI5_CS_IN_Pin;
+	devices[2].cs_pin_out = SPI5_CS_OUT_Pin;
+	devices[2].cs_port_in = SPI5_CS_IN_GPIO_Port;
+	devices[2].cs_port_out = SPI5_CS_OUT_GPIO_Port;
+	devices[2].nss_pin = SPI5_NSS_Pin;
+	devices[2].nss_port = SPI5_NSS_GPIO_Port;
+	devices[2].nss_af = SPI5_NSS_AF;
+	devices[2].cs_setup_us = SPI_CS_SETUP_US_DEFAULT;
+	devices[2].cs_hold_us = SPI_CS_HOLD_US_DEFAULT;
+	devices[2].turnaround_us = SPI_TURNAROUND_US_DEFAULT;
+
+	bzero(device_buffers, sizeof(device_buffers));
+
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		devices[idx].tx_buff = &device_buffers[idx].tx_buff;
+		devices[idx].rx_buff = &device_buffers[idx].rx_buff;
+		devices[idx].ack_byte = &device_buffers[idx].ack_byte;
+
+		spi_io_reset_queue_stats(devices+idx);
+		spi_io_reset_crc_stats(devices+idx);
+		spi_io_reset_recovery_stats(devices+idx);
+	}
+
+	cycles_initialize();
+	us_timer_initialize();
+
+	is_initialized = true;
+}
+
+ITCM_FUNC SPIDevice_t* hspi_to_struct(SPI_HandleTypeDef *hspi)
+{
+	if (hspi == &hspi1) return devices+0;
+	if (hspi == &hspi3) return devices+1;
+	if (hspi == &hspi5) return devices+2;
+
+	return NULL;
+}
+
+SPIDevice_t* spi_io_get_device(uint8_t index)
+{
+	if (index >= 3) return NULL;
+
+	return devices + index;
+}
+
+ITCM_FUNC uint8_t spi_io_get_index(SPIDevice_t *spid)
+{
+	return (uint8_t)(spid - devices);
+}
+
+/**
+ * A Target waiting to be selected, with only its header reception armed.
+ */
+static bool spi_io_is_waiting(SPIDevice_t *spid)
+{
+	return spid->handle->Init.Mode == SPI_MODE_SLAVE
+			&& spid->op == SPIOP_RX
+			&& spid->phase == SPIPHASE_HEADER
+			&& !(spid->state & SPISTATE_SELECTED)
+			&& spi_io_rx_untouched(spid);
+}
+
+/**
+ * A waiting Target has no deadline, neither has an idle device.
+ */
+static bool spi_io_phase_expired(SPIDevice_t *spid)
+{
+	bool expired = false;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (spid->op != SPIOP_NONE && !spi_io_is_waiting(spid))
+	{
+		expired = cycles_now() - spid->phase_start_cycles > spid->phase_timeout_cycles;
+	}
+
+	__set_PRIMASK(primask);
+
+	return expired;
+}
+
+static void spi_io_start_recovery(SPIDevice_t *spid)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	spid->recovery_start_cycles = cycles_now();
+	spid->recovery = SPIRECOVERY_ABORTING;
+	spid->phase_timeouts[spid->phase]++;
+	spi_io_push_event(spid, SPIEVT_TIMEOUT, spid->phase);
+
+	// a pending CS or turnaround wait must not resume the transaction
+	us_timer_cancel(spid);
+
+	// concluded by HAL_SPI_AbortCpltCallback(), possibly from within
+	if (HAL_SPI_Abort_IT(spid->handle) != HAL_OK)
+	{
+		spid->recovery = SPIRECOVERY_ABORTED;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+static void spi_io_reset_peripheral(SPI_TypeDef *instance)
 {
-	if (spid->rx_buff.header.tx_len > 0
-		&& spid->rx_buff.header.tx_reg < SPI_REG_COUNT)
+	if (instance == SPI1)
 	{
-		memcpy((uint8_t *)spid->regs[spid->rx_buff.header.tx_reg],
-				(uint8_t *)spid->rx_buff.data, spid->rx_buff.header.tx_len);
+		__HAL_RCC_SPI1_FORCE_RESET();
+		__HAL_RCC_SPI1_RELEASE_RESET();
 	}
+	else if (instance == SPI3)
+	{
+		__HAL_RCC_SPI3_FORCE_RESET();
+		__HAL_RCC_SPI3_RELEASE_RESET();
+	}
+	else if (instance == SPI5)
+	{
+		__HAL_RCC_SPI5_FORCE_RESET();
+		__HAL_RCC_SPI5_RELEASE_RESET();
+	}
+}
+
+/**
+ * Second half of a recovery, in thread context as the re-initialization
+ * goes through the MSP callbacks and the DMA init.
+ */
+static void spi_io_finish_recovery(SPIDevice_t *spid)
+{
+	SPI_HandleTypeDef *handle = spid->handle;
+
+	// a Controller releases the Target it left selected
+	if (spid->target_device != NULL)
+	{
+		HAL_GPIO_WritePin(spid->target_device->cs_port_out,
+			spid->target_device->cs_pin_out, GPIO_PIN_SET);
+		spid->target_device = NULL;
+	}
+
+	// disabling the peripheral leaves the FIFOs as they are,
+	// only a reset guarantees no stale frames shift the following packets
+	HAL_SPI_DeInit(handle);
+	spi_io_reset_peripheral(handle->Instance);
+	HAL_SPI_Init(handle);
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	spid->state = (spid->state & SPISTATE_SELECTED) | SPISTATE_ABORT;
+	spid->op = SPIOP_NONE;
+	spid->phase = SPIPHASE_IDLE;
+	spid->tx_pos = 0;
+	spid->rx_pos = 0;
+	spid->retries = 0;
+	spid->retry_pending = false;
+	spid->rearm_after_tx = false;
+	spid->resync_pending = false;
+
+	uint32_t recovery_cycles = cycles_now() - spid->recovery_start_cycles;
+	uint32_t recovery_us = cycles_to_us(recovery_cycles);
+
+	spid->recovery_count++;
+	spid->recovery_last_cycles = recovery_cycles;
+	if (recovery_cycles > spid->recovery_max_cycles) spid->recovery_max_cycles = recovery_cycles;
+	spid->recovery = SPIRECOVERY_NONE;
+
+	spi_io_push_event(spid, SPIEVT_RECOVERED, recovery_us > UINT16_MAX ? UINT16_MAX : recovery_us);
+
+	// carry on with whatever is still queued
+	spi_io_start_next(spid, false);
+	spi_io_rearm_hard_nss(spid);
+
+	__set_PRIMASK(primask);
+}
+
+/**
+ * Enforces the transaction phase deadlines and completes pending recoveries.
+ * Must be called periodically from thread context, e.g. while waiting on transfers.
+ */
+void spi_io_poll(void)
+{
+	if (!is_initialized) return;
+
+	for (uint8_t idx = 0; idx < 3; idx++)
+	{
+		SPIDevice_t *spid = devices + idx;
+
+		switch (spid->recovery)
+		{
+		case SPIRECOVERY_NONE:
+			if (spi_io_phase_expired(spid)) spi_io_start_recovery(spid);
+			break;
+		case SPIRECOVERY_ABORTING:
+			// a DMA abort that never reports back is not waited on forever
+			if (cycles_now() - spid->recovery_start_cycles
+					> SPI_TIMEOUT_MARGIN_US * (SystemCoreClock / 1000000u))
+			{
+				spi_io_finish_recovery(spid);
+			}
+			break;
+		case SPIRECOVERY_ABORTED:
+			spi_io_finish_recovery(spid);
+			break;
+		}
+	}
+}
+
+/**
+ * Nothing in progress: with hardware NSS an idle Target has its header
+ * reception armed already.
+ */
+bool spi_io_is_idle(SPIDevice_t *spid)
+{
+	return spid->op == SPIOP_NONE || spi_io_is_waiting(spid);
+}
+
+void spi_io_reset_recovery_stats(SPIDevice_t *spid)
+{
+	bzero(spid->phase_timeouts, sizeof(spid->phase_timeouts));
+	spid->recovery_count = 0;
+	spid->recovery_last_cycles = 0;
+	spid->recovery_max_cycles = 0;
+	spid->header_errors = 0;
+}
+
+/**
+ * Queues a packet, starting it right away if the device is idle.
+ * Only fails when the device queue is full.
+ */
+static bool spi_io_enqueue_packet(SPIDevice_t *spid, const SPIHeader_t *header,
+		const uint8_t *data, SPIDevice_t *target_device)
+{
+	SPITxQueue_t *queue = &spid->tx_queue;
+	uint8_t depth = queue->head - queue->tail;
+	uint8_t len = spi_io_clamp_len(header->tx_len);
+
+	if (depth >= SPI_TX_QUEUE_LEN)
+	{
+		queue->enqueue_failures++;
+		return false;
+	}
+
+	SPIQueueEntry_t *entry = queue->entries + (queue->head & (SPI_TX_QUEUE_LEN - 1));
+	SPIPacket_t *packet = &entry->packet;
 
-	spid->state |= SPISTATE_RX_CPLT;
-	spid->op &= ~SPIOP_RX;
+	bzero(packet, sizeof(SPIPacket_t));
+	packet->header = *header;
+	if (len > 0 && data != NULL) memcpy(packet->data, data, len);
+
+	entry->target_device = target_device;
+	entry->enqueue_cycles = cycles_now();
+
+	// publish the entry only once it is complete
+	__DMB();
+	queue->head++;
 
-	if (spid->rx_buff.header.rx_len > 0
-		&& spid->rx_buff.header.rx_reg < SPI_REG_COUNT)
+	if (depth + 1 > queue->high_water) queue->high_water = depth + 1;
+
+	/**
+	 * Kick the device if it is idle. Masking interrupts here closes the window
+	 * where a completing transfer finds the queue empty, but has not yet
+	 * cleared its TX flag.
+	 */
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (!(spid->op & SPIOP_TX))
 	{
-		spi_io_transmit(spid,
-				(uint8_t *)spid->regs[spid->rx_buff.header.rx_reg],
-				spid->rx_buff.header.rx_len,
-				spid->rx_buff.header.rx_reg, NULL);
+		spi_io_start_next(spid, false);
 	}
+
+	__set_PRIMASK(primask);
+
+	return true;
 }
 
-bool spi_io_is_initialized(void)
+static bool spi_io_enqueue(SPIDevice_t *spid, uint8_t opcode,
+		uint8_t tx_reg, uint8_t *data, uint8_t tx_len,
+		uint8_t rx_reg, uint8_t rx_len, SPIDevice_t *target_device)
 {
-	return is_initialized;
+	SPIHeader_t header = {
+		.pad_head = { 255u, 255u },
+		.opcode = opcode,
+		.tx_reg = tx_reg,
+		.tx_len = tx_len,
+		.rx_reg = rx_reg,
+		.rx_len = rx_len,
+		.pad_tail = { 255u },
+	};
+
+	return spi_io_enqueue_packet(spid, &header, data, target_device);
 }
 
-void spi_io_initialize(void)
+bool spi_io_transmit(SPIDevice_t *spid, uint8_t *data, uint8_t len, uint8_t dst_reg, SPIDevice_t *target_device)
 {
-	if (is_initialized) return;
+	if (len < 1) return false;
 
-	bzero(devices+0, sizeof(SPIDevice_t));
-	strcpy(devices[0].name, "SPI1");
-	devices[0].handle = &hspi1;
+	if (dst_reg >= SPI_REG_COUNT) return false;
 
-	bzero(devices+1, sizeof(SPIDevice_t));
-	strcpy(devices[1].name, "SPI3");
-	devices[1].handle = &hspi3;
-	devices[1].cs_pin_in = SPI3_CS_IN_Pin;
-	devices[1].cs_pin_out = SPI3_CS_OUT_Pin;
-	devices[1].cs_port_in = SPI3_CS_IN_GPIO_Port;
-	devices[1].cs_port_out = SPI3_CS_OUT_GPIO_Port;
+	if (len > SPI_DATA_MAX_LEN) len = SPI_DATA_MAX_LEN;
 
-	bzero(devices+2, sizeof(SPIDevice_t));
-	strcpy(devices[2].name, "SPI5");
-	devices[2].handle = &hspi5;
-	devices[2].cs_pin_in = SPI5_CS_IN_Pin;
-	devices[2].cs_pin_out = SPI5_CS_OUT_Pin;
-	devices[2].cs_port_in = SPI5_CS_IN_GPIO_Port;
-	devices[2].cs_port_out = SPI5_CS_OUT_GPIO_Port;
+	return spi_io_enqueue(spid, SPIOP_TX, dst_reg, data, len, 0u, 0u, target_device);
+}
 
-	is_initialized = true;
+/**
+ * Queues a register read on a Target. The request header is followed,
+ * after the Target's turnaround time, by clocking in its response.
+ * On completion the data is mirrored into the Controller's own regs[src_reg]
+ * and SPISTATE_RX_CPLT is set, or SPISTATE_ERROR on a malformed response.
+ */
+bool spi_io_read(SPIDevice_t *spid, uint8_t src_reg, uint8_t len, SPIDevice_t *target_device)
+{
+	if (len < 1) return false;
+
+	if (src_reg >= SPI_REG_COUNT) return false;
+
+	// a response can only be clocked in while the Target is selected
+	if (target_device == NULL) return false;
+
+	if (len > SPI_DATA_MAX_LEN) len = SPI_DATA_MAX_LEN;
+
+	return spi_io_enqueue(spid, SPIOP_RX, 0u, NULL, 0u, src_reg, len, target_device);
 }
 
-SPIDevice_t* hspi_to_struct(SPI_HandleTypeDef *hspi)
+/**
+ * Sends a blob of up to SPI_STREAM_MAX_LEN bytes as a train of chunks.
+ * Blocks until the last chunk is queued, sleeping whenever the queue is full,
+ * so it must only be called from thread context.
+ * Returns the number of chunks queued, fewer than the stream has if queueing fails.
+ */
+uint32_t spi_io_stream_send(SPIDevice_t *spid, const uint8_t *data, uint32_t len, SPIDevice_t *target_device)
 {
-	if (hspi == &hspi1) return devices+0;
-	if (hspi == &hspi3) return devices+1;
-	if (hspi == &hspi5) return devices+2;
+	uint32_t chunk_count = 0;
 
-	return NULL;
+	if (len < 1 || len > SPI_STREAM_MAX_LEN || target_device == NULL) return 0;
+
+	for (uint32_t offset = 0; offset < len; offset += SPI_DATA_MAX_LEN)
+	{
+		uint16_t seq = (uint16_t)(offset / SPI_DATA_MAX_LEN);
+		uint8_t chunk_len = (len - offset) > SPI_DATA_MAX_LEN ? SPI_DATA_MAX_LEN : (uint8_t)(len - offset);
+		uint8_t opcode = SPI_OPCODE_STREAM;
+
+		if (offset + chunk_len >= len) opcode |= SPI_OPCODE_FLAG_FINAL;
+
+		// a full queue is only back-pressure here, wait for a slot to free up,
+		// polling so that a stalled chunk times out and the queue moves on
+		while (spi_io_queue_depth(spid) >= SPI_TX_QUEUE_LEN)
+		{
+			spi_io_poll();
+			__WFI();
+		}
+
+		if (!spi_io_enqueue(spid, opcode, 0u, (uint8_t *)data + offset, chunk_len,
+				(uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8), target_device))
+		{
+			break;
+		}
+
+		chunk_count++;
+	}
+
+	return chunk_count;
 }
 
-bool spi_io_transmit(SPIDevice_t *spid, uint8_t *data, uint8_t len, uint8_t dst_reg, SPIDevice_t *target_device)
+/**
+ * Queues a packet with its header exactly as given, pads included, for stress
+ * testing a Target's header validation. Whatever the header claims, at most
+ * SPI_DATA_MAX_LEN payload bytes are clocked out, and as many taken in response.
+ */
+bool spi_io_transmit_raw(SPIDevice_t *spid, const SPIHeader_t *header, const uint8_t *data, SPIDevice_t *target_device)
 {
-	if (len < 1) return false;
+	if (header == NULL || target_device == NULL) return false;
 
-	if (dst_reg >= SPI_REG_COUNT) return false;
+	return spi_io_enqueue_packet(spid, header, data, target_device);
+}
 
-	if (spid->op & SPIOP_TX)
+/**
+ * Prepares a Target for reassembling an incoming stream into the given buffer.
+ * stream.complete is set once the final chunk arrives, stream.length then holds
+ * the size of the reassembled data.
+ */
+void spi_io_stream_listen(SPIDevice_t *spid, uint8_t *buffer, uint32_t capacity)
+{
+	SPIStream_t *stream = &spid->stream;
+
+	// detach the buffer while resetting, chunks are processed in ISR context
+	stream->buffer = NULL;
+	stream->capacity = capacity;
+	stream->length = 0;
+	stream->next_seq = 0;
+	stream->complete = false;
+	stream->chunk_count = 0;
+	stream->seq_errors = 0;
+	stream->overflow_errors = 0;
+	stream->buffer = buffer;
+}
+
+/**
+ * Queues the next len bytes of the Controller's PRBS sequence for a Target
+ * listening with spi_io_ber_listen(). Fails without advancing the sequence
+ * when the queue is full.
+ */
+bool spi_io_ber_send(SPIDevice_t *spid, PRBSGenerator_t *prbs, uint8_t len, uint16_t seq, SPIDevice_t *target_device)
+{
+	uint8_t payload[SPI_DATA_MAX_LEN];
+
+	if (len < 1 || len > SPI_DATA_MAX_LEN || target_device == NULL) return false;
+
+	if (spi_io_queue_depth(spid) >= SPI_TX_QUEUE_LEN) return false;
+
+	prbs_fill(prbs, payload, len);
+
+	return spi_io_enqueue(spid, SPI_OPCODE_PRBS, 0u, payload, len,
+			(uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8), target_device);
+}
+
+/**
+ * Resets a Target's bit error counters and its generator to the common seed,
+ * and starts checking. Stopping keeps the counters for the report.
+ */
+void spi_io_ber_listen(SPIDevice_t *spid, PRBSType_t type, bool active)
+{
+	SPIBer_t *ber = &spid->ber;
+
+	// packets are checked in ISR context
+	ber->active = false;
+	if (!active) return;
+
+	prbs_initialize(&ber->prbs, type);
+	ber->next_seq = 0;
+	ber->packet_count = 0;
+	ber->missed_packets = 0;
+	ber->duplicate_packets = 0;
+	ber->resyncs = 0;
+	ber->bit_count = 0;
+	ber->bit_errors = 0;
+	ber->check_cycles = 0;
+	ber->active = active;
+}
+
+ITCM_FUNC bool spi_io_receive(SPIDevice_t *spid)
+{
+	if (spid->op & SPIOP_RX)
 	{
 		/*
 		serial_print("Device ", 0);
 		serial_print(spid->name, 0);
-		serial_print_line(" TX line busy, aborting transmission.", 0);
+		serial_print_line(" RX line busy, aborting reception.", 0);
 		*/
 		return false;
 	}
 
-	spid->state |= SPISTATE_TX_PENDING;
-	spid->op |= SPIOP_TX;
+	spid->state |= SPISTATE_RX_PENDING;
+	spid->op |= SPIOP_RX;
 
-	if (len > SPI_DATA_MAX_LEN) len = SPI_DATA_MAX_LEN;
+	if (spid->framing == SPIFRAME_SINGLE)
+	{
+		spid->rx_pos = 1;
+		spi_io_start_rx(spid, SPIPHASE_HEADER, (uint8_t *)spid->rx_buff, sizeof(SPIPacket_t));
+	}
+	else
+	{
+		spid->rx_pos = 0;
+		spi_io_start_rx(spid, SPIPHASE_HEADER, (uint8_t *)spid->rx_buff, sizeof(SPIHeader_t));
+	}
 
-	bzero((uint8_t *)&spid->tx_buff, sizeof(SPIPacket_t));
-	memset((uint8_t *)spid->tx_buff.header.pad_head, 255u, 2);
-	memset((uint8_t *)spid->tx_buff.header.pad_tail, 255u, 1);
-	spid->tx_buff.header.opcode = SPIOP_TX;
-	spid->tx_buff.header.tx_len = len;
-	spid->tx_buff.header.tx_reg = dst_reg;
-	spid->tx_buff.header.rx_len = 0u;
-	spid->tx_buff.header.rx_reg = 0u;
-	memcpy((uint8_t *)spid->tx_buff.data, data, len);
+	return true;
+}
 
-	spid->tx_pos = 0;
+bool spi_io_set_mode(SPIDevice_t *spid, SPITransferMode_t mode)
+{
+	// the mode must not change under an ongoing transfer
+	if (spid->op != SPIOP_NONE) return false;
 
-	// the target device is only set when a Controller is transmitting,
-	// since it is only used for controlling the CS line
-	if (target_device != NULL)
+	// DMA mode requires both streams to be linked in the MSP init
+	if (mode == SPIMODE_DMA
+		&& (spid->handle->hdmatx == NULL || spid->handle->hdmarx == NULL))
 	{
-		/**
-		 * Enabling the target devices's CS line.
-		 * In this implementation this triggers an EXTI callback,
-		 * which in turn calls spi_io_receive() on the target SPI device.
-		 */
-		spid->target_device = target_device;
-		serial_print_line("Selecting Target SPI Device.", 0);
-		// making sure that the CS line is low first
-		HAL_GPIO_WritePin(spid->target_device->cs_port_out, target_device->cs_pin_out, GPIO_PIN_SET);
-		HAL_Delay(100);
-		HAL_GPIO_WritePin(spid->target_device->cs_port_out, target_device->cs_pin_out, GPIO_PIN_RESET);
+		return false;
 	}
 
-	HAL_SPI_Transmit_IT(spid->handle, (uint8_t *)&spid->tx_buff.header,
-			sizeof(SPIHeader_t));
+	spid->mode = mode;
 
 	return true;
 }
 
-bool spi_io_receive(SPIDevice_t *spid)
+bool spi_io_set_framing(SPIDevice_t *spid, SPIFraming_t framing)
 {
-	if (spid->op & SPIOP_RX)
+	if (spid->op != SPIOP_NONE) return false;
+
+	spid->framing = framing;
+
+	return true;
+}
+
+/**
+ * Switches the peripheral's CRC calculation, re-initializing the handle.
+ * The polynomial is left as configured by CubeMX.
+ */
+bool spi_io_set_crc(SPIDevice_t *spid, bool enabled)
+{
+	if (spid->op != SPIOP_NONE) return false;
+
+	spid->handle->Init.CRCCalculation = enabled
+			? SPI_CRCCALCULATION_ENABLE : SPI_CRCCALCULATION_DISABLE;
+	spid->handle->Init.CRCLength = SPI_CRC_LENGTH_8BIT;
+
+	if (HAL_SPI_Init(spid->handle) != HAL_OK) return false;
+
+	spid->crc_enabled = enabled;
+
+	return true;
+}
+
+/**
+ * Sets the bit clock divider of a Controller, any power of two from 2 to 256.
+ * Targets follow the Controller's clock, so this has no effect on them.
+ */
+bool spi_io_set_prescaler(SPIDevice_t *spid, uint16_t divider)
+{
+	uint32_t br = 0;
+
+	if (spid->op != SPIOP_NONE) return false;
+
+	while (br < 7 && (2u << br) < divider) br++;
+
+	if ((2u << br) != divider) return false;
+
+	spid->handle->Init.BaudRatePrescaler = br << SPI_CR1_BR_Pos;
+
+	return HAL_SPI_Init(spid->handle) == HAL_OK;
+}
+
+uint16_t spi_io_get_prescaler(SPIDevice_t *spid)
+{
+	return 2u << ((spid->handle->Init.BaudRatePrescaler & SPI_CR1_BR_Msk) >> SPI_CR1_BR_Pos);
+}
+
+/**
+ * SPI2/SPI3 are clocked from APB1, the other instances from APB2.
+ */
+uint32_t spi_io_get_kernel_clock(SPIDevice_t *spid)
+{
+	SPI_TypeDef *instance = spid->handle->Instance;
+
+	return (instance == SPI2 || instance == SPI3) ? HAL_RCC_GetPCLK1Freq() : HAL_RCC_GetPCLK2Freq();
+}
+
+/**
+ * The resulting bit rate of a Controller.
+ */
+uint32_t spi_io_get_bitrate(SPIDevice_t *spid)
+{
+	return spi_io_get_kernel_clock(spid) / spi_io_get_prescaler(spid);
+}
+
+/**
+ * Sets the smallest divider whose bit rate does not exceed max_bitrate,
+ * or the largest one if none is slow enough. Keeps a Controller's link
+ * rate after its bus clock changed.
+ */
+bool spi_io_set_max_bitrate(SPIDevice_t *spid, uint32_t max_bitrate)
+{
+	uint32_t pclk = spi_io_get_kernel_clock(spid);
+	uint16_t divider = 2;
+
+	while (divider < 256 && pclk / divider > max_bitrate) divider <<= 1;
+
+	return spi_io_set_prescaler(spid, divider);
+}
+
+/**
+ * Switches between the software CS and the peripheral's hardware NSS,
+ * configuring the NSS pin and re-initializing the handle.
+ * An idle Target in hardware mode has its pre-armed reception aborted first.
+ */
+bool spi_io_set_nss(SPIDevice_t *spid, SPINSSMode_t nss)
+{
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+	SPI_HandleTypeDef *handle = spid->handle;
+	bool is_controller = handle->Init.Mode == SPI_MODE_MASTER;
+
+	// pulses are only generated by a Controller, and require the first edge clock phase
+	if (nss == SPINSS_HARD_PULSE
+		&& (!is_controller || handle->Init.CLKPhase != SPI_PHASE_1EDGE))
 	{
-		/*
-		serial_print("Device ", 0);
-		serial_print(spid->name, 0);
-		serial_print_line(" RX line busy, aborting reception.", 0);
-		*/
 		return false;
 	}
 
-	spid->state |= SPISTATE_RX_PENDING;
-	spid->op |= SPIOP_RX;
+	if (!is_controller && spid->nss != SPINSS_SOFT
+		&& spid->op == SPIOP_RX && !(spid->state & SPISTATE_SELECTED))
+	{
+		HAL_SPI_Abort(handle);
+		spid->op = SPIOP_NONE;
+	}
 
-	spid->rx_pos = 0;
+	if (spid->op != SPIOP_NONE) return false;
+
+	if (nss == SPINSS_SOFT)
+	{
+		handle->Init.NSS = SPI_NSS_SOFT;
+		HAL_GPIO_DeInit(spid->nss_port, spid->nss_pin);
+	}
+	else
+	{
+		handle->Init.NSS = is_controller ? SPI_NSS_HARD_OUTPUT : SPI_NSS_HARD_INPUT;
+
+		// a Target's NSS is pulled up, leaving it deselected while unwired
+		GPIO_InitStruct.Pin = spid->nss_pin;
+		GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+		GPIO_InitStruct.Pull = is_controller ? GPIO_NOPULL : GPIO_PULLUP;
+		GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+		GPIO_InitStruct.Alternate = spid->nss_af;
+		HAL_GPIO_Init(spid->nss_port, &GPIO_InitStruct);
+	}
+
+	handle->Init.NSSPMode = nss == SPINSS_HARD_PULSE
+			? SPI_NSS_PULSE_ENABLE : SPI_NSS_PULSE_DISABLE;
 
-	HAL_SPI_Receive_IT(spid->handle, (uint8_t *)&spid->rx_buff, sizeof(SPIHeader_t));
+	if (HAL_SPI_Init(handle) != HAL_OK) return false;
+
+	spid->nss = nss;
+	spi_io_rearm_hard_nss(spid);
 
 	return true;
 }
 
-void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+void spi_io_reset_crc_stats(SPIDevice_t *spid)
+{
+	spid->crc_errors = 0;
+	spid->crc_retransmits = 0;
+	spid->crc_failures = 0;
+	spid->acked_bytes = 0;
+}
+
+void spi_io_set_cs_timing(SPIDevice_t *spid, uint16_t setup_us, uint16_t hold_us)
+{
+	spid->cs_setup_us = setup_us;
+	spid->cs_hold_us = hold_us;
+}
+
+void spi_io_set_turnaround(SPIDevice_t *spid, uint16_t turnaround_us)
+{
+	spid->turnaround_us = turnaround_us;
+}
+
+uint8_t spi_io_queue_depth(SPIDevice_t *spid)
+{
+	return spid->tx_queue.head - spid->tx_queue.tail;
+}
+
+void spi_io_reset_queue_stats(SPIDevice_t *spid)
+{
+	SPITxQueue_t *queue = &spid->tx_queue;
+
+	queue->high_water = 0;
+	queue->enqueue_failures = 0;
+	queue->dequeue_count = 0;
+	queue->delay_min_cycles = UINT32_MAX;
+	queue->delay_max_cycles = 0;
+	queue->delay_total_cycles = 0;
+}
+
+ITCM_FUNC void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
 	// TODO: also check the EXTI line (this case will work regardless, but it's a good habit)
 	if (GPIO_Pin == SPI3_CS_IN_Pin
@@ -166,80 +1415,204 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 		if (HAL_GPIO_ReadPin(spid->cs_port_in, spid->cs_pin_in) == GPIO_PIN_RESET)
 		{
 			spid->state |= SPISTATE_SELECTED;
+			spi_io_push_event(spid, SPIEVT_SELECTED, 0);
+			spi_trace_stamp(spid->txn_id, SPITRACE_TGT_SELECTED);
 
-			if (spid->op == SPIOP_NONE)
+			// with hardware NSS the reception is normally armed already,
+			// its deadline only starts with the selection
+			if (spid->op == SPIOP_RX && spid->phase == SPIPHASE_HEADER && spi_io_rx_untouched(spid))
+			{
+				spid->phase_start_cycles = cycles_now();
+			}
+			else if (spid->op == SPIOP_NONE && spid->recovery == SPIRECOVERY_NONE)
 			{
+				// frames clocked since the last packet completed are stale,
+				// e.g. a Controller sending more than its header announced
+				spi_io_resync(spid);
+
 				spi_io_receive(spid);
+
+				uint32_t latency = cycles_now() - spid->select_cycles;
+				if (latency > spid->arm_latency_max_cycles) spid->arm_latency_max_cycles = latency;
+				spid->arm_latency_total_cycles += latency;
+				spid->arm_latency_count++;
 			}
 		}
 		// rising edge - deselected
 		else
 		{
 			spid->state &= ~SPISTATE_SELECTED;
+			spi_io_push_event(spid, SPIEVT_DESELECTED, 0);
+
+			if (spid->resync_pending && !(spid->op & SPIOP_RX))
+			{
+				spi_io_resync(spid);
+				spi_io_rearm_hard_nss(spid);
+			}
+			// a packet cut short would misalign every later one,
+			// have spi_io_poll() recover the device right away
+			else if ((spid->op & SPIOP_RX)
+					&& !(spid->phase == SPIPHASE_HEADER && spi_io_rx_untouched(spid)))
+			{
+				spid->phase_timeout_cycles = 0;
+			}
 		}
 	}
 }
 
-void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+ITCM_FUNC void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
 {
 	if (!is_initialized) return;
 
 	SPIDevice_t *spid = hspi_to_struct(hspi);
 	spid->state |= SPISTATE_ERROR;
+	spi_io_push_event(spid, SPIEVT_ERROR, (uint16_t)hspi->ErrorCode);
+
+	if (!spid->crc_enabled || !(hspi->ErrorCode & HAL_SPI_ERROR_CRC))
+	{
+		// the HAL gave up on a Target's reception, e.g. on an overrun,
+		// the rest of the packet is drained once deselected
+		if (hspi->Init.Mode == SPI_MODE_SLAVE && (spid->op & SPIOP_RX))
+		{
+			spid->op &= ~SPIOP_RX;
+			spid->resync_pending = true;
+		}
+
+		return;
+	}
+
+	spid->crc_errors++;
+
+	// a Controller's response or ACK was corrupted
+	if (spid->target_device != NULL)
+	{
+		spi_io_retry(spid);
+	}
+	// a Target drops the packet and asks for it again
+	else
+	{
+		spid->op &= ~SPIOP_RX;
+		spid->rearm_after_tx = false;
+		spi_io_acknowledge(spid, SPI_NACK);
+	}
 }
 
-void HAL_SPI_AbortCpltCallback(SPI_HandleTypeDef *hspi)
+ITCM_FUNC void HAL_SPI_AbortCpltCallback(SPI_HandleTypeDef *hspi)
 {
 	if (!is_initialized) return;
 
 	SPIDevice_t *spid = hspi_to_struct(hspi);
 	spid->state |= SPISTATE_ABORT;
+	spi_io_push_event(spid, SPIEVT_ABORT, 0);
+
+	if (spid->recovery == SPIRECOVERY_ABORTING)
+	{
+		spid->recovery = SPIRECOVERY_ABORTED;
+	}
 }
 
-void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+ITCM_FUNC void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
 {
 	SPIDevice_t *spid = hspi_to_struct(hspi);
 
-	if (spid->tx_pos == 0)
+	spi_io_push_event(spid, SPIEVT_TX_CPLT, spid->tx_pos);
+
+	if (spid->target_device != NULL)
+	{
+		spi_trace_stamp(spid->txn_id, spid->tx_pos == 0 ? SPITRACE_HEADER_TX : SPITRACE_PAYLOAD_TX);
+	}
+
+	if (spid->tx_pos == 0 && spid->tx_buff->header.tx_len > 0)
 	{
 		spid->tx_pos = 1;
-		HAL_SPI_Transmit_IT(spid->handle, (uint8_t *)spid->tx_buff.data,
-				spid->tx_buff.header.tx_len);
+		spi_io_start_tx(spid, SPIPHASE_PAYLOAD, (uint8_t *)spid->tx_buff->data,
+				spi_io_clamp_len(spid->tx_buff->header.tx_len));
 	}
-	else
+	// a Target's response or a transmission without CS control
+	else if (spid->target_device == NULL)
 	{
-		// If this is a Controller callback,
-		// deselect the Target device.
-		// TODO: check here if we sent an Rx request,
-		//       in which case, we immediately transition to Rx mode
-		if (spid->target_device != NULL)
+		spi_io_complete_tx(spid);
+
+		if (spid->rearm_after_tx)
 		{
-			HAL_GPIO_WritePin(spid->target_device->cs_port_out,
-				spid->target_device->cs_pin_out, GPIO_PIN_SET);
-			spid->target_device = NULL;
+			spid->rearm_after_tx = false;
+			if (HAL_GPIO_ReadPin(spid->cs_port_in, spid->cs_pin_in) == GPIO_PIN_RESET)
+			{
+				spi_io_receive(spid);
+			}
 		}
 
-		HAL_Delay(2);
-
-		spid->state |= SPISTATE_TX_CPLT;
-		spid->op &= ~SPIOP_TX;
+		spi_io_rearm_hard_nss(spid);
+	}
+	// a Controller's read request: wait for the Target to turn around
+	else if (spid->tx_buff->header.opcode == SPIOP_RX)
+	{
+		spi_io_wait(spid, SPIPHASE_TURNAROUND, spid->target_device->turnaround_us, spi_io_turnaround_elapsed);
+	}
+	// a CRC-protected write waits for the Target to acknowledge it
+	else if (spid->crc_enabled)
+	{
+		spi_io_wait(spid, SPIPHASE_TURNAROUND, spid->target_device->turnaround_us, spi_io_ack_turnaround_elapsed);
+	}
+	// a stream continues under the same CS after the Target's turnaround
+	else if (spi_io_can_chain(spid))
+	{
+		spi_io_wait(spid, SPIPHASE_TURNAROUND, spid->target_device->turnaround_us, spi_io_chain_elapsed);
+	}
+	// a Controller's write: deselect the Target once its hold time has elapsed
+	else
+	{
+		spi_io_start_cs_hold(spid);
 	}
 }
 
-void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+ITCM_FUNC void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
 {
 	SPIDevice_t *spid = hspi_to_struct(hspi);
 
-	if (spid->rx_pos == 0)
+	spi_io_push_event(spid, SPIEVT_RX_CPLT, spid->rx_pos);
+
+	spi_trace_stamp(spid->txn_id, spid->target_device != NULL ? SPITRACE_RESPONSE_RX
+			: spid->rx_pos == 0 ? SPITRACE_HEADER_RX : SPITRACE_PAYLOAD_RX);
+
+	// a Controller only receives the response to its own read request,
+	// or the acknowledgement of its CRC-protected write
+	if (spid->target_device != NULL)
+	{
+		if (spid->tx_buff->header.opcode == SPIOP_RX)
+		{
+			spi_io_process_response(spid);
+			spi_io_start_cs_hold(spid);
+		}
+		else
+		{
+			spi_io_process_ack(spid);
+		}
+	}
+	// a Target checks a header before anything is sized from it
+	else if ((spid->rx_pos == 0 || spid->framing == SPIFRAME_SINGLE)
+		&& !spi_io_header_is_valid(&spid->rx_buff->header))
+	{
+		spi_io_reject_header(spid);
+	}
+	// header-only packets (e.g. read requests) have no payload phase
+	else if (spid->rx_pos == 0 && spid->rx_buff->header.tx_len > 0)
 	{
 		spid->rx_pos = 1;
-		HAL_SPI_Receive_IT(spid->handle,
-			(uint8_t *)spid->rx_buff.data,
-			spid->rx_buff.header.tx_len);
+		spi_io_start_rx(spid, SPIPHASE_PAYLOAD,
+			(uint8_t *)spid->rx_buff->data,
+			spid->rx_buff->header.tx_len);
+	}
+	else if (spid->rx_buff->header.opcode & SPI_OPCODE_STREAM)
+	{
+		spi_io_process_stream_chunk(spid);
+	}
+	else if (spid->rx_buff->header.opcode == SPI_OPCODE_PRBS)
+	{
+		spi_io_process_prbs(spid);
 	}
 	else
 	{
 		spi_io_process_rx(spid);
 	}
-
 }
@@ -10,6 +10,16 @@
 
 #define SPI_DATA_MAX_LEN (64u)
 #define SPI_REG_COUNT (2u)
+#define SPI_CS_SETUP_US_DEFAULT (10u)
+#define SPI_CS_HOLD_US_DEFAULT (2u)
+#define SPI_TURNAROUND_US_DEFAULT (10u)
+// must be a power of two no larger than 128, the queue indices wrap at 256
+#define SPI_TX_QUEUE_LEN (8u)
+#define SPI_CRC_MAX_RETRIES (3u)
+// slack added to every phase deadline on top of its expected duration
+#define SPI_TIMEOUT_MARGIN_US (1000u)
+#define SPI_ACK (0x79u)
+#define SPI_NACK (0x1Fu)
 
 #include <stdbool.h>
 #include <string.h>
@@ -17,6 +27,13 @@
 #include "main.h"
 
 #include "uart_io.h"
+#include "us_timer.h"
+#include "cycles.h"
+#include "spi_event.h"
+#include "spi_trace.h"
+#include "prbs.h"
+#include "mpu_cache.h"
+#include "tcm.h"
 
 typedef enum SPIOperation
 {
@@ -26,6 +43,54 @@ typedef enum SPIOperation
 	SPIOP_TX_RX = 0x03,
 } SPIOperation_t;
 
+/**
+ * Stream chunks carry SPI_OPCODE_STREAM in the header opcode, with
+ * SPI_OPCODE_FLAG_FINAL set on the last chunk. Since chunks never request
+ * a read, the rx_reg/rx_len bytes hold the 16 bit chunk sequence number.
+ * All chunks but the final one carry a full SPI_DATA_MAX_LEN payload.
+ */
+#define SPI_OPCODE_STREAM (0x04u)
+#define SPI_OPCODE_FLAG_FINAL (0x80u)
+#define SPI_HEADER_GET_SEQ(header) ((uint16_t)((header).rx_reg | ((header).rx_len << 8)))
+#define SPI_STREAM_MAX_LEN (SPI_DATA_MAX_LEN * 65536u)
+
+/**
+ * Bit error rate test packets carry SPI_OPCODE_PRBS, their payload continues
+ * a PRBS sequence the Target regenerates locally. Like stream chunks they
+ * hold a 16 bit sequence number in rx_reg/rx_len, letting the Target step
+ * its generator past lost packets instead of losing sync. Without CRC the
+ * number itself can be hit by a bit error, so only a gap of up to
+ * SPI_BER_MAX_GAP packets either way is taken at its word. Past that the
+ * Target resyncs, taking its generator state from the payload received.
+ */
+#define SPI_OPCODE_PRBS (0x08u)
+#define SPI_BER_MAX_GAP (16u)
+
+/**
+ * Phases of a transaction, each with its own deadline enforced by spi_io_poll().
+ * An expired phase has the device aborted, reset and re-initialized,
+ * after which it carries on with its queue.
+ */
+typedef enum SPIPhase
+{
+	SPIPHASE_IDLE = 0x00,
+	SPIPHASE_CS_SETUP = 0x01,
+	SPIPHASE_HEADER = 0x02,
+	SPIPHASE_PAYLOAD = 0x03,
+	SPIPHASE_TURNAROUND = 0x04,
+	SPIPHASE_RESPONSE = 0x05,
+	SPIPHASE_CS_HOLD = 0x06,
+} SPIPhase_t;
+
+#define SPI_PHASE_COUNT (7u)
+
+typedef enum SPIRecovery
+{
+	SPIRECOVERY_NONE = 0x00,
+	SPIRECOVERY_ABORTING = 0x01,
+	SPIRECOVERY_ABORTED = 0x02,
+} SPIRecovery_t;
+
 typedef enum SPIDeviceState
 {
 	SPISTATE_PENDING = 0x00,
@@ -45,6 +110,43 @@ typedef enum SPIDeviceState
 	SPISTATE_SELECTED = 0x20,
 } SPIDeviceState_t;
 
+typedef enum SPITransferMode
+{
+	SPIMODE_IT = 0x00,
+	SPIMODE_DMA = 0x01,
+} SPITransferMode_t;
+
+/**
+ * SPLIT framing sends the header and the payload as two transfers,
+ * letting the target size the payload reception from the received header.
+ * SINGLE framing sends the whole SPIPacket_t as one fixed-size transfer,
+ * removing the gap between the phases at the cost of always clocking
+ * SPI_DATA_MAX_LEN payload bytes. Both sides of a link must agree.
+ */
+typedef enum SPIFraming
+{
+	SPIFRAME_SPLIT = 0x00,
+	SPIFRAME_SINGLE = 0x01,
+} SPIFraming_t;
+
+/**
+ * SOFT: the Controller drives the Target's CS through a GPIO, and the Target
+ * arms its reception from the EXTI on the CS falling edge.
+ * HARD: Targets use SPI_NSS_HARD_INPUT and keep a reception armed while idle,
+ * since an unselected peripheral ignores the clock. A Controller uses
+ * SPI_NSS_HARD_OUTPUT, asserting its NSS pin for the duration of a packet.
+ * HARD_PULSE: a Controller additionally pulses NSS between data frames.
+ * The CS GPIOs and their EXTI stay in use in every mode, the NSS pins are
+ * wired in parallel: SPIx_CS_OUT to the Target's SPIx_NSS, or SPI1_NSS to it
+ * when the Controller drives NSS itself.
+ */
+typedef enum SPINSSMode
+{
+	SPINSS_SOFT = 0x00,
+	SPINSS_HARD = 0x01,
+	SPINSS_HARD_PULSE = 0x02,
+} SPINSSMode_t;
+
 typedef struct SPIHeader
 {
 	uint8_t pad_head[2];
@@ -62,21 +164,150 @@ typedef struct SPIPacket
 	uint8_t data[SPI_DATA_MAX_LEN];
 } SPIPacket_t;
 
+/**
+ * Pending packets of a device, in a lock-free single-producer/single-consumer
+ * ring: spi_io_transmit() only advances the head, the transfer completion
+ * path only advances the tail.
+ */
+typedef struct SPIQueueEntry
+{
+	SPIPacket_t packet;
+	struct SPIDevice *target_device;
+	uint32_t enqueue_cycles;
+} SPIQueueEntry_t;
+
+typedef struct SPITxQueue
+{
+	SPIQueueEntry_t entries[SPI_TX_QUEUE_LEN];
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	uint8_t high_water;
+	uint32_t enqueue_failures;
+	uint32_t dequeue_count;
+	uint32_t delay_min_cycles;
+	uint32_t delay_max_cycles;
+	uint64_t delay_total_cycles;
+} SPITxQueue_t;
+
+/**
+ * Reassembly state of a Target listening for a stream,
+ * the buffer is provided by the caller of spi_io_stream_listen().
+ */
+typedef struct SPIStream
+{
+	uint8_t *buffer;
+	uint32_t capacity;
+	volatile uint32_t length;
+	volatile uint16_t next_seq;
+	volatile bool complete;
+	uint32_t chunk_count;
+	uint32_t seq_errors;
+	uint32_t overflow_errors;
+} SPIStream_t;
+
+/**
+ * Bit error counting state of a Target, see spi_io_ber_listen().
+ */
+typedef struct SPIBer
+{
+	PRBSGenerator_t prbs;
+	volatile bool active;
+	uint16_t next_seq;
+	uint32_t packet_count;
+	uint32_t missed_packets;
+	uint32_t duplicate_packets;
+	uint32_t resyncs;
+	uint64_t bit_count;
+	uint64_t bit_errors;
+	uint64_t check_cycles;
+} SPIBer_t;
+
+/**
+ * What the DMA streams of a device read and write, kept out of SPIDevice_t
+ * in the uncached DMA_BUFFER memory, see mpu_cache.h. The device points
+ * at its set.
+ */
+typedef struct SPIDeviceBuffers
+{
+	SPIPacket_t tx_buff;
+	SPIPacket_t rx_buff;
+	uint8_t ack_byte;
+} SPIDeviceBuffers_t;
+
 typedef struct SPIDevice
 {
 	SPI_HandleTypeDef *handle;
 	GPIO_TypeDef *cs_port_in;
 	GPIO_TypeDef *cs_port_out;
+	GPIO_TypeDef *nss_port;
 	struct SPIDevice *target_device;
 	uint16_t cs_pin_in;
 	uint16_t cs_pin_out;
+	uint16_t nss_pin;
+	uint8_t nss_af;
+	SPINSSMode_t nss;
+	// the time a Target needs between CS falling and the first clock,
+	// and between the last clock and CS rising, enforced by the Controller
+	uint16_t cs_setup_us;
+	uint16_t cs_hold_us;
+	// the time a Target needs between receiving a read request
+	// and having its response ready to be clocked out
+	uint16_t turnaround_us;
+	// stamped by the Controller when selecting this Target, the delays until
+	// the Target had its reception armed are kept for latency measurements
+	volatile uint32_t select_cycles;
+	uint32_t arm_latency_max_cycles;
+	uint32_t arm_latency_total_cycles;
+	uint32_t arm_latency_count;
+	// the transaction being traced, set on the Target by the Controller selecting it
+	volatile uint32_t txn_id;
 	volatile SPIDeviceState_t state;
 	volatile SPIOperation_t op;
+	SPITransferMode_t mode;
+	SPIFraming_t framing;
 	volatile uint8_t tx_pos;
 	volatile uint8_t rx_pos;
-	volatile SPIPacket_t tx_buff;
-	volatile SPIPacket_t rx_buff;
+	volatile SPIPacket_t *tx_buff;
+	volatile SPIPacket_t *rx_buff;
 	volatile char regs[SPI_REG_COUNT][SPI_DATA_MAX_LEN];
+	SPITxQueue_t tx_queue;
+	SPIStream_t stream;
+	SPIBer_t ber;
+	uint32_t rx_packets;
+	// packets a Target dropped for an inconsistent header, see spi_io_transmit_raw()
+	uint32_t header_errors;
+	// a Target that dropped a packet drains the rest of it once deselected
+	volatile bool resync_pending;
+	uint32_t read_errors;
+	uint32_t response_drops;
+	/**
+	 * In CRC mode every transfer is trailed by the CRC byte the peripheral
+	 * computes, and checked by the receiving peripheral. A failed check is
+	 * reported as HAL_SPI_ERROR_CRC. Each Controller write is then followed,
+	 * after the Target's turnaround, by a one byte ACK/NACK from the Target,
+	 * and NACKed or unanswered packets are sent again under a fresh CS assertion,
+	 * at most SPI_CRC_MAX_RETRIES times. Reads are retried the same way when their
+	 * response fails the check. Both sides of a link must agree, see spi_io_set_crc().
+	 */
+	bool crc_enabled;
+	volatile bool retry_pending;
+	// a Target re-arms its reception once its ACK of a stream chunk is out
+	volatile bool rearm_after_tx;
+	uint8_t retries;
+	volatile uint8_t *ack_byte;
+	uint32_t crc_errors;
+	uint32_t crc_retransmits;
+	uint32_t crc_failures;
+	uint32_t acked_bytes;
+	volatile SPIPhase_t phase;
+	volatile uint32_t phase_start_cycles;
+	volatile uint32_t phase_timeout_cycles;
+	volatile SPIRecovery_t recovery;
+	uint32_t recovery_start_cycles;
+	uint32_t phase_timeouts[SPI_PHASE_COUNT];
+	uint32_t recovery_count;
+	uint32_t recovery_last_cycles;
+	uint32_t recovery_max_cycles;
 	char name[8];
 } SPIDevice_t;
 
@@ -87,7 +318,32 @@ extern SPI_HandleTypeDef hspi5;
 bool spi_io_is_initialized(void);
 void spi_io_initialize(void);
 SPIDevice_t* hspi_to_struct(SPI_HandleTypeDef *hspi);
+SPIDevice_t* spi_io_get_device(uint8_t index);
+uint8_t spi_io_get_index(SPIDevice_t *spid);
 bool spi_io_transmit(SPIDevice_t *spid, uint8_t *data, uint8_t len, uint8_t dst_reg, SPIDevice_t *target_device);
+bool spi_io_read(SPIDevice_t *spid, uint8_t src_reg, uint8_t len, SPIDevice_t *target_device);
+bool spi_io_transmit_raw(SPIDevice_t *spid, const SPIHeader_t *header, const uint8_t *data, SPIDevice_t *target_device);
 bool spi_io_receive(SPIDevice_t *spid);
+uint32_t spi_io_stream_send(SPIDevice_t *spid, const uint8_t *data, uint32_t len, SPIDevice_t *target_device);
+void spi_io_stream_listen(SPIDevice_t *spid, uint8_t *buffer, uint32_t capacity);
+bool spi_io_ber_send(SPIDevice_t *spid, PRBSGenerator_t *prbs, uint8_t len, uint16_t seq, SPIDevice_t *target_device);
+void spi_io_ber_listen(SPIDevice_t *spid, PRBSType_t type, bool active);
+bool spi_io_set_mode(SPIDevice_t *spid, SPITransferMode_t mode);
+bool spi_io_set_framing(SPIDevice_t *spid, SPIFraming_t framing);
+bool spi_io_set_crc(SPIDevice_t *spid, bool enabled);
+bool spi_io_set_nss(SPIDevice_t *spid, SPINSSMode_t nss);
+bool spi_io_set_prescaler(SPIDevice_t *spid, uint16_t divider);
+uint16_t spi_io_get_prescaler(SPIDevice_t *spid);
+uint32_t spi_io_get_kernel_clock(SPIDevice_t *spid);
+uint32_t spi_io_get_bitrate(SPIDevice_t *spid);
+bool spi_io_set_max_bitrate(SPIDevice_t *spid, uint32_t max_bitrate);
+void spi_io_reset_crc_stats(SPIDevice_t *spid);
+void spi_io_poll(void);
+bool spi_io_is_idle(SPIDevice_t *spid);
+void spi_io_reset_recovery_stats(SPIDevice_t *spid);
+void spi_io_set_cs_timing(SPIDevice_t *spid, uint16_t setup_us, uint16_t hold_us);
+void spi_io_set_turnaround(SPIDevice_t *spid, uint16_t turnaround_us);
+uint8_t spi_io_queue_depth(SPIDevice_t *spid);
+void spi_io_reset_queue_stats(SPIDevice_t *spid);
 
 #endif /* UTILS_SPI_IO_H_ */
@@ -0,0 +1,123 @@
+/*
+ * spi_trace.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "spi_trace.h"
+
+SPITraceRecord_t spi_trace_records[SPI_TRACE_SLOTS];
+
+static volatile uint32_t opened = 0;
+static uint32_t collected = 0;
+static uint32_t lost = 0;
+static SPITraceStats_t stats[SPI_TRACE_DEVICES][SPI_TRACE_POINT_COUNT];
+
+static void spi_trace_add(SPITraceStats_t *point_stats, uint32_t cycles)
+{
+	uint32_t bin = 0;
+	uint32_t scaled = cycles >> SPI_TRACE_HIST_SHIFT;
+
+	if (scaled > 0) bin = 32u - __CLZ(scaled);
+	if (bin >= SPI_TRACE_HIST_BINS) bin = SPI_TRACE_HIST_BINS - 1;
+
+	if (point_stats->count == 0 || cycles < point_stats->min) point_stats->min = cycles;
+	if (cycles > point_stats->max) point_stats->max = cycles;
+	point_stats->count++;
+	point_stats->total += cycles;
+	point_stats->hist[bin]++;
+}
+
+/**
+ * Starts a new transaction record, returning its ID.
+ * Only the Controller opens records, from its transfer start path.
+ */
+uint32_t spi_trace_open(uint8_t device, uint8_t target)
+{
+	uint32_t txn = opened;
+	SPITraceRecord_t *record = spi_trace_records + (txn & (SPI_TRACE_SLOTS - 1));
+
+	bzero((uint32_t *)record->stamps, sizeof(record->stamps));
+	record->device = device;
+	record->target = target;
+	record->txn = txn;
+
+	opened = txn + 1;
+
+	return txn;
+}
+
+/**
+ * Folds the finished transactions into the statistics, from thread context.
+ * A transaction is finished once CS is released, or once a later one started,
+ * as one that was aborted never releases CS on its own.
+ */
+void spi_trace_collect(void)
+{
+	SPITraceRecord_t snapshot;
+
+	while (collected != opened)
+	{
+		SPITraceRecord_t *record = spi_trace_records + (collected & (SPI_TRACE_SLOTS - 1));
+
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		memcpy(&snapshot, record, sizeof(snapshot));
+		uint32_t newest = opened;
+		__set_PRIMASK(primask);
+
+		// the slot was reused before it could be collected
+		if (snapshot.txn != collected)
+		{
+			lost++;
+			collected++;
+			continue;
+		}
+
+		if (snapshot.stamps[SPITRACE_CS_RELEASE] == 0 && newest - collected < 2) break;
+
+		if (snapshot.target < SPI_TRACE_DEVICES)
+		{
+			uint32_t prev = 0;
+
+			for (uint8_t point = 0; point < SPI_TRACE_POINT_COUNT; point++)
+			{
+				uint32_t stamp = snapshot.stamps[point];
+
+				if (stamp == 0) continue;
+
+				// points of both sides may land in either order when nearly simultaneous
+				if (prev != 0)
+				{
+					int32_t delta = (int32_t)(stamp - prev);
+					spi_trace_add(&stats[snapshot.target][point], delta > 0 ? (uint32_t)delta : 0u);
+				}
+
+				prev = stamp;
+			}
+		}
+
+		collected++;
+	}
+}
+
+const SPITraceStats_t *spi_trace_get_stats(uint8_t target, SPITracePoint_t point)
+{
+	if (target >= SPI_TRACE_DEVICES || point >= SPI_TRACE_POINT_COUNT) return NULL;
+
+	return &stats[target][point];
+}
+
+uint32_t spi_trace_lost(void)
+{
+	return lost;
+}
+
+void spi_trace_reset(void)
+{
+	spi_trace_collect();
+
+	bzero(stats, sizeof(stats));
+	lost = 0;
+}
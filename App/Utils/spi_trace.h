@@ -0,0 +1,84 @@
+/*
+ * spi_trace.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_SPI_TRACE_H_
+#define UTILS_SPI_TRACE_H_
+
+// must be a power of two, the number of transactions kept until collected
+#define SPI_TRACE_SLOTS (16u)
+#define SPI_TRACE_DEVICES (3u)
+#define SPI_TRACE_HIST_BINS (16u)
+// the first histogram bin spans 2^SHIFT cycles, each following one doubles
+#define SPI_TRACE_HIST_SHIFT (6u)
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "main.h"
+
+/**
+ * Trace points of a transaction, in the order they normally occur.
+ * Both the Controller and the Target stamp into the Controller's
+ * transaction record, the Target learning the transaction ID
+ * when it gets selected.
+ */
+typedef enum SPITracePoint
+{
+	SPITRACE_CS_ASSERT = 0x00,
+	SPITRACE_TGT_SELECTED = 0x01,
+	SPITRACE_HEADER_TX = 0x02,
+	SPITRACE_HEADER_RX = 0x03,
+	SPITRACE_PAYLOAD_TX = 0x04,
+	SPITRACE_PAYLOAD_RX = 0x05,
+	SPITRACE_PROCESS_START = 0x06,
+	SPITRACE_PROCESS_END = 0x07,
+	SPITRACE_RESPONSE_RX = 0x08,
+	SPITRACE_CS_RELEASE = 0x09,
+} SPITracePoint_t;
+
+#define SPI_TRACE_POINT_COUNT (10u)
+
+typedef struct SPITraceRecord
+{
+	volatile uint32_t stamps[SPI_TRACE_POINT_COUNT];
+	volatile uint32_t txn;
+	uint8_t device;
+	uint8_t target;
+} SPITraceRecord_t;
+
+/**
+ * Durations leading up to a trace point, measured from the latest earlier
+ * point stamped in the same transaction, in cycles.
+ */
+typedef struct SPITraceStats
+{
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint32_t hist[SPI_TRACE_HIST_BINS];
+} SPITraceStats_t;
+
+extern SPITraceRecord_t spi_trace_records[SPI_TRACE_SLOTS];
+
+/**
+ * A stamp is a single store, cheap enough to be left enabled.
+ * The lowest bit is forced so that zero marks a point never reached.
+ */
+static inline void spi_trace_stamp(uint32_t txn, SPITracePoint_t point)
+{
+	spi_trace_records[txn & (SPI_TRACE_SLOTS - 1)].stamps[point] = DWT->CYCCNT | 1u;
+}
+
+uint32_t spi_trace_open(uint8_t device, uint8_t target);
+void spi_trace_collect(void);
+const SPITraceStats_t *spi_trace_get_stats(uint8_t target, SPITracePoint_t point);
+uint32_t spi_trace_lost(void);
+void spi_trace_reset(void);
+
+#endif /* UTILS_SPI_TRACE_H_ */
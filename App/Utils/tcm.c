@@ -0,0 +1,48 @@
+/*
+ * tcm.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "tcm.h"
+
+// from the linker scripts, weak as a build with nothing placed has none
+extern const uint8_t __start_itcm_text[] __attribute__((weak));
+extern const uint8_t __stop_itcm_text[] __attribute__((weak));
+extern const uint8_t __start_dtcm_data[] __attribute__((weak));
+extern const uint8_t __stop_dtcm_data[] __attribute__((weak));
+extern const uint8_t __start_dtcm_bss[] __attribute__((weak));
+extern const uint8_t __stop_dtcm_bss[] __attribute__((weak));
+
+inline static uint32_t tcm_section_len(const uint8_t *start, const uint8_t *stop)
+{
+	return (uint32_t)((uintptr_t)stop - (uintptr_t)start);
+}
+
+uint32_t tcm_itcm_used(void)
+{
+	return tcm_section_len(__start_itcm_text, __stop_itcm_text);
+}
+
+uint32_t tcm_dtcm_used(void)
+{
+	return tcm_section_len(__start_dtcm_data, __stop_dtcm_data)
+			+ tcm_section_len(__start_dtcm_bss, __stop_dtcm_bss);
+}
+
+/**
+ * Which of the MCU's memories an address is in. Flash is reached over AXI,
+ * through the cache, unless the address is in its ITCM alias.
+ */
+const char *tcm_region_name(uintptr_t addr)
+{
+	if (addr >= RAMITCM_BASE && addr < RAMITCM_BASE + ITCM_SIZE) return "ITCM";
+	if (addr >= FLASHITCM_BASE && addr <= FLASHITCM_BASE + (FLASH_END - FLASHAXI_BASE)) return "flash (ITCM)";
+	if (addr >= FLASHAXI_BASE && addr <= FLASH_END) return "flash";
+	if (addr >= RAMDTCM_BASE && addr < RAMDTCM_BASE + DTCM_SIZE) return "DTCM";
+	if (addr >= SRAM1_BASE && addr < SRAM2_BASE) return "SRAM1";
+	if (addr >= SRAM2_BASE && addr < SRAM2_BASE + 16u * 1024u) return "SRAM2";
+
+	return "elsewhere";
+}
@@ -0,0 +1,39 @@
+/*
+ * tcm.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_TCM_H_
+#define UTILS_TCM_H_
+
+#include <stdint.h>
+
+#include "main.h"
+
+#define ITCM_SIZE (16u * 1024u)
+#define DTCM_SIZE (64u * 1024u)
+
+/**
+ * Places code in ITCM and data in DTCM, which the CPU reaches with no wait
+ * states and without going through the caches, for the paths an interrupt
+ * latency depends on. The startup code copies the ITCM code and the DTCM
+ * data from flash, and clears the DTCM bss, before main() runs.
+ *
+ * Calls between flash and ITCM are out of reach of a BL, the linker goes
+ * through a veneer for them. The linker scripts also pull the HAL's share
+ * of the SPI, DMA and EXTI interrupts into ITCM, by function name.
+ *
+ * The section names are C identifiers so that the host builds, with no
+ * linker script of their own, get the same __start_ and __stop_ symbols.
+ */
+#define ITCM_FUNC __attribute__((section("itcm_text")))
+#define DTCM_DATA __attribute__((section("dtcm_data")))
+#define DTCM_BSS __attribute__((section("dtcm_bss")))
+
+uint32_t tcm_itcm_used(void);
+uint32_t tcm_dtcm_used(void);
+const char *tcm_region_name(uintptr_t addr);
+
+#endif /* UTILS_TCM_H_ */
@@ -6,9 +6,136 @@
  */
 
 #include "uart_io.h"
+#include "frame.h"
+#include "usb_cdc.h"
 
 #define UART_PEER huart3
 
+static uint8_t tx_ring[UART_TX_RING_LEN];
+// the UART or USB sends from here, so that the ring is all queued output
+static uint8_t tx_chunk[SERIAL_USB_CHUNK_LEN];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+static volatile bool tx_busy = false;
+static UARTTxPolicy_t tx_policy = UARTTX_BLOCK;
+static UARTTxStats_t tx_stats = {0};
+static SerialTransport_t tx_transport = SERIALTRANSPORT_USB;
+
+static uint8_t rx_ring[UART_RX_RING_LEN];
+// the UART receives here, then the interrupt moves the bytes into the ring
+static uint8_t rx_chunk[UART_RX_CHUNK_LEN];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+static volatile bool rx_armed = false;
+static UARTRxStats_t rx_stats = {0};
+// the USB CDC class holds back OUT packets until the ring has room
+static volatile bool rx_usb_held = false;
+// a line ended by CR, so that the LF of a CR LF pair does not end another
+static bool rx_after_cr = false;
+
+static SerialFrameHandler_t frame_handler = NULL;
+static uint8_t rx_frame[UART_FRAME_MAX_LEN];
+static uint16_t rx_frame_len = 0;
+static bool rx_frame_open = false;
+static bool rx_frame_oversized = false;
+
+/**
+ * Hands the next chunk of queued output to the UART or the USB CDC port,
+ * unless a chunk is still being sent. The transport is picked per chunk.
+ * Called with interrupts masked, or from the TX complete interrupts.
+ */
+static void serial_tx_next(void)
+{
+	uint32_t pending = tx_head - tx_tail;
+
+	if (tx_busy || pending == 0) return;
+
+	bool usb = serial_active_transport() == SERIALTRANSPORT_USB;
+	uint16_t max_len = usb ? SERIAL_USB_CHUNK_LEN : UART_TX_CHUNK_LEN;
+	uint16_t len = pending > max_len ? max_len : (uint16_t)pending;
+
+	for (uint16_t idx = 0; idx < len; idx++)
+	{
+		tx_chunk[idx] = tx_ring[(tx_tail + idx) & (UART_TX_RING_LEN - 1)];
+	}
+
+	tx_tail += len;
+
+	if (usb ? usb_cdc_transmit(tx_chunk, len) : HAL_UART_Transmit_IT(&UART_PEER, tx_chunk, len) == HAL_OK)
+	{
+		tx_busy = true;
+	}
+	else
+	{
+		tx_stats.dropped_bytes += len;
+	}
+}
+
+/**
+ * Queues output for the UART, applying the policy when the ring is full.
+ */
+static void serial_write(const uint8_t *data, uint16_t len)
+{
+	uint16_t written = 0;
+	bool waited = false;
+
+	while (written < len)
+	{
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+
+		uint16_t remaining = len - written;
+		uint32_t room = UART_TX_RING_LEN - (tx_head - tx_tail);
+
+		if (room < remaining && tx_policy == UARTTX_DROP_OLDEST)
+		{
+			uint32_t evict = remaining - room;
+			uint32_t queued = tx_head - tx_tail;
+
+			if (evict > queued) evict = queued;
+
+			tx_tail += evict;
+			room += evict;
+			tx_stats.evicted_bytes += evict;
+		}
+
+		uint16_t count = room < remaining ? (uint16_t)room : remaining;
+
+		for (uint16_t idx = 0; idx < count; idx++)
+		{
+			tx_ring[(tx_head + idx) & (UART_TX_RING_LEN - 1)] = data[written + idx];
+		}
+
+		tx_head += count;
+		written += count;
+		tx_stats.queued_bytes += count;
+
+		uint32_t level = tx_head - tx_tail;
+		if (level > tx_stats.high_water) tx_stats.high_water = (uint16_t)level;
+
+		serial_tx_next();
+
+		__set_PRIMASK(primask);
+
+		if (written == len) break;
+
+		// nothing could drain the ring while this waits
+		if (tx_policy != UARTTX_BLOCK || primask != 0 || __get_IPSR() != 0)
+		{
+			tx_stats.dropped_bytes += len - written;
+			break;
+		}
+
+		if (!waited)
+		{
+			tx_stats.blocked_writes++;
+			waited = true;
+		}
+
+		__WFI();
+	}
+}
+
 static void serial_backspace_destructive(uint16_t count)
 {
 	static const uint8_t* backspace = (uint8_t *)"\b \b";
@@ -16,7 +143,7 @@ static void serial_backspace_destructive(uint16_t count)
 
 	for (uint16_t idx = 0; idx < count; idx++)
 	{
-		HAL_UART_Transmit(&UART_PEER, backspace, len, HAL_MAX_DELAY);
+		serial_write(backspace, len);
 	}
 }
 
@@ -25,13 +152,13 @@ static void serial_newline(void)
 	static const uint8_t newline[2] = {'\r', '\n'};
 	static const uint8_t len = 2;
 
-	HAL_UART_Transmit(&UART_PEER, newline, len, HAL_MAX_DELAY);
+	serial_write(newline, len);
 }
 
 void serial_print(const char *msg, uint16_t len)
 {
 	if (len == 0) len = strlen(msg);
-	HAL_UART_Transmit(&UART_PEER, (uint8_t *)msg, len, HAL_MAX_DELAY);
+	serial_write((uint8_t *)msg, len);
 }
 
 void serial_print_line(const char *msg, uint16_t len)
@@ -40,7 +167,7 @@ void serial_print_line(const char *msg, uint16_t len)
 	if (msg != NULL)
 	{
 		if (len == 0) len = strlen(msg);
-		HAL_UART_Transmit(&UART_PEER, (uint8_t *)msg, len, HAL_MAX_DELAY);
+		serial_write((uint8_t *)msg, len);
 	}
 
 	serial_newline();
@@ -48,46 +175,424 @@ void serial_print_line(const char *msg, uint16_t len)
 
 void serial_print_char(const char c)
 {
-	HAL_UART_Transmit(&UART_PEER, (uint8_t *)&c, 1, HAL_MAX_DELAY);
+	serial_write((uint8_t *)&c, 1);
 }
 
-uint8_t serial_scan(char *buffer, const uint8_t max_len, const char min, const char max)
+void serial_send(const uint8_t *data, uint16_t len)
+{
+	serial_write(data, len);
+}
+
+/**
+ * Moves a finished reception into the RX ring, dropping what does not fit.
+ * Called from the UART and USB interrupts, which share a priority.
+ */
+static void serial_rx_store(const uint8_t *data, uint16_t size)
+{
+	uint16_t idx = 0;
+
+	for (; idx < size && rx_head - rx_tail < UART_RX_RING_LEN; idx++)
+	{
+		rx_ring[rx_head & (UART_RX_RING_LEN - 1)] = data[idx];
+		rx_head++;
+	}
+
+	rx_stats.received_bytes += idx;
+	rx_stats.overflow_bytes += size - idx;
+
+	uint32_t level = rx_head - rx_tail;
+	if (level > rx_stats.high_water) rx_stats.high_water = (uint16_t)level;
+}
+
+/**
+ * Starts the next reception, which ends once the chunk is full or the line
+ * goes idle. Called with interrupts masked, or from the UART interrupt.
+ */
+static void serial_rx_arm(void)
 {
-	uint8_t inchar = ' ';
-	uint8_t input_idx = 0;
+	if (rx_armed) return;
+
+	rx_armed = HAL_UARTEx_ReceiveToIdle_IT(&UART_PEER, rx_chunk, UART_RX_CHUNK_LEN) == HAL_OK;
+}
+
+/**
+ * Bytes received and not read yet. Also starts the reception the first
+ * time, or again if the interrupt could not, and lets the USB host send
+ * more once there is room for it.
+ */
+uint16_t serial_rx_available(void)
+{
+	if (rx_usb_held && UART_RX_RING_LEN - (rx_head - rx_tail) >= USB_CDC_PACKET_LEN)
+	{
+		rx_usb_held = false;
+		usb_cdc_rx_resume();
+	}
+
+	if (!rx_armed)
+	{
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+
+		serial_rx_arm();
+
+		__set_PRIMASK(primask);
+	}
+
+	return (uint16_t)(rx_head - rx_tail);
+}
+
+bool serial_read_char(char *c)
+{
+	if (serial_rx_available() == 0) return false;
+
+	*c = (char)rx_ring[rx_tail & (UART_RX_RING_LEN - 1)];
+	rx_tail++;
+
+	return true;
+}
+
+void serial_line_begin(SerialLine_t *line, char *buffer, uint8_t max_len, char min, char max)
+{
+	line->buffer = buffer;
+	line->max_len = max_len;
+	line->len = 0;
+	line->min = min;
+	line->max = max;
 
 	bzero(buffer, max_len);
+}
+
+void serial_set_frame_handler(SerialFrameHandler_t handler)
+{
+	frame_handler = handler;
+	rx_frame_open = false;
+}
 
-	for(;;)
+/**
+ * Collects the bytes of a binary frame, handing the frame over once its
+ * closing delimiter arrives. Returns false for text bytes.
+ */
+static bool serial_frame_take(char inchar)
+{
+	if ((uint8_t)inchar == FRAME_DELIMITER)
+	{
+		// back to back delimiters keep the frame open
+		if (rx_frame_open && rx_frame_len > 0)
+		{
+			if (rx_frame_oversized)
+			{
+				rx_stats.oversized_frames++;
+			}
+			else
+			{
+				rx_stats.frames++;
+				frame_handler(rx_frame, rx_frame_len);
+			}
+
+			rx_frame_open = false;
+		}
+		else
+		{
+			rx_frame_open = true;
+		}
+
+		rx_frame_len = 0;
+		rx_frame_oversized = false;
+		return true;
+	}
+
+	if (!rx_frame_open) return false;
+
+	if (rx_frame_len < UART_FRAME_MAX_LEN)
+	{
+		rx_frame[rx_frame_len++] = (uint8_t)inchar;
+	}
+	else
+	{
+		rx_frame_oversized = true;
+	}
+
+	return true;
+}
+
+/**
+ * Takes the input received so far into the line without waiting for more.
+ * Returns true once the line is ended by CR or LF. Binary frames met on
+ * the way are handed to the frame handler, if one is set.
+ */
+bool serial_line_poll(SerialLine_t *line)
+{
+	char inchar;
+
+	while (serial_read_char(&inchar))
 	{
-		HAL_Delay(1);
+		if (frame_handler != NULL && serial_frame_take(inchar)) continue;
+
+		bool after_cr = rx_after_cr;
+		rx_after_cr = inchar == '\r';
 
-		if (HAL_OK == HAL_UART_Receive(&UART_PEER, &inchar, 1, 0x0))
+		switch (inchar)
 		{
-			switch (inchar)
+		case '\b':
+			if (line->len > 0)
+			{
+				line->len--;
+				line->buffer[line->len] = '\0';
+				serial_backspace_destructive(1);
+			}
+			continue;
+		case '\n':
+			if (after_cr) continue;
+			// fall through
+		case '\r':
+			// drop the LF of a CR LF pair now if it is already in
+			if (rx_after_cr && rx_head != rx_tail
+				&& rx_ring[rx_tail & (UART_RX_RING_LEN - 1)] == '\n')
+			{
+				rx_tail++;
+				rx_after_cr = false;
+			}
+			line->buffer[line->len] = '\0';
+			serial_newline();
+			return true;
+		default:
+			if (line->len >= line->max_len || inchar > line->max || inchar < line->min)
 			{
-			case '\b':
-				if (input_idx > 0)
-				{
-					buffer[input_idx] = '\0';
-					serial_backspace_destructive(1);
-					input_idx--;
-				}
 				continue;
-			case '\n':
-			case '\r':
-				buffer[input_idx] = '\0';
-				serial_newline();
-				return input_idx+1;
-			default:
-				if (input_idx >= max_len || inchar > max || inchar < min)
-				{
-					continue;
-				}
-				buffer[input_idx] = inchar;
-				serial_print_char(inchar);
-				input_idx++;
 			}
+			line->buffer[line->len] = inchar;
+			serial_print_char(inchar);
+			line->len++;
 		}
 	}
+
+	return false;
+}
+
+uint8_t serial_scan(char *buffer, const uint8_t max_len, const char min, const char max)
+{
+	SerialLine_t line;
+
+	serial_line_begin(&line, buffer, max_len, min, max);
+
+	// the reception interrupt wakes the core
+	while (!serial_line_poll(&line))
+	{
+		__WFI();
+	}
+
+	return line.len + 1;
+}
+
+/**
+ * Waits until all queued output has left the UART.
+ */
+void serial_flush(void)
+{
+	while (tx_head != tx_tail || tx_busy)
+	{
+		__WFI();
+	}
+}
+
+uint16_t serial_tx_pending(void)
+{
+	return (uint16_t)(tx_head - tx_tail);
+}
+
+void serial_set_tx_policy(UARTTxPolicy_t policy)
+{
+	tx_policy = policy;
+}
+
+UARTTxPolicy_t serial_get_tx_policy(void)
+{
+	return tx_policy;
+}
+
+void serial_get_tx_stats(UARTTxStats_t *stats)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	*stats = tx_stats;
+
+	__set_PRIMASK(primask);
+}
+
+void serial_reset_tx_stats(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	bzero(&tx_stats, sizeof(tx_stats));
+	tx_stats.high_water = (uint16_t)(tx_head - tx_tail);
+
+	__set_PRIMASK(primask);
+}
+
+void serial_get_rx_stats(UARTRxStats_t *stats)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	*stats = rx_stats;
+
+	__set_PRIMASK(primask);
+}
+
+void serial_reset_rx_stats(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	bzero(&rx_stats, sizeof(rx_stats));
+	rx_stats.high_water = (uint16_t)(rx_head - rx_tail);
+
+	__set_PRIMASK(primask);
+}
+
+/**
+ * Reconfigures the UART for another baud rate once the queued output has
+ * been sent. Input received so far stays readable, it came at the old rate.
+ */
+bool serial_set_baud(uint32_t baud, bool over8)
+{
+	serial_flush();
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (rx_armed)
+	{
+		uint16_t received = UART_PEER.RxXferSize - UART_PEER.RxXferCount;
+
+		HAL_UART_AbortReceive(&UART_PEER);
+		rx_armed = false;
+		serial_rx_store(rx_chunk, received);
+	}
+
+	__set_PRIMASK(primask);
+
+	UART_PEER.Init.BaudRate = baud;
+	UART_PEER.Init.OverSampling = over8 ? UART_OVERSAMPLING_8 : UART_OVERSAMPLING_16;
+
+	bool success = HAL_UART_Init(&UART_PEER) == HAL_OK;
+
+	if (success) serial_rx_available();
+
+	return success;
+}
+
+/**
+ * Re-derives the divider for the same baud rate after the APB1 clock
+ * changed, with 8x oversampling once 16x no longer reaches the rate.
+ */
+bool serial_update_clock(void)
+{
+	uint32_t baud = UART_PEER.Init.BaudRate;
+
+	return serial_set_baud(baud, baud > HAL_RCC_GetPCLK1Freq() / 16u);
+}
+
+/**
+ * The baud rate the programmed divider actually yields.
+ */
+uint32_t serial_get_baud(void)
+{
+	uint32_t brr = UART_PEER.Instance->BRR;
+	uint32_t clock = HAL_RCC_GetPCLK1Freq();
+
+	// with 8x oversampling BRR holds USARTDIV with its low nibble shifted right
+	if (UART_PEER.Init.OverSampling == UART_OVERSAMPLING_8)
+	{
+		uint32_t usartdiv = (brr & 0xFFF0u) | ((brr & 0x7u) << 1);
+		return usartdiv == 0 ? 0 : (uint32_t)(2u * (uint64_t)clock / usartdiv);
+	}
+
+	return brr == 0 ? 0 : clock / brr;
+}
+
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+	if (huart != &UART_PEER) return;
+
+	rx_armed = false;
+	serial_rx_store(rx_chunk, Size);
+	serial_rx_arm();
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	if (huart != &UART_PEER) return;
+
+	rx_stats.line_errors++;
+
+	// an overrun ends the reception, keep what it had received
+	if (rx_armed && huart->RxState == HAL_UART_STATE_READY)
+	{
+		rx_armed = false;
+		serial_rx_store(rx_chunk, huart->RxXferSize - huart->RxXferCount);
+		serial_rx_arm();
+	}
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart != &UART_PEER) return;
+
+	tx_busy = false;
+	serial_tx_next();
+}
+
+/**
+ * Selects the console output, see SerialTransport_t. Output already
+ * queued follows the new selection, a chunk in flight is finished first.
+ */
+void serial_set_transport(SerialTransport_t transport)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	tx_transport = transport;
+	serial_tx_next();
+
+	__set_PRIMASK(primask);
+}
+
+SerialTransport_t serial_get_transport(void)
+{
+	return tx_transport;
+}
+
+/**
+ * The transport the next output goes to: USART3 stands in for USB
+ * while no terminal has the CDC port open.
+ */
+SerialTransport_t serial_active_transport(void)
+{
+	if (tx_transport == SERIALTRANSPORT_USB && usb_cdc_is_connected()) return SERIALTRANSPORT_USB;
+
+	return SERIALTRANSPORT_UART;
+}
+
+void serial_usb_tx_complete(void)
+{
+	tx_busy = false;
+	serial_tx_next();
+}
+
+/**
+ * Takes a received OUT packet. Returns false once the ring has no room
+ * for another one, the class then holds the host back until
+ * serial_rx_available() finds room again.
+ */
+bool serial_usb_rx_store(const uint8_t *data, uint16_t len)
+{
+	serial_rx_store(data, len);
+
+	if (UART_RX_RING_LEN - (rx_head - rx_tail) >= USB_CDC_PACKET_LEN) return true;
+
+	rx_usb_held = true;
+	return false;
 }
@@ -17,11 +17,122 @@
 #define ASCII_PRINTABLE ' ', '~'
 #define ASCII_NUMERIC '0', '9'
 
+// the rate MX_USART3_UART_Init sets, and the one a failed switch returns to
+#define UART_DEFAULT_BAUD (115200u)
+
+// must be a power of two
+#define UART_TX_RING_LEN (2048u)
+// bytes handed to the UART per interrupt-driven transmission
+#define UART_TX_CHUNK_LEN (64u)
+// bytes handed to the USB CDC port per transfer, whole packets save interrupts
+#define SERIAL_USB_CHUNK_LEN (512u)
+
+/**
+ * Where the console output goes. USB sends it to the CDC port while
+ * a terminal has that open, and to USART3 otherwise. Input is taken from
+ * both, into the same RX ring.
+ */
+typedef enum SerialTransport
+{
+	SERIALTRANSPORT_UART = 0x00,
+	SERIALTRANSPORT_USB = 0x01,
+} SerialTransport_t;
+
+/**
+ * What a print does when the TX ring has no room left for it.
+ * BLOCK: waits for the UART to drain the ring, dropping the rest instead
+ * when called with interrupts masked or from an interrupt.
+ * DROP_NEWEST: drops what does not fit.
+ * DROP_OLDEST: drops output queued but not yet sent to make room.
+ */
+typedef enum UARTTxPolicy
+{
+	UARTTX_BLOCK = 0x00,
+	UARTTX_DROP_NEWEST = 0x01,
+	UARTTX_DROP_OLDEST = 0x02,
+} UARTTxPolicy_t;
+
+// must be a power of two, holds input typed or pasted ahead of the reader
+#define UART_RX_RING_LEN (1024u)
+// the most bytes taken per reception, it also ends when the line goes idle
+#define UART_RX_CHUNK_LEN (32u)
+// the longest binary frame taken from the input, without its delimiters
+#define UART_FRAME_MAX_LEN (256u)
+
+typedef struct UARTTxStats
+{
+	uint32_t queued_bytes;
+	// newest output that did not fit
+	uint32_t dropped_bytes;
+	// queued output discarded for newer one
+	uint32_t evicted_bytes;
+	// prints that had to wait for room
+	uint32_t blocked_writes;
+	uint16_t high_water;
+} UARTTxStats_t;
+
+typedef struct UARTRxStats
+{
+	uint32_t received_bytes;
+	// input lost to a full ring
+	uint32_t overflow_bytes;
+	// overrun, framing, noise and parity errors
+	uint32_t line_errors;
+	uint16_t high_water;
+	// binary frames handed to the frame handler, and the longer ones dropped
+	uint32_t frames;
+	uint32_t oversized_frames;
+} UARTRxStats_t;
+
+/**
+ * Takes binary frames out of the input read by serial_line_poll(), see
+ * frame.h: a frame opens with a zero byte and runs up to the next one,
+ * its bytes are neither echoed nor added to the line.
+ */
+typedef void (*SerialFrameHandler_t)(const uint8_t *frame, uint16_t len);
+
+/**
+ * A line being read by serial_line_poll(), which echoes the accepted
+ * characters and handles backspace. Characters outside min to max are
+ * ignored, as are those past max_len.
+ */
+typedef struct SerialLine
+{
+	char *buffer;
+	uint8_t max_len;
+	uint8_t len;
+	char min;
+	char max;
+} SerialLine_t;
+
 extern UART_HandleTypeDef huart3;
 
 void serial_print(const char *msg, uint16_t len);
 void serial_print_line(const char *msg, uint16_t len);
 void serial_print_char(const char c);
+void serial_send(const uint8_t *data, uint16_t len);
 uint8_t serial_scan(char *buffer, const uint8_t max_len, const char min, const char max);
+void serial_flush(void);
+uint16_t serial_tx_pending(void);
+void serial_set_tx_policy(UARTTxPolicy_t policy);
+UARTTxPolicy_t serial_get_tx_policy(void);
+void serial_get_tx_stats(UARTTxStats_t *stats);
+void serial_reset_tx_stats(void);
+uint16_t serial_rx_available(void);
+bool serial_read_char(char *c);
+void serial_line_begin(SerialLine_t *line, char *buffer, uint8_t max_len, char min, char max);
+bool serial_line_poll(SerialLine_t *line);
+void serial_get_rx_stats(UARTRxStats_t *stats);
+void serial_reset_rx_stats(void);
+bool serial_set_baud(uint32_t baud, bool over8);
+bool serial_update_clock(void);
+void serial_set_frame_handler(SerialFrameHandler_t handler);
+uint32_t serial_get_baud(void);
+void serial_set_transport(SerialTransport_t transport);
+SerialTransport_t serial_get_transport(void);
+SerialTransport_t serial_active_transport(void);
+// for the USB CDC class, called from its interrupt
+void serial_usb_tx_complete(void);
+bool serial_usb_rx_store(const uint8_t *data, uint16_t len);
 
 #endif /* UART_IO_H_ */
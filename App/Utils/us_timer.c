@@ -0,0 +1,121 @@
+/*
+ * us_timer.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "us_timer.h"
+
+#define US_TIMER_INSTANCE TIM6
+#define US_TIMER_IRQN TIM6_DAC_IRQn
+#define US_TIMER_IRQ_PRIORITY (2u)
+
+static volatile USTimerCallback_t pending_callback = NULL;
+static void * volatile pending_context = NULL;
+
+static uint32_t us_timer_get_clock(void)
+{
+	uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+
+	// APB1 timers run at twice the bus clock whenever the bus is divided
+	if ((RCC->CFGR & RCC_CFGR_PPRE1) == RCC_CFGR_PPRE1_DIV1)
+	{
+		return pclk1;
+	}
+
+	return pclk1 * 2u;
+}
+
+void us_timer_initialize(void)
+{
+	__HAL_RCC_TIM6_CLK_ENABLE();
+
+	US_TIMER_INSTANCE->CR1 = TIM_CR1_OPM | TIM_CR1_URS;
+	US_TIMER_INSTANCE->DIER = TIM_DIER_UIE;
+	us_timer_update_clock();
+
+	HAL_NVIC_SetPriority(US_TIMER_IRQN, US_TIMER_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(US_TIMER_IRQN);
+}
+
+/**
+ * Derives the prescaler for a 1 MHz count from the current bus clock.
+ * Must be called again whenever the system clock configuration changes.
+ */
+void us_timer_update_clock(void)
+{
+	US_TIMER_INSTANCE->PSC = (us_timer_get_clock() / 1000000u) - 1u;
+	// latch the prescaler, URS keeps this from raising the update flag
+	US_TIMER_INSTANCE->EGR = TIM_EGR_UG;
+	US_TIMER_INSTANCE->SR = 0;
+}
+
+bool us_timer_is_busy(void)
+{
+	return pending_callback != NULL;
+}
+
+ITCM_FUNC bool us_timer_start(uint16_t delay_us, USTimerCallback_t callback, void *context)
+{
+	if (callback == NULL) return false;
+	if (pending_callback != NULL) return false;
+
+	// nothing to wait for, run the callback right away
+	if (delay_us == 0)
+	{
+		callback(context);
+		return true;
+	}
+
+	pending_context = context;
+	pending_callback = callback;
+
+	// the update fires one tick after reaching ARR, erring on the safe side
+	US_TIMER_INSTANCE->CNT = 0;
+	US_TIMER_INSTANCE->ARR = delay_us;
+	US_TIMER_INSTANCE->CR1 |= TIM_CR1_CEN;
+
+	return true;
+}
+
+/**
+ * Stops the timer if its pending callback was armed with the given context.
+ */
+ITCM_FUNC void us_timer_cancel(void *context)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (pending_callback != NULL && pending_context == context)
+	{
+		US_TIMER_INSTANCE->CR1 &= ~TIM_CR1_CEN;
+		// UIF is the only flag of a basic timer
+		US_TIMER_INSTANCE->SR = 0;
+
+		pending_callback = NULL;
+		pending_context = NULL;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+ITCM_FUNC void us_timer_isr(void)
+{
+	if ((US_TIMER_INSTANCE->SR & TIM_SR_UIF) == 0) return;
+
+	// UIF is the only flag of a basic timer
+	US_TIMER_INSTANCE->SR = 0;
+
+	USTimerCallback_t callback = pending_callback;
+	void *context = pending_context;
+
+	// cleared before the call so that the callback may re-arm the timer
+	pending_callback = NULL;
+	pending_context = NULL;
+
+	if (callback != NULL)
+	{
+		callback(context);
+	}
+}
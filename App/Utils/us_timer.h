@@ -0,0 +1,32 @@
+/*
+ * us_timer.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_US_TIMER_H_
+#define UTILS_US_TIMER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "tcm.h"
+
+/**
+ * One-shot microsecond timer on TIM6.
+ * The HAL TIM module is not part of this project, so the basic timer
+ * is driven directly through its registers in one-pulse mode.
+ * The callback runs from the TIM6 interrupt.
+ */
+typedef void (*USTimerCallback_t)(void *context);
+
+void us_timer_initialize(void);
+void us_timer_update_clock(void);
+bool us_timer_is_busy(void);
+bool us_timer_start(uint16_t delay_us, USTimerCallback_t callback, void *context);
+void us_timer_cancel(void *context);
+void us_timer_isr(void);
+
+#endif /* UTILS_US_TIMER_H_ */
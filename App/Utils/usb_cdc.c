@@ -0,0 +1,692 @@
+/*
+ * usb_cdc.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include "usb_cdc.h"
+#include "uart_io.h"
+
+#define USB_PEER hpcd_USB_OTG_FS
+
+// standard requests, USB 2.0 chapter 9.4
+#define USB_REQ_GET_STATUS (0x00u)
+#define USB_REQ_CLEAR_FEATURE (0x01u)
+#define USB_REQ_SET_FEATURE (0x03u)
+#define USB_REQ_SET_ADDRESS (0x05u)
+#define USB_REQ_GET_DESCRIPTOR (0x06u)
+#define USB_REQ_GET_CONFIGURATION (0x08u)
+#define USB_REQ_SET_CONFIGURATION (0x09u)
+#define USB_REQ_GET_INTERFACE (0x0Au)
+#define USB_REQ_SET_INTERFACE (0x0Bu)
+
+// class requests, CDC PSTN subclass chapter 6.3
+#define CDC_REQ_SET_LINE_CODING (0x20u)
+#define CDC_REQ_GET_LINE_CODING (0x21u)
+#define CDC_REQ_SET_CONTROL_LINE_STATE (0x22u)
+#define CDC_REQ_SEND_BREAK (0x23u)
+
+#define USB_REQ_DIR_IN (0x80u)
+#define USB_REQ_TYPE_MASK (0x60u)
+#define USB_REQ_TYPE_STANDARD (0x00u)
+#define USB_REQ_TYPE_CLASS (0x20u)
+#define USB_REQ_RECIPIENT_MASK (0x1Fu)
+#define USB_REQ_RECIPIENT_DEVICE (0x00u)
+#define USB_REQ_RECIPIENT_INTERFACE (0x01u)
+#define USB_REQ_RECIPIENT_ENDPOINT (0x02u)
+
+#define USB_DESC_DEVICE (0x01u)
+#define USB_DESC_CONFIGURATION (0x02u)
+#define USB_DESC_STRING (0x03u)
+#define USB_FEATURE_ENDPOINT_HALT (0x00u)
+
+#define USB_CDC_CONFIG_VALUE (1u)
+#define USB_CDC_COMM_INTERFACE (0u)
+#define USB_CDC_LINE_CODING_LEN (7u)
+#define USB_CDC_CONTROL_LINE_DTR (0x0001u)
+
+// FIFO sizes in 32-bit words, the OTG FS core has 320 of them
+#define USB_CDC_RX_FIFO_WORDS (0x80u)
+#define USB_CDC_EP0_FIFO_WORDS (0x20u)
+#define USB_CDC_DATA_FIFO_WORDS (0x80u)
+#define USB_CDC_NOTIFY_FIFO_WORDS (0x10u)
+
+typedef enum USBControlStage
+{
+	USBCTRL_IDLE = 0x00,
+	USBCTRL_DATA_IN = 0x01,
+	USBCTRL_DATA_OUT = 0x02,
+	USBCTRL_STATUS_IN = 0x03,
+	USBCTRL_STATUS_OUT = 0x04,
+} USBControlStage_t;
+
+typedef struct USBSetup
+{
+	uint8_t request_type;
+	uint8_t request;
+	uint16_t value;
+	uint16_t index;
+	uint16_t length;
+} USBSetup_t;
+
+static const uint8_t device_descriptor[18] = {
+	18, USB_DESC_DEVICE,
+	0x00, 0x02,					// USB 2.0
+	0x02, 0x00, 0x00,			// communications device class
+	USB_CDC_PACKET_LEN,
+	USB_CDC_VID & 0xFF, USB_CDC_VID >> 8,
+	USB_CDC_PID & 0xFF, USB_CDC_PID >> 8,
+	0x00, 0x02,					// device release 2.00
+	1, 2, 3,					// manufacturer, product and serial number strings
+	1,
+};
+
+static const uint8_t configuration_descriptor[67] = {
+	9, USB_DESC_CONFIGURATION, 67, 0, 2, USB_CDC_CONFIG_VALUE, 0,
+	0x80, 50,					// bus powered, 100 mA
+	// communications interface, abstract control model
+	9, 0x04, USB_CDC_COMM_INTERFACE, 0, 1, 0x02, 0x02, 0x00, 0,
+	5, 0x24, 0x00, 0x10, 0x01,	// header, CDC 1.10
+	5, 0x24, 0x01, 0x00, 1,		// call management over the comm interface
+	4, 0x24, 0x02, 0x02,		// ACM: line coding and control line state
+	5, 0x24, 0x06, 0, 1,		// union of interfaces 0 and 1
+	7, 0x05, USB_CDC_NOTIFY_EP, 0x03, USB_CDC_NOTIFY_PACKET_LEN, 0, 16,
+	// data interface
+	9, 0x04, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+	7, 0x05, USB_CDC_DATA_OUT_EP, 0x02, USB_CDC_PACKET_LEN, 0, 0,
+	7, 0x05, USB_CDC_DATA_IN_EP, 0x02, USB_CDC_PACKET_LEN, 0, 0,
+};
+
+static const char *strings[] = { NULL, "STMicroelectronics", "SPI Test Console" };
+
+static volatile USBCDCState_t state = USBCDC_DETACHED;
+static USBCDCState_t resume_state = USBCDC_DETACHED;
+static volatile bool dtr = false;
+static USBCDCLineCoding_t line_coding = { 115200u, 0, 0, 8 };
+static USBCDCStats_t stats = {0};
+
+static USBControlStage_t ctrl_stage = USBCTRL_IDLE;
+static uint8_t ctrl_request = 0;
+static const uint8_t *ctrl_data = NULL;
+static uint16_t ctrl_remaining = 0;
+static bool ctrl_zlp = false;
+// string descriptors, short replies and the data of OUT requests
+static uint8_t ctrl_buff[USB_CDC_PACKET_LEN];
+
+static volatile bool tx_busy = false;
+static uint16_t tx_len = 0;
+static volatile bool rx_paused = false;
+static uint8_t rx_packet[USB_CDC_PACKET_LEN];
+
+/* Control transfers -------------------------------------------------------*/
+
+static void usb_cdc_ctrl_next_packet(void)
+{
+	uint16_t len = ctrl_remaining > USB_CDC_PACKET_LEN ? USB_CDC_PACKET_LEN : ctrl_remaining;
+
+	HAL_PCD_EP_Transmit(&USB_PEER, 0x80, (uint8_t *)ctrl_data, len);
+	ctrl_data += len;
+	ctrl_remaining -= len;
+}
+
+/**
+ * Starts the data stage of an IN request. The core sends a single packet
+ * per transfer on EP0, the DataIn callback queues the next one.
+ * A reply shorter than asked for that ends on a whole packet needs
+ * a zero-length packet to tell the host it is complete.
+ */
+static void usb_cdc_ctrl_send(const uint8_t *data, uint16_t len, uint16_t requested)
+{
+	if (len > requested) len = requested;
+
+	ctrl_data = data;
+	ctrl_remaining = len;
+	ctrl_zlp = len > 0 && len < requested && len % USB_CDC_PACKET_LEN == 0;
+	ctrl_stage = USBCTRL_DATA_IN;
+
+	usb_cdc_ctrl_next_packet();
+}
+
+static void usb_cdc_ctrl_receive(uint8_t request, uint16_t len)
+{
+	ctrl_request = request;
+	ctrl_stage = USBCTRL_DATA_OUT;
+
+	HAL_PCD_EP_Receive(&USB_PEER, 0x00, ctrl_buff, len);
+}
+
+static void usb_cdc_ctrl_status(void)
+{
+	ctrl_stage = USBCTRL_STATUS_IN;
+
+	HAL_PCD_EP_Transmit(&USB_PEER, 0x80, NULL, 0);
+}
+
+/**
+ * Refuses a request, the core clears the stall on the next SETUP packet.
+ */
+static void usb_cdc_ctrl_stall(void)
+{
+	ctrl_stage = USBCTRL_IDLE;
+	stats.stalled_requests++;
+
+	HAL_PCD_EP_SetStall(&USB_PEER, 0x80);
+	HAL_PCD_EP_SetStall(&USB_PEER, 0x00);
+}
+
+/* Data endpoints ----------------------------------------------------------*/
+
+static void usb_cdc_rx_arm(void)
+{
+	rx_paused = false;
+
+	HAL_PCD_EP_Receive(&USB_PEER, USB_CDC_DATA_OUT_EP, rx_packet, USB_CDC_PACKET_LEN);
+}
+
+/**
+ * Stops an output transfer the host is not going to read anymore and
+ * hands it back to the console, which goes on over USART3.
+ */
+static void usb_cdc_cancel_transmit(void)
+{
+	if (!tx_busy) return;
+
+	HAL_PCD_EP_Abort(&USB_PEER, USB_CDC_DATA_IN_EP);
+	HAL_PCD_EP_Flush(&USB_PEER, USB_CDC_DATA_IN_EP);
+
+	tx_busy = false;
+	stats.tx_lost_bytes += tx_len;
+	serial_usb_tx_complete();
+}
+
+/**
+ * Ends the transfers cut short by a reset or a deconfiguration.
+ */
+static void usb_cdc_end_transfers(void)
+{
+	dtr = false;
+	rx_paused = false;
+
+	usb_cdc_cancel_transmit();
+}
+
+static void usb_cdc_configure(uint8_t config)
+{
+	if (config == USB_CDC_CONFIG_VALUE && state != USBCDC_CONFIGURED)
+	{
+		HAL_PCD_EP_Open(&USB_PEER, USB_CDC_DATA_OUT_EP, USB_CDC_PACKET_LEN, EP_TYPE_BULK);
+		HAL_PCD_EP_Open(&USB_PEER, USB_CDC_DATA_IN_EP, USB_CDC_PACKET_LEN, EP_TYPE_BULK);
+		HAL_PCD_EP_Open(&USB_PEER, USB_CDC_NOTIFY_EP, USB_CDC_NOTIFY_PACKET_LEN, EP_TYPE_INTR);
+
+		state = USBCDC_CONFIGURED;
+		usb_cdc_rx_arm();
+	}
+	else if (config == 0 && state == USBCDC_CONFIGURED)
+	{
+		state = USBCDC_ADDRESSED;
+		usb_cdc_end_transfers();
+
+		HAL_PCD_EP_Close(&USB_PEER, USB_CDC_DATA_OUT_EP);
+		HAL_PCD_EP_Close(&USB_PEER, USB_CDC_DATA_IN_EP);
+		HAL_PCD_EP_Close(&USB_PEER, USB_CDC_NOTIFY_EP);
+	}
+}
+
+/* Requests ----------------------------------------------------------------*/
+
+/**
+ * Builds a string descriptor in ctrl_buff, the serial number is the
+ * device's unique ID in hex. Returns its length, 0 for unknown ones.
+ */
+static uint16_t usb_cdc_string_descriptor(uint8_t index)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char serial[25] = {0};
+	const char *text = NULL;
+	uint16_t len = 2;
+
+	if (index == 0)
+	{
+		// English (United States) only
+		ctrl_buff[2] = 0x09;
+		ctrl_buff[3] = 0x04;
+		len = 4;
+	}
+	else
+	{
+		if (index < sizeof(strings) / sizeof(strings[0]))
+		{
+			text = strings[index];
+		}
+		else if (index == 3)
+		{
+			uint32_t uid[3] = { HAL_GetUIDw0(), HAL_GetUIDw1(), HAL_GetUIDw2() };
+
+			for (uint8_t idx = 0; idx < 24; idx++)
+			{
+				serial[idx] = hex[(uid[idx / 8] >> (28 - 4 * (idx % 8))) & 0xF];
+			}
+			text = serial;
+		}
+		else
+		{
+			return 0;
+		}
+
+		for (; *text != '\0' && len + 2 <= sizeof(ctrl_buff); text++)
+		{
+			ctrl_buff[len++] = (uint8_t)*text;
+			ctrl_buff[len++] = 0;
+		}
+	}
+
+	ctrl_buff[0] = (uint8_t)len;
+	ctrl_buff[1] = USB_DESC_STRING;
+
+	return len;
+}
+
+static bool usb_cdc_device_request(const USBSetup_t *setup)
+{
+	switch (setup->request)
+	{
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (setup->value >> 8)
+		{
+		case USB_DESC_DEVICE:
+			usb_cdc_ctrl_send(device_descriptor, sizeof(device_descriptor), setup->length);
+			return true;
+		case USB_DESC_CONFIGURATION:
+			usb_cdc_ctrl_send(configuration_descriptor, sizeof(configuration_descriptor), setup->length);
+			return true;
+		case USB_DESC_STRING:
+		{
+			uint16_t len = usb_cdc_string_descriptor((uint8_t)setup->value);
+			if (len == 0) return false;
+			usb_cdc_ctrl_send(ctrl_buff, len, setup->length);
+			return true;
+		}
+		default:
+			// a full speed only device has no device qualifier
+			return false;
+		}
+	case USB_REQ_SET_ADDRESS:
+		if (setup->value > 127 || state == USBCDC_CONFIGURED) return false;
+		// the core answers the status stage from the old address
+		HAL_PCD_SetAddress(&USB_PEER, (uint8_t)setup->value);
+		state = setup->value == 0 ? USBCDC_DEFAULT : USBCDC_ADDRESSED;
+		usb_cdc_ctrl_status();
+		return true;
+	case USB_REQ_GET_CONFIGURATION:
+		ctrl_buff[0] = state == USBCDC_CONFIGURED ? USB_CDC_CONFIG_VALUE : 0;
+		usb_cdc_ctrl_send(ctrl_buff, 1, setup->length);
+		return true;
+	case USB_REQ_SET_CONFIGURATION:
+		if (setup->value > USB_CDC_CONFIG_VALUE || state < USBCDC_ADDRESSED) return false;
+		usb_cdc_configure((uint8_t)setup->value);
+		usb_cdc_ctrl_status();
+		return true;
+	case USB_REQ_GET_STATUS:
+		// bus powered, no remote wakeup
+		ctrl_buff[0] = 0;
+		ctrl_buff[1] = 0;
+		usb_cdc_ctrl_send(ctrl_buff, 2, setup->length);
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool usb_cdc_interface_request(const USBSetup_t *setup)
+{
+	if (state != USBCDC_CONFIGURED || setup->index > 1) return false;
+
+	switch (setup->request)
+	{
+	case USB_REQ_GET_STATUS:
+		ctrl_buff[0] = 0;
+		ctrl_buff[1] = 0;
+		usb_cdc_ctrl_send(ctrl_buff, 2, setup->length);
+		return true;
+	case USB_REQ_GET_INTERFACE:
+		ctrl_buff[0] = 0;
+		usb_cdc_ctrl_send(ctrl_buff, 1, setup->length);
+		return true;
+	case USB_REQ_SET_INTERFACE:
+		// there are no alternate settings
+		if (setup->value != 0) return false;
+		usb_cdc_ctrl_status();
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool usb_cdc_endpoint_request(const USBSetup_t *setup)
+{
+	uint8_t ep_addr = (uint8_t)setup->index;
+	uint8_t ep_num = ep_addr & 0x0F;
+
+	if (ep_num > 2 || (ep_num != 0 && state != USBCDC_CONFIGURED)) return false;
+
+	PCD_EPTypeDef *ep = ep_addr & 0x80 ? &USB_PEER.IN_ep[ep_num] : &USB_PEER.OUT_ep[ep_num];
+
+	switch (setup->request)
+	{
+	case USB_REQ_GET_STATUS:
+		ctrl_buff[0] = ep->is_stall ? 1 : 0;
+		ctrl_buff[1] = 0;
+		usb_cdc_ctrl_send(ctrl_buff, 2, setup->length);
+		return true;
+	case USB_REQ_CLEAR_FEATURE:
+		if (setup->value != USB_FEATURE_ENDPOINT_HALT) return false;
+		HAL_PCD_EP_ClrStall(&USB_PEER, ep_addr);
+		usb_cdc_ctrl_status();
+		return true;
+	case USB_REQ_SET_FEATURE:
+		if (setup->value != USB_FEATURE_ENDPOINT_HALT) return false;
+		HAL_PCD_EP_SetStall(&USB_PEER, ep_addr);
+		usb_cdc_ctrl_status();
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool usb_cdc_class_request(const USBSetup_t *setup)
+{
+	if ((setup->request_type & USB_REQ_RECIPIENT_MASK) != USB_REQ_RECIPIENT_INTERFACE
+		|| setup->index != USB_CDC_COMM_INTERFACE)
+	{
+		return false;
+	}
+
+	switch (setup->request)
+	{
+	case CDC_REQ_SET_LINE_CODING:
+		if (setup->length != USB_CDC_LINE_CODING_LEN) return false;
+		usb_cdc_ctrl_receive(setup->request, setup->length);
+		return true;
+	case CDC_REQ_GET_LINE_CODING:
+		memcpy(ctrl_buff, &line_coding.baud, sizeof(line_coding.baud));
+		ctrl_buff[4] = line_coding.stop_bits;
+		ctrl_buff[5] = line_coding.parity;
+		ctrl_buff[6] = line_coding.data_bits;
+		usb_cdc_ctrl_send(ctrl_buff, USB_CDC_LINE_CODING_LEN, setup->length);
+		return true;
+	case CDC_REQ_SET_CONTROL_LINE_STATE:
+		// terminals raise DTR when they open the port and drop it on closing,
+		// after which the host no longer reads what is in flight
+		dtr = (setup->value & USB_CDC_CONTROL_LINE_DTR) != 0;
+		if (!dtr) usb_cdc_cancel_transmit();
+		usb_cdc_ctrl_status();
+		return true;
+	case CDC_REQ_SEND_BREAK:
+		usb_cdc_ctrl_status();
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* HAL callbacks -----------------------------------------------------------*/
+
+void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd)
+{
+	if (hpcd != &USB_PEER) return;
+
+	const uint8_t *raw = (const uint8_t *)hpcd->Setup;
+	USBSetup_t setup = {
+		.request_type = raw[0],
+		.request = raw[1],
+		.value = (uint16_t)(raw[2] | raw[3] << 8),
+		.index = (uint16_t)(raw[4] | raw[5] << 8),
+		.length = (uint16_t)(raw[6] | raw[7] << 8),
+	};
+	bool handled = false;
+
+	// a SETUP packet ends whatever control transfer came before it
+	ctrl_stage = USBCTRL_IDLE;
+
+	switch (setup.request_type & USB_REQ_TYPE_MASK)
+	{
+	case USB_REQ_TYPE_STANDARD:
+		switch (setup.request_type & USB_REQ_RECIPIENT_MASK)
+		{
+		case USB_REQ_RECIPIENT_DEVICE:
+			handled = usb_cdc_device_request(&setup);
+			break;
+		case USB_REQ_RECIPIENT_INTERFACE:
+			handled = usb_cdc_interface_request(&setup);
+			break;
+		case USB_REQ_RECIPIENT_ENDPOINT:
+			handled = usb_cdc_endpoint_request(&setup);
+			break;
+		}
+		break;
+	case USB_REQ_TYPE_CLASS:
+		handled = usb_cdc_class_request(&setup);
+		break;
+	}
+
+	if (!handled) usb_cdc_ctrl_stall();
+}
+
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+	if (hpcd != &USB_PEER) return;
+
+	if (epnum == 0)
+	{
+		if (ctrl_stage == USBCTRL_DATA_IN)
+		{
+			if (ctrl_remaining > 0)
+			{
+				usb_cdc_ctrl_next_packet();
+			}
+			else if (ctrl_zlp)
+			{
+				ctrl_zlp = false;
+				HAL_PCD_EP_Transmit(&USB_PEER, 0x80, NULL, 0);
+			}
+			else
+			{
+				ctrl_stage = USBCTRL_STATUS_OUT;
+				HAL_PCD_EP_Receive(&USB_PEER, 0x00, NULL, 0);
+			}
+		}
+		else if (ctrl_stage == USBCTRL_STATUS_IN)
+		{
+			ctrl_stage = USBCTRL_IDLE;
+		}
+	}
+	else if (epnum == (USB_CDC_DATA_IN_EP & 0x0F) && tx_busy)
+	{
+		// the host only sees a transfer of whole packets end with a short one
+		if (tx_len > 0 && tx_len % USB_CDC_PACKET_LEN == 0)
+		{
+			tx_len = 0;
+			stats.zero_length_packets++;
+			HAL_PCD_EP_Transmit(&USB_PEER, USB_CDC_DATA_IN_EP, NULL, 0);
+			return;
+		}
+
+		tx_busy = false;
+		serial_usb_tx_complete();
+	}
+}
+
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+	if (hpcd != &USB_PEER) return;
+
+	if (epnum == 0)
+	{
+		if (ctrl_stage == USBCTRL_DATA_OUT)
+		{
+			if (ctrl_request == CDC_REQ_SET_LINE_CODING
+				&& HAL_PCD_EP_GetRxCount(hpcd, 0) >= USB_CDC_LINE_CODING_LEN)
+			{
+				memcpy(&line_coding.baud, ctrl_buff, sizeof(line_coding.baud));
+				line_coding.stop_bits = ctrl_buff[4];
+				line_coding.parity = ctrl_buff[5];
+				line_coding.data_bits = ctrl_buff[6];
+			}
+
+			usb_cdc_ctrl_status();
+		}
+		else if (ctrl_stage == USBCTRL_STATUS_OUT)
+		{
+			ctrl_stage = USBCTRL_IDLE;
+		}
+	}
+	else if (epnum == USB_CDC_DATA_OUT_EP && state == USBCDC_CONFIGURED)
+	{
+		uint16_t count = (uint16_t)HAL_PCD_EP_GetRxCount(hpcd, epnum);
+
+		stats.rx_packets++;
+		stats.rx_bytes += count;
+
+		// the next packet waits in the host until the reader makes room
+		if (serial_usb_rx_store(rx_packet, count))
+		{
+			usb_cdc_rx_arm();
+		}
+		else
+		{
+			rx_paused = true;
+			stats.rx_pauses++;
+		}
+	}
+}
+
+void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd)
+{
+	if (hpcd != &USB_PEER) return;
+
+	stats.bus_resets++;
+	state = USBCDC_DEFAULT;
+	ctrl_stage = USBCTRL_IDLE;
+	usb_cdc_end_transfers();
+
+	HAL_PCD_EP_Open(&USB_PEER, 0x00, USB_CDC_PACKET_LEN, EP_TYPE_CTRL);
+	HAL_PCD_EP_Open(&USB_PEER, 0x80, USB_CDC_PACKET_LEN, EP_TYPE_CTRL);
+}
+
+void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd)
+{
+	if (hpcd != &USB_PEER || state == USBCDC_DETACHED || state == USBCDC_SUSPENDED) return;
+
+	resume_state = state;
+	state = USBCDC_SUSPENDED;
+	usb_cdc_cancel_transmit();
+}
+
+void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd)
+{
+	if (hpcd != &USB_PEER || state != USBCDC_SUSPENDED) return;
+
+	state = resume_state;
+}
+
+void HAL_PCD_DisconnectCallback(PCD_HandleTypeDef *hpcd)
+{
+	if (hpcd != &USB_PEER) return;
+
+	state = USBCDC_DETACHED;
+	usb_cdc_end_transfers();
+}
+
+/* API ---------------------------------------------------------------------*/
+
+/**
+ * Sizes the FIFOs and connects to the bus, MX_USB_OTG_FS_PCD_Init()
+ * has set up the core.
+ */
+void usb_cdc_initialize(void)
+{
+	HAL_PCDEx_SetRxFiFo(&USB_PEER, USB_CDC_RX_FIFO_WORDS);
+	HAL_PCDEx_SetTxFiFo(&USB_PEER, 0, USB_CDC_EP0_FIFO_WORDS);
+	HAL_PCDEx_SetTxFiFo(&USB_PEER, USB_CDC_DATA_IN_EP & 0x0F, USB_CDC_DATA_FIFO_WORDS);
+	HAL_PCDEx_SetTxFiFo(&USB_PEER, USB_CDC_NOTIFY_EP & 0x0F, USB_CDC_NOTIFY_FIFO_WORDS);
+
+	HAL_PCD_Start(&USB_PEER);
+}
+
+/**
+ * Configured by the host and opened by a terminal, which raised DTR.
+ * A suspended bus sends nothing, the console then goes to USART3.
+ */
+bool usb_cdc_is_connected(void)
+{
+	return state == USBCDC_CONFIGURED && dtr;
+}
+
+USBCDCState_t usb_cdc_get_state(void)
+{
+	return state;
+}
+
+void usb_cdc_get_line_coding(USBCDCLineCoding_t *coding)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	*coding = line_coding;
+
+	__set_PRIMASK(primask);
+}
+
+/**
+ * Starts sending data, which has to stay untouched until the console is
+ * told the transfer completed. Called with interrupts masked, or from the
+ * USB interrupt. Returns false if the port is not open or still sending.
+ */
+bool usb_cdc_transmit(const uint8_t *data, uint16_t len)
+{
+	if (!usb_cdc_is_connected() || tx_busy || len == 0) return false;
+
+	tx_busy = true;
+	tx_len = len;
+	stats.tx_transfers++;
+	stats.tx_bytes += len;
+
+	HAL_PCD_EP_Transmit(&USB_PEER, USB_CDC_DATA_IN_EP, (uint8_t *)data, len);
+
+	return true;
+}
+
+/**
+ * Accepts the next OUT packet again after reception was held back,
+ * once the console has read enough to make room for it.
+ */
+void usb_cdc_rx_resume(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (rx_paused && state == USBCDC_CONFIGURED) usb_cdc_rx_arm();
+
+	__set_PRIMASK(primask);
+}
+
+void usb_cdc_get_stats(USBCDCStats_t *stats_out)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	*stats_out = stats;
+
+	__set_PRIMASK(primask);
+}
+
+void usb_cdc_reset_stats(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	bzero(&stats, sizeof(stats));
+
+	__set_PRIMASK(primask);
+}
@@ -0,0 +1,93 @@
+/*
+ * usb_cdc.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef UTILS_USB_CDC_H_
+#define UTILS_USB_CDC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "main.h"
+
+// full speed bulk and control endpoints take packets of up to 64 bytes
+#define USB_CDC_PACKET_LEN (64u)
+#define USB_CDC_NOTIFY_PACKET_LEN (8u)
+#define USB_CDC_DATA_OUT_EP (0x01u)
+#define USB_CDC_DATA_IN_EP (0x81u)
+#define USB_CDC_NOTIFY_EP (0x82u)
+
+// ST's VID and the PID of its virtual COM port, which hosts bind to CDC-ACM
+#define USB_CDC_VID (0x0483u)
+#define USB_CDC_PID (0x5740u)
+
+typedef enum USBCDCState
+{
+	USBCDC_DETACHED = 0x00,
+	USBCDC_DEFAULT = 0x01,
+	USBCDC_ADDRESSED = 0x02,
+	USBCDC_CONFIGURED = 0x03,
+	USBCDC_SUSPENDED = 0x04,
+} USBCDCState_t;
+
+/**
+ * The line coding the host last set. The data does not go through a UART,
+ * it only reports what the terminal program asked for.
+ */
+typedef struct USBCDCLineCoding
+{
+	uint32_t baud;
+	// 0: 1, 1: 1.5, 2: 2 stop bits
+	uint8_t stop_bits;
+	// 0: none, 1: odd, 2: even, 3: mark, 4: space
+	uint8_t parity;
+	uint8_t data_bits;
+} USBCDCLineCoding_t;
+
+typedef struct USBCDCStats
+{
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	uint32_t tx_transfers;
+	uint32_t rx_packets;
+	// zero-length packets ending transfers of whole packets
+	uint32_t zero_length_packets;
+	// OUT packets held back by the host while the RX ring had no room
+	uint32_t rx_pauses;
+	// output lost to a bus reset or disconnection while it was in flight
+	uint32_t tx_lost_bytes;
+	uint32_t bus_resets;
+	uint32_t stalled_requests;
+} USBCDCStats_t;
+
+extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
+
+/**
+ * A CDC-ACM device on the OTG FS core, on top of HAL_PCD: the standard
+ * requests of enumeration, the ACM class requests, a bulk IN and OUT
+ * endpoint pair for the data and an interrupt endpoint for notifications,
+ * of which none are sent.
+ *
+ * The data endpoints carry the console, see uart_io.h: received packets go
+ * into the console RX ring, and the next one is only accepted once the ring
+ * has room for it, so the host is held back instead of losing input.
+ * The console sends its queued output through usb_cdc_transmit() while the
+ * host holds DTR, i.e. a terminal has the port open.
+ *
+ * All of it runs from the OTG FS interrupt, which shares its priority with
+ * USART3, so the two never preempt each other on the console rings.
+ */
+void usb_cdc_initialize(void);
+bool usb_cdc_is_connected(void);
+USBCDCState_t usb_cdc_get_state(void);
+void usb_cdc_get_line_coding(USBCDCLineCoding_t *coding);
+bool usb_cdc_transmit(const uint8_t *data, uint16_t len);
+void usb_cdc_rx_resume(void);
+void usb_cdc_get_stats(USBCDCStats_t *stats);
+void usb_cdc_reset_stats(void);
+
+#endif /* UTILS_USB_CDC_H_ */
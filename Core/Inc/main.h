@@ -119,6 +119,15 @@ void Error_Handler(void);
 #define LD2_GPIO_Port GPIOB
 
 /* USER CODE BEGIN Private defines */
+#define SPI1_NSS_Pin GPIO_PIN_4
+#define SPI1_NSS_GPIO_Port GPIOA
+#define SPI1_NSS_AF GPIO_AF5_SPI1
+#define SPI3_NSS_Pin GPIO_PIN_15
+#define SPI3_NSS_GPIO_Port GPIOA
+#define SPI3_NSS_AF GPIO_AF6_SPI3
+#define SPI5_NSS_Pin GPIO_PIN_6
+#define SPI5_NSS_GPIO_Port GPIOF
+#define SPI5_NSS_AF GPIO_AF5_SPI5
 
 /* USER CODE END Private defines */
 
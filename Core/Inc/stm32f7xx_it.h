@@ -27,6 +27,7 @@ extern "C" {
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "tcm.h"
 
 /* USER CODE END Includes */
 
@@ -61,6 +62,21 @@ void SPI1_IRQHandler(void);
 void SPI3_IRQHandler(void);
 void SPI5_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+/* The SPI transactions' interrupts run from ITCM, see tcm.h */
+void EXTI2_IRQHandler(void) ITCM_FUNC;
+void EXTI3_IRQHandler(void) ITCM_FUNC;
+void SPI1_IRQHandler(void) ITCM_FUNC;
+void SPI3_IRQHandler(void) ITCM_FUNC;
+void SPI5_IRQHandler(void) ITCM_FUNC;
+void TIM6_DAC_IRQHandler(void) ITCM_FUNC;
+void DMA1_Stream0_IRQHandler(void) ITCM_FUNC;
+void DMA1_Stream5_IRQHandler(void) ITCM_FUNC;
+void DMA2_Stream0_IRQHandler(void) ITCM_FUNC;
+void DMA2_Stream3_IRQHandler(void) ITCM_FUNC;
+void DMA2_Stream4_IRQHandler(void) ITCM_FUNC;
+void DMA2_Stream5_IRQHandler(void) ITCM_FUNC;
+void USART3_IRQHandler(void);
+void OTG_FS_IRQHandler(void);
 
 /* USER CODE END EFP */
 
@@ -78,7 +78,8 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
-
+  // the MPU region of the DMA buffers has to be in place before the D-cache is on
+  mpu_cache_initialize();
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -41,6 +41,12 @@
 
 /* Private variables ---------------------------------------------------------*/
 /* USER CODE BEGIN PV */
+DMA_HandleTypeDef hdma_spi1_rx;
+DMA_HandleTypeDef hdma_spi1_tx;
+DMA_HandleTypeDef hdma_spi3_rx;
+DMA_HandleTypeDef hdma_spi3_tx;
+DMA_HandleTypeDef hdma_spi5_rx;
+DMA_HandleTypeDef hdma_spi5_tx;
 
 /* USER CODE END PV */
 
@@ -55,7 +61,43 @@
 /* USER CODE END ExternalFunctions */
 
 /* USER CODE BEGIN 0 */
+/**
+  * @brief Configures a DMA stream for an SPI direction and links it to the handle.
+  * The links are made unconditionally, the SPI I/O utils decide per device
+  * whether the IT or the DMA transfer functions are used.
+  */
+static void spi_dma_link(SPI_HandleTypeDef *hspi, DMA_HandleTypeDef *hdma,
+		DMA_Stream_TypeDef *stream, uint32_t channel, uint32_t direction,
+		IRQn_Type irqn, uint32_t priority)
+{
+  hdma->Instance = stream;
+  hdma->Init.Channel = channel;
+  hdma->Init.Direction = direction;
+  hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma->Init.MemInc = DMA_MINC_ENABLE;
+  hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+  hdma->Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+  hdma->Init.Mode = DMA_NORMAL;
+  hdma->Init.Priority = DMA_PRIORITY_HIGH;
+  hdma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+  if (HAL_DMA_Init(hdma) != HAL_OK)
+  {
+    Error_Handler();
+  }
 
+  if (direction == DMA_PERIPH_TO_MEMORY)
+  {
+    __HAL_LINKDMA(hspi, hdmarx, *hdma);
+  }
+  else
+  {
+    __HAL_LINKDMA(hspi, hdmatx, *hdma);
+  }
+
+  /* the DMA stream IRQ should share the priority of the SPI IRQ it serves */
+  HAL_NVIC_SetPriority(irqn, priority, 0);
+  HAL_NVIC_EnableIRQ(irqn);
+}
 /* USER CODE END 0 */
 /**
   * Initializes the Global MSP.
@@ -118,6 +160,12 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef* hspi)
     HAL_NVIC_SetPriority(SPI1_IRQn, 2, 0);
     HAL_NVIC_EnableIRQ(SPI1_IRQn);
     /* USER CODE BEGIN SPI1_MspInit 1 */
+    /* SPI1 DMA Init: RX on DMA2 Stream0, TX on DMA2 Stream3 */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    spi_dma_link(hspi, &hdma_spi1_rx, DMA2_Stream0, DMA_CHANNEL_3,
+    		DMA_PERIPH_TO_MEMORY, DMA2_Stream0_IRQn, 2);
+    spi_dma_link(hspi, &hdma_spi1_tx, DMA2_Stream3, DMA_CHANNEL_3,
+    		DMA_MEMORY_TO_PERIPH, DMA2_Stream3_IRQn, 2);
 
     /* USER CODE END SPI1_MspInit 1 */
   }
@@ -146,6 +194,12 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef* hspi)
     HAL_NVIC_SetPriority(SPI3_IRQn, 1, 0);
     HAL_NVIC_EnableIRQ(SPI3_IRQn);
     /* USER CODE BEGIN SPI3_MspInit 1 */
+    /* SPI3 DMA Init: RX on DMA1 Stream0, TX on DMA1 Stream5 */
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    spi_dma_link(hspi, &hdma_spi3_rx, DMA1_Stream0, DMA_CHANNEL_0,
+    		DMA_PERIPH_TO_MEMORY, DMA1_Stream0_IRQn, 1);
+    spi_dma_link(hspi, &hdma_spi3_tx, DMA1_Stream5, DMA_CHANNEL_0,
+    		DMA_MEMORY_TO_PERIPH, DMA1_Stream5_IRQn, 1);
 
     /* USER CODE END SPI3_MspInit 1 */
   }
@@ -174,6 +228,12 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef* hspi)
     HAL_NVIC_SetPriority(SPI5_IRQn, 1, 0);
     HAL_NVIC_EnableIRQ(SPI5_IRQn);
     /* USER CODE BEGIN SPI5_MspInit 1 */
+    /* SPI5 DMA Init: RX on DMA2 Stream5, TX on DMA2 Stream4 */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    spi_dma_link(hspi, &hdma_spi5_rx, DMA2_Stream5, DMA_CHANNEL_7,
+    		DMA_PERIPH_TO_MEMORY, DMA2_Stream5_IRQn, 1);
+    spi_dma_link(hspi, &hdma_spi5_tx, DMA2_Stream4, DMA_CHANNEL_2,
+    		DMA_MEMORY_TO_PERIPH, DMA2_Stream4_IRQn, 1);
 
     /* USER CODE END SPI5_MspInit 1 */
   }
@@ -206,6 +266,9 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef* hspi)
     /* SPI1 interrupt DeInit */
     HAL_NVIC_DisableIRQ(SPI1_IRQn);
     /* USER CODE BEGIN SPI1_MspDeInit 1 */
+    /* SPI DMA DeInit */
+    HAL_DMA_DeInit(hspi->hdmarx);
+    HAL_DMA_DeInit(hspi->hdmatx);
 
     /* USER CODE END SPI1_MspDeInit 1 */
   }
@@ -227,6 +290,9 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef* hspi)
     /* SPI3 interrupt DeInit */
     HAL_NVIC_DisableIRQ(SPI3_IRQn);
     /* USER CODE BEGIN SPI3_MspDeInit 1 */
+    /* SPI DMA DeInit */
+    HAL_DMA_DeInit(hspi->hdmarx);
+    HAL_DMA_DeInit(hspi->hdmatx);
 
     /* USER CODE END SPI3_MspDeInit 1 */
   }
@@ -248,6 +314,9 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef* hspi)
     /* SPI5 interrupt DeInit */
     HAL_NVIC_DisableIRQ(SPI5_IRQn);
     /* USER CODE BEGIN SPI5_MspDeInit 1 */
+    /* SPI DMA DeInit */
+    HAL_DMA_DeInit(hspi->hdmarx);
+    HAL_DMA_DeInit(hspi->hdmatx);
 
     /* USER CODE END SPI5_MspDeInit 1 */
   }
@@ -295,7 +364,9 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
     HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
 
     /* USER CODE BEGIN USART3_MspInit 1 */
-
+    /* USART3 interrupt Init, drains the serial TX ring */
+    HAL_NVIC_SetPriority(USART3_IRQn, 3, 0);
+    HAL_NVIC_EnableIRQ(USART3_IRQn);
     /* USER CODE END USART3_MspInit 1 */
 
   }
@@ -325,7 +396,8 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* huart)
     HAL_GPIO_DeInit(GPIOD, STLK_RX_Pin|STLK_TX_Pin);
 
     /* USER CODE BEGIN USART3_MspDeInit 1 */
-
+    /* USART3 interrupt DeInit */
+    HAL_NVIC_DisableIRQ(USART3_IRQn);
     /* USER CODE END USART3_MspDeInit 1 */
   }
 
@@ -379,7 +451,9 @@ void HAL_PCD_MspInit(PCD_HandleTypeDef* hpcd)
     /* Peripheral clock enable */
     __HAL_RCC_USB_OTG_FS_CLK_ENABLE();
     /* USER CODE BEGIN USB_OTG_FS_MspInit 1 */
-
+    /* USB OTG FS interrupt Init, shares the console priority with USART3 */
+    HAL_NVIC_SetPriority(OTG_FS_IRQn, 3, 0);
+    HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
     /* USER CODE END USB_OTG_FS_MspInit 1 */
 
   }
@@ -413,7 +487,8 @@ void HAL_PCD_MspDeInit(PCD_HandleTypeDef* hpcd)
                           |USB_DP_Pin);
 
     /* USER CODE BEGIN USB_OTG_FS_MspDeInit 1 */
-
+    /* USB OTG FS interrupt DeInit */
+    HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
     /* USER CODE END USB_OTG_FS_MspDeInit 1 */
   }
 
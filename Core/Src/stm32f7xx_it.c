@@ -22,6 +22,7 @@
 #include "stm32f7xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "us_timer.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -59,6 +60,14 @@ extern SPI_HandleTypeDef hspi1;
 extern SPI_HandleTypeDef hspi3;
 extern SPI_HandleTypeDef hspi5;
 /* USER CODE BEGIN EV */
+extern DMA_HandleTypeDef hdma_spi1_rx;
+extern DMA_HandleTypeDef hdma_spi1_tx;
+extern DMA_HandleTypeDef hdma_spi3_rx;
+extern DMA_HandleTypeDef hdma_spi3_tx;
+extern DMA_HandleTypeDef hdma_spi5_rx;
+extern DMA_HandleTypeDef hdma_spi5_tx;
+extern UART_HandleTypeDef huart3;
+extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
 
 /* USER CODE END EV */
 
@@ -272,4 +281,76 @@ void SPI5_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles TIM6 global interrupt (SPI CS setup/hold timing).
+  */
+void TIM6_DAC_IRQHandler(void)
+{
+  us_timer_isr();
+}
+
+/**
+  * @brief This function handles DMA1 Stream0 global interrupt (SPI3_RX).
+  */
+void DMA1_Stream0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi3_rx);
+}
+
+/**
+  * @brief This function handles DMA1 Stream5 global interrupt (SPI3_TX).
+  */
+void DMA1_Stream5_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi3_tx);
+}
+
+/**
+  * @brief This function handles DMA2 Stream0 global interrupt (SPI1_RX).
+  */
+void DMA2_Stream0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi1_rx);
+}
+
+/**
+  * @brief This function handles DMA2 Stream3 global interrupt (SPI1_TX).
+  */
+void DMA2_Stream3_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi1_tx);
+}
+
+/**
+  * @brief This function handles DMA2 Stream4 global interrupt (SPI5_TX).
+  */
+void DMA2_Stream4_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi5_tx);
+}
+
+/**
+  * @brief This function handles DMA2 Stream5 global interrupt (SPI5_RX).
+  */
+void DMA2_Stream5_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi5_rx);
+}
+
+/**
+  * @brief This function handles USART3 global interrupt (serial TX ring).
+  */
+void USART3_IRQHandler(void)
+{
+  HAL_UART_IRQHandler(&huart3);
+}
+
+/**
+  * @brief This function handles USB On The Go FS global interrupt (USB CDC console).
+  */
+void OTG_FS_IRQHandler(void)
+{
+  HAL_PCD_IRQHandler(&hpcd_USB_OTG_FS);
+}
+
 /* USER CODE END 1 */
@@ -94,6 +94,57 @@ LoopFillZerobss:
   cmp r2, r4
   bcc FillZerobss
 
+/* Copy the ITCM code and the DTCM data from flash, see tcm.h */
+  ldr r0, =__start_itcm_text
+  ldr r1, =__stop_itcm_text
+  ldr r2, =_siitcm_text
+  movs r3, #0
+  b LoopCopyItcmInit
+
+CopyItcmInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyItcmInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyItcmInit
+
+  ldr r0, =__start_dtcm_data
+  ldr r1, =__stop_dtcm_data
+  ldr r2, =_sidtcm_data
+  movs r3, #0
+  b LoopCopyDtcmDataInit
+
+CopyDtcmDataInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyDtcmDataInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyDtcmDataInit
+
+/* Zero fill the DTCM bss */
+  ldr r2, =__start_dtcm_bss
+  ldr r4, =__stop_dtcm_bss
+  movs r3, #0
+  b LoopFillZeroDtcmBss
+
+FillZeroDtcmBss:
+  str  r3, [r2]
+  adds r2, r2, #4
+
+LoopFillZeroDtcmBss:
+  cmp r2, r4
+  bcc FillZeroDtcmBss
+
+/* The ITCM code was written through the data side, complete it before fetching from there */
+  dsb
+  isb
+
 
 /* Call static constructors */
     bl __libc_init_array
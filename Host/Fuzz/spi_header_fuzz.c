@@ -0,0 +1,400 @@
+/*
+ * spi_header_fuzz.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+/**
+ * Drives the Target side of spi_io.c with arbitrary bus traffic on the
+ * simulated HAL. The input is read as a link configuration byte followed by
+ * bus operations against SPI3: selecting, clocking raw frames or packets
+ * built from the input, waiting and deselecting. After every operation the
+ * transfer the Target has armed must lie within its packet buffers. After
+ * every input the Target must settle back to idle, and accept a well-formed
+ * write right away, whatever frames it was left with.
+ *
+ * Built with libFuzzer the engine provides the inputs, otherwise main()
+ * replays the files given, or runs a number of random inputs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_board.h"
+#include "spi_io.h"
+
+// the index of SPI3 in spi_io.c
+#define FUZZ_TARGET_INDEX (1u)
+// one frame at the slowest bit clock, PCLK2/256
+#define FUZZ_FRAME_CYCLES (8u * 256u)
+// comfortably past the longest phase deadline
+#define FUZZ_SETTLE_CYCLES (20u * 72000u)
+#define FUZZ_RANDOM_MAX_LEN (512u)
+
+typedef struct FuzzInput
+{
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+} FuzzInput_t;
+
+static SPIDevice_t *target = NULL;
+static uint8_t stream_buff[4 * SPI_DATA_MAX_LEN];
+
+static void fuzz_fail(const char *reason)
+{
+	fprintf(stderr, "spi_header_fuzz: %s\n", reason);
+	abort();
+}
+
+static bool fuzz_has_more(FuzzInput_t *input)
+{
+	return input->pos < input->size;
+}
+
+static uint8_t fuzz_next(FuzzInput_t *input)
+{
+	return fuzz_has_more(input) ? input->data[input->pos++] : 0xFF;
+}
+
+/**
+ * Lengths and registers within bounds half of the time.
+ */
+static uint8_t fuzz_next_len(FuzzInput_t *input)
+{
+	uint8_t value = fuzz_next(input);
+
+	return (value & 0x80) ? value : value % (SPI_DATA_MAX_LEN + 1);
+}
+
+static uint8_t fuzz_next_reg(FuzzInput_t *input)
+{
+	uint8_t value = fuzz_next(input);
+
+	return (value & 0x80) ? value : value % SPI_REG_COUNT;
+}
+
+static bool fuzz_within(const volatile void *ptr, size_t len, const volatile void *base, size_t size)
+{
+	uintptr_t start = (uintptr_t)ptr;
+	uintptr_t limit = (uintptr_t)base + size;
+
+	return start >= (uintptr_t)base && start <= limit && len <= limit - start;
+}
+
+static void fuzz_check_buffers(void)
+{
+	SPI_HandleTypeDef *hspi = target->handle;
+
+	if (hspi->State == HAL_SPI_STATE_BUSY_RX
+		&& !fuzz_within(hspi->pRxBuffPtr, hspi->RxXferCount, target->rx_buff, sizeof(SPIPacket_t)))
+	{
+		fuzz_fail("reception armed past rx_buff");
+	}
+
+	if (hspi->State == HAL_SPI_STATE_BUSY_TX
+		&& !fuzz_within(hspi->pTxBuffPtr, hspi->TxXferCount, target->tx_buff, sizeof(SPIPacket_t))
+		&& !fuzz_within(hspi->pTxBuffPtr, hspi->TxXferCount, target->ack_byte, 1))
+	{
+		fuzz_fail("transmission armed past tx_buff");
+	}
+}
+
+static void fuzz_select(bool selected)
+{
+	HAL_GPIO_WritePin(SPI3_CS_OUT_GPIO_Port, SPI3_CS_OUT_Pin, selected ? GPIO_PIN_RESET : GPIO_PIN_SET);
+	fuzz_check_buffers();
+}
+
+static void fuzz_clock(uint8_t mosi)
+{
+	sim_spi_exchange(target->handle, mosi);
+	sim_advance(FUZZ_FRAME_CYCLES);
+	fuzz_check_buffers();
+}
+
+static void fuzz_clock_bytes(const uint8_t *data, size_t len)
+{
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		fuzz_clock(data[idx]);
+	}
+}
+
+/**
+ * Clocks a header built from the input, followed by as many payload frames
+ * as it announces, or by a count of its own, and optionally by the frames
+ * a Controller clocks for a response.
+ */
+static void fuzz_clock_packet(FuzzInput_t *input, uint8_t cmd)
+{
+	static const uint8_t opcodes[8] = {
+		SPIOP_TX, SPIOP_RX, SPIOP_TX, SPI_OPCODE_STREAM,
+		SPI_OPCODE_STREAM | SPI_OPCODE_FLAG_FINAL, SPI_OPCODE_PRBS, SPIOP_RX, 0x00
+	};
+
+	SPIHeader_t header = { .pad_head = { 255u, 255u }, .pad_tail = { 255u } };
+	uint8_t op = fuzz_next(input);
+
+	header.opcode = (op & 0x08) ? fuzz_next(input) : opcodes[op & 0x07];
+	header.tx_reg = fuzz_next_reg(input);
+	header.tx_len = fuzz_next_len(input);
+	header.rx_reg = fuzz_next_reg(input);
+	header.rx_len = fuzz_next_len(input);
+
+	if (cmd & 0x08)
+	{
+		uint8_t pad = fuzz_next(input);
+		uint8_t *pads[3] = { &header.pad_head[0], &header.pad_head[1], &header.pad_tail[0] };
+
+		*pads[pad % 3] = fuzz_next(input);
+	}
+
+	fuzz_clock_bytes((uint8_t *)&header, sizeof(header));
+
+	uint16_t payload_len = (cmd & 0x10) ? fuzz_next(input) % 96u : header.tx_len;
+
+	for (uint16_t idx = 0; idx < payload_len; idx++)
+	{
+		fuzz_clock(fuzz_next(input));
+	}
+
+	if (cmd & 0x20)
+	{
+		for (uint16_t idx = 0; idx <= header.rx_len + sizeof(SPIHeader_t); idx++)
+		{
+			fuzz_clock(0xFF);
+		}
+	}
+}
+
+/**
+ * Releases the Target and lets every deadline pass, then expects it idle:
+ * nothing in progress, or only a header reception armed that took no frame.
+ */
+static void fuzz_settle(void)
+{
+	fuzz_select(false);
+
+	for (uint8_t round = 0; round < 4; round++)
+	{
+		sim_advance(FUZZ_SETTLE_CYCLES);
+		spi_io_poll();
+	}
+
+	spi_event_flush();
+
+	// the simulated HAL counts DMA receptions down in RxXferCount as well
+	bool idle = target->op == SPIOP_NONE
+			|| (target->op == SPIOP_RX && target->phase == SPIPHASE_HEADER
+				&& target->handle->RxXferCount == target->handle->RxXferSize);
+
+	if (target->recovery != SPIRECOVERY_NONE || !idle)
+	{
+		fuzz_fail("Target did not settle");
+	}
+}
+
+static void fuzz_configure(uint8_t config)
+{
+	fuzz_settle();
+
+	// an idle Target in hardware NSS mode has its reception pre-armed
+	if (!spi_io_set_nss(target, SPINSS_SOFT)
+		|| !spi_io_set_framing(target, (config & 0x01) ? SPIFRAME_SINGLE : SPIFRAME_SPLIT)
+		|| !spi_io_set_mode(target, (config & 0x02) ? SPIMODE_DMA : SPIMODE_IT)
+		|| !spi_io_set_crc(target, (config & 0x08) != 0)
+		|| !spi_io_set_nss(target, (config & 0x04) ? SPINSS_HARD : SPINSS_SOFT))
+	{
+		fuzz_fail("Target refused its configuration");
+	}
+}
+
+/**
+ * Writes a register the way a Controller does, clocking the ACK in CRC mode.
+ */
+static bool fuzz_write(uint8_t reg, uint8_t len, uint8_t seed)
+{
+	SPIPacket_t packet = { .header = { .pad_head = { 255u, 255u }, .pad_tail = { 255u } } };
+	uint32_t rx_packets = target->rx_packets;
+
+	packet.header.opcode = SPIOP_TX;
+	packet.header.tx_reg = reg;
+	packet.header.tx_len = len;
+
+	for (uint8_t idx = 0; idx < SPI_DATA_MAX_LEN; idx++)
+	{
+		packet.data[idx] = (uint8_t)(seed + idx * 29u);
+	}
+
+	fuzz_select(true);
+	fuzz_clock_bytes((uint8_t *)&packet, target->framing == SPIFRAME_SINGLE
+			? sizeof(SPIPacket_t) : sizeof(SPIHeader_t) + len);
+	if (target->crc_enabled) fuzz_clock(0xFF);
+	fuzz_select(false);
+	spi_io_poll();
+
+	return target->rx_packets == rx_packets + 1
+		&& memcmp((uint8_t *)target->regs[reg], packet.data, len) == 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	FuzzInput_t input = { data, size, 0 };
+
+	if (target == NULL)
+	{
+		sim_board_initialize();
+		spi_io_initialize();
+		target = spi_io_get_device(FUZZ_TARGET_INDEX);
+		spi_io_stream_listen(target, stream_buff, sizeof(stream_buff));
+		spi_io_ber_listen(target, PRBS15, true);
+	}
+
+	uint8_t config = fuzz_next(&input);
+	fuzz_configure(config);
+
+	while (fuzz_has_more(&input))
+	{
+		uint8_t cmd = fuzz_next(&input);
+
+		switch (cmd & 0x07)
+		{
+		case 0:
+			fuzz_select(true);
+			break;
+		case 1:
+			fuzz_select(false);
+			break;
+		case 2:
+			for (uint8_t count = fuzz_next(&input) % 80u + 1u; count > 0; count--)
+			{
+				fuzz_clock(fuzz_next(&input));
+			}
+			break;
+		case 3:
+			fuzz_clock_packet(&input, cmd);
+			break;
+		case 4:
+			sim_advance((uint32_t)fuzz_next(&input) * 100u * 72u);
+			break;
+		case 5:
+			for (uint8_t count = fuzz_next(&input) % 80u + 1u; count > 0; count--)
+			{
+				fuzz_clock(0xFF);
+			}
+			break;
+		case 6:
+			fuzz_select(false);
+			fuzz_select(true);
+			break;
+		case 7:
+			spi_event_flush();
+			spi_trace_collect();
+			break;
+		}
+
+		spi_io_poll();
+		fuzz_check_buffers();
+	}
+
+	fuzz_settle();
+
+	// a stream test in progress would take the write's register
+	uint8_t reg = config >> 7;
+	uint8_t len = (uint8_t)(size % SPI_DATA_MAX_LEN) + 1u;
+
+	if (!fuzz_write(reg, len, (uint8_t)size))
+	{
+		fuzz_fail("Target rejects a well-formed write after the input");
+	}
+
+	return 0;
+}
+
+#ifndef SIM_LIBFUZZER
+
+static uint32_t fuzz_random(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+static int fuzz_replay(const char *path)
+{
+	static uint8_t buffer[1u << 16];
+
+	FILE *file = fopen(path, "rb");
+
+	if (file == NULL)
+	{
+		perror(path);
+		return 1;
+	}
+
+	size_t size = fread(buffer, 1, sizeof(buffer), file);
+	fclose(file);
+
+	LLVMFuzzerTestOneInput(buffer, size);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t buffer[FUZZ_RANDOM_MAX_LEN];
+
+	uint32_t iterations = 10000;
+	uint32_t seed = 1;
+	int arg = 1;
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++)
+	{
+		if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) iterations = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) seed = strtoul(argv[++arg], NULL, 0);
+		else
+		{
+			fprintf(stderr, "usage: %s [-n iterations] [-s seed] [input files...]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (arg < argc)
+	{
+		for (; arg < argc; arg++)
+		{
+			if (fuzz_replay(argv[arg]) != 0) return 1;
+		}
+
+		return 0;
+	}
+
+	if (seed == 0) seed = 1;
+
+	for (uint32_t iteration = 0; iteration < iterations; iteration++)
+	{
+		size_t size = fuzz_random(&seed) % FUZZ_RANDOM_MAX_LEN;
+
+		for (size_t idx = 0; idx < size; idx++)
+		{
+			buffer[idx] = (uint8_t)fuzz_random(&seed);
+		}
+
+		LLVMFuzzerTestOneInput(buffer, size);
+	}
+
+	printf("%lu inputs: %lu packets accepted, %lu headers rejected, %lu recoveries.\n",
+			(unsigned long)iterations, (unsigned long)target->rx_packets,
+			(unsigned long)target->header_errors, (unsigned long)target->recovery_count);
+
+	return 0;
+}
+
+#endif /* SIM_LIBFUZZER */
@@ -0,0 +1,28 @@
+/*
+ * sim_board.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef SIM_BOARD_H_
+#define SIM_BOARD_H_
+
+#include "main.h"
+
+/**
+ * The simulated counterpart of the CubeMX initialization in Core/Src/main.c:
+ * the same peripheral handles and settings, with each SPIx_CS_OUT pin wired
+ * to its Target's SPIx_CS_IN EXTI line and SPIx_NSS pin, and SPI1 as the
+ * Controller of the bus both Targets are on. The OTG FS core has no host
+ * on its bus until a harness drives one with the sim_usb_*() calls.
+ */
+extern SPI_HandleTypeDef hspi1;
+extern SPI_HandleTypeDef hspi3;
+extern SPI_HandleTypeDef hspi5;
+extern UART_HandleTypeDef huart3;
+extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
+
+void sim_board_initialize(void);
+
+#endif /* SIM_BOARD_H_ */
@@ -0,0 +1,891 @@
+/*
+ * sim_hal.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef SIM_HAL_H_
+#define SIM_HAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+/**
+ * Host stand-in for the part of the STM32F7 HAL, CMSIS and device headers
+ * the App sources use, so that they build unchanged on Linux.
+ * Peripheral registers are plain memory: the models in sim_hal.c read and
+ * update them where the firmware expects the hardware to, but a register
+ * access has no side effect of its own. In particular SR.FRLVL is never set,
+ * the modeled RX FIFO is flushed by __HAL_SPI_CLEAR_OVRFLAG() instead.
+ * Constants keep their device values where the firmware derives anything
+ * from them.
+ */
+
+#define __IO volatile
+
+typedef enum
+{
+	DISABLE = 0U,
+	ENABLE = !DISABLE
+} FunctionalState;
+
+/* Core --------------------------------------------------------------------*/
+
+typedef enum
+{
+	EXTI2_IRQn = 8,
+	EXTI3_IRQn = 9,
+	SPI1_IRQn = 35,
+	USART3_IRQn = 39,
+	SPI3_IRQn = 51,
+	TIM6_DAC_IRQn = 54,
+	OTG_FS_IRQn = 67,
+	SPI5_IRQn = 85,
+} IRQn_Type;
+
+// the memory map, which only tells where the firmware's linker placed things
+#define RAMITCM_BASE 0x00000000UL
+#define FLASHITCM_BASE 0x00200000UL
+#define FLASHAXI_BASE 0x08000000UL
+#define RAMDTCM_BASE 0x20000000UL
+#define SRAM1_BASE 0x20010000UL
+#define SRAM2_BASE 0x2004C000UL
+#define FLASH_END 0x080FFFFFUL
+
+typedef struct
+{
+	__IO uint32_t CTRL;
+	__IO uint32_t CYCCNT;
+	__IO uint32_t LAR;
+} DWT_Type;
+
+typedef struct
+{
+	__IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+extern DWT_Type sim_dwt;
+extern CoreDebug_Type sim_core_debug;
+#define DWT (&sim_dwt)
+#define CoreDebug (&sim_core_debug)
+
+// the caches only exist as their enable bits, they change no timing
+typedef struct
+{
+	__IO uint32_t CCR;
+} SCB_Type;
+
+#define SCB_CCR_DC_Msk (1UL << 16)
+#define SCB_CCR_IC_Msk (1UL << 17)
+
+extern SCB_Type sim_scb;
+#define SCB (&sim_scb)
+
+static inline void SCB_EnableICache(void)
+{
+	SCB->CCR |= SCB_CCR_IC_Msk;
+}
+
+static inline void SCB_DisableICache(void)
+{
+	SCB->CCR &= ~SCB_CCR_IC_Msk;
+}
+
+static inline void SCB_EnableDCache(void)
+{
+	SCB->CCR |= SCB_CCR_DC_Msk;
+}
+
+static inline void SCB_DisableDCache(void)
+{
+	SCB->CCR &= ~SCB_CCR_DC_Msk;
+}
+
+extern uint32_t SystemCoreClock;
+
+/**
+ * Interrupts are raised by the peripheral models and run in the order raised,
+ * right away unless masked or already inside one, else once that is over.
+ * There are no priorities, an interrupt never preempts another one.
+ *
+ * Interrupt handlers take no time. Thread code lets time pass by sleeping,
+ * or by entering critical sections, which gives loops spinning on device
+ * state a cost per round.
+ */
+#define SIM_CRITICAL_SECTION_CYCLES (32u)
+
+extern volatile uint32_t sim_primask;
+void sim_irq_dispatch(void);
+void sim_wfi(void);
+void sim_cpu_spend(uint32_t cycles);
+// stands for the exception number, not 0 while an interrupt is handled
+uint32_t sim_irq_active(void);
+
+static inline uint32_t __get_PRIMASK(void)
+{
+	return sim_primask;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+	sim_primask = primask;
+	if (primask == 0) sim_irq_dispatch();
+}
+
+static inline void __disable_irq(void)
+{
+	sim_cpu_spend(SIM_CRITICAL_SECTION_CYCLES);
+	sim_primask = 1;
+}
+
+static inline void __enable_irq(void)
+{
+	__set_PRIMASK(0);
+}
+
+static inline void __DMB(void)
+{
+	__sync_synchronize();
+}
+
+static inline void __DSB(void)
+{
+	__sync_synchronize();
+}
+
+static inline void __ISB(void)
+{
+	__sync_synchronize();
+}
+
+static inline uint32_t __get_IPSR(void)
+{
+	return sim_irq_active();
+}
+
+static inline void __WFI(void)
+{
+	sim_wfi();
+}
+
+static inline uint8_t __CLZ(uint32_t value)
+{
+	return value == 0 ? 32u : (uint8_t)__builtin_clz(value);
+}
+
+static inline uint32_t __REV(uint32_t value)
+{
+	return __builtin_bswap32(value);
+}
+
+static inline uint32_t __USAD8(uint32_t op1, uint32_t op2)
+{
+	uint32_t sum = 0;
+
+	for (uint8_t shift = 0; shift < 32; shift += 8)
+	{
+		int32_t a = (op1 >> shift) & 0xFF;
+		int32_t b = (op2 >> shift) & 0xFF;
+		sum += (uint32_t)(a > b ? a - b : b - a);
+	}
+
+	return sum;
+}
+
+/* HAL common --------------------------------------------------------------*/
+
+typedef enum
+{
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03,
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
+void HAL_NVIC_SetPriority(IRQn_Type irqn, uint32_t preempt_priority, uint32_t sub_priority);
+void HAL_NVIC_EnableIRQ(IRQn_Type irqn);
+void HAL_NVIC_DisableIRQ(IRQn_Type irqn);
+uint32_t NVIC_GetVector(IRQn_Type irqn);
+uint32_t HAL_GetUIDw0(void);
+uint32_t HAL_GetUIDw1(void);
+uint32_t HAL_GetUIDw2(void);
+
+/* MPU ---------------------------------------------------------------------*/
+
+typedef struct
+{
+	uint8_t Enable;
+	uint8_t Number;
+	uint32_t BaseAddress;
+	uint8_t Size;
+	uint8_t SubRegionDisable;
+	uint8_t TypeExtField;
+	uint8_t AccessPermission;
+	uint8_t DisableExec;
+	uint8_t IsShareable;
+	uint8_t IsCacheable;
+	uint8_t IsBufferable;
+} MPU_Region_InitTypeDef;
+
+#define MPU_REGION_ENABLE ((uint8_t)0x01)
+#define MPU_REGION_NUMBER0 ((uint8_t)0x00)
+#define MPU_REGION_SIZE_16KB ((uint8_t)0x0D)
+#define MPU_TEX_LEVEL1 ((uint8_t)0x01)
+#define MPU_REGION_FULL_ACCESS ((uint8_t)0x03)
+#define MPU_INSTRUCTION_ACCESS_DISABLE ((uint8_t)0x01)
+#define MPU_ACCESS_SHAREABLE ((uint8_t)0x01)
+#define MPU_ACCESS_NOT_CACHEABLE ((uint8_t)0x00)
+#define MPU_ACCESS_NOT_BUFFERABLE ((uint8_t)0x00)
+#define MPU_PRIVILEGED_DEFAULT (0x00000004U)
+
+// there are no memory attributes, the regions are only kept for inspection
+extern MPU_Region_InitTypeDef sim_mpu_regions[8];
+
+void HAL_MPU_Disable(void);
+void HAL_MPU_Enable(uint32_t control);
+void HAL_MPU_ConfigRegion(MPU_Region_InitTypeDef *init);
+
+/* FLASH -------------------------------------------------------------------*/
+
+typedef struct
+{
+	__IO uint32_t ACR;
+} FLASH_TypeDef;
+
+#define FLASH_ACR_LATENCY (0xFUL << 0)
+#define FLASH_ACR_PRFTEN (1UL << 8)
+#define FLASH_ACR_ARTEN (1UL << 9)
+
+#define FLASH_LATENCY_0 (0x00000000U)
+#define FLASH_LATENCY_1 (0x00000001U)
+#define FLASH_LATENCY_2 (0x00000002U)
+#define FLASH_LATENCY_3 (0x00000003U)
+#define FLASH_LATENCY_4 (0x00000004U)
+#define FLASH_LATENCY_5 (0x00000005U)
+#define FLASH_LATENCY_6 (0x00000006U)
+#define FLASH_LATENCY_7 (0x00000007U)
+
+extern FLASH_TypeDef sim_flash;
+#define FLASH (&sim_flash)
+
+#define __HAL_FLASH_ART_ENABLE() (FLASH->ACR |= FLASH_ACR_ARTEN)
+#define __HAL_FLASH_PREFETCH_BUFFER_ENABLE() (FLASH->ACR |= FLASH_ACR_PRFTEN)
+#define __HAL_FLASH_GET_LATENCY() (FLASH->ACR & FLASH_ACR_LATENCY)
+
+/* PWR ---------------------------------------------------------------------*/
+
+#define PWR_REGULATOR_VOLTAGE_SCALE1 (0x0000C000U)
+#define PWR_REGULATOR_VOLTAGE_SCALE2 (0x00008000U)
+#define PWR_REGULATOR_VOLTAGE_SCALE3 (0x00004000U)
+
+void sim_pwr_set_voltage_scaling(uint32_t scale);
+
+#define __HAL_RCC_PWR_CLK_ENABLE() ((void)0)
+#define __HAL_PWR_VOLTAGESCALING_CONFIG(scale) sim_pwr_set_voltage_scaling(scale)
+
+HAL_StatusTypeDef HAL_PWREx_EnableOverDrive(void);
+HAL_StatusTypeDef HAL_PWREx_DisableOverDrive(void);
+
+/* RCC ---------------------------------------------------------------------*/
+
+typedef struct
+{
+	__IO uint32_t CR;
+	__IO uint32_t PLLCFGR;
+	__IO uint32_t CFGR;
+} RCC_TypeDef;
+
+#define RCC_CFGR_PPRE1 (0x7UL << 10)
+#define RCC_CFGR_PPRE1_DIV1 (0x0UL << 10)
+#define RCC_CFGR_PPRE1_DIV2 (0x4UL << 10)
+#define RCC_CFGR_PPRE1_DIV4 (0x5UL << 10)
+#define RCC_CFGR_PPRE2 (0x7UL << 13)
+#define RCC_CFGR_PPRE2_DIV1 (0x0UL << 13)
+#define RCC_CFGR_PPRE2_DIV2 (0x4UL << 13)
+
+extern RCC_TypeDef sim_rcc;
+#define RCC (&sim_rcc)
+
+typedef struct
+{
+	uint32_t PLLState;
+	uint32_t PLLSource;
+	uint32_t PLLM;
+	uint32_t PLLN;
+	uint32_t PLLP;
+	uint32_t PLLQ;
+} RCC_PLLInitTypeDef;
+
+typedef struct
+{
+	uint32_t OscillatorType;
+	uint32_t HSEState;
+	RCC_PLLInitTypeDef PLL;
+} RCC_OscInitTypeDef;
+
+typedef struct
+{
+	uint32_t ClockType;
+	uint32_t SYSCLKSource;
+	uint32_t AHBCLKDivider;
+	uint32_t APB1CLKDivider;
+	uint32_t APB2CLKDivider;
+} RCC_ClkInitTypeDef;
+
+#define RCC_OSCILLATORTYPE_NONE (0x00000000U)
+#define RCC_OSCILLATORTYPE_HSE (0x00000001U)
+#define RCC_HSE_BYPASS (0x00050000U)
+#define RCC_PLL_NONE (0x00000000U)
+#define RCC_PLL_OFF (0x00000001U)
+#define RCC_PLL_ON (0x00000002U)
+#define RCC_PLLSOURCE_HSE (0x00400000U)
+#define RCC_PLLP_DIV2 (0x00000002U)
+#define RCC_PLLP_DIV4 (0x00000004U)
+#define RCC_CLOCKTYPE_SYSCLK (0x00000001U)
+#define RCC_CLOCKTYPE_HCLK (0x00000002U)
+#define RCC_CLOCKTYPE_PCLK1 (0x00000004U)
+#define RCC_CLOCKTYPE_PCLK2 (0x00000008U)
+#define RCC_SYSCLKSOURCE_HSE (0x00000001U)
+#define RCC_SYSCLKSOURCE_PLLCLK (0x00000002U)
+#define RCC_SYSCLK_DIV1 (0x00000000U)
+#define RCC_HCLK_DIV1 RCC_CFGR_PPRE1_DIV1
+#define RCC_HCLK_DIV2 RCC_CFGR_PPRE1_DIV2
+#define RCC_HCLK_DIV4 RCC_CFGR_PPRE1_DIV4
+
+/**
+ * The clock tree from the 8 MHz HSE, checked against the limits of the
+ * datasheet and the reference manual's switching sequence, the simulation
+ * aborting on a violation. The PLL always runs off HSE. Time carries on at
+ * the new system clock, HAL_GetTick() without a jump.
+ */
+#define SIM_HSE_HZ (8000000u)
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *init);
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *init, uint32_t flash_latency);
+
+uint32_t HAL_RCC_GetSysClockFreq(void);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+
+/* GPIO --------------------------------------------------------------------*/
+
+typedef struct
+{
+	__IO uint32_t MODER;
+	__IO uint32_t OTYPER;
+	__IO uint32_t OSPEEDR;
+	__IO uint32_t PUPDR;
+	__IO uint32_t IDR;
+	__IO uint32_t ODR;
+	__IO uint32_t BSRR;
+	__IO uint32_t LCKR;
+	__IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET,
+} GPIO_PinState;
+
+typedef struct
+{
+	uint32_t Pin;
+	uint32_t Mode;
+	uint32_t Pull;
+	uint32_t Speed;
+	uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+#define GPIO_MODE_INPUT (0x0UL)
+#define GPIO_MODE_OUTPUT_PP (0x1UL)
+#define GPIO_MODE_AF_PP (0x2UL)
+#define GPIO_MODE_IT_RISING_FALLING (0x10310000UL)
+#define GPIO_NOPULL (0x0UL)
+#define GPIO_PULLUP (0x1UL)
+#define GPIO_PULLDOWN (0x2UL)
+#define GPIO_SPEED_FREQ_LOW (0x0UL)
+#define GPIO_SPEED_FREQ_VERY_HIGH (0x3UL)
+#define GPIO_AF5_SPI1 ((uint8_t)0x05)
+#define GPIO_AF5_SPI5 ((uint8_t)0x05)
+#define GPIO_AF6_SPI3 ((uint8_t)0x06)
+
+#define SIM_GPIO_PORTS (11u)
+
+extern GPIO_TypeDef sim_gpio[SIM_GPIO_PORTS];
+#define GPIOA (&sim_gpio[0])
+#define GPIOB (&sim_gpio[1])
+#define GPIOC (&sim_gpio[2])
+#define GPIOD (&sim_gpio[3])
+#define GPIOE (&sim_gpio[4])
+#define GPIOF (&sim_gpio[5])
+#define GPIOG (&sim_gpio[6])
+#define GPIOH (&sim_gpio[7])
+#define GPIOI (&sim_gpio[8])
+#define GPIOJ (&sim_gpio[9])
+#define GPIOK (&sim_gpio[10])
+
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init);
+void HAL_GPIO_DeInit(GPIO_TypeDef *port, uint32_t pin);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *port, uint16_t pin);
+void HAL_GPIO_EXTI_Callback(uint16_t pin);
+
+/* TIM ---------------------------------------------------------------------*/
+
+typedef struct
+{
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t SMCR;
+	__IO uint32_t DIER;
+	__IO uint32_t SR;
+	__IO uint32_t EGR;
+	__IO uint32_t CCMR1;
+	__IO uint32_t CCMR2;
+	__IO uint32_t CCER;
+	__IO uint32_t CNT;
+	__IO uint32_t PSC;
+	__IO uint32_t ARR;
+} TIM_TypeDef;
+
+#define TIM_CR1_CEN (1UL << 0)
+#define TIM_CR1_URS (1UL << 2)
+#define TIM_CR1_OPM (1UL << 3)
+#define TIM_DIER_UIE (1UL << 0)
+#define TIM_EGR_UG (1UL << 0)
+#define TIM_SR_UIF (1UL << 0)
+
+extern TIM_TypeDef sim_tim6;
+#define TIM6 (&sim_tim6)
+
+#define __HAL_RCC_TIM6_CLK_ENABLE() ((void)0)
+
+/* DMA ---------------------------------------------------------------------*/
+
+typedef struct
+{
+	__IO uint32_t CR;
+	__IO uint32_t NDTR;
+	__IO uint32_t PAR;
+	__IO uint32_t M0AR;
+} DMA_Stream_TypeDef;
+
+typedef struct __DMA_HandleTypeDef
+{
+	DMA_Stream_TypeDef *Instance;
+	void *Parent;
+} DMA_HandleTypeDef;
+
+// frames a reception started with HAL_SPI_Receive_DMA() has still to take
+#define __HAL_DMA_GET_COUNTER(__HANDLE__) ((__HANDLE__)->Instance->NDTR)
+
+/* SPI ---------------------------------------------------------------------*/
+
+typedef struct
+{
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t SR;
+	__IO uint32_t DR;
+	__IO uint32_t CRCPR;
+	__IO uint32_t RXCRCR;
+	__IO uint32_t TXCRCR;
+	__IO uint32_t I2SCFGR;
+	__IO uint32_t I2SPR;
+} SPI_TypeDef;
+
+typedef struct
+{
+	uint32_t Mode;
+	uint32_t Direction;
+	uint32_t DataSize;
+	uint32_t CLKPolarity;
+	uint32_t CLKPhase;
+	uint32_t NSS;
+	uint32_t BaudRatePrescaler;
+	uint32_t FirstBit;
+	uint32_t TIMode;
+	uint32_t CRCCalculation;
+	uint32_t CRCPolynomial;
+	uint32_t CRCLength;
+	uint32_t NSSPMode;
+} SPI_InitTypeDef;
+
+typedef enum
+{
+	HAL_SPI_STATE_RESET = 0x00,
+	HAL_SPI_STATE_READY = 0x01,
+	HAL_SPI_STATE_BUSY = 0x02,
+	HAL_SPI_STATE_BUSY_TX = 0x03,
+	HAL_SPI_STATE_BUSY_RX = 0x04,
+	HAL_SPI_STATE_BUSY_TX_RX = 0x05,
+	HAL_SPI_STATE_ERROR = 0x06,
+	HAL_SPI_STATE_ABORT = 0x07,
+} HAL_SPI_StateTypeDef;
+
+typedef struct __SPI_HandleTypeDef
+{
+	SPI_TypeDef *Instance;
+	SPI_InitTypeDef Init;
+	uint8_t *pTxBuffPtr;
+	uint16_t TxXferSize;
+	__IO uint16_t TxXferCount;
+	uint8_t *pRxBuffPtr;
+	uint16_t RxXferSize;
+	__IO uint16_t RxXferCount;
+	DMA_HandleTypeDef *hdmatx;
+	DMA_HandleTypeDef *hdmarx;
+	__IO HAL_SPI_StateTypeDef State;
+	__IO uint32_t ErrorCode;
+} SPI_HandleTypeDef;
+
+#define SPI_CR1_CPHA (1UL << 0)
+#define SPI_CR1_CPOL (1UL << 1)
+#define SPI_CR1_MSTR (1UL << 2)
+#define SPI_CR1_BR_Pos (3U)
+#define SPI_CR1_BR_Msk (0x7UL << SPI_CR1_BR_Pos)
+#define SPI_CR1_SPE (1UL << 6)
+#define SPI_CR1_SSI (1UL << 8)
+#define SPI_CR1_SSM (1UL << 9)
+#define SPI_CR1_CRCEN (1UL << 13)
+#define SPI_CR2_SSOE (1UL << 2)
+#define SPI_CR2_NSSP (1UL << 3)
+
+#define SPI_SR_RXNE (1UL << 0)
+#define SPI_SR_TXE (1UL << 1)
+#define SPI_SR_CRCERR (1UL << 4)
+#define SPI_SR_MODF (1UL << 5)
+#define SPI_SR_OVR (1UL << 6)
+#define SPI_SR_BSY (1UL << 7)
+#define SPI_SR_FRE (1UL << 8)
+#define SPI_SR_FRLVL (0x3UL << 9)
+#define SPI_SR_FTLVL (0x3UL << 11)
+
+#define SPI_MODE_SLAVE (0x00000000U)
+#define SPI_MODE_MASTER (SPI_CR1_MSTR | SPI_CR1_SSI)
+#define SPI_DIRECTION_2LINES (0x00000000U)
+#define SPI_DATASIZE_8BIT (0x00000700U)
+#define SPI_POLARITY_LOW (0x00000000U)
+#define SPI_POLARITY_HIGH SPI_CR1_CPOL
+#define SPI_PHASE_1EDGE (0x00000000U)
+#define SPI_PHASE_2EDGE SPI_CR1_CPHA
+#define SPI_NSS_SOFT SPI_CR1_SSM
+#define SPI_NSS_HARD_INPUT (0x00000000U)
+#define SPI_NSS_HARD_OUTPUT (SPI_CR2_SSOE << 16U)
+#define SPI_NSS_PULSE_ENABLE SPI_CR2_NSSP
+#define SPI_NSS_PULSE_DISABLE (0x00000000U)
+#define SPI_BAUDRATEPRESCALER_2 (0x00000000U)
+#define SPI_BAUDRATEPRESCALER_256 (SPI_CR1_BR_Msk)
+#define SPI_FIRSTBIT_MSB (0x00000000U)
+#define SPI_TIMODE_DISABLE (0x00000000U)
+#define SPI_CRCCALCULATION_DISABLE (0x00000000U)
+#define SPI_CRCCALCULATION_ENABLE SPI_CR1_CRCEN
+#define SPI_CRC_LENGTH_DATASIZE (0x00000000U)
+#define SPI_CRC_LENGTH_8BIT (0x00000001U)
+#define SPI_CRC_LENGTH_16BIT (0x00000002U)
+
+#define HAL_SPI_ERROR_NONE (0x00000000U)
+#define HAL_SPI_ERROR_MODF (0x00000001U)
+#define HAL_SPI_ERROR_CRC (0x00000002U)
+#define HAL_SPI_ERROR_OVR (0x00000004U)
+#define HAL_SPI_ERROR_FRE (0x00000008U)
+#define HAL_SPI_ERROR_DMA (0x00000010U)
+#define HAL_SPI_ERROR_FLAG (0x00000020U)
+#define HAL_SPI_ERROR_ABORT (0x00000040U)
+
+#define SIM_SPI_INSTANCES (6u)
+
+extern SPI_TypeDef sim_spi[SIM_SPI_INSTANCES];
+#define SPI1 (&sim_spi[0])
+#define SPI2 (&sim_spi[1])
+#define SPI3 (&sim_spi[2])
+#define SPI4 (&sim_spi[3])
+#define SPI5 (&sim_spi[4])
+#define SPI6 (&sim_spi[5])
+
+void sim_spi_clear_ovr(SPI_HandleTypeDef *hspi);
+void sim_spi_reset(SPI_TypeDef *instance);
+
+#define __HAL_SPI_ENABLE(__HANDLE__) ((__HANDLE__)->Instance->CR1 |= SPI_CR1_SPE)
+#define __HAL_SPI_DISABLE(__HANDLE__) ((__HANDLE__)->Instance->CR1 &= ~SPI_CR1_SPE)
+#define __HAL_SPI_CLEAR_OVRFLAG(__HANDLE__) sim_spi_clear_ovr(__HANDLE__)
+
+#define __HAL_RCC_SPI1_FORCE_RESET() sim_spi_reset(SPI1)
+#define __HAL_RCC_SPI3_FORCE_RESET() sim_spi_reset(SPI3)
+#define __HAL_RCC_SPI5_FORCE_RESET() sim_spi_reset(SPI5)
+#define __HAL_RCC_SPI1_RELEASE_RESET() ((void)0)
+#define __HAL_RCC_SPI3_RELEASE_RESET() ((void)0)
+#define __HAL_RCC_SPI5_RELEASE_RESET() ((void)0)
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_DeInit(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Transmit_IT(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Receive_IT(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Abort_IT(SPI_HandleTypeDef *hspi);
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_AbortCpltCallback(SPI_HandleTypeDef *hspi);
+
+/* UART --------------------------------------------------------------------*/
+
+typedef struct
+{
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t CR3;
+	__IO uint32_t BRR;
+	__IO uint32_t GTPR;
+	__IO uint32_t RTOR;
+	__IO uint32_t RQR;
+	__IO uint32_t ISR;
+	__IO uint32_t ICR;
+	__IO uint32_t RDR;
+	__IO uint32_t TDR;
+} USART_TypeDef;
+
+typedef struct
+{
+	uint32_t BaudRate;
+	uint32_t WordLength;
+	uint32_t StopBits;
+	uint32_t Parity;
+	uint32_t Mode;
+	uint32_t HwFlowCtl;
+	uint32_t OverSampling;
+	uint32_t OneBitSampling;
+} UART_InitTypeDef;
+
+typedef struct
+{
+	uint32_t AdvFeatureInit;
+} UART_AdvFeatureInitTypeDef;
+
+typedef struct __UART_HandleTypeDef
+{
+	USART_TypeDef *Instance;
+	UART_InitTypeDef Init;
+	UART_AdvFeatureInitTypeDef AdvancedInit;
+	uint8_t *pRxBuffPtr;
+	uint16_t RxXferSize;
+	__IO uint16_t RxXferCount;
+	__IO uint32_t gState;
+	__IO uint32_t RxState;
+	__IO uint32_t ErrorCode;
+} UART_HandleTypeDef;
+
+#define USART_CR1_UE (1UL << 0)
+#define USART_CR1_RE (1UL << 2)
+#define USART_CR1_TE (1UL << 3)
+#define USART_CR1_OVER8 (1UL << 15)
+
+#define UART_WORDLENGTH_8B (0x00000000U)
+#define UART_STOPBITS_1 (0x00000000U)
+#define UART_PARITY_NONE (0x00000000U)
+#define UART_MODE_TX_RX (USART_CR1_TE | USART_CR1_RE)
+#define UART_HWCONTROL_NONE (0x00000000U)
+#define UART_OVERSAMPLING_16 (0x00000000U)
+#define UART_OVERSAMPLING_8 USART_CR1_OVER8
+#define UART_ONE_BIT_SAMPLE_DISABLE (0x00000000U)
+#define UART_ADVFEATURE_NO_INIT (0x00000000U)
+
+#define HAL_UART_STATE_RESET (0x00000000U)
+#define HAL_UART_STATE_READY (0x00000020U)
+#define HAL_UART_STATE_BUSY_TX (0x00000021U)
+#define HAL_UART_STATE_BUSY_RX (0x00000022U)
+#define HAL_UART_ERROR_NONE (0x00000000U)
+
+extern USART_TypeDef sim_usart3;
+#define USART3 (&sim_usart3)
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_IT(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart);
+void HAL_UART_IRQHandler(UART_HandleTypeDef *huart);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t size);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+
+/* PCD ---------------------------------------------------------------------*/
+
+typedef struct
+{
+	__IO uint32_t GOTGCTL;
+} USB_OTG_GlobalTypeDef;
+
+typedef struct
+{
+	uint32_t dev_endpoints;
+	uint32_t speed;
+	uint32_t dma_enable;
+	uint32_t phy_itface;
+	uint32_t Sof_enable;
+	uint32_t low_power_enable;
+	uint32_t lpm_enable;
+	uint32_t vbus_sensing_enable;
+	uint32_t use_dedicated_ep1;
+} PCD_InitTypeDef;
+
+typedef struct
+{
+	uint8_t num;
+	uint8_t is_in;
+	uint8_t is_stall;
+	uint8_t type;
+	uint32_t maxpacket;
+	uint8_t *xfer_buff;
+	uint32_t xfer_len;
+	uint32_t xfer_count;
+} PCD_EPTypeDef;
+
+typedef struct
+{
+	USB_OTG_GlobalTypeDef *Instance;
+	PCD_InitTypeDef Init;
+	__IO uint8_t USB_Address;
+	PCD_EPTypeDef IN_ep[16];
+	PCD_EPTypeDef OUT_ep[16];
+	__IO uint32_t State;
+	uint32_t Setup[12];
+} PCD_HandleTypeDef;
+
+#define PCD_SPEED_FULL (2U)
+#define PCD_PHY_EMBEDDED (2U)
+#define EP_TYPE_CTRL (0U)
+#define EP_TYPE_ISOC (1U)
+#define EP_TYPE_BULK (2U)
+#define EP_TYPE_INTR (3U)
+
+#define HAL_PCD_STATE_RESET (0x00U)
+#define HAL_PCD_STATE_READY (0x01U)
+
+// FIFO RAM of the OTG FS core, in 32-bit words
+#define SIM_USB_FIFO_WORDS (320u)
+
+extern USB_OTG_GlobalTypeDef sim_usb_otg_fs;
+#define USB_OTG_FS (&sim_usb_otg_fs)
+
+HAL_StatusTypeDef HAL_PCD_Init(PCD_HandleTypeDef *hpcd);
+HAL_StatusTypeDef HAL_PCD_Start(PCD_HandleTypeDef *hpcd);
+HAL_StatusTypeDef HAL_PCD_Stop(PCD_HandleTypeDef *hpcd);
+HAL_StatusTypeDef HAL_PCD_SetAddress(PCD_HandleTypeDef *hpcd, uint8_t address);
+HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type);
+HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_Abort(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_Flush(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_Receive(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len);
+HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len);
+HAL_StatusTypeDef HAL_PCD_EP_SetStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_ClrStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+uint32_t HAL_PCD_EP_GetRxCount(PCD_HandleTypeDef const *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCDEx_SetTxFiFo(PCD_HandleTypeDef *hpcd, uint8_t fifo, uint16_t size);
+HAL_StatusTypeDef HAL_PCDEx_SetRxFiFo(PCD_HandleTypeDef *hpcd, uint16_t size);
+void HAL_PCD_IRQHandler(PCD_HandleTypeDef *hpcd);
+void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd);
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum);
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum);
+void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd);
+void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd);
+void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd);
+void HAL_PCD_DisconnectCallback(PCD_HandleTypeDef *hpcd);
+
+/* Simulation control ------------------------------------------------------*/
+
+/**
+ * Time only advances when told to, by the harness or by the thread side
+ * waiting in __WFI(). Advancing runs the microsecond timer and raises its
+ * interrupt once due, TIM6_DAC_IRQHandler() being provided by the board.
+ */
+void sim_reset(void);
+uint64_t sim_now(void);
+void sim_advance(uint32_t cycles);
+void sim_irq_raise(void (*handler)(void *), void *context);
+
+/**
+ * Connects an output pin to an input pin, an edge on the input raises
+ * HAL_GPIO_EXTI_Callback() when exti is set. Inputs read high until driven.
+ */
+void sim_gpio_connect(GPIO_TypeDef *out_port, uint16_t out_pin,
+		GPIO_TypeDef *in_port, uint16_t in_pin, bool exti);
+
+/**
+ * Exchanges one frame with a Target as seen from the bus: mosi is shifted
+ * into its pending reception, or into its RX FIFO if none is armed, and the
+ * returned MISO frame comes from its pending transmission, or is 0 on an
+ * underrun. A disabled peripheral, or one deselected through its hardware
+ * NSS input, ignores the frame. Completions raise the HAL callbacks.
+ */
+uint8_t sim_spi_exchange(SPI_HandleTypeDef *hspi, uint8_t mosi);
+void sim_spi_attach(SPI_HandleTypeDef *hspi, GPIO_TypeDef *nss_port, uint16_t nss_pin);
+
+/**
+ * The bus of an attached Controller: every frame of its transfers takes the
+ * time of 8 bits at its prescaled clock, or at the bit rate set here if not 0,
+ * and is exchanged with each attached Target as by sim_spi_exchange().
+ * SCK and MOSI are shared, MISO is driven by the Target with NSS low.
+ */
+void sim_spi_set_bit_rate(uint32_t bit_rate);
+
+/**
+ * Lets a UART stand for the terminal: transmissions are written to stdout
+ * and receptions read from stdin, each byte taking its 10 bit times at the
+ * configured baud rate. Input is only taken while a reception is armed,
+ * sim_uart_input_closed() tells once stdin has ended.
+ */
+void sim_uart_connect_stdio(UART_HandleTypeDef *huart);
+bool sim_uart_input_closed(void);
+
+/**
+ * The USB host on the bus of the PCD last started, modeled in sim_usb.c.
+ * Packets move when the harness asks for them, raising the HAL callbacks
+ * the core would, and take no time. sim_usb_control() runs all stages of
+ * a control transfer and returns the length of its data stage.
+ * sim_usb_in() takes one packet of an IN endpoint, sim_usb_out() gives
+ * one to an OUT endpoint. All return -1 for a NAK or a STALL.
+ * Starting the PCD checks that its FIFOs fit in SIM_USB_FIFO_WORDS.
+ */
+void sim_usb_reset(void);
+void sim_usb_disconnect(void);
+int sim_usb_control(const uint8_t setup[8], uint8_t *data);
+int sim_usb_in(uint8_t ep_addr, uint8_t *data);
+int sim_usb_out(uint8_t ep_addr, const uint8_t *data, uint16_t len);
+
+void TIM6_DAC_IRQHandler(void);
+
+#endif /* SIM_HAL_H_ */
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Runs a scripted menu session on the simulator and checks its output:
+# every line of the .expect file next to the script must appear in it,
+# and no selection or value may have been refused.
+#
+#   check.sh <simulator> <script>
+#
+
+sim="$1"
+script="$2"
+expect="${script%.txt}.expect"
+output="$(mktemp)"
+
+trap 'rm -f "$output"' EXIT
+
+if ! timeout 120 "$sim" < "$script" > "$output"; then
+	echo "check: the session did not complete" >&2
+	exit 1
+fi
+
+status=0
+
+while IFS= read -r line; do
+	if ! grep -qF -- "$line" "$output"; then
+		echo "check: missing \"$line\"" >&2
+		status=1
+	fi
+done < "$expect"
+
+if grep -E "Invalid|out of range" "$output" >&2; then
+	echo "check: the script was refused input" >&2
+	status=1
+fi
+
+[ $status -eq 0 ] && echo "check: $(grep -c "concluded" "$output") routines passed"
+exit $status
@@ -0,0 +1,69 @@
+/*
+ * sim_main.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+/**
+ * The firmware's main loop on the simulated board: the interface menu runs
+ * on USART3, which stands for the terminal on stdin and stdout. Scripted
+ * sessions pipe the menu input in, the simulation ends once the menu has
+ * read all of it and its output has been sent.
+ *
+ *   spi_sim [-b bit rate]
+ *
+ * With -b the virtual SPI bus runs at the given bit rate in bit/s, instead
+ * of the one the Controller's prescaler selects.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sim_board.h"
+#include "sim_terminal.h"
+#include "interface.h"
+#include "uart_io.h"
+
+int main(int argc, char **argv)
+{
+	uint32_t bit_rate = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'b':
+			bit_rate = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b bit rate]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	sim_board_initialize();
+	mpu_cache_initialize();
+	sim_spi_set_bit_rate(bit_rate);
+	sim_uart_connect_stdio(&huart3);
+	sim_terminal_raw();
+
+	// like main(), leave the terminal time to attach
+	HAL_Delay(1000);
+
+	for (;;)
+	{
+		// the reception runs ahead of the menu, it has to consume the input first
+		if (sim_uart_input_closed() && serial_rx_available() == 0)
+		{
+			serial_flush();
+			fprintf(stderr, "sim: input closed after %lu ms\n",
+					(unsigned long)(sim_now() / (SystemCoreClock / 1000u)));
+			return 0;
+		}
+
+		interface_loop();
+	}
+}
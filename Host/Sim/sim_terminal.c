@@ -0,0 +1,33 @@
+/*
+ * sim_terminal.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sim_terminal.h"
+
+static struct termios saved_termios;
+
+static void sim_terminal_restore(void)
+{
+	tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+}
+
+void sim_terminal_raw(void)
+{
+	struct termios raw;
+
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_termios) != 0) return;
+
+	raw = saved_termios;
+	raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+
+	if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0) atexit(sim_terminal_restore);
+}
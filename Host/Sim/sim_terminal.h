@@ -0,0 +1,20 @@
+/*
+ * sim_terminal.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#ifndef SIM_TERMINAL_H_
+#define SIM_TERMINAL_H_
+
+/**
+ * Kept apart from the HAL stand-in, whose register names clash with the
+ * termios macros.
+ * Passes keys through one at a time and without a local echo when stdin is
+ * a terminal, the menu echoes what it accepts like it does over the UART.
+ * The terminal is restored on exit.
+ */
+void sim_terminal_raw(void);
+
+#endif /* SIM_TERMINAL_H_ */
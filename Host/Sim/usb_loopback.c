@@ -0,0 +1,278 @@
+/*
+ * usb_loopback.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+/**
+ * Drives the USB CDC console of usb_cdc.c and uart_io.c as the host would,
+ * on the simulated OTG FS core: enumeration, the ACM class requests, then
+ * random-sized packets echoed back through the console rings, with the
+ * reader falling behind so that the host is held back. What comes back must
+ * be exactly what was sent. It ends with the console falling back to
+ * USART3 when DTR drops, and with a bus reset in the middle of a transfer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_board.h"
+#include "uart_io.h"
+#include "usb_cdc.h"
+
+#define LOOPBACK_BYTES (64u * 1024u)
+
+static uint32_t checks = 0;
+static uint32_t rng_state = 0x2545F491u;
+
+static uint8_t sent[LOOPBACK_BYTES];
+static uint8_t echoed[LOOPBACK_BYTES + USB_CDC_PACKET_LEN];
+
+static void check(bool condition, const char *what)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "usb: %s failed\n", what);
+		exit(1);
+	}
+
+	checks++;
+}
+
+static uint32_t rng_next(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return rng_state;
+}
+
+static int control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+		uint16_t length, uint8_t *data)
+{
+	const uint8_t setup[8] = {
+		request_type, request, (uint8_t)value, (uint8_t)(value >> 8),
+		(uint8_t)index, (uint8_t)(index >> 8), (uint8_t)length, (uint8_t)(length >> 8),
+	};
+
+	return sim_usb_control(setup, data);
+}
+
+// the packets the host reads from the data IN endpoint, until it NAKs
+static uint32_t drain_in(uint8_t *data, uint32_t max_len)
+{
+	uint8_t packet[USB_CDC_PACKET_LEN];
+	uint32_t len = 0;
+	int count;
+
+	while ((count = sim_usb_in(USB_CDC_DATA_IN_EP, packet)) >= 0)
+	{
+		if (len + count > max_len) check(false, "IN data within what was sent");
+		memcpy(data + len, packet, count);
+		len += count;
+	}
+
+	return len;
+}
+
+static void enumerate(void)
+{
+	uint8_t data[256];
+	USBCDCStats_t stats;
+
+	check(usb_cdc_get_state() == USBCDC_DETACHED, "detached until the bus reset");
+	sim_usb_reset();
+	check(usb_cdc_get_state() == USBCDC_DEFAULT, "default state after the bus reset");
+
+	check(control(0x80, 0x06, 0x0100, 0, 64, data) == 18, "device descriptor length");
+	check(data[1] == 0x01 && data[4] == 0x02 && data[8] == 0x83 && data[9] == 0x04,
+			"device descriptor class and VID");
+
+	check(control(0x00, 0x05, 5, 0, 0, NULL) == 0, "SET_ADDRESS");
+	check(hpcd_USB_OTG_FS.USB_Address == 5 && usb_cdc_get_state() == USBCDC_ADDRESSED, "addressed state");
+
+	check(control(0x80, 0x06, 0x0200, 0, 9, data) == 9 && data[2] == 67, "configuration descriptor header");
+	check(control(0x80, 0x06, 0x0200, 0, 64, data) == 64, "configuration descriptor cut at one packet");
+	check(control(0x80, 0x06, 0x0200, 0, 255, data) == 67 && data[62] == USB_CDC_DATA_IN_EP,
+			"configuration descriptor over two packets");
+
+	check(control(0x80, 0x06, 0x0300, 0, 255, data) == 4 && data[2] == 0x09 && data[3] == 0x04,
+			"language ID string");
+	check(control(0x80, 0x06, 0x0302, 0x0409, 255, data) == 2 + 2 * 16 && data[2] == 'S' && data[3] == 0,
+			"product string");
+	check(control(0x80, 0x06, 0x0303, 0x0409, 255, data) == 2 + 2 * 24 && data[2] == '0' && data[14] == '4',
+			"serial number string");
+
+	// full speed only, the host then stays at full speed
+	check(control(0x80, 0x06, 0x0600, 0, 10, data) == -1, "device qualifier stalls");
+	usb_cdc_get_stats(&stats);
+	check(stats.stalled_requests == 1, "stall counted");
+
+	check(control(0x00, 0x09, 1, 0, 0, NULL) == 0, "SET_CONFIGURATION");
+	check(control(0x80, 0x08, 0, 0, 1, data) == 1 && data[0] == 1, "GET_CONFIGURATION");
+	check(usb_cdc_get_state() == USBCDC_CONFIGURED, "configured state");
+}
+
+static void line_state(void)
+{
+	uint8_t coding[7] = { 0x00, 0x10, 0x0E, 0x00, 0, 0, 8 };
+	uint8_t data[7];
+	USBCDCLineCoding_t line_coding;
+
+	check(control(0x21, 0x20, 0, 0, 7, coding) == 7, "SET_LINE_CODING");
+	usb_cdc_get_line_coding(&line_coding);
+	check(line_coding.baud == 921600 && line_coding.data_bits == 8, "line coding taken");
+	check(control(0xA1, 0x21, 0, 0, 7, data) == 7 && memcmp(data, coding, 7) == 0, "GET_LINE_CODING");
+
+	// configured, but no terminal has the port open yet
+	serial_print("to USART3", 0);
+	serial_flush();
+	check(!usb_cdc_is_connected() && sim_usb_in(USB_CDC_DATA_IN_EP, data) == -1, "no output before DTR");
+
+	check(control(0x21, 0x22, 0x0003, 0, 0, NULL) == 0, "SET_CONTROL_LINE_STATE");
+	check(usb_cdc_is_connected() && serial_active_transport() == SERIALTRANSPORT_USB, "console on USB");
+}
+
+/**
+ * The host sends packets until the device holds it back, the reader
+ * echoes a random share of what arrived while the TX ring has room,
+ * then the host reads the echo.
+ */
+static void loopback(void)
+{
+	uint32_t sent_len = 0;
+	uint32_t echoed_len = 0;
+	uint32_t rounds = 0;
+	UARTRxStats_t rx_stats;
+	USBCDCStats_t stats;
+
+	for (uint32_t idx = 0; idx < LOOPBACK_BYTES; idx++) sent[idx] = (uint8_t)rng_next();
+
+	serial_reset_rx_stats();
+	usb_cdc_reset_stats();
+
+	while (echoed_len < LOOPBACK_BYTES)
+	{
+		if (++rounds >= 100000) check(false, "loopback progress");
+
+		while (sent_len < LOOPBACK_BYTES)
+		{
+			uint16_t len = 1 + rng_next() % USB_CDC_PACKET_LEN;
+
+			if (len > LOOPBACK_BYTES - sent_len) len = LOOPBACK_BYTES - sent_len;
+			if (sim_usb_out(USB_CDC_DATA_OUT_EP, sent + sent_len, len) < 0) break;
+			sent_len += len;
+		}
+
+		uint16_t budget = rng_next() % (UART_RX_RING_LEN / 2);
+		char c;
+
+		while (budget-- > 0 && serial_tx_pending() < UART_TX_RING_LEN && serial_read_char(&c))
+		{
+			serial_send((const uint8_t *)&c, 1);
+		}
+
+		echoed_len += drain_in(echoed + echoed_len, sizeof(echoed) - echoed_len);
+	}
+
+	check(echoed_len == LOOPBACK_BYTES && memcmp(sent, echoed, LOOPBACK_BYTES) == 0, "echo matches");
+
+	serial_get_rx_stats(&rx_stats);
+	usb_cdc_get_stats(&stats);
+	check(rx_stats.overflow_bytes == 0, "no input lost");
+	check(stats.rx_pauses > 0, "host held back");
+	check(stats.rx_bytes == LOOPBACK_BYTES && stats.tx_bytes == LOOPBACK_BYTES, "byte counts");
+
+	printf("usb: %u bytes looped back in %u transfers, %u pauses, %u zero-length packets\n",
+			(unsigned)echoed_len, (unsigned)stats.tx_transfers, (unsigned)stats.rx_pauses,
+			(unsigned)stats.zero_length_packets);
+}
+
+static void zero_length_packet(void)
+{
+	uint8_t data[2 * USB_CDC_PACKET_LEN];
+	USBCDCStats_t before;
+	USBCDCStats_t after;
+
+	usb_cdc_get_stats(&before);
+
+	memset(data, 'z', USB_CDC_PACKET_LEN);
+	serial_send(data, USB_CDC_PACKET_LEN);
+
+	check(sim_usb_in(USB_CDC_DATA_IN_EP, data) == USB_CDC_PACKET_LEN, "whole packet");
+	check(sim_usb_in(USB_CDC_DATA_IN_EP, data) == 0, "zero-length packet after it");
+	check(sim_usb_in(USB_CDC_DATA_IN_EP, data) == -1, "transfer complete");
+
+	usb_cdc_get_stats(&after);
+	check(after.zero_length_packets == before.zero_length_packets + 1, "zero-length packet counted");
+}
+
+static void fallback(void)
+{
+	uint8_t data[3 * USB_CDC_PACKET_LEN / 2];
+	USBCDCStats_t before;
+	USBCDCStats_t after;
+
+	check(control(0x21, 0x22, 0x0000, 0, 0, NULL) == 0, "DTR dropped");
+	check(serial_active_transport() == SERIALTRANSPORT_UART, "console back on USART3");
+
+	usb_cdc_get_stats(&before);
+	serial_print_line("fallback", 0);
+	serial_flush();
+	usb_cdc_get_stats(&after);
+	check(after.tx_bytes == before.tx_bytes && sim_usb_in(USB_CDC_DATA_IN_EP, data) == -1, "output on USART3");
+
+	// the terminal closing the port in the middle of a transfer, the host stops reading
+	check(control(0x21, 0x22, 0x0001, 0, 0, NULL) == 0, "DTR raised");
+	memset(data, 'c', sizeof(data));
+	serial_send(data, sizeof(data));
+	check(sim_usb_in(USB_CDC_DATA_IN_EP, data) == USB_CDC_PACKET_LEN, "first packet before closing");
+
+	usb_cdc_get_stats(&before);
+	check(control(0x21, 0x22, 0x0000, 0, 0, NULL) == 0, "DTR dropped in a transfer");
+	usb_cdc_get_stats(&after);
+	check(after.tx_lost_bytes == before.tx_lost_bytes + sizeof(data), "transfer lost to the closing");
+
+	serial_print_line("after close", 0);
+	serial_flush();
+	check(serial_active_transport() == SERIALTRANSPORT_UART && serial_tx_pending() == 0,
+			"console drained on USART3 after closing");
+
+	// a bus reset cuts a transfer short, the console finishes on USART3
+	check(control(0x21, 0x22, 0x0001, 0, 0, NULL) == 0, "DTR raised");
+	memset(data, 'r', sizeof(data));
+	serial_send(data, sizeof(data));
+	check(sim_usb_in(USB_CDC_DATA_IN_EP, data) == USB_CDC_PACKET_LEN, "first packet of the transfer");
+
+	usb_cdc_get_stats(&before);
+	sim_usb_reset();
+	usb_cdc_get_stats(&after);
+	check(after.tx_lost_bytes == before.tx_lost_bytes + sizeof(data) && after.bus_resets == before.bus_resets + 1, "transfer lost to the reset");
+	check(usb_cdc_get_state() == USBCDC_DEFAULT && !usb_cdc_is_connected(), "default state after the reset");
+
+	serial_flush();
+	check(serial_tx_pending() == 0, "console drained");
+
+	sim_usb_disconnect();
+	check(usb_cdc_get_state() == USBCDC_DETACHED, "detached");
+}
+
+int main(void)
+{
+	sim_board_initialize();
+	usb_cdc_initialize();
+	serial_set_transport(SERIALTRANSPORT_USB);
+
+	enumerate();
+	line_state();
+	loopback();
+	zero_length_packet();
+	fallback();
+
+	printf("usb: %u checks passed\n", (unsigned)checks);
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * sim_board.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sim_board.h"
+#include "us_timer.h"
+
+SPI_HandleTypeDef hspi1;
+SPI_HandleTypeDef hspi3;
+SPI_HandleTypeDef hspi5;
+UART_HandleTypeDef huart3;
+PCD_HandleTypeDef hpcd_USB_OTG_FS;
+
+static DMA_HandleTypeDef hdma_spi1_rx;
+static DMA_HandleTypeDef hdma_spi1_tx;
+static DMA_HandleTypeDef hdma_spi3_rx;
+static DMA_HandleTypeDef hdma_spi3_tx;
+static DMA_HandleTypeDef hdma_spi5_rx;
+static DMA_HandleTypeDef hdma_spi5_tx;
+static DMA_Stream_TypeDef sim_dma_streams[6];
+static uint8_t sim_dma_stream_count;
+
+static void sim_spi_initialize(SPI_HandleTypeDef *hspi, SPI_TypeDef *instance, uint32_t mode,
+		DMA_HandleTypeDef *hdma_rx, DMA_HandleTypeDef *hdma_tx)
+{
+	bzero(hspi, sizeof(SPI_HandleTypeDef));
+
+	hspi->Instance = instance;
+	hspi->Init.Mode = mode;
+	hspi->Init.Direction = SPI_DIRECTION_2LINES;
+	hspi->Init.DataSize = SPI_DATASIZE_8BIT;
+	hspi->Init.CLKPolarity = SPI_POLARITY_LOW;
+	hspi->Init.CLKPhase = SPI_PHASE_1EDGE;
+	hspi->Init.NSS = SPI_NSS_SOFT;
+	hspi->Init.BaudRatePrescaler = mode == SPI_MODE_MASTER ? SPI_BAUDRATEPRESCALER_256 : 0;
+	hspi->Init.FirstBit = SPI_FIRSTBIT_MSB;
+	hspi->Init.TIMode = SPI_TIMODE_DISABLE;
+	hspi->Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+	hspi->Init.CRCPolynomial = 7;
+	hspi->Init.CRCLength = SPI_CRC_LENGTH_DATASIZE;
+	hspi->Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+
+	// linked like in HAL_SPI_MspInit()
+	hdma_rx->Instance = &sim_dma_streams[sim_dma_stream_count++];
+	hdma_tx->Instance = &sim_dma_streams[sim_dma_stream_count++];
+	hdma_rx->Parent = hspi;
+	hdma_tx->Parent = hspi;
+	hspi->hdmarx = hdma_rx;
+	hspi->hdmatx = hdma_tx;
+
+	if (HAL_SPI_Init(hspi) != HAL_OK) Error_Handler();
+}
+
+static void sim_uart_initialize(void)
+{
+	bzero(&huart3, sizeof(UART_HandleTypeDef));
+
+	huart3.Instance = USART3;
+	huart3.Init.BaudRate = 115200;
+	huart3.Init.WordLength = UART_WORDLENGTH_8B;
+	huart3.Init.StopBits = UART_STOPBITS_1;
+	huart3.Init.Parity = UART_PARITY_NONE;
+	huart3.Init.Mode = UART_MODE_TX_RX;
+	huart3.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+	huart3.Init.OverSampling = UART_OVERSAMPLING_16;
+	huart3.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
+	huart3.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+
+	if (HAL_UART_Init(&huart3) != HAL_OK) Error_Handler();
+}
+
+static void sim_usb_initialize(void)
+{
+	bzero(&hpcd_USB_OTG_FS, sizeof(PCD_HandleTypeDef));
+
+	hpcd_USB_OTG_FS.Instance = USB_OTG_FS;
+	hpcd_USB_OTG_FS.Init.dev_endpoints = 6;
+	hpcd_USB_OTG_FS.Init.speed = PCD_SPEED_FULL;
+	hpcd_USB_OTG_FS.Init.dma_enable = DISABLE;
+	hpcd_USB_OTG_FS.Init.phy_itface = PCD_PHY_EMBEDDED;
+	hpcd_USB_OTG_FS.Init.Sof_enable = ENABLE;
+	hpcd_USB_OTG_FS.Init.low_power_enable = DISABLE;
+	hpcd_USB_OTG_FS.Init.lpm_enable = DISABLE;
+	hpcd_USB_OTG_FS.Init.vbus_sensing_enable = ENABLE;
+	hpcd_USB_OTG_FS.Init.use_dedicated_ep1 = DISABLE;
+
+	if (HAL_PCD_Init(&hpcd_USB_OTG_FS) != HAL_OK) Error_Handler();
+}
+
+void sim_board_initialize(void)
+{
+	sim_reset();
+	sim_dma_stream_count = 0;
+
+	// what HAL_Init() sets up from ART_ACCELERATOR_ENABLE and PREFETCH_ENABLE
+	__HAL_FLASH_ART_ENABLE();
+	__HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+
+	sim_gpio_connect(SPI3_CS_OUT_GPIO_Port, SPI3_CS_OUT_Pin, SPI3_CS_IN_GPIO_Port, SPI3_CS_IN_Pin, true);
+	sim_gpio_connect(SPI3_CS_OUT_GPIO_Port, SPI3_CS_OUT_Pin, SPI3_NSS_GPIO_Port, SPI3_NSS_Pin, false);
+	sim_gpio_connect(SPI5_CS_OUT_GPIO_Port, SPI5_CS_OUT_Pin, SPI5_CS_IN_GPIO_Port, SPI5_CS_IN_Pin, true);
+	sim_gpio_connect(SPI5_CS_OUT_GPIO_Port, SPI5_CS_OUT_Pin, SPI5_NSS_GPIO_Port, SPI5_NSS_Pin, false);
+
+	HAL_GPIO_WritePin(GPIOD, SPI3_CS_OUT_Pin|SPI5_CS_OUT_Pin, GPIO_PIN_SET);
+
+	sim_spi_initialize(&hspi1, SPI1, SPI_MODE_MASTER, &hdma_spi1_rx, &hdma_spi1_tx);
+	sim_spi_initialize(&hspi3, SPI3, SPI_MODE_SLAVE, &hdma_spi3_rx, &hdma_spi3_tx);
+	sim_spi_initialize(&hspi5, SPI5, SPI_MODE_SLAVE, &hdma_spi5_rx, &hdma_spi5_tx);
+
+	sim_spi_attach(&hspi1, SPI1_NSS_GPIO_Port, SPI1_NSS_Pin);
+	sim_spi_attach(&hspi3, SPI3_NSS_GPIO_Port, SPI3_NSS_Pin);
+	sim_spi_attach(&hspi5, SPI5_NSS_GPIO_Port, SPI5_NSS_Pin);
+
+	sim_uart_initialize();
+	sim_usb_initialize();
+}
+
+void TIM6_DAC_IRQHandler(void)
+{
+	us_timer_isr();
+}
+
+void Error_Handler(void)
+{
+	fprintf(stderr, "sim: Error_Handler() called\n");
+	abort();
+}
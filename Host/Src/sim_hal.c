@@ -0,0 +1,1179 @@
+/*
+ * sim_hal.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main.h"
+
+// must be a power of two
+#define SIM_IRQ_QUEUE_LEN (64u)
+#define SIM_GPIO_WIRES (8u)
+// an 8 bit frame size leaves four frames of room in the 32 bit RX FIFO
+#define SIM_SPI_FIFO_LEN (4u)
+
+uint32_t SystemCoreClock = 72000000u;
+volatile uint32_t sim_primask = 0;
+
+DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+SCB_Type sim_scb;
+MPU_Region_InitTypeDef sim_mpu_regions[8];
+FLASH_TypeDef sim_flash;
+RCC_TypeDef sim_rcc;
+GPIO_TypeDef sim_gpio[SIM_GPIO_PORTS];
+TIM_TypeDef sim_tim6;
+SPI_TypeDef sim_spi[SIM_SPI_INSTANCES];
+USART_TypeDef sim_usart3;
+
+typedef struct SimIrq
+{
+	void (*handler)(void *);
+	void *context;
+} SimIrq_t;
+
+typedef struct SimWire
+{
+	GPIO_TypeDef *out_port;
+	GPIO_TypeDef *in_port;
+	uint16_t out_pin;
+	uint16_t in_pin;
+	bool exti;
+} SimWire_t;
+
+typedef struct SimSPI
+{
+	SPI_HandleTypeDef *handle;
+	GPIO_TypeDef *nss_port;
+	uint16_t nss_pin;
+	uint8_t fifo[SIM_SPI_FIFO_LEN];
+	uint8_t fifo_level;
+	bool rx_dma;
+	// when a Controller clocks the next frame of its transfer
+	uint64_t frame_due;
+} SimSPI_t;
+
+static uint64_t now_cycles = 0;
+static bool advancing = false;
+static bool tim6_running = false;
+static uint64_t tim6_residue = 0;
+
+static SimIrq_t irq_queue[SIM_IRQ_QUEUE_LEN];
+static uint32_t irq_head = 0;
+static uint32_t irq_tail = 0;
+static bool in_irq = false;
+
+static SimWire_t wires[SIM_GPIO_WIRES];
+static uint8_t wire_count = 0;
+
+static SimSPI_t spi_models[SIM_SPI_INSTANCES];
+static uint32_t spi_bit_rate = 0;
+
+static UART_HandleTypeDef *stdio_uart = NULL;
+// the UARTs sending and receiving from interrupt, and when each is next due
+static UART_HandleTypeDef *tx_uart = NULL;
+static uint64_t tx_uart_due = 0;
+static UART_HandleTypeDef *rx_uart = NULL;
+static uint64_t rx_uart_due = 0;
+static bool stdin_closed = false;
+
+static const uint8_t apb_shift[8] = { 0, 0, 0, 0, 1, 2, 3, 4 };
+
+// the clock tree as SystemClock_Config() leaves it
+static uint32_t voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE3;
+static bool over_drive = false;
+static bool pll_on = true;
+static bool sysclk_from_pll = true;
+static uint32_t pll_hz = 72000000u;
+// HAL_GetTick() counts on from here after a change of the system clock
+static uint64_t tick_base_cycles = 0;
+static uint32_t tick_base_ms = 0;
+
+/* Interrupts --------------------------------------------------------------*/
+
+void sim_irq_raise(void (*handler)(void *), void *context)
+{
+	if (irq_head - irq_tail >= SIM_IRQ_QUEUE_LEN)
+	{
+		fprintf(stderr, "sim: interrupt queue overflow\n");
+		abort();
+	}
+
+	irq_queue[irq_head & (SIM_IRQ_QUEUE_LEN - 1)] = (SimIrq_t){ handler, context };
+	irq_head++;
+
+	sim_irq_dispatch();
+}
+
+void sim_irq_dispatch(void)
+{
+	if (in_irq || sim_primask) return;
+
+	in_irq = true;
+
+	while (irq_tail != irq_head)
+	{
+		SimIrq_t irq = irq_queue[irq_tail & (SIM_IRQ_QUEUE_LEN - 1)];
+		irq_tail++;
+		irq.handler(irq.context);
+	}
+
+	in_irq = false;
+}
+
+/* Time --------------------------------------------------------------------*/
+
+static uint64_t sim_spi_cycles_left(void);
+static void sim_spi_step(void);
+static uint64_t sim_uart_cycles_left(void);
+static void sim_uart_step(void);
+
+static uint64_t sim_tim6_cycles_per_tick(void)
+{
+	uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+	uint32_t timer_clock = (RCC->CFGR & RCC_CFGR_PPRE1) == RCC_CFGR_PPRE1_DIV1 ? pclk1 : pclk1 * 2u;
+
+	return (uint64_t)(TIM6->PSC + 1u) * SystemCoreClock / timer_clock;
+}
+
+static void sim_tim6_update(void *context)
+{
+	(void)context;
+
+	TIM6_DAC_IRQHandler();
+}
+
+/**
+ * Cycles until the running timer raises its update, 0 if it is stopped.
+ */
+static uint64_t sim_tim6_cycles_left(void)
+{
+	if (!(TIM6->CR1 & TIM_CR1_CEN)) return 0;
+
+	uint64_t ticks_left = TIM6->CNT > TIM6->ARR ? 1u : (uint64_t)TIM6->ARR + 1u - TIM6->CNT;
+	uint64_t cycles = ticks_left * sim_tim6_cycles_per_tick();
+
+	return cycles > tim6_residue ? cycles - tim6_residue : 1u;
+}
+
+static void sim_tim6_step(uint64_t cycles)
+{
+	if (!(TIM6->CR1 & TIM_CR1_CEN))
+	{
+		tim6_running = false;
+		return;
+	}
+
+	// the firmware resets the count when it starts the timer
+	if (!tim6_running)
+	{
+		tim6_running = true;
+		tim6_residue = 0;
+	}
+
+	uint64_t cycles_per_tick = sim_tim6_cycles_per_tick();
+
+	tim6_residue += cycles;
+	TIM6->CNT += (uint32_t)(tim6_residue / cycles_per_tick);
+	tim6_residue %= cycles_per_tick;
+
+	if (TIM6->CNT > TIM6->ARR)
+	{
+		TIM6->CNT = 0;
+		TIM6->SR |= TIM_SR_UIF;
+
+		if (TIM6->CR1 & TIM_CR1_OPM)
+		{
+			TIM6->CR1 &= ~TIM_CR1_CEN;
+			tim6_running = false;
+		}
+
+		if (TIM6->DIER & TIM_DIER_UIE) sim_irq_raise(sim_tim6_update, NULL);
+	}
+}
+
+static uint64_t sim_earliest(uint64_t left, uint64_t other_left)
+{
+	if (left == 0) return other_left;
+	if (other_left == 0) return left;
+
+	return left < other_left ? left : other_left;
+}
+
+/**
+ * Cycles until the next timer update, bus frame or UART completion,
+ * 0 if none is due.
+ */
+static uint64_t sim_event_cycles_left(void)
+{
+	uint64_t left = sim_earliest(sim_tim6_cycles_left(), sim_spi_cycles_left());
+
+	return sim_earliest(left, sim_uart_cycles_left());
+}
+
+uint64_t sim_now(void)
+{
+	return now_cycles;
+}
+
+void sim_advance(uint32_t cycles)
+{
+	bool was_advancing = advancing;
+	advancing = true;
+
+	// stepping up to each event lets it happen at its own time
+	while (cycles > 0)
+	{
+		uint64_t step = cycles;
+		uint64_t event_left = sim_event_cycles_left();
+
+		if (event_left > 0 && event_left < step) step = event_left;
+
+		now_cycles += step;
+		if (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) DWT->CYCCNT += (uint32_t)step;
+		cycles -= (uint32_t)step;
+
+		sim_tim6_step(step);
+		sim_spi_step();
+		sim_uart_step();
+	}
+
+	advancing = was_advancing;
+}
+
+uint32_t sim_irq_active(void)
+{
+	return in_irq ? 1u : 0u;
+}
+
+void sim_cpu_spend(uint32_t cycles)
+{
+	if (in_irq || advancing) return;
+
+	sim_advance(cycles);
+}
+
+/**
+ * Sleeps until the next event, or for a millisecond when none is due.
+ */
+void sim_wfi(void)
+{
+	uint64_t limit = SystemCoreClock / 1000u;
+	uint64_t event_left = sim_event_cycles_left();
+
+	sim_advance((uint32_t)(event_left > 0 && event_left < limit ? event_left : limit));
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return tick_base_ms + (uint32_t)((now_cycles - tick_base_cycles) / (SystemCoreClock / 1000u));
+}
+
+void HAL_Delay(uint32_t delay)
+{
+	uint32_t start = HAL_GetTick();
+
+	// like the HAL, wait at least the requested time
+	if (delay < HAL_MAX_DELAY) delay++;
+
+	while (HAL_GetTick() - start < delay)
+	{
+		sim_wfi();
+	}
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type irqn, uint32_t preempt_priority, uint32_t sub_priority)
+{
+	(void)irqn;
+	(void)preempt_priority;
+	(void)sub_priority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type irqn)
+{
+	(void)irqn;
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type irqn)
+{
+	(void)irqn;
+}
+
+// there is no vector table, the models call the handlers directly
+uint32_t NVIC_GetVector(IRQn_Type irqn)
+{
+	(void)irqn;
+
+	return 0;
+}
+
+// a fixed unique ID, the USB serial number is made of it
+uint32_t HAL_GetUIDw0(void)
+{
+	return 0x00350041u;
+}
+
+uint32_t HAL_GetUIDw1(void)
+{
+	return 0x3138510Du;
+}
+
+uint32_t HAL_GetUIDw2(void)
+{
+	return 0x33373732u;
+}
+
+/* MPU ---------------------------------------------------------------------*/
+
+void HAL_MPU_Disable(void)
+{
+}
+
+void HAL_MPU_Enable(uint32_t control)
+{
+	(void)control;
+}
+
+void HAL_MPU_ConfigRegion(MPU_Region_InitTypeDef *init)
+{
+	sim_mpu_regions[init->Number & 0x07u] = *init;
+}
+
+/* PWR ---------------------------------------------------------------------*/
+
+static void sim_clock_fail(const char *what)
+{
+	fprintf(stderr, "sim: %s\n", what);
+	abort();
+}
+
+void sim_pwr_set_voltage_scaling(uint32_t scale)
+{
+	if (pll_on) sim_clock_fail("regulator scale changed with the PLL on");
+
+	voltage_scale = scale;
+}
+
+HAL_StatusTypeDef HAL_PWREx_EnableOverDrive(void)
+{
+	if (voltage_scale == PWR_REGULATOR_VOLTAGE_SCALE3 || !pll_on || sysclk_from_pll)
+	{
+		sim_clock_fail("over-drive entered out of sequence");
+	}
+
+	over_drive = true;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PWREx_DisableOverDrive(void)
+{
+	if (sysclk_from_pll) sim_clock_fail("over-drive left with the system on the PLL");
+
+	over_drive = false;
+
+	return HAL_OK;
+}
+
+/* RCC ---------------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *init)
+{
+	const RCC_PLLInitTypeDef *pll = &init->PLL;
+
+	if (pll->PLLState == RCC_PLL_NONE) return HAL_OK;
+
+	// like the HAL, the PLL clocking the system is not reprogrammed
+	if (sysclk_from_pll) return HAL_ERROR;
+
+	pll_on = false;
+
+	if (pll->PLLState == RCC_PLL_OFF) return HAL_OK;
+
+	uint32_t input_hz = pll->PLLM == 0 ? 0 : SIM_HSE_HZ / pll->PLLM;
+	uint64_t vco_hz = (uint64_t)input_hz * pll->PLLN;
+
+	if (pll->PLLSource != RCC_PLLSOURCE_HSE || input_hz < 1000000u || input_hz > 2000000u
+			|| vco_hz < 100000000u || vco_hz > 432000000u
+			|| pll->PLLP == 0 || pll->PLLQ < 2 || pll->PLLQ > 15)
+	{
+		sim_clock_fail("PLL configured out of range");
+	}
+
+	// the OTG FS core takes its clock from the Q output
+	if (vco_hz != 48000000u * (uint64_t)pll->PLLQ) sim_clock_fail("PLLQ output is not 48 MHz");
+
+	pll_hz = (uint32_t)(vco_hz / pll->PLLP);
+	pll_on = true;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *init, uint32_t flash_latency)
+{
+	bool from_pll = init->SYSCLKSource == RCC_SYSCLKSOURCE_PLLCLK;
+
+	if (from_pll && !pll_on) return HAL_ERROR;
+
+	uint32_t sysclk_hz = from_pll ? pll_hz : SIM_HSE_HZ;
+	uint32_t pclk1 = sysclk_hz >> apb_shift[(init->APB1CLKDivider & RCC_CFGR_PPRE1) >> 10];
+	uint32_t pclk2 = sysclk_hz >> apb_shift[(init->APB2CLKDivider & RCC_CFGR_PPRE1) >> 10];
+	// the regulator scale limits the clock, the over-drive raises the limit
+	uint32_t max_hz = voltage_scale == PWR_REGULATOR_VOLTAGE_SCALE1 ? (over_drive ? 216000000u : 180000000u)
+			: voltage_scale == PWR_REGULATOR_VOLTAGE_SCALE2 ? (over_drive ? 180000000u : 168000000u)
+			: 144000000u;
+
+	if (init->AHBCLKDivider != RCC_SYSCLK_DIV1) sim_clock_fail("AHB prescaler not modeled");
+	if (sysclk_hz > max_hz) sim_clock_fail("system clock above the limit of the regulator scale");
+	// a wait state per 30 MHz, from 2.7 to 3.6 V
+	if (flash_latency < (sysclk_hz - 1u) / 30000000u) sim_clock_fail("too few flash wait states");
+	if (pclk1 > 54000000u || pclk2 > 108000000u) sim_clock_fail("APB clock above its limit");
+
+	tick_base_ms = HAL_GetTick();
+	tick_base_cycles = now_cycles;
+
+	SystemCoreClock = sysclk_hz;
+	sysclk_from_pll = from_pll;
+	RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2))
+			| init->APB1CLKDivider | (init->APB2CLKDivider << 3);
+	FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | flash_latency;
+
+	return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetSysClockFreq(void)
+{
+	return SystemCoreClock;
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void)
+{
+	return SystemCoreClock;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+	return SystemCoreClock >> apb_shift[(RCC->CFGR & RCC_CFGR_PPRE1) >> 10];
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+	return SystemCoreClock >> apb_shift[(RCC->CFGR & RCC_CFGR_PPRE2) >> 13];
+}
+
+/* GPIO --------------------------------------------------------------------*/
+
+static void sim_gpio_exti(void *context)
+{
+	HAL_GPIO_EXTI_Callback((uint16_t)(uintptr_t)context);
+}
+
+void sim_gpio_connect(GPIO_TypeDef *out_port, uint16_t out_pin,
+		GPIO_TypeDef *in_port, uint16_t in_pin, bool exti)
+{
+	if (wire_count >= SIM_GPIO_WIRES)
+	{
+		fprintf(stderr, "sim: out of GPIO wires\n");
+		abort();
+	}
+
+	wires[wire_count++] = (SimWire_t){ out_port, in_port, out_pin, in_pin, exti };
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init)
+{
+	(void)port;
+	(void)init;
+}
+
+void HAL_GPIO_DeInit(GPIO_TypeDef *port, uint32_t pin)
+{
+	(void)port;
+	(void)pin;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin)
+{
+	return (port->IDR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+	if (state == GPIO_PIN_SET)
+	{
+		port->ODR |= pin;
+		port->IDR |= pin;
+	}
+	else
+	{
+		port->ODR &= ~(uint32_t)pin;
+		port->IDR &= ~(uint32_t)pin;
+	}
+
+	for (uint8_t idx = 0; idx < wire_count; idx++)
+	{
+		SimWire_t *wire = wires + idx;
+
+		if (wire->out_port != port || !(wire->out_pin & pin)) continue;
+
+		uint32_t before = wire->in_port->IDR & wire->in_pin;
+
+		if (state == GPIO_PIN_SET) wire->in_port->IDR |= wire->in_pin;
+		else wire->in_port->IDR &= ~(uint32_t)wire->in_pin;
+
+		if (wire->exti && (wire->in_port->IDR & wire->in_pin) != before)
+		{
+			sim_irq_raise(sim_gpio_exti, (void *)(uintptr_t)wire->in_pin);
+		}
+	}
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *port, uint16_t pin)
+{
+	HAL_GPIO_WritePin(port, pin, (port->ODR & pin) ? GPIO_PIN_RESET : GPIO_PIN_SET);
+}
+
+/* SPI ---------------------------------------------------------------------*/
+
+static SimSPI_t *sim_spi_model(SPI_TypeDef *instance)
+{
+	return spi_models + (instance - sim_spi);
+}
+
+static void sim_spi_tx_cplt(void *context)
+{
+	HAL_SPI_TxCpltCallback((SPI_HandleTypeDef *)context);
+}
+
+static void sim_spi_rx_cplt(void *context)
+{
+	HAL_SPI_RxCpltCallback((SPI_HandleTypeDef *)context);
+}
+
+static void sim_spi_error(void *context)
+{
+	HAL_SPI_ErrorCallback((SPI_HandleTypeDef *)context);
+}
+
+static void sim_spi_abort_cplt(void *context)
+{
+	HAL_SPI_AbortCpltCallback((SPI_HandleTypeDef *)context);
+}
+
+static void sim_spi_flush(SimSPI_t *model, SPI_TypeDef *instance)
+{
+	model->fifo_level = 0;
+	instance->SR &= ~SPI_SR_OVR;
+}
+
+void sim_spi_attach(SPI_HandleTypeDef *hspi, GPIO_TypeDef *nss_port, uint16_t nss_pin)
+{
+	SimSPI_t *model = sim_spi_model(hspi->Instance);
+
+	model->handle = hspi;
+	model->nss_port = nss_port;
+	model->nss_pin = nss_pin;
+}
+
+void sim_spi_clear_ovr(SPI_HandleTypeDef *hspi)
+{
+	sim_spi_flush(sim_spi_model(hspi->Instance), hspi->Instance);
+}
+
+void sim_spi_reset(SPI_TypeDef *instance)
+{
+	bzero((void *)instance, sizeof(SPI_TypeDef));
+	sim_spi_flush(sim_spi_model(instance), instance);
+}
+
+void sim_spi_set_bit_rate(uint32_t bit_rate)
+{
+	spi_bit_rate = bit_rate;
+}
+
+static uint64_t sim_spi_frame_cycles(SPI_TypeDef *instance)
+{
+	uint32_t bit_rate = spi_bit_rate;
+
+	if (bit_rate == 0)
+	{
+		// SPI2 and SPI3 are clocked from APB1, the others from APB2
+		uint32_t pclk = (instance == SPI2 || instance == SPI3)
+				? HAL_RCC_GetPCLK1Freq() : HAL_RCC_GetPCLK2Freq();
+
+		bit_rate = pclk >> (((instance->CR1 & SPI_CR1_BR_Msk) >> SPI_CR1_BR_Pos) + 1u);
+	}
+
+	return ((uint64_t)8u * SystemCoreClock + bit_rate - 1u) / bit_rate;
+}
+
+/**
+ * Takes a frame into the pending reception, completing it on the last one.
+ */
+static void sim_spi_take(SPI_HandleTypeDef *hspi, uint8_t frame)
+{
+	*hspi->pRxBuffPtr++ = frame;
+	hspi->RxXferCount--;
+
+	if (sim_spi_model(hspi->Instance)->rx_dma)
+	{
+		hspi->hdmarx->Instance->NDTR = hspi->RxXferCount;
+	}
+
+	if (hspi->RxXferCount == 0)
+	{
+		hspi->State = HAL_SPI_STATE_READY;
+		sim_irq_raise(sim_spi_rx_cplt, hspi);
+	}
+}
+
+static HAL_StatusTypeDef sim_spi_start(SPI_HandleTypeDef *hspi, uint8_t *tx_data, uint8_t *rx_data, uint16_t size)
+{
+	SimSPI_t *model = sim_spi_model(hspi->Instance);
+
+	if ((tx_data == NULL && rx_data == NULL) || size == 0) return HAL_ERROR;
+	if (hspi->State != HAL_SPI_STATE_READY) return HAL_BUSY;
+
+	hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+	hspi->Instance->CR1 |= SPI_CR1_SPE;
+
+	if (hspi->Init.Mode == SPI_MODE_MASTER)
+	{
+		model->frame_due = now_cycles + sim_spi_frame_cycles(hspi->Instance);
+	}
+
+	if (tx_data != NULL)
+	{
+		hspi->pTxBuffPtr = tx_data;
+		hspi->TxXferSize = size;
+		hspi->TxXferCount = size;
+		hspi->State = HAL_SPI_STATE_BUSY_TX;
+
+		return HAL_OK;
+	}
+
+	hspi->pRxBuffPtr = rx_data;
+	hspi->RxXferSize = size;
+	hspi->RxXferCount = size;
+	hspi->State = HAL_SPI_STATE_BUSY_RX;
+
+	if (model->rx_dma) hspi->hdmarx->Instance->NDTR = size;
+
+	// frames already in the FIFO are read first, whatever they belonged to
+	uint8_t level = model->fifo_level;
+	uint8_t taken = 0;
+
+	while (taken < level && hspi->State == HAL_SPI_STATE_BUSY_RX)
+	{
+		sim_spi_take(hspi, model->fifo[taken++]);
+	}
+
+	memmove(model->fifo, model->fifo + taken, level - taken);
+	model->fifo_level = level - taken;
+
+	// an overrun left standing fails the reception through the error interrupt
+	if (hspi->Instance->SR & SPI_SR_OVR)
+	{
+		hspi->ErrorCode |= HAL_SPI_ERROR_OVR;
+		hspi->State = HAL_SPI_STATE_READY;
+		sim_irq_raise(sim_spi_error, hspi);
+	}
+
+	return HAL_OK;
+}
+
+uint8_t sim_spi_exchange(SPI_HandleTypeDef *hspi, uint8_t mosi)
+{
+	SimSPI_t *model = sim_spi_model(hspi->Instance);
+	uint8_t miso = 0;
+
+	if (!(hspi->Instance->CR1 & SPI_CR1_SPE)) return 0;
+
+	if (hspi->Init.NSS == SPI_NSS_HARD_INPUT && model->nss_port != NULL
+		&& HAL_GPIO_ReadPin(model->nss_port, model->nss_pin) == GPIO_PIN_SET)
+	{
+		return 0;
+	}
+
+	if (hspi->State == HAL_SPI_STATE_BUSY_RX)
+	{
+		sim_spi_take(hspi, mosi);
+		return 0;
+	}
+
+	if (hspi->State == HAL_SPI_STATE_BUSY_TX)
+	{
+		miso = *hspi->pTxBuffPtr++;
+
+		if (--hspi->TxXferCount == 0)
+		{
+			// the HAL clears the overrun of the frames received meanwhile
+			sim_spi_flush(model, hspi->Instance);
+			hspi->State = HAL_SPI_STATE_READY;
+			sim_irq_raise(sim_spi_tx_cplt, hspi);
+
+			return miso;
+		}
+	}
+
+	if (model->fifo_level < SIM_SPI_FIFO_LEN)
+	{
+		model->fifo[model->fifo_level++] = mosi;
+	}
+	else
+	{
+		hspi->Instance->SR |= SPI_SR_OVR;
+	}
+
+	return miso;
+}
+
+static bool sim_spi_is_clocking(SimSPI_t *model)
+{
+	SPI_HandleTypeDef *hspi = model->handle;
+
+	return hspi != NULL && hspi->Init.Mode == SPI_MODE_MASTER
+			&& (hspi->Instance->CR1 & SPI_CR1_SPE)
+			&& (hspi->State == HAL_SPI_STATE_BUSY_TX || hspi->State == HAL_SPI_STATE_BUSY_RX);
+}
+
+static uint64_t sim_spi_cycles_left(void)
+{
+	uint64_t cycles_left = 0;
+
+	for (uint8_t idx = 0; idx < SIM_SPI_INSTANCES; idx++)
+	{
+		SimSPI_t *model = spi_models + idx;
+
+		if (!sim_spi_is_clocking(model)) continue;
+
+		uint64_t left = model->frame_due > now_cycles ? model->frame_due - now_cycles : 1u;
+		if (cycles_left == 0 || left < cycles_left) cycles_left = left;
+	}
+
+	return cycles_left;
+}
+
+/**
+ * Clocks one frame of a Controller's transfer through every Target.
+ */
+static void sim_spi_clock_frame(SimSPI_t *controller)
+{
+	SPI_HandleTypeDef *hspi = controller->handle;
+	HAL_SPI_StateTypeDef state = hspi->State;
+	// like the HAL, a reception clocks out the buffer it is received into
+	uint8_t mosi = state == HAL_SPI_STATE_BUSY_TX ? *hspi->pTxBuffPtr : *hspi->pRxBuffPtr;
+	uint8_t miso = 0xFF;
+	bool driven = false;
+
+	controller->frame_due += sim_spi_frame_cycles(hspi->Instance);
+
+	for (uint8_t idx = 0; idx < SIM_SPI_INSTANCES; idx++)
+	{
+		SimSPI_t *model = spi_models + idx;
+
+		if (model->handle == NULL || model->handle->Init.Mode != SPI_MODE_SLAVE) continue;
+
+		uint8_t frame = sim_spi_exchange(model->handle, mosi);
+
+		if (!driven && model->nss_port != NULL
+			&& HAL_GPIO_ReadPin(model->nss_port, model->nss_pin) == GPIO_PIN_RESET)
+		{
+			miso = frame;
+			driven = true;
+		}
+	}
+
+	// a Target's interrupt may have aborted the transfer meanwhile
+	if (hspi->State != state) return;
+
+	if (state == HAL_SPI_STATE_BUSY_TX)
+	{
+		hspi->pTxBuffPtr++;
+
+		if (--hspi->TxXferCount == 0)
+		{
+			hspi->State = HAL_SPI_STATE_READY;
+			sim_irq_raise(sim_spi_tx_cplt, hspi);
+		}
+	}
+	else
+	{
+		sim_spi_take(hspi, miso);
+	}
+}
+
+static void sim_spi_step(void)
+{
+	for (uint8_t idx = 0; idx < SIM_SPI_INSTANCES; idx++)
+	{
+		SimSPI_t *model = spi_models + idx;
+
+		while (sim_spi_is_clocking(model) && model->frame_due <= now_cycles)
+		{
+			sim_spi_clock_frame(model);
+		}
+	}
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi)
+{
+	if (hspi == NULL || hspi->Instance == NULL) return HAL_ERROR;
+
+	hspi->Instance->CR1 = hspi->Init.Mode | hspi->Init.CLKPolarity | hspi->Init.CLKPhase
+			| (hspi->Init.NSS & SPI_CR1_SSM) | hspi->Init.BaudRatePrescaler
+			| hspi->Init.CRCCalculation;
+	hspi->Instance->CR2 = ((hspi->Init.NSS >> 16) & SPI_CR2_SSOE) | hspi->Init.NSSPMode;
+	hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+	hspi->State = HAL_SPI_STATE_READY;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_DeInit(SPI_HandleTypeDef *hspi)
+{
+	if (hspi == NULL) return HAL_ERROR;
+
+	hspi->Instance->CR1 &= ~SPI_CR1_SPE;
+	hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+	hspi->State = HAL_SPI_STATE_RESET;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_IT(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size)
+{
+	if (data == NULL) return HAL_ERROR;
+
+	return sim_spi_start(hspi, data, NULL, size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_IT(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size)
+{
+	if (data == NULL) return HAL_ERROR;
+
+	sim_spi_model(hspi->Instance)->rx_dma = false;
+
+	return sim_spi_start(hspi, NULL, data, size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size)
+{
+	if (hspi->hdmatx == NULL) return HAL_ERROR;
+
+	return HAL_SPI_Transmit_IT(hspi, data, size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t size)
+{
+	if (hspi->hdmarx == NULL || data == NULL) return HAL_ERROR;
+
+	// the reception runs like an interrupt driven one, counted down in NDTR as well
+	sim_spi_model(hspi->Instance)->rx_dma = true;
+
+	return sim_spi_start(hspi, NULL, data, size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+	hspi->Instance->CR1 &= ~SPI_CR1_SPE;
+	sim_spi_flush(sim_spi_model(hspi->Instance), hspi->Instance);
+	hspi->TxXferCount = 0;
+	hspi->RxXferCount = 0;
+	hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+	hspi->State = HAL_SPI_STATE_READY;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort_IT(SPI_HandleTypeDef *hspi)
+{
+	HAL_SPI_Abort(hspi);
+	sim_irq_raise(sim_spi_abort_cplt, hspi);
+
+	return HAL_OK;
+}
+
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi)
+{
+	return hspi->State;
+}
+
+/* UART --------------------------------------------------------------------*/
+
+/**
+ * Cycles a byte takes on the line: start, 8 data and stop bits,
+ * at the baud rate programmed into BRR. USART3 is clocked from APB1.
+ */
+static uint64_t sim_uart_byte_cycles(UART_HandleTypeDef *huart)
+{
+	uint32_t brr = huart->Instance->BRR;
+	uint64_t clock = HAL_RCC_GetPCLK1Freq();
+	uint64_t usartdiv = brr;
+
+	// with 8x oversampling BRR holds USARTDIV with its low nibble shifted right
+	if (huart->Instance->CR1 & USART_CR1_OVER8)
+	{
+		usartdiv = (brr & 0xFFF0u) | ((brr & 0x7u) << 1);
+		clock *= 2u;
+	}
+
+	return 10u * usartdiv * SystemCoreClock / clock;
+}
+
+void sim_uart_connect_stdio(UART_HandleTypeDef *huart)
+{
+	stdio_uart = huart;
+}
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart)
+{
+	if (huart == NULL || huart->Instance == NULL || huart->Init.BaudRate == 0) return HAL_ERROR;
+
+	uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+	uint32_t baud = huart->Init.BaudRate;
+
+	if (huart->Init.OverSampling == UART_OVERSAMPLING_8)
+	{
+		uint32_t usartdiv = (2u * pclk + baud / 2u) / baud;
+		huart->Instance->BRR = (usartdiv & 0xFFF0u) | ((usartdiv & 0x000Fu) >> 1);
+	}
+	else
+	{
+		huart->Instance->BRR = (pclk + baud / 2u) / baud;
+	}
+
+	huart->Instance->CR1 = USART_CR1_UE | huart->Init.Mode | huart->Init.OverSampling;
+	huart->ErrorCode = HAL_UART_ERROR_NONE;
+
+	// reinitializing ends the transfers in progress
+	if (tx_uart == huart) tx_uart = NULL;
+	if (rx_uart == huart) rx_uart = NULL;
+
+	huart->gState = HAL_UART_STATE_READY;
+	huart->RxState = HAL_UART_STATE_READY;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size, uint32_t timeout)
+{
+	(void)timeout;
+
+	if (data == NULL || size == 0) return HAL_ERROR;
+	if (huart->gState != HAL_UART_STATE_READY) return HAL_BUSY;
+
+	if (huart == stdio_uart) fwrite(data, 1, size, stdout);
+
+	// the thread is blocked while the bytes go out
+	sim_cpu_spend((uint32_t)(size * sim_uart_byte_cycles(huart)));
+
+	return HAL_OK;
+}
+
+static void sim_uart_tx_cplt(void *context)
+{
+	HAL_UART_TxCpltCallback(context);
+}
+
+static void sim_uart_rx_event(void *context)
+{
+	UART_HandleTypeDef *huart = context;
+
+	HAL_UARTEx_RxEventCallback(huart, huart->RxXferSize - huart->RxXferCount);
+}
+
+/**
+ * Reads a byte already typed, waiting a millisecond of real time for one
+ * on a terminal, so that an idle prompt does not spin the host.
+ */
+static bool sim_uart_read_stdin(uint8_t *byte)
+{
+	struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+
+	if (stdin_closed) return false;
+
+	fflush(stdout);
+
+	if (poll(&pfd, 1, isatty(STDIN_FILENO) ? 1 : 0) <= 0) return false;
+
+	if (read(STDIN_FILENO, byte, 1) != 1)
+	{
+		stdin_closed = true;
+		return false;
+	}
+
+	return true;
+}
+
+static uint64_t sim_uart_cycles_left(void)
+{
+	uint64_t tx_left = tx_uart == NULL ? 0 : tx_uart_due > now_cycles ? tx_uart_due - now_cycles : 1u;
+	uint64_t rx_left = rx_uart == NULL ? 0 : rx_uart_due > now_cycles ? rx_uart_due - now_cycles : 1u;
+
+	return sim_earliest(tx_left, rx_left);
+}
+
+/**
+ * Takes the next byte off the line into the armed reception, ending it when
+ * full or when no byte followed the last one for a frame time. An idle line
+ * with nothing received is checked every millisecond.
+ */
+static void sim_uart_rx_step(void)
+{
+	UART_HandleTypeDef *huart = rx_uart;
+	uint8_t byte;
+
+	if (huart == stdio_uart && sim_uart_read_stdin(&byte))
+	{
+		*huart->pRxBuffPtr++ = byte;
+		huart->RxXferCount--;
+		rx_uart_due = now_cycles + sim_uart_byte_cycles(huart);
+
+		if (huart->RxXferCount > 0) return;
+	}
+	else if (huart->RxXferCount == huart->RxXferSize)
+	{
+		rx_uart_due = now_cycles + SystemCoreClock / 1000u;
+		return;
+	}
+
+	rx_uart = NULL;
+	huart->RxState = HAL_UART_STATE_READY;
+	sim_irq_raise(sim_uart_rx_event, huart);
+}
+
+static void sim_uart_step(void)
+{
+	if (tx_uart != NULL && tx_uart_due <= now_cycles)
+	{
+		UART_HandleTypeDef *huart = tx_uart;
+
+		tx_uart = NULL;
+		huart->gState = HAL_UART_STATE_READY;
+		sim_irq_raise(sim_uart_tx_cplt, huart);
+	}
+
+	if (rx_uart != NULL && rx_uart_due <= now_cycles)
+	{
+		sim_uart_rx_step();
+	}
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size)
+{
+	if (data == NULL || size == 0) return HAL_ERROR;
+	if (huart->gState != HAL_UART_STATE_READY || tx_uart != NULL) return HAL_BUSY;
+
+	// the bytes are written at once, the completion comes after their line time
+	if (huart == stdio_uart) fwrite(data, 1, size, stdout);
+
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	tx_uart = huart;
+	tx_uart_due = now_cycles + size * sim_uart_byte_cycles(huart);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_IT(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+	if (data == NULL || size == 0) return HAL_ERROR;
+	if (huart->RxState != HAL_UART_STATE_READY || rx_uart != NULL) return HAL_BUSY;
+
+	huart->pRxBuffPtr = data;
+	huart->RxXferSize = size;
+	huart->RxXferCount = size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	rx_uart = huart;
+	rx_uart_due = now_cycles + sim_uart_byte_cycles(huart);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart)
+{
+	if (rx_uart == huart) rx_uart = NULL;
+	huart->RxState = HAL_UART_STATE_READY;
+
+	return HAL_OK;
+}
+
+void HAL_UART_IRQHandler(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+bool sim_uart_input_closed(void)
+{
+	return stdin_closed;
+}
+
+// like the HAL's, overridden by a firmware using the interrupt transfers
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+__attribute__((weak)) void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t size)
+{
+	(void)huart;
+	(void)size;
+}
+
+/* Simulation control ------------------------------------------------------*/
+
+void sim_reset(void)
+{
+	bzero(&sim_dwt, sizeof(sim_dwt));
+	bzero(&sim_core_debug, sizeof(sim_core_debug));
+	bzero(&sim_scb, sizeof(sim_scb));
+	bzero(sim_mpu_regions, sizeof(sim_mpu_regions));
+	bzero(&sim_flash, sizeof(sim_flash));
+	bzero(&sim_rcc, sizeof(sim_rcc));
+	bzero(&sim_tim6, sizeof(sim_tim6));
+	bzero(sim_gpio, sizeof(sim_gpio));
+	bzero(sim_spi, sizeof(sim_spi));
+	bzero(spi_models, sizeof(spi_models));
+	bzero(&sim_usart3, sizeof(sim_usart3));
+
+	// the default clock tree: 72 MHz SYSCLK, APB1 at half of it
+	SystemCoreClock = 72000000u;
+	RCC->CFGR = RCC_CFGR_PPRE1_DIV2 | RCC_CFGR_PPRE2_DIV1;
+	FLASH->ACR = FLASH_LATENCY_2;
+	voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE3;
+	over_drive = false;
+	pll_on = true;
+	sysclk_from_pll = true;
+	pll_hz = 72000000u;
+	tick_base_cycles = 0;
+	tick_base_ms = 0;
+
+	for (uint8_t idx = 0; idx < SIM_GPIO_PORTS; idx++)
+	{
+		sim_gpio[idx].IDR = 0xFFFFu;
+	}
+
+	now_cycles = 0;
+	tim6_running = false;
+	tim6_residue = 0;
+	irq_head = 0;
+	irq_tail = 0;
+	in_irq = false;
+	advancing = false;
+	sim_primask = 0;
+	wire_count = 0;
+	spi_bit_rate = 0;
+	stdio_uart = NULL;
+	tx_uart = NULL;
+	tx_uart_due = 0;
+	rx_uart = NULL;
+	rx_uart_due = 0;
+	stdin_closed = false;
+}
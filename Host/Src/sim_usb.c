@@ -0,0 +1,407 @@
+/*
+ * sim_usb.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mickey
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+
+#define SIM_USB_EPS (16u)
+#define SIM_USB_EP0_LEN (64u)
+
+USB_OTG_GlobalTypeDef sim_usb_otg_fs;
+
+static PCD_HandleTypeDef *bus_pcd = NULL;
+// endpoints with a transfer the firmware started and the host has not finished
+static bool in_armed[SIM_USB_EPS];
+static bool out_armed[SIM_USB_EPS];
+static uint16_t rx_fifo_words = 0;
+static uint16_t tx_fifo_words[SIM_USB_EPS];
+
+static PCD_EPTypeDef *sim_usb_ep(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+	uint8_t num = ep_addr & 0x0Fu;
+
+	return ep_addr & 0x80u ? &hpcd->IN_ep[num] : &hpcd->OUT_ep[num];
+}
+
+static void sim_usb_disarm(void)
+{
+	memset(in_armed, 0, sizeof(in_armed));
+	memset(out_armed, 0, sizeof(out_armed));
+}
+
+/* Interrupts --------------------------------------------------------------*/
+
+static void sim_usb_setup(void *context)
+{
+	HAL_PCD_SetupStageCallback(context);
+}
+
+static void sim_usb_data_in(void *context)
+{
+	HAL_PCD_DataInStageCallback(bus_pcd, (uint8_t)(uintptr_t)context);
+}
+
+static void sim_usb_data_out(void *context)
+{
+	HAL_PCD_DataOutStageCallback(bus_pcd, (uint8_t)(uintptr_t)context);
+}
+
+static void sim_usb_bus_reset(void *context)
+{
+	HAL_PCD_ResetCallback(context);
+}
+
+static void sim_usb_bus_disconnect(void *context)
+{
+	HAL_PCD_DisconnectCallback(context);
+}
+
+/* PCD ---------------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_PCD_Init(PCD_HandleTypeDef *hpcd)
+{
+	if (hpcd == NULL || hpcd->Instance != USB_OTG_FS) return HAL_ERROR;
+
+	memset(hpcd->IN_ep, 0, sizeof(hpcd->IN_ep));
+	memset(hpcd->OUT_ep, 0, sizeof(hpcd->OUT_ep));
+	hpcd->USB_Address = 0;
+	hpcd->State = HAL_PCD_STATE_READY;
+
+	bus_pcd = NULL;
+	rx_fifo_words = 0;
+	memset(tx_fifo_words, 0, sizeof(tx_fifo_words));
+	sim_usb_disarm();
+
+	return HAL_OK;
+}
+
+/**
+ * Connects to the bus. The device comes up detached, the host resets it
+ * with sim_usb_reset() before enumerating it.
+ */
+HAL_StatusTypeDef HAL_PCD_Start(PCD_HandleTypeDef *hpcd)
+{
+	uint32_t words = rx_fifo_words;
+
+	for (uint8_t idx = 0; idx < SIM_USB_EPS; idx++) words += tx_fifo_words[idx];
+
+	if (words > SIM_USB_FIFO_WORDS)
+	{
+		fprintf(stderr, "sim: USB FIFOs take %u of %u words\n", (unsigned)words, SIM_USB_FIFO_WORDS);
+		abort();
+	}
+
+	bus_pcd = hpcd;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_Stop(PCD_HandleTypeDef *hpcd)
+{
+	if (bus_pcd == hpcd) bus_pcd = NULL;
+	sim_usb_disarm();
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_SetAddress(PCD_HandleTypeDef *hpcd, uint8_t address)
+{
+	hpcd->USB_Address = address;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type)
+{
+	PCD_EPTypeDef *ep = sim_usb_ep(hpcd, ep_addr);
+
+	ep->num = ep_addr & 0x0Fu;
+	ep->is_in = (ep_addr & 0x80u) != 0;
+	ep->maxpacket = ep_mps;
+	ep->type = ep_type;
+	ep->is_stall = 0;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+	uint8_t num = ep_addr & 0x0Fu;
+
+	sim_usb_ep(hpcd, ep_addr)->maxpacket = 0;
+	if (ep_addr & 0x80u) in_armed[num] = false;
+	else out_armed[num] = false;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Abort(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+	(void)hpcd;
+
+	if (ep_addr & 0x80u) in_armed[ep_addr & 0x0Fu] = false;
+	else out_armed[ep_addr & 0x0Fu] = false;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Flush(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+	(void)hpcd;
+
+	// like the core, the FIFO of an enabled endpoint would refill
+	if ((ep_addr & 0x80u) && in_armed[ep_addr & 0x0Fu])
+	{
+		fprintf(stderr, "sim: FIFO of EP%u flushed during a transfer\n", (unsigned)(ep_addr & 0x0Fu));
+		abort();
+	}
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Receive(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len)
+{
+	PCD_EPTypeDef *ep = sim_usb_ep(hpcd, ep_addr & 0x7Fu);
+
+	ep->xfer_buff = pBuf;
+	ep->xfer_len = len;
+	ep->xfer_count = 0;
+	out_armed[ep_addr & 0x0Fu] = true;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len)
+{
+	PCD_EPTypeDef *ep = sim_usb_ep(hpcd, ep_addr | 0x80u);
+
+	// like the core, EP0 sends a single packet per transfer
+	if ((ep_addr & 0x0Fu) == 0 && len > ep->maxpacket)
+	{
+		fprintf(stderr, "sim: EP0 transfer of %u bytes\n", (unsigned)len);
+		abort();
+	}
+
+	ep->xfer_buff = pBuf;
+	ep->xfer_len = len;
+	ep->xfer_count = 0;
+	in_armed[ep_addr & 0x0Fu] = true;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_SetStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+	sim_usb_ep(hpcd, ep_addr)->is_stall = 1;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_ClrStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
+{
+	sim_usb_ep(hpcd, ep_addr)->is_stall = 0;
+
+	return HAL_OK;
+}
+
+uint32_t HAL_PCD_EP_GetRxCount(PCD_HandleTypeDef const *hpcd, uint8_t ep_addr)
+{
+	return hpcd->OUT_ep[ep_addr & 0x0Fu].xfer_count;
+}
+
+HAL_StatusTypeDef HAL_PCDEx_SetTxFiFo(PCD_HandleTypeDef *hpcd, uint8_t fifo, uint16_t size)
+{
+	(void)hpcd;
+
+	if (fifo >= SIM_USB_EPS) return HAL_ERROR;
+	tx_fifo_words[fifo] = size;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCDEx_SetRxFiFo(PCD_HandleTypeDef *hpcd, uint16_t size)
+{
+	(void)hpcd;
+
+	rx_fifo_words = size;
+
+	return HAL_OK;
+}
+
+void HAL_PCD_IRQHandler(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+}
+
+// like the HAL's, overridden by a firmware with a USB device
+__attribute__((weak)) void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+}
+
+__attribute__((weak)) void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+	(void)hpcd;
+	(void)epnum;
+}
+
+__attribute__((weak)) void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
+{
+	(void)hpcd;
+	(void)epnum;
+}
+
+__attribute__((weak)) void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+}
+
+__attribute__((weak)) void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+}
+
+__attribute__((weak)) void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+}
+
+__attribute__((weak)) void HAL_PCD_DisconnectCallback(PCD_HandleTypeDef *hpcd)
+{
+	(void)hpcd;
+}
+
+/* Simulation control ------------------------------------------------------*/
+
+void sim_usb_reset(void)
+{
+	if (bus_pcd == NULL) return;
+
+	sim_usb_disarm();
+	for (uint8_t idx = 0; idx < SIM_USB_EPS; idx++)
+	{
+		bus_pcd->IN_ep[idx].is_stall = 0;
+		bus_pcd->OUT_ep[idx].is_stall = 0;
+	}
+	bus_pcd->USB_Address = 0;
+
+	sim_irq_raise(sim_usb_bus_reset, bus_pcd);
+}
+
+void sim_usb_disconnect(void)
+{
+	if (bus_pcd == NULL) return;
+
+	sim_usb_disarm();
+
+	sim_irq_raise(sim_usb_bus_disconnect, bus_pcd);
+}
+
+/**
+ * A transfer ends on a short packet or once all of its bytes went,
+ * so one of whole packets takes a zero-length transfer after it.
+ */
+int sim_usb_in(uint8_t ep_addr, uint8_t *data)
+{
+	uint8_t num = ep_addr & 0x0Fu;
+
+	if (bus_pcd == NULL) return -1;
+
+	PCD_EPTypeDef *ep = &bus_pcd->IN_ep[num];
+
+	if (ep->is_stall || !in_armed[num]) return -1;
+
+	uint32_t len = ep->xfer_len - ep->xfer_count;
+	if (len > ep->maxpacket) len = ep->maxpacket;
+
+	if (len > 0) memcpy(data, ep->xfer_buff + ep->xfer_count, len);
+	ep->xfer_count += len;
+
+	if (len < ep->maxpacket || ep->xfer_count >= ep->xfer_len)
+	{
+		in_armed[num] = false;
+		sim_irq_raise(sim_usb_data_in, (void *)(uintptr_t)num);
+	}
+
+	return (int)len;
+}
+
+int sim_usb_out(uint8_t ep_addr, const uint8_t *data, uint16_t len)
+{
+	uint8_t num = ep_addr & 0x0Fu;
+
+	if (bus_pcd == NULL) return -1;
+
+	PCD_EPTypeDef *ep = &bus_pcd->OUT_ep[num];
+
+	if (ep->is_stall || !out_armed[num]) return -1;
+
+	// a packet longer than the transfer has room for is a babble
+	if (len > ep->maxpacket || ep->xfer_count + len > ep->xfer_len)
+	{
+		fprintf(stderr, "sim: USB OUT packet of %u bytes overruns the transfer\n", len);
+		abort();
+	}
+
+	if (len > 0) memcpy(ep->xfer_buff + ep->xfer_count, data, len);
+	ep->xfer_count += len;
+
+	if (len < ep->maxpacket || ep->xfer_count >= ep->xfer_len)
+	{
+		out_armed[num] = false;
+		sim_irq_raise(sim_usb_data_out, (void *)(uintptr_t)num);
+	}
+
+	return len;
+}
+
+int sim_usb_control(const uint8_t setup[8], uint8_t *data)
+{
+	uint8_t packet[SIM_USB_EP0_LEN];
+	uint16_t length = (uint16_t)(setup[6] | setup[7] << 8);
+	uint16_t done = 0;
+	int len;
+
+	if (bus_pcd == NULL) return -1;
+
+	// the core takes a SETUP packet whatever state EP0 is in
+	in_armed[0] = false;
+	out_armed[0] = false;
+	bus_pcd->IN_ep[0].is_stall = 0;
+	bus_pcd->OUT_ep[0].is_stall = 0;
+	memcpy(bus_pcd->Setup, setup, 8);
+
+	sim_irq_raise(sim_usb_setup, bus_pcd);
+
+	if (length > 0 && (setup[0] & 0x80u))
+	{
+		do
+		{
+			len = sim_usb_in(0x80, packet);
+			if (len < 0) return -1;
+
+			if (len > length - done) len = length - done;
+			memcpy(data + done, packet, (size_t)len);
+			done += (uint16_t)len;
+		} while (len == SIM_USB_EP0_LEN && done < length);
+
+		return sim_usb_out(0x00, NULL, 0) < 0 ? -1 : done;
+	}
+
+	while (done < length)
+	{
+		uint16_t chunk = length - done > SIM_USB_EP0_LEN ? SIM_USB_EP0_LEN : length - done;
+
+		if (sim_usb_out(0x00, data + done, chunk) < 0) return -1;
+		done += chunk;
+	}
+
+	return sim_usb_in(0x80, packet) == 0 ? done : -1;
+}
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+#
+# Decoder for the deferred log records on the console UART, see
+# App/Utils/dlog.h. The format strings are read from the dlog_fmt section of
+# the firmware's ELF, or of the simulator's. The console text passes through,
+# the log frames are replaced by the lines they stand for.
+#
+#   dlog_decode.py --elf Debug/spi_test.elf --port /dev/ttyACM0
+#   dlog_decode.py --elf build/spi_sim capture.bin
+#
+
+import argparse
+import re
+import struct
+import sys
+
+from spi_cmd import decode_frame
+
+DLOG_FRAME_CODE = 0x40
+FORMAT_SPEC = re.compile(r"%([-+ 0#]*)(\d*)(?:\.(\d+))?(?:hh|h|ll|l|z|j|t)?([diuxXoc%s])")
+
+
+def read_section(path, name):
+    """Returns the contents of a section of an ELF32 or ELF64 file."""
+    with open(path, "rb") as elf:
+        data = elf.read()
+    if data[:4] != b"\x7fELF":
+        raise ValueError("%s is not an ELF file" % path)
+    is64 = data[4] == 2
+    order = "<" if data[5] == 1 else ">"
+    if is64:
+        shoff, = struct.unpack_from(order + "Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(order + "HHH", data, 0x3A)
+        header = order + "IIQQQQIIQQ"
+    else:
+        shoff, = struct.unpack_from(order + "I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(order + "HHH", data, 0x2E)
+        header = order + "IIIIIIIIII"
+
+    sections = [struct.unpack_from(header, data, shoff + idx * shentsize) for idx in range(shnum)]
+    names = sections[shstrndx]
+    for sec_name, _, _, _, offset, size, _, _, _, _ in sections:
+        start = names[4] + sec_name
+        if data[start:data.index(b"\0", start)].decode() == name:
+            return data[offset:offset + size]
+    raise ValueError("%s has no %s section" % (path, name))
+
+
+class Decoder:
+    """Rebuilds the log lines from the records of the log frames."""
+
+    def __init__(self, strings):
+        self.strings = strings
+        self.last_cycles = None
+        self.extended = 0
+
+    def string(self, ident):
+        if ident >= len(self.strings):
+            return "<bad string %d>" % ident
+        return self.strings[ident:self.strings.index(b"\0", ident)].decode(errors="replace")
+
+    def format(self, fmt, args):
+        args = list(args)
+
+        def convert(match):
+            flags, width, precision, conv = match.groups()
+            if conv == "%":
+                return "%"
+            if not args:
+                return "<missing>"
+            value = args.pop(0)
+            if conv == "s":
+                value = self.string(value)
+            elif conv in "di":
+                value = value - (1 << 32) if value & 0x80000000 else value
+                conv = "d"
+            elif conv == "u":
+                conv = "d"
+            spec = "%" + flags + width + ("." + precision if precision else "") + conv
+            return spec % value
+
+        return FORMAT_SPEC.sub(convert, fmt)
+
+    def timestamp(self, cycles):
+        # records may arrive slightly out of order, steps are taken as signed
+        if self.last_cycles is not None:
+            step = (cycles - self.last_cycles) & 0xFFFFFFFF
+            self.extended += step - (1 << 32) if step & 0x80000000 else step
+        self.last_cycles = cycles
+        return self.extended
+
+    def frame(self, payload):
+        """Returns the lines of a log frame."""
+        lines = []
+        clock_mhz = payload[1] or 1
+        cycles, = struct.unpack_from("<I", payload, 2)
+        idx = 6
+
+        def varint():
+            nonlocal idx
+            value = shift = 0
+            while True:
+                byte = payload[idx]
+                idx += 1
+                value |= (byte & 0x7F) << shift
+                shift += 7
+                if not byte & 0x80:
+                    return value & 0xFFFFFFFF
+
+        try:
+            while idx < len(payload):
+                ident, = struct.unpack_from("<H", payload, idx)
+                idx += 2
+                fmt = self.string(ident)
+                cycles = (cycles + varint()) & 0xFFFFFFFF
+                # the format string tells the number of arguments
+                nargs = sum(1 for spec in FORMAT_SPEC.finditer(fmt) if spec.group(4) != "%")
+                args = [varint() for _ in range(nargs)]
+                elapsed = self.timestamp(cycles)
+                lines.append("[%10.1f us] %s" % (elapsed / clock_mhz, self.format(fmt, args)))
+        except IndexError:
+            lines.append("<truncated log frame>")
+        return lines
+
+
+def decode_stream(reader, decoder, out):
+    pending = bytearray()
+    while True:
+        data = reader()
+        if data is None:
+            break
+        pending += data
+        # the text between frames never holds a zero, every chunk is tried
+        while b"\0" in pending:
+            chunk, _, rest = pending.partition(b"\0")
+            pending = bytearray(rest)
+            payload = decode_frame(bytes(chunk)) if chunk else None
+            if payload is None:
+                out.write(chunk.decode(errors="replace"))
+            elif payload[0] == DLOG_FRAME_CODE and len(payload) >= 6:
+                for line in decoder.frame(payload):
+                    out.write(line + "\r\n")
+        out.flush()
+    out.write(pending.decode(errors="replace"))
+    out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decodes the deferred log frames of the console.")
+    parser.add_argument("--elf", required=True, help="ELF of the firmware that logs")
+    parser.add_argument("--port", help="serial port of the board, instead of a capture")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("capture", nargs="?", help="console capture, stdin if omitted")
+    args = parser.parse_args()
+
+    decoder = Decoder(read_section(args.elf, "dlog_fmt"))
+
+    if args.port:
+        import serial
+
+        ser = serial.Serial(args.port, args.baud, timeout=0.1)
+        reader = lambda: ser.read(4096)
+    elif args.capture:
+        capture = open(args.capture, "rb")
+        reader = lambda: capture.read(4096) or None
+    else:
+        reader = lambda: sys.stdin.buffer.read1(4096) or None
+
+    try:
+        decode_stream(reader, decoder, sys.stdout)
+    except KeyboardInterrupt:
+        pass
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
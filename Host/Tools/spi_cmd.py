@@ -0,0 +1,328 @@
+#!/usr/bin/env python3
+#
+# Client for the binary command protocol on the console UART, see
+# App/Interface/command.h. Talks to the board through a serial port, or to
+# the simulator through its stdin and stdout.
+#
+#   spi_cmd.py --port /dev/ttyACM0 ping
+#   spi_cmd.py --sim build/spi_sim bench 1 1000 64
+#   spi_cmd.py --sim build/spi_sim selftest
+#
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import time
+
+PING = 0x01
+GET_PARAM = 0x02
+SET_PARAM = 0x03
+GET_COUNTERS = 0x04
+RESET_COUNTERS = 0x05
+RUN_BENCHMARK = 0x06
+GET_HISTOGRAM = 0x07
+RESET_HISTOGRAMS = 0x08
+RESPONSE_FLAG = 0x80
+FRAME_ERROR = 0xFF
+
+STATUS_NAMES = ["ok", "unknown command", "bad length", "bad argument", "busy", "bad frame"]
+PARAM_NAMES = ["prescaler", "crc", "nss", "mode", "framing",
+               "cs_setup_us", "cs_hold_us", "turnaround_us", "tx_policy"]
+COUNTER_NAMES = ["rx_packets", "header_errors", "read_errors", "response_drops",
+                 "crc_errors", "crc_retransmits", "crc_failures", "acked_bytes",
+                 "recoveries", "recovery_max_us", "queue_sent", "queue_rejected",
+                 "queue_high_water", "timeouts_cs_setup", "timeouts_header",
+                 "timeouts_payload", "timeouts_turnaround", "timeouts_response",
+                 "timeouts_cs_hold"]
+HIST_BINS = 16
+HIST_SHIFT = 6
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_idx = 0
+    code = 1
+    for byte in data:
+        if byte:
+            out.append(byte)
+            code += 1
+        if not byte or code == 0xFF:
+            out[code_idx] = code
+            code_idx = len(out)
+            out.append(0)
+            code = 1
+    out[code_idx] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    idx = 0
+    while idx < len(data):
+        code = data[idx]
+        idx += 1
+        if code == 0 or idx + code - 1 > len(data):
+            return None
+        out += data[idx:idx + code - 1]
+        idx += code - 1
+        if code < 0xFF and idx < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def encode_frame(payload):
+    crc = crc16(payload)
+    return b"\0" + cobs_encode(payload + struct.pack("<H", crc)) + b"\0"
+
+
+def decode_frame(data):
+    decoded = cobs_decode(data)
+    if decoded is None or len(decoded) <= 2:
+        return None
+    payload, crc = decoded[:-2], struct.unpack("<H", decoded[-2:])[0]
+    return payload if crc16(payload) == crc else None
+
+
+class CommandError(Exception):
+    pass
+
+
+class Link:
+    """Sends requests and picks the response frames out of the console output."""
+
+    def __init__(self, reader, writer, timeout):
+        self.reader = reader
+        self.writer = writer
+        self.timeout = timeout
+        self.pending = bytearray()
+        self.next_id = 1
+
+    def send_raw(self, data):
+        self.writer(data)
+
+    def receive(self):
+        deadline = time.monotonic() + self.timeout
+        while time.monotonic() < deadline:
+            # the text between frames never holds a zero, every chunk is tried
+            while b"\0" in self.pending:
+                chunk, _, rest = self.pending.partition(b"\0")
+                self.pending = bytearray(rest)
+                payload = decode_frame(bytes(chunk)) if chunk else None
+                if payload is not None and len(payload) >= 4:
+                    return payload
+            data = self.reader()
+            if data is None:
+                raise CommandError("link closed")
+            self.pending += data
+        raise CommandError("no response")
+
+    def request(self, code, args=b"", check=True):
+        req_id = self.next_id
+        self.next_id = (self.next_id + 1) & 0xFFFF
+        self.writer(encode_frame(struct.pack("<BH", code, req_id) + args))
+        while True:
+            payload = self.receive()
+            resp_code, resp_id, status = struct.unpack("<BHB", payload[:4])
+            if resp_code == FRAME_ERROR or (resp_code == code | RESPONSE_FLAG and resp_id == req_id):
+                break
+        if check and status != 0:
+            raise CommandError("command 0x%02x: %s" % (code, STATUS_NAMES[status]
+                                                         if status < len(STATUS_NAMES) else status))
+        return resp_code, status, payload[4:]
+
+    def ping(self):
+        _, _, data = self.request(PING)
+        version, max_len, uptime, handled, rejected = struct.unpack("<BHIII", data)
+        return {"version": version, "max_payload": max_len, "uptime_ms": uptime,
+                "frames_handled": handled, "frames_rejected": rejected}
+
+    def get_param(self, param, device=0):
+        _, _, data = self.request(GET_PARAM, struct.pack("<BB", param, device))
+        return struct.unpack("<I", data)[0]
+
+    def set_param(self, param, value, device=0):
+        _, _, data = self.request(SET_PARAM, struct.pack("<BBI", param, device, value))
+        return struct.unpack("<I", data)[0]
+
+    def counters(self, device):
+        _, _, data = self.request(GET_COUNTERS, struct.pack("<B", device))
+        values = struct.unpack("<%dI" % (len(data) // 4), data)
+        return dict(zip(COUNTER_NAMES, values))
+
+    def reset_counters(self, device=0xFF):
+        self.request(RESET_COUNTERS, struct.pack("<B", device))
+
+    def benchmark(self, target, count, length):
+        _, _, data = self.request(RUN_BENCHMARK, struct.pack("<BIB", target, count, length))
+        fields = struct.unpack("<IIIIIBB", data)
+        return dict(zip(["elapsed_us", "received", "crc_errors", "dropped",
+                         "recoveries", "error_flags", "verified"], fields))
+
+    def histogram(self, target, point):
+        _, _, data = self.request(GET_HISTOGRAM, struct.pack("<BB", target, point))
+        clock, count, cmin, cmax, total = struct.unpack("<IIIIQ", data[:24])
+        bins = struct.unpack("<%dI" % HIST_BINS, data[24:])
+        return {"clock": clock, "count": count, "min": cmin, "max": cmax,
+                "total": total, "bins": bins}
+
+    def reset_histograms(self):
+        self.request(RESET_HISTOGRAMS)
+
+
+def open_sim(path, timeout):
+    proc = subprocess.Popen([path], stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=0)
+
+    def writer(data):
+        proc.stdin.write(data)
+        proc.stdin.flush()
+
+    # the simulator only closes its output when it exits
+    link = Link(lambda: os.read(proc.stdout.fileno(), 4096) or None, writer, timeout)
+    # the menu keeps waiting at its prompt, commands never end a selection
+    def close():
+        proc.stdin.close()
+        proc.terminate()
+        proc.wait()
+
+    return link, close
+
+
+def open_port(port, baud, timeout):
+    import serial
+
+    ser = serial.Serial(port, baud, timeout=0.1)
+    link = Link(lambda: ser.read(4096), ser.write, timeout)
+    return link, ser.close
+
+
+def print_histogram(hist):
+    us = hist["clock"] / 1e6
+    print("count %d, min %.2f us, max %.2f us, mean %.2f us" % (
+        hist["count"], hist["min"] / us, hist["max"] / us,
+        hist["total"] / us / hist["count"] if hist["count"] else 0))
+    for idx, count in enumerate(hist["bins"]):
+        if count:
+            upper = 1 << (HIST_SHIFT + idx)
+            print("  < %9.2f us: %d" % (upper / us, count))
+
+
+def selftest(link):
+    checks = 0
+
+    def check(condition, what):
+        nonlocal checks
+        if not condition:
+            raise CommandError("selftest: " + what)
+        checks += 1
+
+    info = link.ping()
+    check(info["version"] == 1, "protocol version")
+
+    prescaler = link.get_param(0)
+    check(link.set_param(0, 16) == 16, "prescaler set")
+    _, status, _ = link.request(SET_PARAM, struct.pack("<BBI", 0, 0, 3), check=False)
+    check(status == 3, "odd prescaler refused")
+    _, status, _ = link.request(0x7E, check=False)
+    check(status == 1, "unknown command refused")
+    _, status, _ = link.request(GET_COUNTERS, b"", check=False)
+    check(status == 2, "short request refused")
+
+    # a frame with a broken CRC gets the frame error response
+    link.send_raw(b"\0" + cobs_encode(b"\x01\x00\x10\xAA\xAA") + b"\0")
+    payload = link.receive()
+    check(payload[0] == FRAME_ERROR and payload[3] == 5, "bad frame reported")
+
+    link.reset_counters()
+    link.reset_histograms()
+    result = link.benchmark(1, 200, 64)
+    check(result["received"] == 200 and result["verified"] == 1, "benchmark delivered")
+    check(link.counters(1)["rx_packets"] >= 200, "counters follow")
+    hist = link.histogram(1, 3)
+    check(hist["count"] > 0 and sum(hist["bins"]) == hist["count"], "histogram collected")
+
+    link.set_param(0, prescaler)
+    info = link.ping()
+    check(info["frames_rejected"] == 1, "rejected frames counted")
+
+    print("selftest: %d checks passed, benchmark %d packets in %d us" % (
+        checks, result["received"], result["elapsed_us"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Binary command client for the SPI test board.")
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--port", help="serial port of the board")
+    target.add_argument("--sim", help="path of the simulator")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--timeout", type=float, default=30.0)
+    sub = parser.add_subparsers(dest="command", required=True)
+    sub.add_parser("ping")
+    get = sub.add_parser("get")
+    get.add_argument("param", choices=PARAM_NAMES)
+    get.add_argument("device", type=int, nargs="?", default=0)
+    put = sub.add_parser("set")
+    put.add_argument("param", choices=PARAM_NAMES)
+    put.add_argument("value", type=int)
+    put.add_argument("device", type=int, nargs="?", default=0)
+    counters = sub.add_parser("counters")
+    counters.add_argument("device", type=int)
+    reset = sub.add_parser("reset")
+    reset.add_argument("device", type=int, nargs="?", default=0xFF)
+    bench = sub.add_parser("bench")
+    bench.add_argument("target", type=int)
+    bench.add_argument("count", type=int)
+    bench.add_argument("length", type=int)
+    hist = sub.add_parser("hist")
+    hist.add_argument("target", type=int)
+    hist.add_argument("point", type=int)
+    sub.add_parser("hist-reset")
+    sub.add_parser("selftest")
+    args = parser.parse_args()
+
+    if args.sim:
+        link, close = open_sim(args.sim, args.timeout)
+    else:
+        link, close = open_port(args.port, args.baud, args.timeout)
+
+    try:
+        if args.command == "ping":
+            print(link.ping())
+        elif args.command == "get":
+            print(link.get_param(PARAM_NAMES.index(args.param), args.device))
+        elif args.command == "set":
+            print(link.set_param(PARAM_NAMES.index(args.param), args.value, args.device))
+        elif args.command == "counters":
+            for name, value in link.counters(args.device).items():
+                print("%s: %d" % (name, value))
+        elif args.command == "reset":
+            link.reset_counters(args.device)
+        elif args.command == "bench":
+            print(link.benchmark(args.target, args.count, args.length))
+        elif args.command == "hist":
+            print_histogram(link.histogram(args.target, args.point))
+        elif args.command == "hist-reset":
+            link.reset_histograms()
+        elif args.command == "selftest":
+            selftest(link)
+    except CommandError as error:
+        print(error, file=sys.stderr)
+        return 1
+    finally:
+        close()
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())